@@ -4,8 +4,11 @@
 
 #include "bench.h"
 
+#include "chainparams.h"
 #include "config.h"
 #include "consensus/validation.h"
+#include "crypto/equihash.h"
+#include "hash.h"
 #include "streams.h"
 #include "validation.h"
 
@@ -53,5 +56,50 @@ static void DeserializeAndCheckBlockTest(benchmark::State &state) {
     }
 }
 
+// Per-header serialization cost of the Equihash input and the block hash,
+// which every post-fork header pays on top of the solution check itself.
+static CBlockHeader BenchHeader(const Config &config) {
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.nHeight = config.GetChainParams().GetConsensus().BCPHeight + 1;
+    header.nTime = 1500000000;
+    header.nBits = 0x1d00ffff;
+    header.nNonce = ArithToUint256(arith_uint256(12345));
+    header.nSolution.resize(equihash_solution_size(200, 9));
+    return header;
+}
+
+// Serializes the header separately for the Equihash input and the hash.
+static void HeaderInputAndHashStreams(benchmark::State &state) {
+    DummyConfig config;
+    const CBlockHeader header = BenchHeader(config);
+
+    while (state.KeepRunning()) {
+        CEquihashInput I{header};
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << I;
+        ss << header.nNonce;
+        assert(ss.size() == CBlockHeaderHashContext::SIZE);
+
+        CHashWriter writer(SER_GETHASH, PROTOCOL_VERSION);
+        writer << header;
+        writer.GetHash();
+    }
+}
+
+// Serializes the header once into a CBlockHeaderHashContext.
+static void HeaderInputAndHashContext(benchmark::State &state) {
+    DummyConfig config;
+    const CBlockHeader header = BenchHeader(config);
+
+    while (state.KeepRunning()) {
+        CBlockHeaderHashContext context(header);
+        assert(context.size() == CBlockHeaderHashContext::SIZE);
+        context.GetHash();
+    }
+}
+
 BENCHMARK(DeserializeBlockTest);
 BENCHMARK(DeserializeAndCheckBlockTest);
+BENCHMARK(HeaderInputAndHashStreams);
+BENCHMARK(HeaderInputAndHashContext);
@@ -6,6 +6,9 @@
 
 #include "bench.h"
 #include "bloom.h"
+#include "consensus/merkle.h"
+#include "crypto/common.h"
+#include "crypto/blake2b.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
@@ -48,6 +51,29 @@ static void SHA256_32b(benchmark::State &state) {
     }
 }
 
+static void SHA256D64_1024(benchmark::State &state) {
+    std::vector<uint8_t> in(64 * 1024, 0);
+    while (state.KeepRunning()) {
+        SHA256D64(in.data(), in.data(), 1024);
+    }
+}
+
+/* Merkle root of a block with 9001 transactions. */
+static void MerkleRoot(benchmark::State &state) {
+    FastRandomContext rng(true);
+    std::vector<uint256> leaves(9001);
+    for (uint256 &leaf : leaves) {
+        for (int i = 0; i < 4; i++) {
+            WriteLE64(leaf.begin() + 8 * i, rng.rand64());
+        }
+    }
+    while (state.KeepRunning()) {
+        bool mutated = false;
+        uint256 root = ComputeMerkleRoot(leaves, &mutated);
+        leaves[mutated] = root;
+    }
+}
+
 static void SHA512(benchmark::State &state) {
     uint8_t hash[CSHA512::OUTPUT_SIZE];
     std::vector<uint8_t> in(BUFFER_SIZE, 0);
@@ -55,6 +81,22 @@ static void SHA512(benchmark::State &state) {
         CSHA512().Write(in.data(), in.size()).Finalize(hash);
 }
 
+/* Equihash (200,9) leaf hashing: 512 indices on top of a 140 byte header. */
+static void BLAKE2b_FinalizeIndices(benchmark::State &state) {
+    std::vector<uint8_t> personal(CBLAKE2b::PERSONAL_SIZE, 0);
+    std::vector<uint8_t> in(140, 0);
+    CBLAKE2b base(50, personal.data());
+    base.Write(in.data(), in.size());
+    std::vector<uint32_t> indices(512);
+    for (size_t i = 0; i < indices.size(); i++) {
+        indices[i] = i * 2654435761U;
+    }
+    std::vector<uint8_t> hashes(indices.size() * base.GetOutputSize());
+    while (state.KeepRunning()) {
+        base.FinalizeIndices(indices.data(), indices.size(), hashes.data());
+    }
+}
+
 static void SipHash_32b(benchmark::State &state) {
     uint256 x;
     while (state.KeepRunning()) {
@@ -88,8 +130,11 @@ BENCHMARK(RIPEMD160);
 BENCHMARK(SHA1);
 BENCHMARK(SHA256);
 BENCHMARK(SHA512);
+BENCHMARK(BLAKE2b_FinalizeIndices);
 
 BENCHMARK(SHA256_32b);
+BENCHMARK(SHA256D64_1024);
+BENCHMARK(MerkleRoot);
 BENCHMARK(SipHash_32b);
 BENCHMARK(FastRandom_32bit);
 BENCHMARK(FastRandom_1bit);
@@ -0,0 +1,133 @@
+// Copyright (c) 2017 The Bitcoin Cash Plus developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "config.h"
+#include "crypto/equihash.h"
+#include "miner.h"
+#include "pow.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "util.h"
+#include "validation.h"
+
+#include <boost/thread.hpp>
+
+// Regtest uses the cheap (48,5) parameters, which makes it practical to mine
+// the headers needed by the benchmarks below during setup.
+static const size_t HEADERS_PER_BATCH = 200;
+
+static CBlockHeader MineHeader(const Config &config, uint32_t nHeight) {
+    const CChainParams &params = config.GetChainParams();
+    unsigned int n = params.EquihashN();
+    unsigned int k = params.EquihashK();
+
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.nHeight = nHeight;
+    header.nTime = 1500000000 + nHeight;
+    header.nBits = 0x207fffff;
+
+    while (true) {
+        header.nNonce = ArithToUint256(UintToArith256(header.nNonce) + 1);
+
+        eh_HashState state;
+        EhInitialiseState(n, k, state);
+        CEquihashInput I{header};
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << I;
+        ss << header.nNonce;
+        state.Write((unsigned char *)&ss[0], ss.size());
+
+        std::function<bool(std::vector<unsigned char>)> validBlock =
+            [&header](std::vector<unsigned char> soln) {
+                header.nSolution = soln;
+                return true;
+            };
+        if (EhBasicSolveUncancellable(n, k, state, validBlock)) {
+            return header;
+        }
+    }
+}
+
+static std::vector<CBlockHeader> MineHeaders(const Config &config) {
+    std::vector<CBlockHeader> headers;
+    headers.reserve(HEADERS_PER_BATCH);
+    for (size_t i = 0; i < HEADERS_PER_BATCH; i++) {
+        headers.push_back(MineHeader(config, i));
+    }
+    return headers;
+}
+
+// Verifies one header per iteration, so the reported time is the cost of a
+// single serial solution check.
+static void EquihashVerifyHeader(benchmark::State &state) {
+    DummyConfig config;
+    const std::vector<CBlockHeader> headers = MineHeaders(config);
+
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        assert(CheckEquihashSolution(&headers[i], config));
+        i = (i + 1) % headers.size();
+    }
+}
+
+// Verifies HEADERS_PER_BATCH headers per iteration on the Equihash check
+// queue, as ProcessNewBlockHeaders does for a headers message.
+static void EquihashVerifyHeadersBatch(benchmark::State &state) {
+    DummyConfig config;
+    const std::vector<CBlockHeader> headers = MineHeaders(config);
+    std::vector<const CBlockHeader *> vpheaders;
+    for (const CBlockHeader &header : headers) {
+        vpheaders.push_back(&header);
+    }
+
+    const int nOldScriptCheckThreads = nScriptCheckThreads;
+    nScriptCheckThreads = std::max(2, GetNumCores());
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nScriptCheckThreads - 1; i++) {
+        threadGroup.create_thread(&ThreadEquihashCheck);
+    }
+
+    while (state.KeepRunning()) {
+        assert(CheckEquihashSolutions(config, vpheaders));
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    nScriptCheckThreads = nOldScriptCheckThreads;
+}
+
+// Runs the solver on one nonce per thread per iteration. The target can't be
+// met, so every run goes through the whole search and the time per iteration
+// divided by the number of threads gives the solver throughput.
+static void EquihashSolve(benchmark::State &state, int nThreads) {
+    DummyConfig config;
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.nTime = 1500000000;
+    header.nBits = 0x03000001;
+
+    while (state.KeepRunning()) {
+        uint64_t nTried = 0;
+        assert(!SolveEquihash(config, &header, nThreads, nThreads,
+                              [] { return false; }, nTried));
+        header.nNonce = ArithToUint256(UintToArith256(header.nNonce) + nTried);
+    }
+}
+
+static void EquihashSolveSingleThread(benchmark::State &state) {
+    EquihashSolve(state, 1);
+}
+
+static void EquihashSolveAllCores(benchmark::State &state) {
+    EquihashSolve(state, GetNumCores());
+}
+
+BENCHMARK(EquihashVerifyHeader);
+BENCHMARK(EquihashVerifyHeadersBatch);
+BENCHMARK(EquihashSolveSingleThread);
+BENCHMARK(EquihashSolveAllCores);
@@ -171,6 +171,12 @@ public:
 
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream &s, Operation ser_action) {
+        // The short IDs are keyed by the full header, which the legacy format
+        // leaves fields out of.
+        if (s.GetVersion() & SERIALIZE_BLOCK_LEGACY) {
+            throw std::ios_base::failure(
+                "compact blocks need the full block header format");
+        }
         READWRITE(header);
         READWRITE(nonce);
 
@@ -0,0 +1,109 @@
+// Copyright (c) 2017 The Bitcoin Cash Plus developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKSOLUTIONCACHE_H
+#define BITCOIN_BLOCKSOLUTIONCACHE_H
+
+#include "sync.h"
+
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class CBlockIndex;
+
+/**
+ * In-memory Equihash solutions of block index entries. Solutions of entries
+ * that have not been written to the block tree database yet are held until the
+ * next flush, which validation brings forward once there are too many of them;
+ * after that only the most recently used ones are kept.
+ */
+class CBlockSolutionCache {
+private:
+    typedef std::list<
+        std::pair<const CBlockIndex *, std::vector<unsigned char>>>
+        RecentList;
+
+    CCriticalSection cs;
+    std::unordered_map<const CBlockIndex *, std::vector<unsigned char>>
+        mapUnwritten;
+    //! Most recently used first.
+    RecentList listRecent;
+    std::unordered_map<const CBlockIndex *, RecentList::iterator> mapRecent;
+    const size_t nMaxRecent;
+
+    void AddRecentLocked(const CBlockIndex *pindex,
+                         std::vector<unsigned char> &&solution) {
+        auto it = mapRecent.find(pindex);
+        if (it != mapRecent.end()) {
+            listRecent.erase(it->second);
+            mapRecent.erase(it);
+        }
+        listRecent.emplace_front(pindex, std::move(solution));
+        mapRecent.emplace(pindex, listRecent.begin());
+        if (listRecent.size() > nMaxRecent) {
+            mapRecent.erase(listRecent.back().first);
+            listRecent.pop_back();
+        }
+    }
+
+public:
+    CBlockSolutionCache(size_t nMaxRecentIn) : nMaxRecent(nMaxRecentIn) {}
+
+    void AddUnwritten(const CBlockIndex *pindex,
+                      const std::vector<unsigned char> &solution) {
+        LOCK(cs);
+        mapUnwritten[pindex] = solution;
+    }
+
+    //! Keep the solutions of entries just written to disk as recently used.
+    void MarkWritten(const std::vector<const CBlockIndex *> &vBlocks) {
+        LOCK(cs);
+        for (const CBlockIndex *pindex : vBlocks) {
+            auto it = mapUnwritten.find(pindex);
+            if (it != mapUnwritten.end()) {
+                AddRecentLocked(pindex, std::move(it->second));
+                mapUnwritten.erase(it);
+            }
+        }
+    }
+
+    void AddRecent(const CBlockIndex *pindex,
+                   const std::vector<unsigned char> &solution) {
+        LOCK(cs);
+        AddRecentLocked(pindex, std::vector<unsigned char>(solution));
+    }
+
+    //! Number of solutions held until their entries are written.
+    size_t UnwrittenCount() {
+        LOCK(cs);
+        return mapUnwritten.size();
+    }
+
+    bool Get(const CBlockIndex *pindex, std::vector<unsigned char> &solution) {
+        LOCK(cs);
+        auto it = mapUnwritten.find(pindex);
+        if (it != mapUnwritten.end()) {
+            solution = it->second;
+            return true;
+        }
+        auto itRecent = mapRecent.find(pindex);
+        if (itRecent == mapRecent.end()) {
+            return false;
+        }
+        listRecent.splice(listRecent.begin(), listRecent, itRecent->second);
+        solution = itRecent->second->second;
+        return true;
+    }
+
+    void Clear() {
+        LOCK(cs);
+        mapUnwritten.clear();
+        listRecent.clear();
+        mapRecent.clear();
+    }
+};
+
+#endif // BITCOIN_BLOCKSOLUTIONCACHE_H
@@ -163,6 +163,28 @@ enum BlockStatus : uint32_t {
     BLOCK_FAILED_MASK = BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 };
 
+class CBlockIndex;
+
+/**
+ * Get the Equihash solution of a block index entry, failing if it cannot be
+ * found. Solutions are over a kilobyte each and rarely needed once a block has
+ * been accepted, so they are kept in the block tree database rather than in
+ * CBlockIndex, with the most recently used ones cached in memory. Defined in
+ * validation.cpp.
+ */
+bool GetBlockSolution(const CBlockIndex *pindex,
+                      std::vector<unsigned char> &solution);
+/**
+ * Get the full headers of several block index entries, failing if any
+ * solution cannot be found. Solutions missing from the cache are read from the
+ * block tree database without being cached, so a long run of old headers does
+ * not evict the recent ones. Does not need cs_main, so callers serving many
+ * headers should collect the entries under cs_main and read them after
+ * releasing it. Defined in validation.cpp.
+ */
+bool GetBlockHeaders(const std::vector<const CBlockIndex *> &vIndex,
+                     std::vector<CBlockHeader> &vHeaders);
+
 /**
  * The block chain is a tree shaped structure starting with the genesis block at
  * the root, with each block potentially having multiple candidates to be the
@@ -220,7 +242,7 @@ public:
     uint32_t nTime;
     uint32_t  nBits;
     uint256 nNonce;
-    std::vector<unsigned char> nSolution;
+    //! The Equihash solution is not kept in memory, see GetBlockSolution().
 
     //! (memory only) Sequential id assigned to distinguish order in which
     //! blocks are received.
@@ -249,7 +271,6 @@ public:
         nTime = 0;
         nBits = 0;
         nNonce  = uint256();
-        nSolution.clear();
     }
 
     CBlockIndex() { SetNull(); }
@@ -264,7 +285,6 @@ public:
         nTime = block.nTime;
         nBits = block.nBits;
         nNonce = block.nNonce;
-        nSolution  = block.nSolution;
     }
 
     CDiskBlockPos GetBlockPos() const {
@@ -285,8 +305,9 @@ public:
         return ret;
     }
 
-    CBlockHeader GetBlockHeader() const {
-        CBlockHeader block;
+    //! Set block to the header without its solution.
+    void GetUnsolvedBlockHeader(CBlockHeader &block) const {
+        block.SetNull();
         block.nVersion = nVersion;
         if (pprev) {
             block.hashPrevBlock = pprev->GetBlockHash();
@@ -297,8 +318,12 @@ public:
         block.nTime          = nTime;
         block.nBits          = nBits;
         block.nNonce         = nNonce;
-        block.nSolution      = nSolution;
-        return block;
+    }
+
+    //! Get the header, failing if its solution cannot be found.
+    bool GetBlockHeader(CBlockHeader &block) const {
+        GetUnsolvedBlockHeader(block);
+        return GetBlockSolution(this, block.nSolution);
     }
 
     uint256 GetBlockHash() const { return *phashBlock; }
@@ -390,10 +415,13 @@ int64_t GetBlockProofEquivalentTime(const CBlockIndex &to,
 class CDiskBlockIndex : public CBlockIndex {
 public:
     uint256 hashPrev;
+    std::vector<unsigned char> nSolution;
 
     CDiskBlockIndex() { hashPrev = uint256(); }
 
-    explicit CDiskBlockIndex(const CBlockIndex *pindex) : CBlockIndex(*pindex) {
+    CDiskBlockIndex(const CBlockIndex *pindex,
+                    const std::vector<unsigned char> &solution)
+        : CBlockIndex(*pindex), nSolution(solution) {
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
     }
 
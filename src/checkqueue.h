@@ -141,11 +141,12 @@ public:
     //! successful.
     bool Wait() { return Loop(true); }
 
-    //! Add a batch of checks to the queue
-    void Add(std::vector<T> &vChecks) {
+    //! Add a batch of checks, of T or of a type T can be constructed from,
+    //! to the queue
+    template <typename U> void Add(std::vector<U> &vChecks) {
         boost::unique_lock<boost::mutex> lock(mutex);
-        for (T &check : vChecks) {
-            queue.push_back(std::move(check));
+        for (U &check : vChecks) {
+            queue.emplace_back(std::move(check));
         }
         nTodo += vChecks.size();
         if (vChecks.size() == 1) {
@@ -189,7 +190,7 @@ public:
         return fRet;
     }
 
-    void Add(std::vector<T> &vChecks) {
+    template <typename U> void Add(std::vector<U> &vChecks) {
         if (pqueue != nullptr) pqueue->Add(vChecks);
     }
 
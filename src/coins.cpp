@@ -7,6 +7,8 @@
 #include "consensus/consensus.h"
 #include "memusage.h"
 #include "random.h"
+#include "streams.h"
+#include "version.h"
 
 #include <cassert>
 
@@ -19,12 +21,34 @@ bool CCoinsView::HaveCoin(const COutPoint &outpoint) const {
 uint256 CCoinsView::GetBestBlock() const {
     return uint256();
 }
+std::vector<uint256> CCoinsView::GetHeadBlocks() const {
+    return std::vector<uint256>();
+}
 bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return false;
 }
+bool CCoinsView::BatchWritePartial(CCoinsMap &mapCoins,
+                                   const uint256 &hashBlock) {
+    return false;
+}
 CCoinsViewCursor *CCoinsView::Cursor() const {
     return nullptr;
 }
+CCoinsViewCursor *CCoinsView::Cursor(const uint256 &txidStart) const {
+    return nullptr;
+}
+bool CCoinsView::GetCommitment(CCoinsCommitment &commitment) const {
+    return false;
+}
+bool CCoinsView::WriteCommitment(const CCoinsCommitment &commitment) {
+    return false;
+}
+uint256 CCoinsView::GetSnapshotLoad() const {
+    return uint256();
+}
+bool CCoinsView::WriteSnapshotLoad(const uint256 &hashBlock) {
+    return false;
+}
 
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) {}
 bool CCoinsViewBacked::GetCoin(const COutPoint &outpoint, Coin &coin) const {
@@ -36,6 +60,9 @@ bool CCoinsViewBacked::HaveCoin(const COutPoint &outpoint) const {
 uint256 CCoinsViewBacked::GetBestBlock() const {
     return base->GetBestBlock();
 }
+std::vector<uint256> CCoinsViewBacked::GetHeadBlocks() const {
+    return base->GetHeadBlocks();
+}
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) {
     base = &viewIn;
 }
@@ -43,9 +70,29 @@ bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins,
                                   const uint256 &hashBlock) {
     return base->BatchWrite(mapCoins, hashBlock);
 }
+bool CCoinsViewBacked::BatchWritePartial(CCoinsMap &mapCoins,
+                                         const uint256 &hashBlock) {
+    return base->BatchWritePartial(mapCoins, hashBlock);
+}
 CCoinsViewCursor *CCoinsViewBacked::Cursor() const {
     return base->Cursor();
 }
+CCoinsViewCursor *
+CCoinsViewBacked::Cursor(const uint256 &txidStart) const {
+    return base->Cursor(txidStart);
+}
+bool CCoinsViewBacked::GetCommitment(CCoinsCommitment &commitment) const {
+    return base->GetCommitment(commitment);
+}
+bool CCoinsViewBacked::WriteCommitment(const CCoinsCommitment &commitment) {
+    return base->WriteCommitment(commitment);
+}
+uint256 CCoinsViewBacked::GetSnapshotLoad() const {
+    return base->GetSnapshotLoad();
+}
+bool CCoinsViewBacked::WriteSnapshotLoad(const uint256 &hashBlock) {
+    return base->WriteSnapshotLoad(hashBlock);
+}
 size_t CCoinsViewBacked::EstimateSize() const {
     return base->EstimateSize();
 }
@@ -55,7 +102,7 @@ SaltedOutpointHasher::SaltedOutpointHasher()
       k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
 CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn)
-    : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
+    : CCoinsViewBacked(baseIn), cachedCoinsUsage(0), nSyncCursor(0) {}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
@@ -122,6 +169,23 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin coin,
     cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
 }
 
+void CCoinsViewCache::CacheBaseCoin(const COutPoint &outpoint, Coin &&coin) {
+    CCoinsMap::iterator it;
+    bool inserted;
+    std::tie(it, inserted) =
+        cacheCoins.emplace(std::piecewise_construct,
+                           std::forward_as_tuple(outpoint), std::tuple<>());
+    if (!inserted) {
+        return;
+    }
+    it->second.coin = std::move(coin);
+    if (it->second.coin.IsSpent()) {
+        // Same as in FetchCoin: the parent only has an empty entry.
+        it->second.flags = CCoinsCacheEntry::FRESH;
+    }
+    cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+}
+
 void AddCoins(CCoinsViewCache &cache, const CTransaction &tx, int nHeight) {
     bool fCoinbase = tx.IsCoinBase();
     const uint256 &txid = tx.GetHash();
@@ -246,6 +310,13 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
     return true;
 }
 
+bool CCoinsViewCache::BatchWritePartial(CCoinsMap &mapCoins,
+                                        const uint256 &hashBlockIn) {
+    // A cache has no intermediate state to protect, so apply the changes and
+    // leave the best block to the BatchWrite completing the transition.
+    return BatchWrite(mapCoins, GetBestBlock());
+}
+
 bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
@@ -253,6 +324,54 @@ bool CCoinsViewCache::Flush() {
     return fOk;
 }
 
+bool CCoinsViewCache::Sync(size_t nMaxEntries, bool &fComplete) {
+    // Resume where the previous call stopped, so that writing the cache out
+    // over many calls costs a single pass over it. Entries before the cursor
+    // may have been modified since, hence the walk wraps around once.
+    CCoinsMap mapDirty;
+    const size_t nStart =
+        nSyncCursor < cacheCoins.bucket_count() ? nSyncCursor : 0;
+    CCoinsMap::iterator it = cacheCoins.begin_at(nStart);
+    bool fWrapped = false;
+    fComplete = false;
+    while (true) {
+        if (it == cacheCoins.end() && !fWrapped) {
+            fWrapped = true;
+            it = cacheCoins.begin();
+        }
+        if (fWrapped && cacheCoins.position(it) >= nStart) {
+            fComplete = true;
+            break;
+        }
+        if (mapDirty.size() >= nMaxEntries) {
+            break;
+        }
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
+            ++it;
+            continue;
+        }
+        CCoinsCacheEntry &entry = mapDirty[it->first];
+        entry.flags = CCoinsCacheEntry::DIRTY;
+        if (it->second.coin.IsSpent()) {
+            // Once the base has erased it, there is nothing left to cache.
+            entry.coin = std::move(it->second.coin);
+            CCoinsMap::iterator itOld = it++;
+            cacheCoins.erase(itOld);
+        } else {
+            // The base has the coin from now on, so it is neither modified
+            // nor FRESH here anymore.
+            entry.coin = it->second.coin;
+            it->second.flags = 0;
+            ++it;
+        }
+    }
+    nSyncCursor = fComplete ? 0 : cacheCoins.position(it);
+    if (fComplete) {
+        return base->BatchWrite(mapDirty, GetBestBlock());
+    }
+    return base->BatchWritePartial(mapDirty, GetBestBlock());
+}
+
 void CCoinsViewCache::Uncache(const COutPoint &outpoint) {
     CCoinsMap::iterator it = cacheCoins.find(outpoint);
     if (it != cacheCoins.end() && it->second.flags == 0) {
@@ -335,3 +454,51 @@ const Coin &AccessByTxid(const CCoinsViewCache &view, const uint256 &txid) {
 
     return coinEmpty;
 }
+
+/** Serialize a coin as an element of the UTXO set hash. */
+static void CommitmentElement(std::vector<uint8_t> &data,
+                              const COutPoint &outpoint, const Coin &coin) {
+    data.clear();
+    CVectorWriter(SER_NETWORK, PROTOCOL_VERSION, data, 0, outpoint,
+                  uint32_t(coin.GetHeight() * 2 + coin.IsCoinBase()),
+                  coin.GetTxOut());
+}
+
+/** Size of a coin in the database-independent bogosize metric. */
+static uint64_t BogoSize(const Coin &coin) {
+    return 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ +
+           8 /* amount */ + 2 /* scriptPubKey len */ +
+           coin.GetTxOut().scriptPubKey.size() /* scriptPubKey */;
+}
+
+void CCoinsCommitment::AddCoin(const COutPoint &outpoint, const Coin &coin) {
+    std::vector<uint8_t> data;
+    CommitmentElement(data, outpoint, coin);
+    muhash.Insert(data.data(), data.size());
+    nTransactionOutputs++;
+    nBogoSize += BogoSize(coin);
+    nTotalAmount += coin.GetTxOut().nValue;
+}
+
+void CCoinsCommitment::RemoveCoin(const COutPoint &outpoint,
+                                  const Coin &coin) {
+    std::vector<uint8_t> data;
+    CommitmentElement(data, outpoint, coin);
+    muhash.Remove(data.data(), data.size());
+    nTransactionOutputs--;
+    nBogoSize -= BogoSize(coin);
+    nTotalAmount -= coin.GetTxOut().nValue;
+}
+
+void CCoinsCommitment::Merge(const CCoinsCommitment &other) {
+    muhash *= other.muhash;
+    nTransactionOutputs += other.nTransactionOutputs;
+    nBogoSize += other.nBogoSize;
+    nTotalAmount += other.nTotalAmount;
+}
+
+uint256 CCoinsCommitment::GetHash() {
+    uint256 hash;
+    muhash.Finalize(hash.begin());
+    return hash;
+}
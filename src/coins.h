@@ -8,8 +8,10 @@
 
 #include "compressor.h"
 #include "core_memusage.h"
+#include "crypto/muhash.h"
 #include "hash.h"
 #include "memusage.h"
+#include "openhashmap.h"
 #include "serialize.h"
 #include "uint256.h"
 
@@ -112,9 +114,48 @@ struct CCoinsCacheEntry {
         : coin(std::move(coinIn)), flags(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher>
+typedef openhashmap<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher>
     CCoinsMap;
 
+/**
+ * Statistics about the UTXO set at a given block, together with a hash of the
+ * set that does not depend on the order in which coins were added or removed.
+ * It can therefore be kept up to date as blocks are connected and
+ * disconnected, and matches the result of a full scan of the set.
+ */
+class CCoinsCommitment {
+public:
+    //! The block whose UTXO set this describes.
+    uint256 hashBlock;
+    MuHash3072 muhash;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    Amount nTotalAmount;
+
+    CCoinsCommitment()
+        : nTransactionOutputs(0), nBogoSize(0), nTotalAmount(0) {}
+
+    void AddCoin(const COutPoint &outpoint, const Coin &coin);
+    void RemoveCoin(const COutPoint &outpoint, const Coin &coin);
+
+    //! Add the coins of a disjoint set, such as another part of a scan.
+    void Merge(const CCoinsCommitment &other);
+
+    //! Hash of the set. Not const, as the hash state is normalized.
+    uint256 GetHash();
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action) {
+        READWRITE(hashBlock);
+        READWRITE(muhash);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nBogoSize);
+        READWRITE(nTotalAmount);
+    }
+};
+
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor {
 public:
@@ -148,13 +189,45 @@ public:
     //! Retrieve the block hash whose state this CCoinsView currently represents
     virtual uint256 GetBestBlock() const;
 
+    //! Retrieve the range of blocks that may have been only partially written.
+    //! If the database is in a consistent state, the result is the empty
+    //! vector. Otherwise, a two-element vector is returned consisting of the
+    //! new and the old block hash, in that order.
+    virtual std::vector<uint256> GetHeadBlocks() const;
+
     //! Do a bulk modification (multiple Coin changes + BestBlock change).
     //! The passed mapCoins can be modified.
     virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
 
+    //! Do part of a bulk modification towards hashBlock, which only becomes
+    //! the best block once a BatchWrite with it completes the transition.
+    //! The passed mapCoins can be modified.
+    virtual bool BatchWritePartial(CCoinsMap &mapCoins,
+                                   const uint256 &hashBlock);
+
     //! Get a cursor to iterate over the whole state
     virtual CCoinsViewCursor *Cursor() const;
 
+    //! Get a cursor to iterate over the state from the first coin of the
+    //! given txid onwards, in txid order.
+    virtual CCoinsViewCursor *Cursor(const uint256 &txidStart) const;
+
+    //! Retrieve the last commitment to the state that was written. It need
+    //! not match the best block.
+    virtual bool GetCommitment(CCoinsCommitment &commitment) const;
+
+    //! Store a commitment to the state at its block, replacing any previous
+    //! one.
+    virtual bool WriteCommitment(const CCoinsCommitment &commitment);
+
+    //! Retrieve the block of the UTXO snapshot being loaded into the state,
+    //! or the null hash if no load is in progress.
+    virtual uint256 GetSnapshotLoad() const;
+
+    //! Record that a UTXO snapshot at hashBlock is being loaded into the
+    //! state, or with the null hash, that no load is in progress.
+    virtual bool WriteSnapshotLoad(const uint256 &hashBlock);
+
     //! As we use CCoinsViews polymorphically, have a virtual destructor
     virtual ~CCoinsView() {}
 
@@ -172,9 +245,18 @@ public:
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
+    std::vector<uint256> GetHeadBlocks() const override;
     void SetBackend(CCoinsView &viewIn);
+    CCoinsView *GetBackend() const { return base; }
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWritePartial(CCoinsMap &mapCoins,
+                           const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
+    CCoinsViewCursor *Cursor(const uint256 &txidStart) const override;
+    bool GetCommitment(CCoinsCommitment &commitment) const override;
+    bool WriteCommitment(const CCoinsCommitment &commitment) override;
+    uint256 GetSnapshotLoad() const override;
+    bool WriteSnapshotLoad(const uint256 &hashBlock) override;
     size_t EstimateSize() const override;
 };
 
@@ -193,6 +275,9 @@ protected:
     /* Cached dynamic memory usage for the inner Coin objects. */
     mutable size_t cachedCoinsUsage;
 
+    //! Slot position in cacheCoins at which the next Sync resumes.
+    size_t nSyncCursor;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
 
@@ -202,6 +287,8 @@ public:
     uint256 GetBestBlock() const override;
     void SetBestBlock(const uint256 &hashBlock);
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWritePartial(CCoinsMap &mapCoins,
+                           const uint256 &hashBlock) override;
 
     /**
      * Check if we have the given utxo already loaded in this cache.
@@ -224,6 +311,14 @@ public:
     void AddCoin(const COutPoint &outpoint, Coin coin,
                  bool potential_overwrite);
 
+    /**
+     * Cache a coin that the caller read from the backing view itself, as
+     * AccessCoin would have. Outpoints that are cached already are left
+     * untouched, so a coin read before this cache was modified is never
+     * applied over the modification.
+     */
+    void CacheBaseCoin(const COutPoint &outpoint, Coin &&coin);
+
     /**
      * Spend a coin. Pass moveto in order to get the deleted data.
      * If no unspent output exists for the passed outpoint, this call has no
@@ -239,6 +334,17 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push up to nMaxEntries of the modifications applied to this cache to its
+     * base, as part of the transition to the current best block. Unlike
+     * Flush, the written coins stay in this cache as unmodified entries, so
+     * the cache can be written out over several calls while it is in use.
+     * fComplete is set once no modifications are left, at which point the
+     * best block has been written as well. If false is returned, the state of
+     * this cache (and its backing view) will be undefined.
+     */
+    bool Sync(size_t nMaxEntries, bool &fComplete);
+
     /**
      * Removes the UTXO with the given outpoint from the cache, if it is not
      * modified.
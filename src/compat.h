@@ -10,6 +10,12 @@
 #include "config/bitcoin-config.h"
 #endif
 
+// Wait on sockets with epoll where available, which unlike select() does not
+// limit the socket numbers to FD_SETSIZE.
+#if defined(HAVE_SYS_EPOLL_H) && !defined(WIN32)
+#define USE_EPOLL
+#endif
+
 #ifdef WIN32
 #ifdef _WIN32_WINNT
 #undef _WIN32_WINNT
@@ -85,7 +91,7 @@ size_t strnlen(const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
 static bool inline IsSelectableSocket(SOCKET s) {
-#ifdef WIN32
+#if defined(WIN32) || defined(USE_EPOLL)
     return true;
 #else
     return (s < FD_SETSIZE);
@@ -12,7 +12,12 @@
 #include "primitives/transaction.h"
 #include "uint256.h"
 
-uint256 ComputeMerkleRoot(const std::vector<uint256> &leaves,
+/**
+ * Compute the Merkle root of the given leaves. The tree is reduced level by
+ * level with batched double SHA-256, so the leaves are taken by value.
+ * *mutated is set to true if two identical hashes were paired at any level.
+ */
+uint256 ComputeMerkleRoot(std::vector<uint256> hashes,
                           bool *mutated = nullptr);
 std::vector<uint256> ComputeMerkleBranch(const std::vector<uint256> &leaves,
                                          uint32_t position);
@@ -0,0 +1,260 @@
+// Copyright (c) 2017 The Bitcoin Cash Plus developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "crypto/blake2b.h"
+
+#include "crypto/common.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__amd64__) || defined(__i386__)) &&       \
+    (defined(ENABLE_SSE41) || defined(ENABLE_AVX2))
+#include <cpuid.h>
+#define BLAKE2B_HAVE_CPUID 1
+#endif
+
+#if defined(ENABLE_SSE41)
+namespace blake2b_sse41 {
+void Compress4Way(const uint64_t *h, uint64_t t0, const unsigned char *blocks,
+                  uint64_t *out);
+}
+#endif
+
+#if defined(ENABLE_AVX2)
+namespace blake2b_avx2 {
+void Compress4Way(const uint64_t *h, uint64_t t0, const unsigned char *blocks,
+                  uint64_t *out);
+}
+#endif
+
+// Internal implementation code.
+namespace {
+/// Internal BLAKE2b implementation.
+namespace blake2b {
+    const uint64_t IV[8] = {
+        0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL,
+        0xa54ff53a5f1d36f1ULL, 0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+        0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL};
+
+    const uint8_t SIGMA[12][16] = {
+        {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+        {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+        {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+        {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+        {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+        {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+        {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+        {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+        {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+        {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+        {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+        {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3}};
+
+    inline uint64_t RotR(uint64_t x, int n) {
+        return (x >> n) | (x << (64 - n));
+    }
+
+    inline void G(uint64_t &a, uint64_t &b, uint64_t &c, uint64_t &d,
+                  uint64_t x, uint64_t y) {
+        a = a + b + x;
+        d = RotR(d ^ a, 32);
+        c = c + d;
+        b = RotR(b ^ c, 24);
+        a = a + b + y;
+        d = RotR(d ^ a, 16);
+        c = c + d;
+        b = RotR(b ^ c, 63);
+    }
+
+    /** Compress one 128-byte block into the chaining value h. */
+    void Compress(uint64_t *h, const unsigned char *block, uint64_t t0,
+                  uint64_t t1, bool last) {
+        uint64_t m[16];
+        for (int i = 0; i < 16; i++) {
+            m[i] = ReadLE64(block + 8 * i);
+        }
+
+        uint64_t v[16];
+        for (int i = 0; i < 8; i++) {
+            v[i] = h[i];
+            v[i + 8] = IV[i];
+        }
+        v[12] ^= t0;
+        v[13] ^= t1;
+        if (last) {
+            v[14] = ~v[14];
+        }
+
+        for (int r = 0; r < 12; r++) {
+            const uint8_t *s = SIGMA[r];
+            G(v[0], v[4], v[8], v[12], m[s[0]], m[s[1]]);
+            G(v[1], v[5], v[9], v[13], m[s[2]], m[s[3]]);
+            G(v[2], v[6], v[10], v[14], m[s[4]], m[s[5]]);
+            G(v[3], v[7], v[11], v[15], m[s[6]], m[s[7]]);
+            G(v[0], v[5], v[10], v[15], m[s[8]], m[s[9]]);
+            G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+            G(v[2], v[7], v[8], v[13], m[s[12]], m[s[13]]);
+            G(v[3], v[4], v[9], v[14], m[s[14]], m[s[15]]);
+        }
+
+        for (int i = 0; i < 8; i++) {
+            h[i] ^= v[i] ^ v[i + 8];
+        }
+    }
+
+    typedef void (*Compress4WayFn)(const uint64_t *h, uint64_t t0,
+                                   const unsigned char *blocks, uint64_t *out);
+
+    struct Implementation {
+        Compress4WayFn compress4way;
+        const char *name;
+    };
+
+#if defined(BLAKE2B_HAVE_CPUID)
+    bool HaveSSE41() {
+        unsigned int a, b, c, d;
+        return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSE4_1);
+    }
+
+    bool HaveAVX2() {
+        unsigned int a, b, c, d;
+        if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_OSXSAVE) ||
+            !(c & bit_AVX)) {
+            return false;
+        }
+        // Check that the OS saves the YMM registers on context switches.
+        uint32_t xcr0_lo, xcr0_hi;
+        __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+        if ((xcr0_lo & 6) != 6 || __get_cpuid_max(0, nullptr) < 7) {
+            return false;
+        }
+        __cpuid_count(7, 0, a, b, c, d);
+        return b & bit_AVX2;
+    }
+#endif
+
+    Implementation SelectImplementation() {
+#if defined(ENABLE_AVX2)
+        if (HaveAVX2()) {
+            return {blake2b_avx2::Compress4Way, "avx2"};
+        }
+#endif
+#if defined(ENABLE_SSE41)
+        if (HaveSSE41()) {
+            return {blake2b_sse41::Compress4Way, "sse4.1"};
+        }
+#endif
+        return {nullptr, "standard"};
+    }
+
+    const Implementation &GetImplementation() {
+        static const Implementation impl = SelectImplementation();
+        return impl;
+    }
+} // namespace blake2b
+} // namespace
+
+////// BLAKE2b
+
+CBLAKE2b::CBLAKE2b(size_t outlenIn, const unsigned char *personal)
+    : bufsize(0), outlen(outlenIn) {
+    assert(outlen > 0 && outlen <= MAX_OUTPUT_SIZE);
+    for (int i = 0; i < 8; i++) {
+        h[i] = blake2b::IV[i];
+    }
+    // Parameter block: digest length, no key, fanout 1, depth 1.
+    h[0] ^= 0x01010000ULL ^ outlen;
+    if (personal) {
+        h[6] ^= ReadLE64(personal);
+        h[7] ^= ReadLE64(personal + 8);
+    }
+    t[0] = t[1] = 0;
+    memset(buf, 0, sizeof(buf));
+}
+
+CBLAKE2b &CBLAKE2b::Write(const unsigned char *data, size_t len) {
+    while (len > 0) {
+        // The last block gets compressed with the finalization flag set, so
+        // only flush a full buffer once we know more data follows.
+        if (bufsize == BLOCK_SIZE) {
+            t[0] += BLOCK_SIZE;
+            if (t[0] < BLOCK_SIZE) {
+                t[1]++;
+            }
+            blake2b::Compress(h, buf, t[0], t[1], false);
+            bufsize = 0;
+        }
+        size_t n = std::min(len, BLOCK_SIZE - bufsize);
+        memcpy(buf + bufsize, data, n);
+        bufsize += n;
+        data += n;
+        len -= n;
+    }
+    return *this;
+}
+
+void CBLAKE2b::Finalize(unsigned char *hash) {
+    t[0] += bufsize;
+    if (t[0] < bufsize) {
+        t[1]++;
+    }
+    memset(buf + bufsize, 0, BLOCK_SIZE - bufsize);
+    blake2b::Compress(h, buf, t[0], t[1], true);
+
+    unsigned char out[MAX_OUTPUT_SIZE];
+    for (int i = 0; i < 8; i++) {
+        WriteLE64(out + 8 * i, h[i]);
+    }
+    memcpy(hash, out, outlen);
+}
+
+void CBLAKE2b::FinalizeIndices(const uint32_t *indices, size_t count,
+                               unsigned char *hashes) const {
+    size_t i = 0;
+    blake2b::Compress4WayFn compress4way =
+        blake2b::GetImplementation().compress4way;
+
+    // The multi-lane kernels handle the common case where the index fits in
+    // the buffered block, so each lane needs exactly one final compression.
+    const uint64_t t0 = t[0] + bufsize + sizeof(uint32_t);
+    if (compress4way && bufsize + sizeof(uint32_t) <= BLOCK_SIZE &&
+        t[1] == 0 && t0 > t[0]) {
+        unsigned char blocks[4 * BLOCK_SIZE];
+        memset(blocks, 0, sizeof(blocks));
+        for (int l = 0; l < 4; l++) {
+            memcpy(blocks + l * BLOCK_SIZE, buf, bufsize);
+        }
+
+        uint64_t out[4 * 8];
+        unsigned char hash[MAX_OUTPUT_SIZE];
+        for (; i + 4 <= count; i += 4) {
+            for (int l = 0; l < 4; l++) {
+                WriteLE32(blocks + l * BLOCK_SIZE + bufsize, indices[i + l]);
+            }
+            compress4way(h, t0, blocks, out);
+            for (int l = 0; l < 4; l++) {
+                for (int j = 0; j < 8; j++) {
+                    WriteLE64(hash + 8 * j, out[8 * l + j]);
+                }
+                memcpy(hashes + (i + l) * outlen, hash, outlen);
+            }
+        }
+    }
+
+    for (; i < count; i++) {
+        unsigned char le[sizeof(uint32_t)];
+        WriteLE32(le, indices[i]);
+        CBLAKE2b(*this).Write(le, sizeof(le)).Finalize(hashes + i * outlen);
+    }
+}
+
+const char *BLAKE2bImplementation() {
+    return blake2b::GetImplementation().name;
+}
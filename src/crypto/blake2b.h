@@ -0,0 +1,49 @@
+// Copyright (c) 2017 The Bitcoin Cash Plus developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_BLAKE2B_H
+#define BITCOIN_CRYPTO_BLAKE2B_H
+
+#include <cstdint>
+#include <cstdlib>
+
+/**
+ * A hasher class for unkeyed BLAKE2b with an optional personalization string,
+ * as used by Equihash. Produces the same digests as libsodium's
+ * crypto_generichash_blake2b_init_salt_personal() with no key and no salt.
+ */
+class CBLAKE2b {
+private:
+    uint64_t h[8];
+    uint64_t t[2];
+    unsigned char buf[128];
+    size_t bufsize;
+    size_t outlen;
+
+public:
+    static const size_t BLOCK_SIZE = 128;
+    static const size_t MAX_OUTPUT_SIZE = 64;
+    static const size_t PERSONAL_SIZE = 16;
+
+    CBLAKE2b(size_t outlenIn = MAX_OUTPUT_SIZE,
+             const unsigned char *personal = nullptr);
+    CBLAKE2b &Write(const unsigned char *data, size_t len);
+    void Finalize(unsigned char *hash);
+
+    size_t GetOutputSize() const { return outlen; }
+
+    /**
+     * Compute, for each of the count indices, the digest of this state
+     * extended with the index as a 32-bit little-endian word. count * outlen
+     * bytes are written to hashes and the state itself is left untouched.
+     * Several indices are hashed at once when the CPU supports it.
+     */
+    void FinalizeIndices(const uint32_t *indices, size_t count,
+                         unsigned char *hashes) const;
+};
+
+/** Return the name of the multi-lane implementation FinalizeIndices uses. */
+const char *BLAKE2bImplementation();
+
+#endif // BITCOIN_CRYPTO_BLAKE2B_H
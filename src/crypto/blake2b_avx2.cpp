@@ -0,0 +1,127 @@
+// Copyright (c) 2017 The Bitcoin Cash Plus developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// 4-way BLAKE2b final compression using AVX2, one lane per 64-bit element of
+// a 256-bit register.
+
+#ifdef ENABLE_AVX2
+
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+namespace blake2b_avx2 {
+namespace {
+
+    const uint64_t IV[8] = {
+        0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL,
+        0xa54ff53a5f1d36f1ULL, 0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+        0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL};
+
+    const uint8_t SIGMA[12][16] = {
+        {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+        {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+        {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+        {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+        {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+        {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+        {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+        {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+        {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+        {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+        {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+        {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3}};
+
+    typedef __m256i Word;
+
+    inline Word Broadcast(uint64_t x) { return _mm256_set1_epi64x(x); }
+
+    inline Word Add(Word a, Word b) { return _mm256_add_epi64(a, b); }
+
+    inline Word Xor(Word a, Word b) { return _mm256_xor_si256(a, b); }
+
+    inline Word RotR32(Word x) {
+        return _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1));
+    }
+
+    inline Word RotR24(Word x) {
+        const __m256i r24 = _mm256_setr_epi8(
+            3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10, 3, 4, 5, 6,
+            7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+        return _mm256_shuffle_epi8(x, r24);
+    }
+
+    inline Word RotR16(Word x) {
+        const __m256i r16 = _mm256_setr_epi8(
+            2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9, 2, 3, 4, 5,
+            6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+        return _mm256_shuffle_epi8(x, r16);
+    }
+
+    inline Word RotR63(Word x) {
+        return _mm256_xor_si256(_mm256_srli_epi64(x, 63),
+                                _mm256_add_epi64(x, x));
+    }
+
+    inline void G(Word &a, Word &b, Word &c, Word &d, Word x, Word y) {
+        a = Add(Add(a, b), x);
+        d = RotR32(Xor(d, a));
+        c = Add(c, d);
+        b = RotR24(Xor(b, c));
+        a = Add(Add(a, b), y);
+        d = RotR16(Xor(d, a));
+        c = Add(c, d);
+        b = RotR63(Xor(b, c));
+    }
+
+    inline uint64_t Load64(const unsigned char *p) {
+        uint64_t x;
+        memcpy(&x, p, 8);
+        return x;
+    }
+
+} // namespace
+
+void Compress4Way(const uint64_t *h, uint64_t t0, const unsigned char *blocks,
+                  uint64_t *out) {
+    Word m[16];
+    for (int i = 0; i < 16; i++) {
+        m[i] = _mm256_set_epi64x(
+            Load64(blocks + 3 * 128 + 8 * i), Load64(blocks + 2 * 128 + 8 * i),
+            Load64(blocks + 128 + 8 * i), Load64(blocks + 8 * i));
+    }
+
+    Word v[16];
+    for (int i = 0; i < 8; i++) {
+        v[i] = Broadcast(h[i]);
+        v[i + 8] = Broadcast(IV[i]);
+    }
+    v[12] = Broadcast(IV[4] ^ t0);
+    v[14] = Broadcast(~IV[6]);
+
+    for (int r = 0; r < 12; r++) {
+        const uint8_t *s = SIGMA[r];
+        G(v[0], v[4], v[8], v[12], m[s[0]], m[s[1]]);
+        G(v[1], v[5], v[9], v[13], m[s[2]], m[s[3]]);
+        G(v[2], v[6], v[10], v[14], m[s[4]], m[s[5]]);
+        G(v[3], v[7], v[11], v[15], m[s[6]], m[s[7]]);
+        G(v[0], v[5], v[10], v[15], m[s[8]], m[s[9]]);
+        G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+        G(v[2], v[7], v[8], v[13], m[s[12]], m[s[13]]);
+        G(v[3], v[4], v[9], v[14], m[s[14]], m[s[15]]);
+    }
+
+    for (int i = 0; i < 8; i++) {
+        Word w = Xor(Broadcast(h[i]), Xor(v[i], v[i + 8]));
+        uint64_t lanes[4];
+        _mm256_storeu_si256((__m256i *)lanes, w);
+        for (int l = 0; l < 4; l++) {
+            out[8 * l + i] = lanes[l];
+        }
+    }
+}
+
+} // namespace blake2b_avx2
+
+#endif // ENABLE_AVX2
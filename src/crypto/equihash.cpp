@@ -37,26 +37,22 @@ int Equihash<N,K>::InitialiseState(eh_HashState& base_state)
 {
     uint32_t le_N = htole32(N);
     uint32_t le_K = htole32(K);
-    unsigned char personalization[crypto_generichash_blake2b_PERSONALBYTES] = {};
+    unsigned char personalization[CBLAKE2b::PERSONAL_SIZE] = {};
     memcpy(personalization, "ZcashPoW", 8);
     memcpy(personalization+8,  &le_N, 4);
     memcpy(personalization+12, &le_K, 4);
-    return crypto_generichash_blake2b_init_salt_personal(&base_state,
-                                                         NULL, 0, // No key.
-                                                         (512/N)*N/8,
-                                                         NULL,    // No salt.
-                                                         personalization);
+    base_state = CBLAKE2b((512/N)*N/8, personalization);
+    return 0;
 }
 
 void GenerateHash(const eh_HashState& base_state, eh_index g,
                   unsigned char* hash, size_t hLen)
 {
-    eh_HashState state;
-    state = base_state;
+    assert(hLen == base_state.GetOutputSize());
+    eh_HashState state = base_state;
     eh_index lei = htole32(g);
-    crypto_generichash_blake2b_update(&state, (const unsigned char*) &lei,
-                                      sizeof(eh_index));
-    crypto_generichash_blake2b_final(&state, hash, hLen);
+    state.Write((const unsigned char*) &lei, sizeof(eh_index));
+    state.Finalize(hash);
 }
 
 void ExpandArray(const unsigned char* in, size_t in_len,
@@ -321,11 +317,9 @@ TruncatedStepRow<WIDTH>& TruncatedStepRow<WIDTH>::operator=(const TruncatedStepR
 }
 
 template<size_t WIDTH>
-std::shared_ptr<eh_trunc> TruncatedStepRow<WIDTH>::GetTruncatedIndices(size_t len, size_t lenIndices) const
+void TruncatedStepRow<WIDTH>::GetTruncatedIndices(size_t len, size_t lenIndices, eh_trunc* indices) const
 {
-    std::shared_ptr<eh_trunc> p (new eh_trunc[lenIndices], std::default_delete<eh_trunc[]>());
-    std::copy(hash+len, hash+len+lenIndices, p.get());
-    return p;
+    std::copy(hash+len, hash+len+lenIndices, indices);
 }
 
 template<unsigned int N, unsigned int K>
@@ -340,6 +334,7 @@ bool Equihash<N,K>::BasicSolve(const eh_HashState& base_state,
     size_t hashLen = HashLength;
     size_t lenIndices = sizeof(eh_index);
     std::vector<FullStepRow<FullWidth>> X;
+    std::vector<FullStepRow<FullWidth>> Xc;
     X.reserve(init_size);
     unsigned char tmpHash[HashOutput];
     for (eh_index g = 0; X.size() < init_size; g++) {
@@ -356,13 +351,12 @@ bool Equihash<N,K>::BasicSolve(const eh_HashState& base_state,
         LogPrint("pow", "Round %u:\n", r);
         // 2a) Sort the list
         LogPrint("pow", "- Sorting list\n");
-        std::sort(X.begin(), X.end(), CompareSR(CollisionByteLength));
+        SortRows(X, CollisionByteLength);
         if (cancelled(ListSorting)) throw solver_cancelled;
 
         LogPrint("pow", "- Finding collisions\n");
         size_t i = 0;
         size_t posFree = 0;
-        std::vector<FullStepRow<FullWidth>> Xc;
         while (i < X.size() - 1) {
             // 2b) Find next set of unordered pairs with collisions on the next n/(k+1) bits
             size_t j = 1;
@@ -399,10 +393,10 @@ bool Equihash<N,K>::BasicSolve(const eh_HashState& base_state,
         if (Xc.size() > 0) {
             // 2f) Add overflow to end of table
             X.insert(X.end(), Xc.begin(), Xc.end());
+            Xc.clear();
         } else if (posFree < X.size()) {
             // 2g) Remove empty space at the end
             X.erase(X.begin()+posFree, X.end());
-            X.shrink_to_fit();
         }
 
         hashLen -= CollisionByteLength;
@@ -414,7 +408,7 @@ bool Equihash<N,K>::BasicSolve(const eh_HashState& base_state,
     LogPrint("pow", "Final round:\n");
     if (X.size() > 1) {
         LogPrint("pow", "- Sorting list\n");
-        std::sort(X.begin(), X.end(), CompareSR(hashLen));
+        SortRows(X, hashLen);
         if (cancelled(FinalSorting)) throw solver_cancelled;
         LogPrint("pow", "- Finding collisions\n");
         size_t i = 0;
@@ -510,7 +504,8 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
     // First run the algorithm with truncated indices
 
     const eh_index soln_size { 1 << K };
-    std::vector<std::shared_ptr<eh_trunc>> partialSolns;
+    // Truncated indices of the partial solutions, soln_size per solution
+    std::vector<eh_trunc> partialSolns;
     size_t invalidCount = 0;
     {
 
@@ -519,7 +514,9 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
         size_t hashLen = HashLength;
         size_t lenIndices = sizeof(eh_trunc);
         std::vector<TruncatedStepRow<TruncatedWidth>> Xt;
+        std::vector<TruncatedStepRow<TruncatedWidth>> Xc;
         Xt.reserve(init_size);
+        eh_trunc tmpIndices[soln_size];
         unsigned char tmpHash[HashOutput];
         for (eh_index g = 0; Xt.size() < init_size; g++) {
             GenerateHash(base_state, g, tmpHash, HashOutput);
@@ -535,13 +532,12 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
             LogPrint("pow", "Round %zu:\n", r);
             // 2a) Sort the list
             LogPrint("pow", "- Sorting list\n");
-            std::sort(Xt.begin(), Xt.end(), CompareSR(CollisionByteLength));
+            SortRows(Xt, CollisionByteLength);
             if (cancelled(ListSorting)) throw solver_cancelled;
 
             LogPrint("pow", "- Finding collisions\n");
             size_t i = 0;
             size_t posFree = 0;
-            std::vector<TruncatedStepRow<TruncatedWidth>> Xc;
             while (i < Xt.size() - 1) {
                 // 2b) Find next set of unordered pairs with collisions on the next n/(k+1) bits
                 size_t j = 1;
@@ -558,11 +554,12 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
                         TruncatedStepRow<TruncatedWidth> Xi {Xt[i+l], Xt[i+m],
                                                              hashLen, lenIndices,
                                                              CollisionByteLength};
-                        if (!(Xi.IsZero(hashLen-CollisionByteLength) &&
-                              IsProbablyDuplicate<soln_size>(Xi.GetTruncatedIndices(hashLen-CollisionByteLength, 2*lenIndices),
-                                                             2*lenIndices))) {
-                            Xc.emplace_back(Xi);
+                        if (Xi.IsZero(hashLen-CollisionByteLength)) {
+                            Xi.GetTruncatedIndices(hashLen-CollisionByteLength, 2*lenIndices, tmpIndices);
+                            if (IsProbablyDuplicate<soln_size>(tmpIndices, 2*lenIndices))
+                                continue;
                         }
+                        Xc.emplace_back(Xi);
                     }
                 }
 
@@ -585,10 +582,10 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
             if (Xc.size() > 0) {
                 // 2f) Add overflow to end of table
                 Xt.insert(Xt.end(), Xc.begin(), Xc.end());
+                Xc.clear();
             } else if (posFree < Xt.size()) {
                 // 2g) Remove empty space at the end
                 Xt.erase(Xt.begin()+posFree, Xt.end());
-                Xt.shrink_to_fit();
             }
 
             hashLen -= CollisionByteLength;
@@ -600,7 +597,7 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
         LogPrint("pow", "Final round:\n");
         if (Xt.size() > 1) {
             LogPrint("pow", "- Sorting list\n");
-            std::sort(Xt.begin(), Xt.end(), CompareSR(hashLen));
+            SortRows(Xt, hashLen);
             if (cancelled(FinalSorting)) throw solver_cancelled;
             LogPrint("pow", "- Finding collisions\n");
             size_t i = 0;
@@ -615,9 +612,10 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
                     for (size_t m = l + 1; m < j; m++) {
                         TruncatedStepRow<FinalTruncatedWidth> res(Xt[i+l], Xt[i+m],
                                                                   hashLen, lenIndices, 0);
-                        auto soln = res.GetTruncatedIndices(hashLen, 2*lenIndices);
-                        if (!IsProbablyDuplicate<soln_size>(soln, 2*lenIndices)) {
-                            partialSolns.push_back(soln);
+                        res.GetTruncatedIndices(hashLen, 2*lenIndices, tmpIndices);
+                        if (!IsProbablyDuplicate<soln_size>(tmpIndices, 2*lenIndices)) {
+                            partialSolns.insert(partialSolns.end(), tmpIndices,
+                                                tmpIndices+soln_size);
                         }
                     }
                 }
@@ -630,11 +628,12 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
 
     } // Ensure Xt goes out of scope and is destroyed
 
-    LogPrint("pow", "Found %d partial solutions\n", partialSolns.size());
+    LogPrint("pow", "Found %d partial solutions\n", partialSolns.size()/soln_size);
 
     // Now for each solution run the algorithm again to recreate the indices
     LogPrint("pow", "Culling solutions\n");
-    for (std::shared_ptr<eh_trunc> partialSoln : partialSolns) {
+    for (size_t s = 0; s < partialSolns.size(); s += soln_size) {
+        const eh_trunc* partialSoln = &partialSolns[s];
         std::set<std::vector<unsigned char>> solns;
         size_t hashLen;
         size_t lenIndices;
@@ -648,7 +647,7 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
             std::vector<FullStepRow<FinalFullWidth>> icv;
             icv.reserve(recreate_size);
             for (eh_index j = 0; j < recreate_size; j++) {
-                eh_index newIndex { UntruncateIndex(partialSoln.get()[i], j, CollisionBitLength + 1) };
+                eh_index newIndex { UntruncateIndex(partialSoln[i], j, CollisionBitLength + 1) };
                 if (j == 0 || newIndex % IndicesPerHashOutput == 0) {
                     GenerateHash(base_state, newIndex/IndicesPerHashOutput,
                                  tmpHash, HashOutput);
@@ -670,13 +669,13 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
                         // 2c) Merge the lists
                         ic->reserve(ic->size() + X[r]->size());
                         ic->insert(ic->end(), X[r]->begin(), X[r]->end());
-                        std::sort(ic->begin(), ic->end(), CompareSR(hashLen));
+                        SortRows(*ic, hashLen);
                         if (cancelled(PartialSorting)) throw solver_cancelled;
                         size_t lti = rti-(1<<r);
                         CollideBranches(*ic, hashLen, lenIndices,
                                         CollisionByteLength,
                                         CollisionBitLength + 1,
-                                        partialSoln.get()[lti], partialSoln.get()[rti]);
+                                        partialSoln[lti], partialSoln[rti]);
 
                         // 2d) Check if this has become an invalid solution
                         if (ic->size() == 0)
@@ -730,12 +729,21 @@ bool Equihash<N,K>::IsValidSolution(const eh_HashState& base_state, std::vector<
         return false;
     }
 
+    // Hash all the leaves up front so that FinalizeIndices can run several
+    // BLAKE2b compressions side by side.
+    std::vector<eh_index> indices = GetIndicesFromMinimal(soln, CollisionBitLength);
+    std::vector<eh_index> hashIndices(indices.size());
+    for (size_t j = 0; j < indices.size(); j++) {
+        hashIndices[j] = indices[j]/IndicesPerHashOutput;
+    }
+    std::vector<unsigned char> hashes(indices.size() * HashOutput);
+    base_state.FinalizeIndices(hashIndices.data(), hashIndices.size(), hashes.data());
+
     std::vector<FullStepRow<FinalFullWidth>> X;
     X.reserve(1 << K);
-    unsigned char tmpHash[HashOutput];
-    for (eh_index i : GetIndicesFromMinimal(soln, CollisionBitLength)) {
-        GenerateHash(base_state, i/IndicesPerHashOutput, tmpHash, HashOutput);
-        X.emplace_back(tmpHash+((i % IndicesPerHashOutput) * N/8),
+    for (size_t j = 0; j < indices.size(); j++) {
+        eh_index i = indices[j];
+        X.emplace_back(&hashes[j * HashOutput] + ((i % IndicesPerHashOutput) * N/8),
                        N/8, HashLength, CollisionBitLength, i);
     }
 
@@ -808,3 +816,7 @@ template bool Equihash<48,5>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
 template bool Equihash<48,5>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+
+// Explicit instantiation of the Equihash<48,5> solver rows, for the row sorting
+// tests
+template class FullStepRow<Equihash<48,5>::FullWidth>;
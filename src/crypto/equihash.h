@@ -7,21 +7,22 @@
 #define BITCOIN_EQUIHASH_H
 
 #include "compat/endian.h"
+#include "crypto/blake2b.h"
 #include "crypto/sha256.h"
 #include "utilstrencodings.h"
 
-#include "sodium.h"
-
+#include <algorithm>
 #include <cstring>
 #include <exception>
 #include <functional>
 #include <memory>
 #include <set>
+#include <stdexcept>
 #include <vector>
 
 #include <boost/static_assert.hpp>
 
-typedef crypto_generichash_blake2b_state eh_HashState;
+typedef CBLAKE2b eh_HashState;
 typedef uint32_t eh_index;
 typedef uint8_t eh_trunc;
 
@@ -59,6 +60,7 @@ public:
     StepRow(const StepRow<W>& a);
 
     bool IsZero(size_t len);
+    inline unsigned char GetByte(size_t i) const { return hash[i]; }
     std::string GetHex(size_t len) { return HexStr(hash, hash+len); }
 
     template<size_t W>
@@ -129,9 +131,59 @@ public:
     TruncatedStepRow& operator=(const TruncatedStepRow<WIDTH>& a);
 
     inline bool IndicesBefore(const TruncatedStepRow<WIDTH>& a, size_t len, size_t lenIndices) const { return memcmp(hash+len, a.hash+len, lenIndices) < 0; }
-    std::shared_ptr<eh_trunc> GetTruncatedIndices(size_t len, size_t lenIndices) const;
+    void GetTruncatedIndices(size_t len, size_t lenIndices, eh_trunc* indices) const;
 };
 
+// Sorts rows on their first len bytes, in the same order as CompareSR(len).
+// This is an in-place MSD radix sort: rows are swapped into 256 buckets on one
+// byte and each bucket is then sorted on the next byte, so no scratch table is
+// needed and the rows colliding on the first len bytes end up adjacent.
+template<typename Row>
+void SortRows(Row* begin, Row* end, size_t len, size_t pos = 0)
+{
+    const size_t size = end - begin;
+    if (size < 2 || pos >= len)
+        return;
+    if (size < 64) {
+        std::sort(begin, end, CompareSR(len));
+        return;
+    }
+
+    size_t next[256] = {};
+    size_t bucketEnd[256];
+    for (Row* row = begin; row != end; row++)
+        next[row->GetByte(pos)]++;
+    size_t offset = 0;
+    for (size_t b = 0; b < 256; b++) {
+        size_t count = next[b];
+        next[b] = offset;
+        offset += count;
+        bucketEnd[b] = offset;
+    }
+
+    for (size_t b = 0; b < 256; b++) {
+        while (next[b] < bucketEnd[b]) {
+            unsigned char v = begin[next[b]].GetByte(pos);
+            if (v == b)
+                next[b]++;
+            else
+                std::swap(begin[next[b]], begin[next[v]++]);
+        }
+    }
+
+    size_t start = 0;
+    for (size_t b = 0; b < 256; b++) {
+        SortRows(begin+start, begin+bucketEnd[b], len, pos+1);
+        start = bucketEnd[b];
+    }
+}
+
+template<typename Row>
+void SortRows(std::vector<Row>& X, size_t len)
+{
+    SortRows(X.data(), X.data()+X.size(), len);
+}
+
 enum EhSolverCancelCheck
 {
     ListGeneration,
@@ -21,7 +21,7 @@ bool DistinctIndices(const FullStepRow<WIDTH>& a, const FullStepRow<WIDTH>& b, s
 }
 
 template<size_t MAX_INDICES>
-bool IsProbablyDuplicate(std::shared_ptr<eh_trunc> indices, size_t lenIndices)
+bool IsProbablyDuplicate(const eh_trunc* indices, size_t lenIndices)
 {
     assert(lenIndices <= MAX_INDICES);
     bool checked_index[MAX_INDICES] = {false};
@@ -30,7 +30,7 @@ bool IsProbablyDuplicate(std::shared_ptr<eh_trunc> indices, size_t lenIndices)
         // Skip over indices we have already paired
         if (!checked_index[z]) {
             for (size_t y = z+1; y < lenIndices; y++) {
-                if (!checked_index[y] && indices.get()[z] == indices.get()[y]) {
+                if (!checked_index[y] && indices[z] == indices[y]) {
                     // Pair found
                     checked_index[y] = true;
                     count_checked += 2;
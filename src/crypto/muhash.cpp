@@ -0,0 +1,184 @@
+// Copyright (c) 2017 The Bitcoin Cash Plus developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/muhash.h"
+
+#include "crypto/chacha20.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+
+#include <cstring>
+
+namespace {
+
+typedef Num3072::limb_t limb_t;
+typedef Num3072::double_limb_t double_limb_t;
+
+/** 2^3072 - 1103717 is the largest 3072-bit safe prime. */
+const limb_t MAX_PRIME_DIFF = 1103717;
+
+inline limb_t ReadLimb(const uint8_t *p) {
+    return Num3072::LIMB_SIZE == 64 ? limb_t(ReadLE64(p)) : ReadLE32(p);
+}
+
+inline void WriteLimb(uint8_t *p, limb_t x) {
+    if (Num3072::LIMB_SIZE == 64) {
+        WriteLE64(p, x);
+    } else {
+        WriteLE32(p, x);
+    }
+}
+
+/**
+ * Reduce the 6144-bit product t into num, using 2^3072 = MAX_PRIME_DIFF
+ * modulo the prime. The result is below 2^3072 but may exceed the prime.
+ */
+void Reduce(Num3072 &num, const limb_t *t) {
+    double_limb_t c = 0;
+    for (int i = 0; i < Num3072::LIMBS; i++) {
+        c += double_limb_t(t[i + Num3072::LIMBS]) * MAX_PRIME_DIFF + t[i];
+        num.limbs[i] = limb_t(c);
+        c >>= Num3072::LIMB_SIZE;
+    }
+    // Fold the bits above 2^3072 back in until none are left. The second
+    // round is only needed when the first one carries out again.
+    limb_t carry = limb_t(c);
+    while (carry != 0) {
+        double_limb_t d = double_limb_t(carry) * MAX_PRIME_DIFF;
+        for (int i = 0; i < Num3072::LIMBS && d != 0; i++) {
+            d += num.limbs[i];
+            num.limbs[i] = limb_t(d);
+            d >>= Num3072::LIMB_SIZE;
+        }
+        carry = limb_t(d);
+    }
+}
+
+/** Whether num is at least the prime, which it can exceed only once. */
+bool IsOverflow(const Num3072 &num) {
+    if (num.limbs[0] < limb_t(0 - MAX_PRIME_DIFF)) {
+        return false;
+    }
+    for (int i = 1; i < Num3072::LIMBS; i++) {
+        if (num.limbs[i] != limb_t(~limb_t(0))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Subtract the prime, by adding MAX_PRIME_DIFF and dropping 2^3072. */
+void FullReduce(Num3072 &num) {
+    double_limb_t c = MAX_PRIME_DIFF;
+    for (int i = 0; i < Num3072::LIMBS; i++) {
+        c += num.limbs[i];
+        num.limbs[i] = limb_t(c);
+        c >>= Num3072::LIMB_SIZE;
+    }
+}
+
+/** Map a byte string to a number, through SHA-256 and ChaCha20. */
+Num3072 ToNum3072(const uint8_t *data, size_t len) {
+    uint8_t key[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(key);
+    uint8_t tmp[Num3072::BYTE_SIZE];
+    ChaCha20(key, sizeof(key)).Output(tmp, sizeof(tmp));
+    return Num3072(tmp);
+}
+
+} // namespace
+
+Num3072::Num3072(const uint8_t (&data)[BYTE_SIZE]) {
+    for (int i = 0; i < LIMBS; i++) {
+        limbs[i] = ReadLimb(data + i * (LIMB_SIZE / 8));
+    }
+}
+
+void Num3072::SetToOne() {
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; i++) {
+        limbs[i] = 0;
+    }
+}
+
+void Num3072::Multiply(const Num3072 &a) {
+    // Schoolbook multiplication. The row sums cannot overflow a double limb,
+    // as (2^n - 1)^2 + 2 * (2^n - 1) = 2^2n - 1.
+    limb_t t[2 * LIMBS] = {0};
+    for (int i = 0; i < LIMBS; i++) {
+        double_limb_t c = 0;
+        for (int j = 0; j < LIMBS; j++) {
+            c += double_limb_t(limbs[i]) * a.limbs[j] + t[i + j];
+            t[i + j] = limb_t(c);
+            c >>= LIMB_SIZE;
+        }
+        t[i + LIMBS] = limb_t(c);
+    }
+    Reduce(*this, t);
+}
+
+Num3072 Num3072::GetInverse() const {
+    // Fermat's little theorem: the inverse is this^(p - 2). All limbs of
+    // p - 2 but the lowest are all ones.
+    Num3072 r;
+    for (int i = LIMBS - 1; i >= 0; i--) {
+        const limb_t e =
+            i > 0 ? limb_t(~limb_t(0)) : limb_t(0 - MAX_PRIME_DIFF - 2);
+        for (int b = LIMB_SIZE - 1; b >= 0; b--) {
+            r.Multiply(r);
+            if ((e >> b) & 1) {
+                r.Multiply(*this);
+            }
+        }
+    }
+    return r;
+}
+
+void Num3072::Divide(const Num3072 &a) {
+    Multiply(a.GetInverse());
+}
+
+void Num3072::ToBytes(uint8_t (&out)[BYTE_SIZE]) {
+    if (IsOverflow(*this)) {
+        FullReduce(*this);
+    }
+    for (int i = 0; i < LIMBS; i++) {
+        WriteLimb(out + i * (LIMB_SIZE / 8), limbs[i]);
+    }
+}
+
+MuHash3072::MuHash3072(const uint8_t *data, size_t len)
+    : numerator(ToNum3072(data, len)) {}
+
+MuHash3072 &MuHash3072::Insert(const uint8_t *data, size_t len) {
+    numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072 &MuHash3072::Remove(const uint8_t *data, size_t len) {
+    denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072 &MuHash3072::operator*=(const MuHash3072 &mul) {
+    numerator.Multiply(mul.numerator);
+    denominator.Multiply(mul.denominator);
+    return *this;
+}
+
+MuHash3072 &MuHash3072::operator/=(const MuHash3072 &div) {
+    numerator.Multiply(div.denominator);
+    denominator.Multiply(div.numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(uint8_t out[OUTPUT_SIZE]) {
+    // Replace the fraction by its value, which represents the same set.
+    numerator.Divide(denominator);
+    denominator.SetToOne();
+
+    uint8_t data[Num3072::BYTE_SIZE];
+    numerator.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(out);
+}
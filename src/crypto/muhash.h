@@ -0,0 +1,97 @@
+// Copyright (c) 2017 The Bitcoin Cash Plus developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+/** An integer modulo the prime 2^3072 - 1103717. */
+class Num3072 {
+public:
+#ifdef __SIZEOF_INT128__
+    typedef unsigned __int128 double_limb_t;
+    typedef uint64_t limb_t;
+    static const int LIMBS = 48;
+    static const int LIMB_SIZE = 64;
+#else
+    typedef uint64_t double_limb_t;
+    typedef uint32_t limb_t;
+    static const int LIMBS = 96;
+    static const int LIMB_SIZE = 32;
+#endif
+    static const size_t BYTE_SIZE = 384;
+
+    //! Not necessarily fully reduced, see ToBytes.
+    limb_t limbs[LIMBS];
+
+    Num3072() { SetToOne(); }
+    //! Read a little-endian number, which may exceed the modulus.
+    explicit Num3072(const uint8_t (&data)[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072 &a);
+    //! Multiply by the inverse of a, which must not be zero.
+    void Divide(const Num3072 &a);
+    Num3072 GetInverse() const;
+    //! Write the fully reduced number in little-endian order.
+    void ToBytes(uint8_t (&out)[BYTE_SIZE]);
+};
+
+/**
+ * A hash of a set of byte strings, in which elements can be added and removed
+ * in any order.
+ *
+ * Each element is mapped to a number modulo a 3072-bit prime by expanding its
+ * SHA-256 hash with ChaCha20, and the set hashes to the product of these
+ * numbers. Removed elements are multiplied into a separate denominator, so
+ * that the costly inversion happens only once, in Finalize. Finding two sets
+ * with the same hash reduces to the discrete logarithm problem in the
+ * multiplicative group, see https://arxiv.org/abs/1601.06502.
+ */
+class MuHash3072 {
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+
+    //! The hash of the empty set.
+    MuHash3072() {}
+    //! The hash of the set holding a single element.
+    MuHash3072(const uint8_t *data, size_t len);
+
+    MuHash3072 &Insert(const uint8_t *data, size_t len);
+    MuHash3072 &Remove(const uint8_t *data, size_t len);
+
+    //! Union with another set.
+    MuHash3072 &operator*=(const MuHash3072 &mul);
+    //! Difference with another set, which must be a subset of this one.
+    MuHash3072 &operator/=(const MuHash3072 &div);
+
+    //! Write the 32-byte hash of the set, without changing the set.
+    void Finalize(uint8_t out[OUTPUT_SIZE]);
+
+    template <typename Stream> void Serialize(Stream &s) const {
+        uint8_t data[Num3072::BYTE_SIZE];
+        Num3072 copy = numerator;
+        copy.ToBytes(data);
+        s.write((const char *)data, sizeof(data));
+        copy = denominator;
+        copy.ToBytes(data);
+        s.write((const char *)data, sizeof(data));
+    }
+
+    template <typename Stream> void Unserialize(Stream &s) {
+        uint8_t data[Num3072::BYTE_SIZE];
+        s.read((char *)data, sizeof(data));
+        numerator = Num3072(data);
+        s.read((char *)data, sizeof(data));
+        denominator = Num3072(data);
+    }
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
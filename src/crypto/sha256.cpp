@@ -8,6 +8,33 @@
 
 #include <cstring>
 
+#if (defined(__x86_64__) || defined(__amd64__) || defined(__i386__)) &&       \
+    (defined(ENABLE_SSE41) || defined(ENABLE_AVX2) || defined(ENABLE_SHANI))
+#include <cpuid.h>
+#define SHA256_HAVE_CPUID 1
+#endif
+
+#if defined(ENABLE_SSE41)
+namespace sha256d64_sse41 {
+void Transform_4way(uint8_t *out, const uint8_t *in);
+}
+#endif
+
+#if defined(ENABLE_AVX2)
+namespace sha256d64_avx2 {
+void Transform_8way(uint8_t *out, const uint8_t *in);
+}
+#endif
+
+#if defined(ENABLE_SHANI)
+namespace sha256_shani {
+void Transform(uint32_t *s, const uint8_t *chunk);
+}
+namespace sha256d64_shani {
+void Transform_2way(uint8_t *out, const uint8_t *in);
+}
+#endif
+
 // Internal implementation code.
 namespace {
 /// Internal SHA-256 implementation.
@@ -186,6 +213,112 @@ namespace sha256 {
         s[7] += h;
     }
 
+    typedef void (*TransformFn)(uint32_t *s, const uint8_t *chunk);
+    typedef void (*TransformD64Fn)(uint8_t *out, const uint8_t *in);
+
+    /**
+     * The single block transform used by CSHA256, and the kernels computing
+     * the double SHA-256 of 2, 4 or 8 64-byte inputs at once, where
+     * available.
+     */
+    struct Implementation {
+        TransformFn transform;
+        TransformD64Fn d64_2way;
+        TransformD64Fn d64_4way;
+        TransformD64Fn d64_8way;
+        const char *name;
+    };
+
+#if defined(SHA256_HAVE_CPUID)
+    bool HaveSSE41() {
+        unsigned int a, b, c, d;
+        return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSE4_1);
+    }
+
+    bool HaveAVX2() {
+        unsigned int a, b, c, d;
+        if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_OSXSAVE) ||
+            !(c & bit_AVX)) {
+            return false;
+        }
+        // Check that the OS saves the YMM registers on context switches.
+        uint32_t xcr0_lo, xcr0_hi;
+        __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+        if ((xcr0_lo & 6) != 6 || __get_cpuid_max(0, nullptr) < 7) {
+            return false;
+        }
+        __cpuid_count(7, 0, a, b, c, d);
+        return b & bit_AVX2;
+    }
+
+    bool HaveSHANI() {
+        unsigned int a, b, c, d;
+        if (!HaveSSE41() || __get_cpuid_max(0, nullptr) < 7) {
+            return false;
+        }
+        __cpuid_count(7, 0, a, b, c, d);
+        return b & (1 << 29);
+    }
+#endif
+
+    Implementation SelectImplementation() {
+#if defined(ENABLE_SHANI)
+        // The SHA extensions beat the multi-lane kernels on the CPUs that
+        // have both.
+        if (HaveSHANI()) {
+            return {sha256_shani::Transform, sha256d64_shani::Transform_2way,
+                    nullptr, nullptr, "shani(1way,2way)"};
+        }
+#endif
+        Implementation impl = {Transform, nullptr, nullptr, nullptr,
+                               "standard"};
+#if defined(ENABLE_SSE41)
+        if (HaveSSE41()) {
+            impl.d64_4way = sha256d64_sse41::Transform_4way;
+            impl.name = "standard,sse4.1(4way)";
+        }
+#endif
+#if defined(ENABLE_AVX2)
+        if (HaveAVX2()) {
+            impl.d64_8way = sha256d64_avx2::Transform_8way;
+            impl.name = impl.d64_4way ? "standard,sse4.1(4way),avx2(8way)"
+                                      : "standard,avx2(8way)";
+        }
+#endif
+        return impl;
+    }
+
+    const Implementation &GetImplementation() {
+        static const Implementation impl = SelectImplementation();
+        return impl;
+    }
+
+    /** Double SHA-256 of a single 64-byte input, one transform at a time. */
+    void TransformD64(TransformFn transform, uint8_t *out, const uint8_t *in) {
+        // Padding of a 64-byte message, and of a 32-byte digest.
+        static const uint8_t padding[64] = {
+            0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+            0,    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+            0,    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+            0,    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0};
+        uint8_t digest[64] = {0};
+        digest[32] = 0x80;
+        digest[62] = 0x01;
+
+        uint32_t s[8];
+        Initialize(s);
+        transform(s, in);
+        transform(s, padding);
+        for (int i = 0; i < 8; i++) {
+            WriteBE32(digest + 4 * i, s[i]);
+        }
+        Initialize(s);
+        transform(s, digest);
+        for (int i = 0; i < 8; i++) {
+            WriteBE32(out + 4 * i, s[i]);
+        }
+    }
+
 } // namespace sha256
 } // namespace
 
@@ -196,6 +329,7 @@ CSHA256::CSHA256() : bytes(0) {
 }
 
 CSHA256 &CSHA256::Write(const uint8_t *data, size_t len) {
+    const sha256::TransformFn transform = sha256::GetImplementation().transform;
     const uint8_t *end = data + len;
     size_t bufsize = bytes % 64;
     if (bufsize && bufsize + len >= 64) {
@@ -203,12 +337,12 @@ CSHA256 &CSHA256::Write(const uint8_t *data, size_t len) {
         memcpy(buf + bufsize, data, 64 - bufsize);
         bytes += 64 - bufsize;
         data += 64 - bufsize;
-        sha256::Transform(s, buf);
+        transform(s, buf);
         bufsize = 0;
     }
     while (end >= data + 64) {
         // Process full chunks directly from the source.
-        sha256::Transform(s, data);
+        transform(s, data);
         bytes += 64;
         data += 64;
     }
@@ -241,3 +375,37 @@ CSHA256 &CSHA256::Reset() {
     sha256::Initialize(s);
     return *this;
 }
+
+void SHA256D64(uint8_t *output, const uint8_t *input, size_t blocks) {
+    const sha256::Implementation &impl = sha256::GetImplementation();
+    if (impl.d64_8way) {
+        for (; blocks >= 8; blocks -= 8) {
+            impl.d64_8way(output, input);
+            output += 256;
+            input += 512;
+        }
+    }
+    if (impl.d64_4way) {
+        for (; blocks >= 4; blocks -= 4) {
+            impl.d64_4way(output, input);
+            output += 128;
+            input += 256;
+        }
+    }
+    if (impl.d64_2way) {
+        for (; blocks >= 2; blocks -= 2) {
+            impl.d64_2way(output, input);
+            output += 64;
+            input += 128;
+        }
+    }
+    for (; blocks > 0; blocks--) {
+        sha256::TransformD64(impl.transform, output, input);
+        output += 32;
+        input += 64;
+    }
+}
+
+const char *SHA256Implementation() {
+    return sha256::GetImplementation().name;
+}
@@ -24,4 +24,15 @@ public:
     CSHA256 &Reset();
 };
 
+/**
+ * Compute the double SHA-256 of each of blocks 64-byte inputs, writing the
+ * 32-byte digests consecutively to output. Several inputs are hashed at once
+ * when the CPU supports it. output may alias input, as merkle tree levels are
+ * computed in place.
+ */
+void SHA256D64(uint8_t *output, const uint8_t *input, size_t blocks);
+
+/** Return the name of the SHA-256 implementations in use. */
+const char *SHA256Implementation();
+
 #endif // BITCOIN_CRYPTO_SHA256_H
@@ -0,0 +1,148 @@
+// Copyright (c) 2017 The Bitcoin Cash Plus developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// SHA-256 transform using the x86 SHA extensions. The state is kept in the
+// ABEF/CDGH register layout that sha256rnds2 expects; the double SHA-256 of
+// 64-byte inputs interleaves two independent states to hide its latency.
+
+#ifdef ENABLE_SHANI
+
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+namespace {
+
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+const uint32_t IV[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+/** Convert eight state words into the ABEF/CDGH layout. */
+inline void Load(__m128i &abef, __m128i &cdgh, const uint32_t *s) {
+    __m128i dcba = _mm_loadu_si128((const __m128i *)s);
+    __m128i hgfe = _mm_loadu_si128((const __m128i *)(s + 4));
+    __m128i cdab = _mm_shuffle_epi32(dcba, 0xB1);
+    __m128i efgh = _mm_shuffle_epi32(hgfe, 0x1B);
+    abef = _mm_alignr_epi8(cdab, efgh, 8);
+    cdgh = _mm_blend_epi16(efgh, cdab, 0xF0);
+}
+
+/** Convert the ABEF/CDGH layout back into eight state words. */
+inline void Save(uint32_t *s, __m128i abef, __m128i cdgh) {
+    __m128i feba = _mm_shuffle_epi32(abef, 0x1B);
+    __m128i dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128((__m128i *)s, _mm_blend_epi16(feba, dchg, 0xF0));
+    _mm_storeu_si128((__m128i *)(s + 4), _mm_alignr_epi8(dchg, feba, 8));
+}
+
+/** Process one 64-byte chunk for each of N independent states. */
+template <int N>
+inline void Compress(__m128i *abef, __m128i *cdgh,
+                     const unsigned char *const *chunks) {
+    const __m128i mask =
+        _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i abef_save[N], cdgh_save[N], m[N][4];
+    for (int l = 0; l < N; l++) {
+        abef_save[l] = abef[l];
+        cdgh_save[l] = cdgh[l];
+    }
+    for (int i = 0; i < 16; i++) {
+        const __m128i k = _mm_loadu_si128((const __m128i *)(K + 4 * i));
+        for (int l = 0; l < N; l++) {
+            // m[l][i & 3] holds message words 4*i to 4*i+3.
+            __m128i &w = m[l][i & 3];
+            if (i < 4) {
+                w = _mm_shuffle_epi8(
+                    _mm_loadu_si128((const __m128i *)(chunks[l] + 16 * i)),
+                    mask);
+            } else {
+                const __m128i &w1 = m[l][(i + 1) & 3];
+                const __m128i &w2 = m[l][(i + 2) & 3];
+                const __m128i &w3 = m[l][(i + 3) & 3];
+                w = _mm_sha256msg2_epu32(
+                    _mm_add_epi32(_mm_sha256msg1_epu32(w, w1),
+                                  _mm_alignr_epi8(w3, w2, 4)),
+                    w3);
+            }
+            // Each sha256rnds2 does two rounds, after which the previous
+            // ABEF value is the new CDGH one.
+            __m128i msg = _mm_add_epi32(w, k);
+            cdgh[l] = _mm_sha256rnds2_epu32(cdgh[l], abef[l], msg);
+            abef[l] = _mm_sha256rnds2_epu32(abef[l], cdgh[l],
+                                            _mm_shuffle_epi32(msg, 0x0E));
+        }
+    }
+    for (int l = 0; l < N; l++) {
+        abef[l] = _mm_add_epi32(abef[l], abef_save[l]);
+        cdgh[l] = _mm_add_epi32(cdgh[l], cdgh_save[l]);
+    }
+}
+
+inline void WriteBE32(unsigned char *p, uint32_t x) {
+    uint32_t be = __builtin_bswap32(x);
+    memcpy(p, &be, 4);
+}
+
+} // namespace
+
+namespace sha256_shani {
+void Transform(uint32_t *s, const unsigned char *chunk) {
+    __m128i abef, cdgh;
+    Load(abef, cdgh, s);
+    Compress<1>(&abef, &cdgh, &chunk);
+    Save(s, abef, cdgh);
+}
+} // namespace sha256_shani
+
+namespace sha256d64_shani {
+void Transform_2way(unsigned char *out, const unsigned char *in) {
+    // Padding of a 64-byte message, and of a 32-byte digest.
+    unsigned char padding[64] = {0x80};
+    padding[62] = 0x02;
+    unsigned char digests[2][64] = {{0}};
+    for (int l = 0; l < 2; l++) {
+        digests[l][32] = 0x80;
+        digests[l][62] = 0x01;
+    }
+
+    __m128i abef[2], cdgh[2];
+    uint32_t s[8];
+    for (int l = 0; l < 2; l++) {
+        Load(abef[l], cdgh[l], IV);
+    }
+    const unsigned char *first[2] = {in, in + 64};
+    Compress<2>(abef, cdgh, first);
+    const unsigned char *second[2] = {padding, padding};
+    Compress<2>(abef, cdgh, second);
+    for (int l = 0; l < 2; l++) {
+        Save(s, abef[l], cdgh[l]);
+        for (int i = 0; i < 8; i++) {
+            WriteBE32(digests[l] + 4 * i, s[i]);
+        }
+        Load(abef[l], cdgh[l], IV);
+    }
+    const unsigned char *third[2] = {digests[0], digests[1]};
+    Compress<2>(abef, cdgh, third);
+    for (int l = 0; l < 2; l++) {
+        Save(s, abef[l], cdgh[l]);
+        for (int i = 0; i < 8; i++) {
+            WriteBE32(out + 32 * l + 4 * i, s[i]);
+        }
+    }
+}
+} // namespace sha256d64_shani
+
+#endif // ENABLE_SHANI
@@ -0,0 +1,147 @@
+// Copyright (c) 2017 The Bitcoin Cash Plus developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// 4-way double SHA-256 of 64-byte inputs using SSE4.1, one lane per 32-bit
+// element of a 128-bit register.
+
+#ifdef ENABLE_SSE41
+
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+namespace sha256d64_sse41 {
+namespace {
+
+    const uint32_t K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+        0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+        0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+        0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+        0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+        0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+        0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+        0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+        0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+    const uint32_t IV[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                            0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+    typedef __m128i Word;
+
+    inline Word Broadcast(uint32_t x) { return _mm_set1_epi32(x); }
+    inline Word Add(Word a, Word b) { return _mm_add_epi32(a, b); }
+    inline Word Add(Word a, Word b, Word c) { return Add(Add(a, b), c); }
+    inline Word Xor(Word a, Word b) { return _mm_xor_si128(a, b); }
+    inline Word Xor(Word a, Word b, Word c) { return Xor(Xor(a, b), c); }
+    inline Word And(Word a, Word b) { return _mm_and_si128(a, b); }
+    inline Word Or(Word a, Word b) { return _mm_or_si128(a, b); }
+    inline Word Shr(Word x, int n) { return _mm_srli_epi32(x, n); }
+    inline Word RotR(Word x, int n) {
+        return Or(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - n));
+    }
+
+    inline Word Ch(Word x, Word y, Word z) { return Xor(z, And(x, Xor(y, z))); }
+    inline Word Maj(Word x, Word y, Word z) {
+        return Or(And(x, y), And(z, Or(x, y)));
+    }
+    inline Word Sigma0(Word x) {
+        return Xor(RotR(x, 2), RotR(x, 13), RotR(x, 22));
+    }
+    inline Word Sigma1(Word x) {
+        return Xor(RotR(x, 6), RotR(x, 11), RotR(x, 25));
+    }
+    inline Word sigma0(Word x) {
+        return Xor(RotR(x, 7), RotR(x, 18), Shr(x, 3));
+    }
+    inline Word sigma1(Word x) {
+        return Xor(RotR(x, 17), RotR(x, 19), Shr(x, 10));
+    }
+
+    /** Run the 64 rounds over the message schedule w and add into s. */
+    void Compress(Word *s, Word *w) {
+        Word a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5],
+             g = s[6], h = s[7];
+        for (int i = 0; i < 64; i++) {
+            if (i >= 16) {
+                w[i & 15] = Add(w[i & 15], sigma1(w[(i + 14) & 15]),
+                                Add(w[(i + 9) & 15], sigma0(w[(i + 1) & 15])));
+            }
+            Word t1 = Add(Add(h, Sigma1(e), Ch(e, f, g)), Broadcast(K[i]),
+                          w[i & 15]);
+            Word t2 = Add(Sigma0(a), Maj(a, b, c));
+            h = g;
+            g = f;
+            f = e;
+            e = Add(d, t1);
+            d = c;
+            c = b;
+            b = a;
+            a = Add(t1, t2);
+        }
+        s[0] = Add(s[0], a);
+        s[1] = Add(s[1], b);
+        s[2] = Add(s[2], c);
+        s[3] = Add(s[3], d);
+        s[4] = Add(s[4], e);
+        s[5] = Add(s[5], f);
+        s[6] = Add(s[6], g);
+        s[7] = Add(s[7], h);
+    }
+
+    inline uint32_t LoadBE32(const unsigned char *p) {
+        uint32_t x;
+        memcpy(&x, p, 4);
+        return __builtin_bswap32(x);
+    }
+
+} // namespace
+
+void Transform_4way(unsigned char *out, const unsigned char *in) {
+    Word s[8], w[16];
+
+    // First hash: the 64-byte input followed by a padding block.
+    for (int i = 0; i < 8; i++) {
+        s[i] = Broadcast(IV[i]);
+    }
+    for (int i = 0; i < 16; i++) {
+        w[i] = _mm_setr_epi32(LoadBE32(in + 4 * i), LoadBE32(in + 64 + 4 * i),
+                              LoadBE32(in + 128 + 4 * i),
+                              LoadBE32(in + 192 + 4 * i));
+    }
+    Compress(s, w);
+    w[0] = Broadcast(0x80000000);
+    for (int i = 1; i < 15; i++) {
+        w[i] = Broadcast(0);
+    }
+    w[15] = Broadcast(512);
+    Compress(s, w);
+
+    // Second hash: the 32-byte digest in a single padded block.
+    for (int i = 0; i < 8; i++) {
+        w[i] = s[i];
+        s[i] = Broadcast(IV[i]);
+    }
+    w[8] = Broadcast(0x80000000);
+    for (int i = 9; i < 15; i++) {
+        w[i] = Broadcast(0);
+    }
+    w[15] = Broadcast(256);
+    Compress(s, w);
+
+    for (int i = 0; i < 8; i++) {
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, s[i]);
+        for (int l = 0; l < 4; l++) {
+            uint32_t be = __builtin_bswap32(lanes[l]);
+            memcpy(out + 32 * l + 4 * i, &be, 4);
+        }
+    }
+}
+
+} // namespace sha256d64_sse41
+
+#endif // ENABLE_SSE41
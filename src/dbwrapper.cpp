@@ -9,20 +9,69 @@
 
 #include <boost/filesystem.hpp>
 
+#include <atomic>
 #include <cstdint>
+#include <cstdio>
 #include <leveldb/cache.h>
 #include <leveldb/env.h>
 #include <leveldb/filter_policy.h>
 #include <memenv.h>
+#include <sstream>
 
-static leveldb::Options GetOptions(size_t nCacheSize) {
+namespace {
+
+/** A block cache that counts how many lookups found their block. */
+class CountingCache : public leveldb::Cache {
+private:
+    std::unique_ptr<leveldb::Cache> base;
+
+public:
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+
+    explicit CountingCache(leveldb::Cache *baseIn)
+        : base(baseIn), nHits(0), nMisses(0) {}
+
+    Handle *Insert(const leveldb::Slice &key, void *value, size_t charge,
+                   void (*deleter)(const leveldb::Slice &key,
+                                   void *value)) override {
+        return base->Insert(key, value, charge, deleter);
+    }
+    Handle *Lookup(const leveldb::Slice &key) override {
+        Handle *handle = base->Lookup(key);
+        if (handle) {
+            nHits.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            nMisses.fetch_add(1, std::memory_order_relaxed);
+        }
+        return handle;
+    }
+    void Release(Handle *handle) override { base->Release(handle); }
+    void *Value(Handle *handle) override { return base->Value(handle); }
+    void Erase(const leveldb::Slice &key) override { base->Erase(key); }
+    uint64_t NewId() override { return base->NewId(); }
+    void Prune() override { base->Prune(); }
+    size_t TotalCharge() const override { return base->TotalCharge(); }
+};
+
+} // namespace
+
+static leveldb::Options GetOptions(size_t nCacheSize,
+                                   const CDBOptions &dbOptions) {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
+    options.block_cache =
+        new CountingCache(leveldb::NewLRUCache(nCacheSize / 2));
     // up to two write buffers may be held in memory simultaneously
-    options.write_buffer_size = nCacheSize / 4;
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    options.write_buffer_size = dbOptions.nWriteBufferSize
+                                    ? dbOptions.nWriteBufferSize
+                                    : nCacheSize / 4;
+    options.block_size = dbOptions.nBlockSize;
+    if (dbOptions.nBloomBits > 0) {
+        options.filter_policy =
+            leveldb::NewBloomFilterPolicy(dbOptions.nBloomBits);
+    }
     options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.max_open_files = dbOptions.nMaxOpenFiles;
     if (leveldb::kMajorVersion > 1 ||
         (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption.
@@ -33,13 +82,14 @@ static leveldb::Options GetOptions(size_t nCacheSize) {
 }
 
 CDBWrapper::CDBWrapper(const boost::filesystem::path &path, size_t nCacheSize,
-                       bool fMemory, bool fWipe, bool obfuscate) {
+                       bool fMemory, bool fWipe, bool obfuscate,
+                       const CDBOptions &dbOptions) {
     penv = nullptr;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, dbOptions);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -121,6 +171,41 @@ bool CDBWrapper::IsEmpty() {
     return !(it->Valid());
 }
 
+void CDBWrapper::Compact() {
+    pdb->CompactRange(nullptr, nullptr);
+}
+
+void CDBWrapper::GetStats(CDBStats &stats) const {
+    stats = CDBStats();
+
+    // The per level table of "leveldb.stats" has the columns level, files,
+    // size, compaction time, read and written. The header lines do not parse.
+    std::string strStats;
+    if (pdb->GetProperty("leveldb.stats", &strStats)) {
+        std::istringstream ss(strStats);
+        std::string line;
+        while (std::getline(ss, line)) {
+            CDBStats::Level level;
+            if (sscanf(line.c_str(), "%d %d %lf %lf %lf %lf", &level.nLevel,
+                       &level.nFiles, &level.dSize, &level.dCompactionTime,
+                       &level.dRead, &level.dWritten) == 6) {
+                stats.levels.push_back(level);
+            }
+        }
+    }
+
+    std::string strMemory;
+    if (pdb->GetProperty("leveldb.approximate-memory-usage", &strMemory)) {
+        stats.nMemoryUsage = atoi64(strMemory);
+    }
+
+    const CountingCache *cache =
+        static_cast<const CountingCache *>(options.block_cache);
+    stats.nCacheHits = cache->nHits.load(std::memory_order_relaxed);
+    stats.nCacheMisses = cache->nMisses.load(std::memory_order_relaxed);
+    stats.nCacheUsage = cache->TotalCharge();
+}
+
 CDBIterator::~CDBIterator() {
     delete piter;
 }
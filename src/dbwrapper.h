@@ -20,6 +20,56 @@
 static const size_t DBWRAPPER_PREALLOC_KEY_SIZE = 64;
 static const size_t DBWRAPPER_PREALLOC_VALUE_SIZE = 1024;
 
+//! Default LevelDB settings of a database, see CDBOptions
+static const size_t DBWRAPPER_BLOCK_SIZE = 4096;
+static const int DBWRAPPER_MAX_OPEN_FILES = 64;
+static const int DBWRAPPER_BLOOM_BITS = 10;
+
+/** LevelDB settings that can be tuned per database. */
+struct CDBOptions {
+    //! Size of each of the up to two write buffers held in memory, or 0 for a
+    //! quarter of the cache size.
+    size_t nWriteBufferSize;
+    //! Approximate size of the uncompressed data in a table block.
+    size_t nBlockSize;
+    //! Number of table files LevelDB keeps open.
+    int nMaxOpenFiles;
+    //! Bits per key of the table bloom filters, or 0 to not use them.
+    int nBloomBits;
+
+    CDBOptions()
+        : nWriteBufferSize(0), nBlockSize(DBWRAPPER_BLOCK_SIZE),
+          nMaxOpenFiles(DBWRAPPER_MAX_OPEN_FILES),
+          nBloomBits(DBWRAPPER_BLOOM_BITS) {}
+};
+
+/** Statistics of a database, see CDBWrapper::GetStats. */
+struct CDBStats {
+    struct Level {
+        int nLevel;
+        int nFiles;
+        //! Sizes in MiB, as rounded by LevelDB.
+        double dSize;
+        double dRead;
+        double dWritten;
+        //! Time spent in compactions into this level, in seconds.
+        double dCompactionTime;
+    };
+
+    //! The levels that hold files or have been compacted into.
+    std::vector<Level> levels;
+    //! Block cache lookups since the database was opened.
+    uint64_t nCacheHits;
+    uint64_t nCacheMisses;
+    //! Bytes held by the block cache.
+    size_t nCacheUsage;
+    //! Approximate bytes used by LevelDB, including write buffers.
+    uint64_t nMemoryUsage;
+
+    CDBStats()
+        : nCacheHits(0), nCacheMisses(0), nCacheUsage(0), nMemoryUsage(0) {}
+};
+
 class dbwrapper_error : public std::runtime_error {
 public:
     dbwrapper_error(const std::string &msg) : std::runtime_error(msg) {}
@@ -219,10 +269,12 @@ public:
      * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If
      * false, XOR
      *                        with a zero'd byte array.
+     * @param[in] dbOptions   LevelDB settings of this database.
      */
     CDBWrapper(const boost::filesystem::path &path, size_t nCacheSize,
                bool fMemory = false, bool fWipe = false,
-               bool obfuscate = false);
+               bool obfuscate = false,
+               const CDBOptions &dbOptions = CDBOptions());
     ~CDBWrapper();
 
     template <typename K, typename V> bool Read(const K &key, V &value) const {
@@ -298,6 +350,14 @@ public:
      */
     bool IsEmpty();
 
+    /**
+     * Compact the whole database, which drops deleted and overwritten entries
+     * and moves the data to the lower levels. Blocks until done.
+     */
+    void Compact();
+
+    void GetStats(CDBStats &stats) const;
+
     template <typename K>
     size_t EstimateSize(const K &key_begin, const K &key_end) const {
         CDataStream ssKey1(SER_DISK, CLIENT_VERSION),
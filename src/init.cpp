@@ -162,8 +162,15 @@ public:
     // the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = nullptr;
 static CCoinsViewErrorCatcher *pcoinscatcher = nullptr;
+
+static void CompactChainState() {
+    LogPrintf("Compacting the chain state database...\n");
+    int64_t nStart = GetTimeMillis();
+    pcoinsdbview->Compact();
+    LogPrintf("Compacted the chain state database in %dms\n",
+              GetTimeMillis() - nStart);
+}
 static std::unique_ptr<ECCVerifyHandle> globalVerifyHandle;
 
 void Interrupt(boost::thread_group &threadGroup) {
@@ -173,6 +180,7 @@ void Interrupt(boost::thread_group &threadGroup) {
     InterruptREST();
     InterruptTorControl();
     if (g_connman) g_connman->Interrupt();
+    InterruptBlockFileWriter();
     threadGroup.interrupt_all();
 }
 
@@ -336,6 +344,17 @@ std::string HelpMessage(HelpMessageMode mode) {
                   Params(CBaseChainParams::TESTNET)
                       .GetConsensus()
                       .defaultAssumeValid.GetHex()));
+    strUsage += HelpMessageOpt(
+        "-coinscommitment",
+        strprintf(_("Keep a commitment to the UTXO set up to date as blocks "
+                    "are connected, for gettxoutsetinfo \"muhash\" "
+                    "(default: %u)"),
+                  DEFAULT_COINS_COMMITMENT));
+    strUsage += HelpMessageOpt(
+        "-compactchainstate=<n>",
+        strprintf(_("Compact the chain state database every <n> hours (0 to "
+                    "disable, default: %d)"),
+                  nDefaultDbCompactInterval));
     strUsage += HelpMessageOpt(
         "-conf=<file>", strprintf(_("Specify configuration file (default: %s)"),
                                   BITCOIN_CONF_FILENAME));
@@ -347,11 +366,50 @@ std::string HelpMessage(HelpMessageMode mode) {
 #endif
     }
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
+    if (showDebug) {
+        strUsage += HelpMessageOpt(
+            "-dbbatchsize",
+            strprintf("Maximum database write batch size in bytes (default: "
+                      "%u)",
+                      nDefaultDbBatchSize));
+        strUsage += HelpMessageOpt(
+            "-coinssyncentries",
+            strprintf("Maximum number of coins written per block while the "
+                      "coins cache is written out without being emptied "
+                      "(default: %u)",
+                      MAX_COINS_SYNC_ENTRIES));
+    }
     strUsage += HelpMessageOpt(
         "-dbcache=<n>",
         strprintf(
             _("Set database cache size in megabytes (%d to %d, default: %d)"),
             nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    if (showDebug) {
+        strUsage += HelpMessageOpt(
+            "-dbblocksize=<n>",
+            strprintf("Approximate size of a LevelDB table block in KiB "
+                      "(default: %u)",
+                      DBWRAPPER_BLOCK_SIZE >> 10));
+        strUsage += HelpMessageOpt(
+            "-dbbloombits=<n>",
+            strprintf("Bits per key of the LevelDB bloom filters, 0 to not "
+                      "use them (default: %d)",
+                      DBWRAPPER_BLOOM_BITS));
+        strUsage += HelpMessageOpt(
+            "-dbmaxopenfiles=<n>",
+            strprintf("Number of LevelDB table files to keep open per "
+                      "database (default: %d)",
+                      DBWRAPPER_MAX_OPEN_FILES));
+        strUsage += HelpMessageOpt(
+            "-dbwritebuffer=<n>",
+            "Size of each LevelDB write buffer in megabytes (default: a "
+            "quarter of the database cache)");
+        strUsage += HelpMessageOpt(
+            "-chainstate<setting>=<n>, -blockindex<setting>=<n>",
+            "Override one of the above -db<setting> options for the chain "
+            "state or block index database only, e.g. "
+            "-chainstatemaxopenfiles=1000");
+    }
     if (showDebug)
         strUsage += HelpMessageOpt(
             "-feefilter", strprintf("Tell other nodes to filter invs to us by "
@@ -380,8 +438,11 @@ std::string HelpMessage(HelpMessageMode mode) {
                   DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN));
     strUsage += HelpMessageOpt(
         "-par=<n>",
-        strprintf(_("Set the number of script verification threads (%u to %d, "
-                    "0 = auto, <0 = leave that many cores free, default: %d)"),
+        strprintf(_("Set the number of script and transaction verification "
+                    "threads (%u to %d, 0 = auto, <0 = leave that many cores "
+                    "free, default: %d). The same number is used for "
+                    "Equihash checks and block input prefetching, each with "
+                    "its own threads"),
                   -GetNumCores(), MAX_SCRIPTCHECK_THREADS,
                   DEFAULT_SCRIPTCHECK_THREADS));
 #ifndef WIN32
@@ -409,6 +470,12 @@ std::string HelpMessage(HelpMessageMode mode) {
     strUsage +=
         HelpMessageOpt("-reindex", _("Rebuild chain state and block index from "
                                      "the blk*.dat files on disk"));
+    strUsage += HelpMessageOpt(
+        "-reorgcache=<n>",
+        strprintf(_("Keep the last <n> connected blocks in memory with their "
+                    "undo data, to disconnect them in a reorg without "
+                    "reading from disk (default: %u)"),
+                  DEFAULT_REORG_CACHE_BLOCKS));
 #ifndef WIN32
     strUsage += HelpMessageOpt(
         "-sysperms",
@@ -470,6 +537,13 @@ std::string HelpMessage(HelpMessageMode mode) {
         "-maxconnections=<n>",
         strprintf(_("Maintain at most <n> connections to peers (default: %u)"),
                   DEFAULT_MAX_PEER_CONNECTIONS));
+    strUsage += HelpMessageOpt(
+        "-msghandlerthreads=<n>",
+        strprintf(_("Set the number of threads processing peer messages, each "
+                    "peer being handled by one of them (%u to %d, 0 = auto, "
+                    "<0 = leave that many cores free, default: %d)"),
+                  -GetNumCores(), MAX_MESSAGE_HANDLER_THREADS,
+                  DEFAULT_MESSAGE_HANDLER_THREADS));
     strUsage +=
         HelpMessageOpt("-maxreceivebuffer=<n>",
                        strprintf(_("Maximum per-connection receive buffer, "
@@ -606,6 +680,12 @@ std::string HelpMessage(HelpMessageMode mode) {
                 "setBlockIndexCandidates, chainActive and mapBlocksUnlinked "
                 "occasionally. Also sets -checkmempool (default: %d)",
                 Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
+        strUsage += HelpMessageOpt(
+            "-checkblockindexhashes=<n>",
+            strprintf("Recompute the header hash of one in every <n> block "
+                      "index entries loaded at startup (default: %u, 0 = "
+                      "none)",
+                      DEFAULT_CHECKBLOCKINDEXHASHES));
         strUsage += HelpMessageOpt(
             "-checkmempool=<n>",
             strprintf(
@@ -797,6 +877,12 @@ std::string HelpMessage(HelpMessageMode mode) {
         strprintf(_("Set maximum percentage of a block reserved to "
                     "high-priority/low-fee transactions (default: %d)"),
                   DEFAULT_BLOCK_PRIORITY_PERCENTAGE));
+    strUsage += HelpMessageOpt(
+        "-genproclimit=<n>",
+        strprintf(_("Set the number of threads solving Equihash in generate "
+                    "and generatetoaddress (0 or -1 = all cores, up to %d, "
+                    "default: %d)"),
+                  MAX_GENPROCLIMIT, DEFAULT_GENPROCLIMIT));
     strUsage += HelpMessageOpt(
         "-blockmintxfee=<amt>",
         strprintf(_("Set lowest fee rate (in %s/kB) for transactions to be "
@@ -1301,20 +1387,32 @@ bool AppInitParameterInteraction(Config &config) {
     nUserMaxConnections =
         GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
+    // MIN_CORE_FILEDESCRIPTORS leaves room for the LevelDB table files at the
+    // default limits, raising them takes descriptors from the connections.
+    int nDBFiles = 0;
+#ifndef WIN32
+    nDBFiles =
+        std::max(GetDBMaxOpenFiles() - 2 * DBWRAPPER_MAX_OPEN_FILES, 0);
+#endif
 
-    // Trim requested connection counts, to fit into system limitations
+    // Trim requested connection counts, to fit into system limitations. With
+    // epoll the sockets are not bound by FD_SETSIZE, only by the descriptor
+    // limit below.
+#ifndef USE_EPOLL
     nMaxConnections =
         std::max(std::min(nMaxConnections,
                           (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS -
-                                MAX_ADDNODE_CONNECTIONS)),
+                                nDBFiles - MAX_ADDNODE_CONNECTIONS)),
                  0);
-    nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS +
+#endif
+    nFD = RaiseFileDescriptorLimit(nMaxConnections + nBind +
+                                   MIN_CORE_FILEDESCRIPTORS + nDBFiles +
                                    MAX_ADDNODE_CONNECTIONS);
-    if (nFD < MIN_CORE_FILEDESCRIPTORS)
+    if (nFD < MIN_CORE_FILEDESCRIPTORS + nDBFiles)
         return InitError(_("Not enough file descriptors available."));
-    nMaxConnections =
-        std::min(nFD - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS,
-                 nMaxConnections);
+    nMaxConnections = std::min(nFD - nBind - MIN_CORE_FILEDESCRIPTORS -
+                                   nDBFiles - MAX_ADDNODE_CONNECTIONS,
+                               nMaxConnections);
 
     if (nMaxConnections < nUserMaxConnections)
         InitWarning(strprintf(_("Reducing -maxconnections from %d to %d, "
@@ -1370,6 +1468,8 @@ bool AppInitParameterInteraction(Config &config) {
         GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled =
         GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
+    fCoinsCommitment =
+        GetBoolArg("-coinscommitment", DEFAULT_COINS_COMMITMENT);
 
     hashAssumeValid = uint256S(
         GetArg("-assumevalid",
@@ -1673,13 +1773,19 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
     InitSignatureCache();
     InitScriptExecutionCache();
 
-    LogPrintf("Using %u threads for script verification\n",
+    // Each check queue kind gets its own (n-1) worker threads, the calling
+    // thread being the n-th one.
+    LogPrintf("Using %u threads each for script and transaction verification, "
+              "Equihash checks and block input prefetching\n",
               nScriptCheckThreads);
     if (nScriptCheckThreads) {
         for (int i = 0; i < nScriptCheckThreads - 1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadEquihashCheck);
+            threadGroup.create_thread(&ThreadCoinsPrefetch);
         }
     }
+    threadGroup.create_thread(&ThreadBlockFileWriter);
 
     // Start the lightweight task scheduler thread
     CScheduler::Function serviceLoop =
@@ -1935,6 +2041,8 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
     nTotalCache -= nCoinDBCache;
     // the rest goes to in-memory cache
     nCoinCacheUsage = nTotalCache;
+    nReorgCacheBlocks = std::max<int64_t>(
+        0, GetArg("-reorgcache", DEFAULT_REORG_CACHE_BLOCKS));
     int64_t nMempoolSizeMax =
         GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     LogPrintf("Cache configuration:\n");
@@ -1997,6 +2105,19 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
                                        "Wrong datadir for network?"));
                 }
 
+                // Complete a write of the coins database that was
+                // interrupted, before its best block is used as the tip.
+                if (!ReplayBlocks(config, pcoinsdbview)) {
+                    strLoadError =
+                        _("Unable to replay blocks. You will need to rebuild "
+                          "the database using -reindex-chainstate.");
+                    break;
+                }
+                if (!LoadChainTip(chainparams)) {
+                    strLoadError = _("Error initializing block database");
+                    break;
+                }
+
                 // Initialize the block index (no-op if non-empty database was
                 // already loaded)
                 if (!InitBlockIndex(config)) {
@@ -2022,6 +2143,16 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
                     break;
                 }
 
+                // Rebuilding the chain state needs the blocks up to a UTXO
+                // snapshot, which were never downloaded.
+                if (fReindexChainState && pindexSnapshotBase) {
+                    strLoadError =
+                        _("The chain state was loaded from a UTXO snapshot "
+                          "and can only be rebuilt with -reindex. This will "
+                          "redownload the entire blockchain");
+                    break;
+                }
+
                 if (!fReindex && chainActive.Tip() != nullptr) {
                     uiInterface.InitMessage(_("Rewinding blocks..."));
                     if (!RewindBlockIndex(config)) {
@@ -2139,6 +2270,20 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
         }
     }
 
+    // Likewise without the blocks up to a UTXO snapshot.
+    if (pindexSnapshotBase && (nLocalServices & NODE_NETWORK)) {
+        LogPrintf("Unsetting NODE_NETWORK after loading a UTXO snapshot\n");
+        nLocalServices = ServiceFlags(nLocalServices & ~NODE_NETWORK);
+    }
+
+    // Compaction runs on the scheduler thread and does not hold cs_main, so
+    // blocks keep being connected meanwhile.
+    int64_t nCompactInterval =
+        GetArg("-compactchainstate", nDefaultDbCompactInterval);
+    if (nCompactInterval > 0) {
+        scheduler.scheduleEvery(&CompactChainState, nCompactInterval * 60 * 60);
+    }
+
     // Step 10: import blocks
 
     if (!CheckDiskSpace()) {
@@ -2208,6 +2353,14 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
 
     connOptions.nMaxOutboundTimeframe = nMaxOutboundTimeframe;
     connOptions.nMaxOutboundLimit = nMaxOutboundLimit;
+    // -msghandlerthreads=0 means one thread per core
+    int nMessageHandlerThreads =
+        GetArg("-msghandlerthreads", DEFAULT_MESSAGE_HANDLER_THREADS);
+    if (nMessageHandlerThreads <= 0) {
+        nMessageHandlerThreads += GetNumCores();
+    }
+    connOptions.nMessageHandlerThreads = std::max(
+        1, std::min(nMessageHandlerThreads, MAX_MESSAGE_HANDLER_THREADS));
 
     if (!connman.Start(scheduler, strNodeError, connOptions)) {
         return InitError(strNodeError);
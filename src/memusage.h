@@ -6,6 +6,7 @@
 #define BITCOIN_MEMUSAGE_H
 
 #include "indirectmap.h"
+#include "openhashmap.h"
 
 #include <cstdlib>
 
@@ -178,6 +179,14 @@ static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z> &m) {
                m.size() +
            MallocUsage(sizeof(void *) * m.bucket_count());
 }
+
+// openhashmap allocates its entries in chunks, next to its slot table
+
+template <typename X, typename Y, typename Z, typename W>
+static inline size_t DynamicUsage(const openhashmap<X, Y, Z, W> &m) {
+    return MallocUsage(m.slots_memory()) + MallocUsage(m.chunks_memory()) +
+           MallocUsage(m.chunk_memory()) * m.chunk_count();
+}
 }
 
 #endif // BITCOIN_MEMUSAGE_H
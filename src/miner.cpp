@@ -13,6 +13,7 @@
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/equihash.h"
 #include "hash.h"
 #include "net.h"
 #include "policy/policy.h"
@@ -28,6 +29,7 @@
 #include "uint256.h"
 
 #include <algorithm>
+#include <atomic>
 #include <queue>
 #include <utility>
 
@@ -77,6 +79,7 @@ int64_t UpdateTime(CBlockHeader *pblock, const Config &config,
     if (consensusParams.fPowAllowMinDifficultyBlocks) {
         pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, config);
     }
+    pblock->hashCache.Clear();
 
     return nNewTime - nOldTime;
 }
@@ -231,6 +234,7 @@ BlockAssembler::CreateNewBlock(const CScript &scriptPubKeyIn) {
     pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, *config);
     pblock->nNonce    = ArithToUint256(nonce);
     pblock->nSolution.clear();
+    pblock->hashCache.Clear();
     pblocktemplate->vTxSigOpsCount[0] = GetSigOpCountWithoutP2SH(*pblock->vtx[0]);
 
     CValidationState state;
@@ -674,4 +678,93 @@ void IncrementExtraNonce(const Config &config, CBlock *pblock,
 
     pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+    pblock->hashCache.Clear();
+}
+
+static void SolveEquihashThread(const Config &config,
+                                const CBlockHeader &header, uint64_t nTries,
+                                const std::function<bool()> &cancelled,
+                                std::atomic<uint64_t> &nNext,
+                                std::atomic<bool> &fFound,
+                                CCriticalSection &cs, CBlockHeader &result) {
+    const CChainParams &params = config.GetChainParams();
+    unsigned int n = params.EquihashN();
+    unsigned int k = params.EquihashK();
+
+    // H(I||...
+    eh_HashState eh_state;
+    EhInitialiseState(n, k, eh_state);
+    CEquihashInput I{header};
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << I;
+    eh_state.Write((unsigned char *)&ss[0], ss.size());
+
+    CBlockHeader candidate = header;
+    candidate.hashCache.Clear();
+    std::function<bool(std::vector<unsigned char>)> validBlock =
+        [&](std::vector<unsigned char> soln) {
+            candidate.nSolution = soln;
+            if (!CheckProofOfWork(candidate.GetHash(), candidate.nBits, true,
+                                  config)) {
+                return false;
+            }
+            LOCK(cs);
+            if (!fFound) {
+                result = candidate;
+                fFound = true;
+            }
+            return true;
+        };
+    std::function<bool(EhSolverCancelCheck)> solverCancelled =
+        [&](EhSolverCancelCheck pos) { return fFound || cancelled(); };
+
+    while (!fFound && !cancelled()) {
+        uint64_t i = nNext++;
+        if (i >= nTries) {
+            break;
+        }
+        candidate.nNonce =
+            ArithToUint256(UintToArith256(header.nNonce) + i + 1);
+
+        // H(I||V||...
+        eh_HashState curr_state = eh_state;
+        curr_state.Write(candidate.nNonce.begin(), candidate.nNonce.size());
+
+        // (x_1, x_2, ...) = A(I, V, n, k)
+        try {
+            if (EhOptimisedSolve(n, k, curr_state, validBlock,
+                                 solverCancelled)) {
+                break;
+            }
+        } catch (EhSolverCancelledException &) {
+            break;
+        }
+    }
+}
+
+bool SolveEquihash(const Config &config, CBlockHeader *pblock, uint64_t nTries,
+                   int nThreads, const std::function<bool()> &cancelled,
+                   uint64_t &nTried) {
+    std::atomic<uint64_t> nNext(0);
+    std::atomic<bool> fFound(false);
+    CCriticalSection cs;
+    CBlockHeader result;
+
+    boost::thread_group threadGroup;
+    for (int i = 0; i < std::max(nThreads, 1); i++) {
+        threadGroup.create_thread(std::bind(
+            &SolveEquihashThread, std::cref(config), std::cref(*pblock),
+            nTries, std::cref(cancelled), std::ref(nNext), std::ref(fFound),
+            std::ref(cs), std::ref(result)));
+    }
+    threadGroup.join_all();
+
+    nTried = std::min<uint64_t>(nNext, nTries);
+    if (!fFound) {
+        return false;
+    }
+    pblock->nNonce = result.nNonce;
+    pblock->nSolution = result.nSolution;
+    pblock->hashCache.Clear();
+    return true;
 }
@@ -13,6 +13,7 @@
 #include "boost/multi_index_container.hpp"
 
 #include <cstdint>
+#include <functional>
 #include <memory>
 
 class CBlockIndex;
@@ -23,6 +24,10 @@ class CScript;
 class CWallet;
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -genproclimit, the Equihash solver threads of generate. */
+static const int DEFAULT_GENPROCLIMIT = -1;
+/** Each solver thread needs around 1 GB at the main chain parameters. */
+static const int MAX_GENPROCLIMIT = 16;
 
 struct CBlockTemplate {
     CBlock block;
@@ -71,7 +76,7 @@ struct modifiedentry_iter {
 // TODO: refactor to avoid duplication of this logic.
 struct CompareModifiedEntry {
     bool operator()(const CTxMemPoolModifiedEntry &a,
-                    const CTxMemPoolModifiedEntry &b) {
+                    const CTxMemPoolModifiedEntry &b) const {
         double f1 = double(b.nSizeWithAncestors *
                            a.nModFeesWithAncestors.GetSatoshis());
         double f2 = double(a.nSizeWithAncestors *
@@ -87,7 +92,7 @@ struct CompareModifiedEntry {
 // This is sufficient to sort an ancestor package in an order that is valid
 // to appear in a block.
 struct CompareTxIterByAncestorCount {
-    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) {
+    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) const {
         if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
             return a->GetCountWithAncestors() < b->GetCountWithAncestors();
         return CTxMemPool::CompareIteratorByHash()(a, b);
@@ -215,4 +220,15 @@ void IncrementExtraNonce(const Config &config, CBlock *pblock,
                          unsigned int &nExtraNonce);
 int64_t UpdateTime(CBlockHeader *pblock, const Config &config,
                    const CBlockIndex *pindexPrev);
+
+/**
+ * Search for an Equihash solution meeting the target of pblock, trying up to
+ * nTries nonces following pblock->nNonce. The nonces are spread over nThreads
+ * threads, each running the optimised solver. The search stops early once
+ * cancelled() returns true. On success pblock->nNonce and nSolution are set.
+ * Returns the number of nonces tried in nTried.
+ */
+bool SolveEquihash(const Config &config, CBlockHeader *pblock, uint64_t nTries,
+                   int nThreads, const std::function<bool()> &cancelled,
+                   uint64_t &nTried);
 #endif // BITCOIN_MINER_H
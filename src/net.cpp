@@ -29,6 +29,11 @@
 #include <fcntl.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -36,6 +41,7 @@
 #include <miniupnpc/upnperrors.h>
 #endif
 
+#include <algorithm>
 #include <cmath>
 
 // Dump addresses to peers.dat and banlist.dat every 15 minutes (900s)
@@ -45,6 +51,15 @@
 // synchronization.
 #define FEELER_SLEEP_WINDOW 1
 
+// How long to wait for socket events, which also bounds how long new data to
+// send waits for select() to notice it.
+static const int SELECT_TIMEOUT_MILLISECONDS = 50;
+#ifdef USE_EPOLL
+// Maximum number of ready sockets taken from epoll at once. Any others are
+// reported again on the next wait.
+static const int MAX_EPOLL_EVENTS = 256;
+#endif
+
 #if !defined(HAVE_MSG_NOSIGNAL) && !defined(MSG_NOSIGNAL)
 #define MSG_NOSIGNAL 0
 #endif
@@ -662,13 +677,24 @@ void CNode::copyStats(CNodeStats &stats) {
     {
         LOCK(cs_vSend);
         X(mapSendBytesPerMsgCmd);
+        X(mapSendMsgsPerMsgCmd);
         X(nSendBytes);
+        stats.nSendQueueMsgs = vSendMsg.size();
+        stats.nSendQueueSize = nSendSize;
     }
     {
         LOCK(cs_vRecv);
         X(mapRecvBytesPerMsgCmd);
+        X(mapRecvMsgsPerMsgCmd);
         X(nRecvBytes);
     }
+    {
+        LOCK(cs_vProcessMsg);
+        X(mapProcessStatsPerMsgCmd);
+        X(sendMessagesStats);
+        stats.nProcessQueueMsgs = vProcessMsg.size();
+        stats.nProcessQueueSize = nProcessQueueSize;
+    }
     X(fWhitelisted);
 
     // It is common for nodes with good ping times to suddenly become lagged,
@@ -734,18 +760,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes,
         nBytes -= handled;
 
         if (msg.complete()) {
-            // Store received bytes per message command to prevent a memory DOS,
-            // only allow valid commands.
-            mapMsgCmdSize::iterator i =
-                mapRecvBytesPerMsgCmd.find(msg.hdr.pchCommand);
-            if (i == mapRecvBytesPerMsgCmd.end()) {
-                i = mapRecvBytesPerMsgCmd.find(NET_MESSAGE_COMMAND_OTHER);
-            }
-
-            assert(i != mapRecvBytesPerMsgCmd.end());
-            i->second += msg.hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
-
-            msg.nTime = nTimeMicros;
+            RecordRecvMsg(msg, nTimeMicros);
             complete = true;
         }
     }
@@ -753,6 +768,123 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes,
     return true;
 }
 
+char *CNode::GetRecvBuffer(unsigned int &nBytes) {
+    LOCK(cs_vRecv);
+    if (vRecvMsg.empty() || !vRecvMsg.back().in_data ||
+        vRecvMsg.back().complete()) {
+        return nullptr;
+    }
+    return vRecvMsg.back().GetDataBuffer(nBytes);
+}
+
+bool CNode::ReceivedMsgBytesInPlace(unsigned int nBytes, bool &complete) {
+    complete = false;
+    int64_t nTimeMicros = GetTimeMicros();
+    LOCK(cs_vRecv);
+    nLastRecv = nTimeMicros / 1000000;
+    nRecvBytes += nBytes;
+
+    CNetMessage &msg = vRecvMsg.back();
+    msg.ReceivedData(nBytes);
+    if (msg.complete()) {
+        RecordRecvMsg(msg, nTimeMicros);
+        complete = true;
+    }
+
+    return true;
+}
+
+// requires LOCK(cs_vRecv)
+void CNode::RecordRecvMsg(CNetMessage &msg, int64_t nTimeMicros) {
+    // Store received bytes per message command to prevent a memory DOS, only
+    // allow valid commands.
+    mapMsgCmdSize::iterator i = mapRecvBytesPerMsgCmd.find(msg.hdr.pchCommand);
+    if (i == mapRecvBytesPerMsgCmd.end()) {
+        i = mapRecvBytesPerMsgCmd.find(NET_MESSAGE_COMMAND_OTHER);
+    }
+
+    assert(i != mapRecvBytesPerMsgCmd.end());
+    i->second += msg.hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
+    mapRecvMsgsPerMsgCmd[i->first]++;
+
+    msg.nTime = nTimeMicros;
+}
+
+void CNode::RecordProcessTime(const std::string &strCommand, int64_t nMicros,
+                              int64_t nLockWaitMicros) {
+    LOCK(cs_vProcessMsg);
+    // As with the received bytes, only valid commands get their own entry.
+    mapMsgCmdProcessStats::iterator i =
+        mapProcessStatsPerMsgCmd.find(strCommand);
+    if (i == mapProcessStatsPerMsgCmd.end()) {
+        i = mapProcessStatsPerMsgCmd.find(NET_MESSAGE_COMMAND_OTHER);
+    }
+    assert(i != mapProcessStatsPerMsgCmd.end());
+    i->second.Add(nMicros, nLockWaitMicros);
+}
+
+void CNode::RecordSendMessagesTime(int64_t nMicros, bool fSkipped) {
+    LOCK(cs_vProcessMsg);
+    if (fSkipped) {
+        sendMessagesStats.nSkipped++;
+    } else {
+        sendMessagesStats.Add(nMicros, 0);
+    }
+}
+
+const int64_t
+    CMsgProcessStats::HISTOGRAM_BOUNDS[CMsgProcessStats::HISTOGRAM_BUCKETS -
+                                       1] = {10,    100,    1000,
+                                             10000, 100000, 1000000};
+
+CMsgProcessStats::CMsgProcessStats()
+    : nCount(0), nMicros(0), nLockWaitMicros(0), nSkipped(0) {
+    std::fill(std::begin(histogram), std::end(histogram), 0);
+}
+
+void CMsgProcessStats::Add(int64_t nMicrosIn, int64_t nLockWaitMicrosIn) {
+    nCount++;
+    nMicros += nMicrosIn;
+    nLockWaitMicros += nLockWaitMicrosIn;
+    int nBucket = 0;
+    while (nBucket < HISTOGRAM_BUCKETS - 1 &&
+           nMicrosIn >= HISTOGRAM_BOUNDS[nBucket]) {
+        nBucket++;
+    }
+    histogram[nBucket]++;
+}
+
+CMsgProcessStats &CMsgProcessStats::operator+=(const CMsgProcessStats &other) {
+    nCount += other.nCount;
+    nMicros += other.nMicros;
+    nLockWaitMicros += other.nLockWaitMicros;
+    nSkipped += other.nSkipped;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        histogram[i] += other.histogram[i];
+    }
+    return *this;
+}
+
+void CNetMsgStats::Add(const CNodeStats &stats) {
+    for (const mapMsgCmdSize::value_type &i : stats.mapSendBytesPerMsgCmd) {
+        mapSendBytesPerMsgCmd[i.first] += i.second;
+    }
+    for (const mapMsgCmdSize::value_type &i : stats.mapSendMsgsPerMsgCmd) {
+        mapSendMsgsPerMsgCmd[i.first] += i.second;
+    }
+    for (const mapMsgCmdSize::value_type &i : stats.mapRecvBytesPerMsgCmd) {
+        mapRecvBytesPerMsgCmd[i.first] += i.second;
+    }
+    for (const mapMsgCmdSize::value_type &i : stats.mapRecvMsgsPerMsgCmd) {
+        mapRecvMsgsPerMsgCmd[i.first] += i.second;
+    }
+    for (const mapMsgCmdProcessStats::value_type &i :
+         stats.mapProcessStatsPerMsgCmd) {
+        mapProcessStatsPerMsgCmd[i.first] += i.second;
+    }
+    sendMessagesStats += stats.sendMessagesStats;
+}
+
 void CNode::SetSendVersion(int nVersionIn) {
     // Send version may only be changed in the version message, and only one
     // version message is allowed per session. We can therefore treat this value
@@ -811,20 +943,36 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes) {
 }
 
 int CNetMessage::readData(const char *pch, unsigned int nBytes) {
-    unsigned int nRemaining = hdr.nMessageSize - nDataPos;
-    unsigned int nCopy = std::min(nRemaining, nBytes);
+    unsigned int nCopy;
+    char *pchData = GetDataBuffer(nCopy);
+    nCopy = std::min(nCopy, nBytes);
+
+    memcpy(pchData, pch, nCopy);
+    ReceivedData(nCopy);
+
+    return nCopy;
+}
 
-    if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message
-        // size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+char *CNetMessage::GetDataBuffer(unsigned int &nBytes) {
+    assert(in_data && !complete());
+    if (vRecv.size() == nDataPos) {
+        // Grow the buffer geometrically, so that a large message is only
+        // moved a few times while it is received, and not once every 256 KiB.
+        // It is kept within twice what has actually been received though,
+        // and never exceeds the total message size, so that a header alone
+        // cannot make us allocate the maximum message size.
+        vRecv.resize(std::min<size_t>(
+            hdr.nMessageSize, std::max<size_t>(2 * nDataPos, 256 * 1024)));
     }
 
-    hasher.Write((const uint8_t *)pch, nCopy);
-    memcpy(&vRecv[nDataPos], pch, nCopy);
-    nDataPos += nCopy;
+    nBytes = vRecv.size() - nDataPos;
+    return &vRecv[nDataPos];
+}
 
-    return nCopy;
+void CNetMessage::ReceivedData(unsigned int nBytes) {
+    assert(nDataPos + nBytes <= vRecv.size());
+    hasher.Write((const uint8_t *)&vRecv[nDataPos], nBytes);
+    nDataPos += nBytes;
 }
 
 const uint256 &CNetMessage::GetMessageHash() const {
@@ -897,6 +1045,11 @@ size_t CConnman::SocketSendData(CNode *pnode) const {
         assert(pnode->nSendOffset == 0);
         assert(pnode->nSendSize == 0);
     }
+#ifdef USE_EPOLL
+    // Wait for the socket to become writable if this left data queued, or
+    // stop waiting for it if the queue was drained.
+    UpdateSocketEvents(pnode);
+#endif
 
     return nSentSize;
 }
@@ -1197,10 +1350,290 @@ void CConnman::AcceptConnection(const ListenSocket &hListenSocket) {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
+#ifdef USE_EPOLL
+    {
+        LOCK(pnode->cs_vSend);
+        UpdateSocketEvents(pnode);
+    }
+#endif
+}
+
+#ifdef USE_EPOLL
+void CConnman::UpdateSocketEvents(CNode *pnode) const {
+    AssertLockHeld(pnode->cs_vSend);
+    // As with select(), wait for the socket to become writable while there
+    // is data to send, draining the send queue before receiving more, and
+    // otherwise for data to receive unless receiving is paused. A socket
+    // waiting for neither is taken out of the epoll set, as hang-ups and
+    // errors cannot be masked and would wake the handler over and over.
+    uint32_t events = 0;
+    if (!pnode->vSendMsg.empty()) {
+        events = EPOLLOUT;
+    } else if (!pnode->fPauseRecv) {
+        events = EPOLLIN;
+    }
+
+    LOCK(pnode->cs_hSocket);
+    if (pnode->hSocket == INVALID_SOCKET || events == pnode->nEpollEvents) {
+        return;
+    }
+    struct epoll_event event = {};
+    event.events = events;
+    event.data.ptr = pnode;
+    int op = events == 0 ? EPOLL_CTL_DEL : pnode->nEpollEvents == 0
+                                               ? EPOLL_CTL_ADD
+                                               : EPOLL_CTL_MOD;
+    if (epoll_ctl(epollFd, op, pnode->hSocket, &event) != 0) {
+        LogPrintf("socket epoll_ctl error %s\n", NetworkErrorString(errno));
+        return;
+    }
+    pnode->nEpollEvents = events;
+}
+
+void CConnman::SocketEvents(std::set<SOCKET> &listen_set,
+                            std::vector<NodeEvents> &vReady) {
+    // The sockets are registered as their nodes change what they wait for,
+    // so only the sockets that are ready are looked at here.
+    std::vector<struct epoll_event> events(MAX_EPOLL_EVENTS);
+    int nEvents = epoll_wait(epollFd, events.data(), events.size(),
+                             SELECT_TIMEOUT_MILLISECONDS);
+    if (nEvents < 0) {
+        if (errno != EINTR) {
+            LogPrintf("socket epoll error %s\n", NetworkErrorString(errno));
+            interruptNet.sleep_for(
+                std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+        }
+        return;
+    }
+
+    LOCK(cs_vNodes);
+    for (int i = 0; i < nEvents; i++) {
+        // The wake up eventfd has no pointer, and the listening sockets
+        // point to their entry in vhListenSocket.
+        if (events[i].data.ptr == nullptr) {
+            // Reset the wake up counter. The eventfd is non-blocking, and a
+            // failed read only means there was nothing to reset.
+            uint64_t nWakes;
+            ssize_t nRead = read(wakeFd, &nWakes, sizeof(nWakes));
+            (void)nRead;
+            continue;
+        }
+        bool fListen = false;
+        for (const ListenSocket &hListenSocket : vhListenSocket) {
+            if (events[i].data.ptr == &hListenSocket) {
+                listen_set.insert(hListenSocket.socket);
+                fListen = true;
+            }
+        }
+        if (fListen) {
+            continue;
+        }
+
+        // Closing a socket takes it out of the epoll set, and nodes are only
+        // deleted by the socket handler, so the node is still there.
+        CNode *pnode = static_cast<CNode *>(events[i].data.ptr);
+        NodeEvents ready(pnode);
+        ready.fRecv = events[i].events & EPOLLIN;
+        ready.fSend = events[i].events & EPOLLOUT;
+        ready.fError = events[i].events & (EPOLLERR | EPOLLHUP);
+        pnode->AddRef();
+        vReady.push_back(ready);
+    }
+}
+#else
+bool CConnman::GenerateSelectSet(std::set<SOCKET> &recv_set,
+                                 std::set<SOCKET> &send_set,
+                                 std::set<SOCKET> &error_set) {
+    for (const ListenSocket &hListenSocket : vhListenSocket) {
+        recv_set.insert(hListenSocket.socket);
+    }
+
+    {
+        LOCK(cs_vNodes);
+        for (CNode *pnode : vNodes) {
+            // Implement the following logic:
+            // * If there is data to send, select() for sending data. As this
+            // only happens when optimistic write failed, we choose to first
+            // drain the write buffer in this case before receiving more. This
+            // avoids needlessly queueing received data, if the remote peer is
+            // not themselves receiving data. This means properly utilizing
+            // TCP flow control signalling.
+            // * Otherwise, if there is space left in the receive buffer,
+            // select() for receiving data.
+            // * Hand off all complete messages to the processor, to be handled
+            // without blocking here.
+
+            bool select_recv = !pnode->fPauseRecv;
+            bool select_send;
+            {
+                LOCK(pnode->cs_vSend);
+                select_send = !pnode->vSendMsg.empty();
+            }
+
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET) {
+                continue;
+            }
+
+            error_set.insert(pnode->hSocket);
+            if (select_send) {
+                send_set.insert(pnode->hSocket);
+                continue;
+            }
+            if (select_recv) {
+                recv_set.insert(pnode->hSocket);
+            }
+        }
+    }
+
+    return !recv_set.empty() || !send_set.empty() || !error_set.empty();
+}
+
+void CConnman::SocketEvents(std::set<SOCKET> &listen_set,
+                            std::vector<NodeEvents> &vReady) {
+    std::set<SOCKET> recv_select_set, send_select_set, error_select_set;
+    if (!GenerateSelectSet(recv_select_set, send_select_set,
+                           error_select_set)) {
+        interruptNet.sleep_for(
+            std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+        return;
+    }
+
+    struct timeval timeout = MillisToTimeval(SELECT_TIMEOUT_MILLISECONDS);
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+
+    for (SOCKET hSocket : recv_select_set) {
+        FD_SET(hSocket, &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+    for (SOCKET hSocket : send_select_set) {
+        FD_SET(hSocket, &fdsetSend);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+    for (SOCKET hSocket : error_select_set) {
+        FD_SET(hSocket, &fdsetError);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+
+    int nSelect =
+        select(hSocketMax + 1, &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (interruptNet) {
+        return;
+    }
+
+    std::set<SOCKET> recv_set, send_set, error_set;
+    if (nSelect == SOCKET_ERROR) {
+        int nErr = WSAGetLastError();
+        LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+        // Try to receive from every socket, to find the ones in error.
+        recv_set.insert(recv_select_set.begin(), recv_select_set.end());
+        recv_set.insert(error_select_set.begin(), error_select_set.end());
+        interruptNet.sleep_for(
+            std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+    } else {
+        for (SOCKET hSocket : recv_select_set) {
+            if (FD_ISSET(hSocket, &fdsetRecv)) {
+                recv_set.insert(hSocket);
+            }
+        }
+        for (SOCKET hSocket : send_select_set) {
+            if (FD_ISSET(hSocket, &fdsetSend)) {
+                send_set.insert(hSocket);
+            }
+        }
+        for (SOCKET hSocket : error_select_set) {
+            if (FD_ISSET(hSocket, &fdsetError)) {
+                error_set.insert(hSocket);
+            }
+        }
+    }
+
+    for (const ListenSocket &hListenSocket : vhListenSocket) {
+        if (recv_set.count(hListenSocket.socket) > 0) {
+            listen_set.insert(hListenSocket.socket);
+        }
+    }
+
+    LOCK(cs_vNodes);
+    for (CNode *pnode : vNodes) {
+        NodeEvents ready(pnode);
+        {
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET) {
+                continue;
+            }
+            ready.fRecv = recv_set.count(pnode->hSocket) > 0;
+            ready.fSend = send_set.count(pnode->hSocket) > 0;
+            ready.fError = error_set.count(pnode->hSocket) > 0;
+        }
+        if (ready.fRecv || ready.fSend || ready.fError) {
+            pnode->AddRef();
+            vReady.push_back(ready);
+        }
+    }
+}
+#endif
+
+void CConnman::WakeSocketHandler() {
+#ifdef USE_EPOLL
+    // The write can only fail when the counter is about to overflow, in
+    // which case the handler is being woken up anyway.
+    uint64_t nWake = 1;
+    if (wakeFd != -1) {
+        ssize_t nWritten = write(wakeFd, &nWake, sizeof(nWake));
+        (void)nWritten;
+    }
+#endif
+}
+
+void CConnman::ResumeReceive(CNode *pnode) {
+#ifdef USE_EPOLL
+    LOCK(pnode->cs_vSend);
+    UpdateSocketEvents(pnode);
+#endif
+}
+
+void CConnman::InactivityCheck(CNode *pnode) {
+    int64_t nTime = GetSystemTimeInSeconds();
+    if (nTime - pnode->nTimeConnected > 60) {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
+            LogPrint("net", "socket no message in first 60 seconds, %d "
+                            "%d from %d\n",
+                     pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
+            LogPrintf("socket sending timeout: %is\n",
+                      nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastRecv >
+                   (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL
+                                                      : 90 * 60)) {
+            LogPrintf("socket receive timeout: %is\n",
+                      nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        } else if (pnode->nPingNonceSent &&
+                   pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 <
+                       GetTimeMicros()) {
+            LogPrintf("ping timeout: %fs\n",
+                      0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        } else if (!pnode->fSuccessfullyConnected) {
+            LogPrintf("version handshake timeout from %d\n", pnode->id);
+            pnode->fDisconnect = true;
+        }
+    }
 }
 
 void CConnman::ThreadSocketHandler() {
     unsigned int nPrevNodeCount = 0;
+    int64_t nLastInactivityCheck = 0;
     while (!interruptNet) {
         //
         // Disconnect nodes
@@ -1265,95 +1698,19 @@ void CConnman::ThreadSocketHandler() {
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        // Frequency to poll pnode->vSend
-        timeout.tv_usec = 50000;
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        for (const ListenSocket &hListenSocket : vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
-        {
-            LOCK(cs_vNodes);
-            for (CNode *pnode : vNodes) {
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As
-                // this only happens when optimistic write failed, we choose to
-                // first drain the write buffer in this case before receiving
-                // more. This avoids needlessly queueing received data, if the
-                // remote peer is not themselves receiving data. This means
-                // properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is space left in the receive buffer,
-                // select() for receiving data.
-                // * Hand off all complete messages to the processor, to be
-                // handled without blocking here.
-
-                bool select_recv = !pnode->fPauseRecv;
-                bool select_send;
-                {
-                    LOCK(pnode->cs_vSend);
-                    select_send = !pnode->vSendMsg.empty();
-                }
-
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET) {
-                    continue;
-                }
-
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
-        }
-
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0, &fdsetRecv,
-                             &fdsetSend, &fdsetError, &timeout);
-        if (interruptNet) {
-            return;
-        }
-
-        if (nSelect == SOCKET_ERROR) {
-            if (have_fds) {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++) {
-                    FD_SET(i, &fdsetRecv);
-                }
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(
-                    std::chrono::milliseconds(timeout.tv_usec / 1000))) {
-                return;
-            }
-        }
+        std::set<SOCKET> listen_set;
+        std::vector<NodeEvents> vReady;
+        SocketEvents(listen_set, vReady);
 
         //
         // Accept new connections
         //
         for (const ListenSocket &hListenSocket : vhListenSocket) {
+            if (interruptNet) {
+                break;
+            }
             if (hListenSocket.socket != INVALID_SOCKET &&
-                FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
+                listen_set.count(hListenSocket.socket) > 0) {
                 AcceptConnection(hListenSocket);
             }
         }
@@ -1361,49 +1718,44 @@ void CConnman::ThreadSocketHandler() {
         //
         // Service each socket
         //
-        std::vector<CNode *> vNodesCopy;
-        {
-            LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode *pnode : vNodesCopy) {
-                pnode->AddRef();
-            }
-        }
-        for (CNode *pnode : vNodesCopy) {
+        for (const NodeEvents &ready : vReady) {
             if (interruptNet) {
-                return;
+                break;
             }
+            CNode *pnode = ready.pnode;
 
             //
             // Receive
             //
-            bool recvSet = false;
-            bool sendSet = false;
-            bool errorSet = false;
-            {
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET) {
-                    continue;
-                }
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
-            }
-            if (recvSet || errorSet) {
+            // A hang-up or error is reported whatever the socket waits for,
+            // and is left for when receiving is resumed.
+            if (ready.fRecv || (ready.fError && !pnode->fPauseRecv)) {
                 // typical socket buffer is 8K-64K
                 char pchBuf[0x10000];
+                // The data of a large message is received directly into the
+                // message, rather than copied there from pchBuf. The end of
+                // it still goes through pchBuf, which can take the start of
+                // the next message along with it.
+                unsigned int nInPlace = 0;
+                char *pchInPlace = pnode->GetRecvBuffer(nInPlace);
+                bool fInPlace =
+                    pchInPlace != nullptr && nInPlace >= sizeof(pchBuf);
                 int nBytes = 0;
                 {
                     LOCK(pnode->cs_hSocket);
                     if (pnode->hSocket == INVALID_SOCKET) {
                         continue;
                     }
-                    nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf),
-                                  MSG_DONTWAIT);
+                    nBytes = fInPlace ? recv(pnode->hSocket, pchInPlace,
+                                             nInPlace, MSG_DONTWAIT)
+                                      : recv(pnode->hSocket, pchBuf,
+                                             sizeof(pchBuf), MSG_DONTWAIT);
                 }
                 if (nBytes > 0) {
                     bool notify = false;
-                    if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify)) {
+                    if (fInPlace
+                            ? !pnode->ReceivedMsgBytesInPlace(nBytes, notify)
+                            : !pnode->ReceiveMsgBytes(pchBuf, nBytes, notify)) {
                         pnode->CloseSocketDisconnect();
                     }
                     RecordBytesRecv(nBytes);
@@ -1417,16 +1769,24 @@ void CConnman::ThreadSocketHandler() {
                             nSizeAdded +=
                                 it->vRecv.size() + CMessageHeader::HEADER_SIZE;
                         }
+                        bool fPaused;
                         {
                             LOCK(pnode->cs_vProcessMsg);
                             pnode->vProcessMsg.splice(
                                 pnode->vProcessMsg.end(), pnode->vRecvMsg,
                                 pnode->vRecvMsg.begin(), it);
                             pnode->nProcessQueueSize += nSizeAdded;
-                            pnode->fPauseRecv =
+                            fPaused =
                                 pnode->nProcessQueueSize > nReceiveFloodSize;
+                            pnode->fPauseRecv = fPaused;
                         }
-                        WakeMessageHandler();
+#ifdef USE_EPOLL
+                        if (fPaused) {
+                            LOCK(pnode->cs_vSend);
+                            UpdateSocketEvents(pnode);
+                        }
+#endif
+                        WakeMessageHandler(pnode);
                     }
                 } else if (nBytes == 0) {
                     // socket closed gracefully
@@ -1451,52 +1811,29 @@ void CConnman::ThreadSocketHandler() {
             //
             // Send
             //
-            if (sendSet) {
+            if (ready.fSend) {
                 LOCK(pnode->cs_vSend);
                 size_t nBytes = SocketSendData(pnode);
                 if (nBytes) {
                     RecordBytesSent(nBytes);
                 }
             }
-
-            //
-            // Inactivity checking
-            //
-            int64_t nTime = GetSystemTimeInSeconds();
-            if (nTime - pnode->nTimeConnected > 60) {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
-                    LogPrint("net", "socket no message in first 60 seconds, %d "
-                                    "%d from %d\n",
-                             pnode->nLastRecv != 0, pnode->nLastSend != 0,
-                             pnode->id);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
-                    LogPrintf("socket sending timeout: %is\n",
-                              nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastRecv >
-                           (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL
-                                                              : 90 * 60)) {
-                    LogPrintf("socket receive timeout: %is\n",
-                              nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                } else if (pnode->nPingNonceSent &&
-                           pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 <
-                               GetTimeMicros()) {
-                    LogPrintf("ping timeout: %fs\n",
-                              0.000001 *
-                                  (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                } else if (!pnode->fSuccessfullyConnected) {
-                    LogPrintf("version handshake timeout from %d\n", pnode->id);
-                    pnode->fDisconnect = true;
-                }
-            }
         }
+
+        //
+        // Inactivity checking, which goes by the second
+        //
+        int64_t nTime = GetSystemTimeInSeconds();
         {
             LOCK(cs_vNodes);
-            for (CNode *pnode : vNodesCopy) {
-                pnode->Release();
+            for (const NodeEvents &ready : vReady) {
+                ready.pnode->Release();
+            }
+            if (nTime != nLastInactivityCheck) {
+                nLastInactivityCheck = nTime;
+                for (CNode *pnode : vNodes) {
+                    InactivityCheck(pnode);
+                }
             }
         }
     }
@@ -1505,9 +1842,29 @@ void CConnman::ThreadSocketHandler() {
 void CConnman::WakeMessageHandler() {
     {
         std::lock_guard<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = true;
+        vMsgProcWake.assign(vMsgProcWake.size(), true);
+    }
+    for (std::condition_variable &cond : vMsgProcCond) {
+        cond.notify_one();
     }
-    condMsgProc.notify_one();
+}
+
+void CConnman::WakeMessageHandler(const CNode *pnode) {
+    int nThread;
+    {
+        std::lock_guard<std::mutex> lock(mutexMsgProc);
+        if (vMsgProcWake.empty()) {
+            return;
+        }
+        nThread = GetMessageHandler(pnode);
+        vMsgProcWake[nThread] = true;
+    }
+    vMsgProcCond[nThread].notify_one();
+}
+
+int CConnman::GetMessageHandler(const CNode *pnode) const {
+    // Peers stay on one thread, which keeps their messages in order.
+    return pnode->GetId() % nMessageHandlerThreads;
 }
 
 #ifdef USE_UPNP
@@ -2070,18 +2427,26 @@ bool CConnman::OpenNetworkConnection(const CAddress &addrConnect,
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
+#ifdef USE_EPOLL
+    {
+        LOCK(pnode->cs_vSend);
+        UpdateSocketEvents(pnode);
+    }
+#endif
 
     return true;
 }
 
-void CConnman::ThreadMessageHandler() {
+void CConnman::ThreadMessageHandler(int nThread) {
     while (!flagInterruptMsgProc) {
         std::vector<CNode *> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode *pnode : vNodesCopy) {
-                pnode->AddRef();
+            for (CNode *pnode : vNodes) {
+                if (GetMessageHandler(pnode) == nThread) {
+                    pnode->AddRef();
+                    vNodesCopy.push_back(pnode);
+                }
             }
         }
 
@@ -2120,11 +2485,13 @@ void CConnman::ThreadMessageHandler() {
 
         std::unique_lock<std::mutex> lock(mutexMsgProc);
         if (!fMoreWork) {
-            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() +
-                                             std::chrono::milliseconds(100),
-                                   [this] { return fMsgProcWake; });
+            vMsgProcCond[nThread].wait_until(
+                lock,
+                std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(100),
+                [this, nThread] { return vMsgProcWake[nThread]; });
         }
-        fMsgProcWake = false;
+        vMsgProcWake[nThread] = false;
     }
 }
 
@@ -2333,6 +2700,11 @@ CConnman::CConnman(const Config &configIn, uint64_t nSeed0In, uint64_t nSeed1In)
     nBestHeight = 0;
     clientInterface = nullptr;
     flagInterruptMsgProc = false;
+    nMessageHandlerThreads = DEFAULT_MESSAGE_HANDLER_THREADS;
+#ifdef USE_EPOLL
+    epollFd = -1;
+    wakeFd = -1;
+#endif
 }
 
 NodeId CConnman::GetNewNodeId() {
@@ -2352,6 +2724,7 @@ bool CConnman::Start(CScheduler &scheduler, std::string &strNodeError,
     nMaxOutbound = std::min((connOptions.nMaxOutbound), nMaxConnections);
     nMaxAddnode = connOptions.nMaxAddnode;
     nMaxFeeler = connOptions.nMaxFeeler;
+    nMessageHandlerThreads = std::max(connOptions.nMessageHandlerThreads, 1);
 
     nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
     nReceiveFloodSize = connOptions.nReceiveFloodSize;
@@ -2418,6 +2791,36 @@ bool CConnman::Start(CScheduler &scheduler, std::string &strNodeError,
         semAddnode = new CSemaphore(nMaxAddnode);
     }
 
+#ifdef USE_EPOLL
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epollFd == -1 || wakeFd == -1) {
+        strNodeError = strprintf("Failed to set up epoll: %s",
+                                 NetworkErrorString(errno));
+        return false;
+    }
+    {
+        // Node sockets point to their node, see SocketEvents.
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        bool fRegistered =
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event) == 0;
+        for (ListenSocket &hListenSocket : vhListenSocket) {
+            event.data.ptr = &hListenSocket;
+            fRegistered = fRegistered &&
+                          epoll_ctl(epollFd, EPOLL_CTL_ADD,
+                                    hListenSocket.socket, &event) == 0;
+        }
+        if (!fRegistered) {
+            strNodeError =
+                strprintf("Failed to register sockets with epoll: %s",
+                          NetworkErrorString(errno));
+            return false;
+        }
+    }
+#endif
+
     //
     // Start threads
     //
@@ -2427,7 +2830,11 @@ bool CConnman::Start(CScheduler &scheduler, std::string &strNodeError,
 
     {
         std::unique_lock<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = false;
+        vMsgProcWake.assign(nMessageHandlerThreads, false);
+        // Condition variables cannot be moved, so the vector is replaced
+        // rather than resized. No handler thread is running yet.
+        vMsgProcCond = std::vector<std::condition_variable>(
+            nMessageHandlerThreads);
     }
 
     // Send and receive from sockets, accept connections
@@ -2460,11 +2867,13 @@ bool CConnman::Start(CScheduler &scheduler, std::string &strNodeError,
                             std::bind(&CConnman::ThreadOpenConnections, this)));
     }
 
-    // Process messages
-    threadMessageHandler =
-        std::thread(&TraceThread<std::function<void()>>, "msghand",
-                    std::function<void()>(
-                        std::bind(&CConnman::ThreadMessageHandler, this)));
+    // Process messages, with the peers spread over the threads
+    for (int i = 0; i < nMessageHandlerThreads; i++) {
+        threadMessageHandlers.emplace_back(
+            &TraceThread<std::function<void()>>, "msghand",
+            std::function<void()>(
+                std::bind(&CConnman::ThreadMessageHandler, this, i)));
+    }
 
     // Dump network addresses
     scheduler.scheduleEvery(boost::bind(&CConnman::DumpData, this),
@@ -2490,9 +2899,12 @@ void CConnman::Interrupt() {
         std::lock_guard<std::mutex> lock(mutexMsgProc);
         flagInterruptMsgProc = true;
     }
-    condMsgProc.notify_all();
+    for (std::condition_variable &cond : vMsgProcCond) {
+        cond.notify_one();
+    }
 
     interruptNet();
+    WakeSocketHandler();
     InterruptSocks5(true);
 
     if (semOutbound) {
@@ -2509,9 +2921,12 @@ void CConnman::Interrupt() {
 }
 
 void CConnman::Stop() {
-    if (threadMessageHandler.joinable()) {
-        threadMessageHandler.join();
+    for (std::thread &threadMessageHandler : threadMessageHandlers) {
+        if (threadMessageHandler.joinable()) {
+            threadMessageHandler.join();
+        }
     }
+    threadMessageHandlers.clear();
     if (threadOpenConnections.joinable()) {
         threadOpenConnections.join();
     }
@@ -2553,6 +2968,16 @@ void CConnman::Stop() {
     vNodes.clear();
     vNodesDisconnected.clear();
     vhListenSocket.clear();
+#ifdef USE_EPOLL
+    if (epollFd != -1) {
+        close(epollFd);
+        epollFd = -1;
+    }
+    if (wakeFd != -1) {
+        close(wakeFd);
+        wakeFd = -1;
+    }
+#endif
     delete semOutbound;
     semOutbound = nullptr;
     delete semAddnode;
@@ -2566,6 +2991,13 @@ void CConnman::DeleteNode(CNode *pnode) {
     if (fUpdateConnectionTime) {
         addrman.Connected(pnode->addr);
     }
+    // Keep the message accounting of the peer in the getnetstats totals.
+    CNodeStats stats;
+    pnode->copyStats(stats);
+    {
+        LOCK(cs_disconnectedMsgStats);
+        disconnectedMsgStats.Add(stats);
+    }
     delete pnode;
 }
 
@@ -2653,6 +3085,11 @@ void CConnman::GetNodeStats(std::vector<CNodeStats> &vstats) {
     }
 }
 
+CNetMsgStats CConnman::GetDisconnectedMsgStats() {
+    LOCK(cs_disconnectedMsgStats);
+    return disconnectedMsgStats;
+}
+
 bool CConnman::DisconnectNode(const std::string &strNode) {
     LOCK(cs_vNodes);
     if (CNode *pnode = FindNode(strNode)) {
@@ -2804,6 +3241,9 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn,
     nServices = NODE_NONE;
     nServicesExpected = NODE_NONE;
     hSocket = hSocketIn;
+#ifdef USE_EPOLL
+    nEpollEvents = 0;
+#endif
     nRecvVersion = INIT_PROTO_VERSION;
     nLastSend = 0;
     nLastRecv = 0;
@@ -2852,8 +3292,12 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn,
 
     for (const std::string &msg : getAllNetMessageTypes()) {
         mapRecvBytesPerMsgCmd[msg] = 0;
+        mapRecvMsgsPerMsgCmd[msg] = 0;
+        mapProcessStatsPerMsgCmd[msg] = CMsgProcessStats();
     }
     mapRecvBytesPerMsgCmd[NET_MESSAGE_COMMAND_OTHER] = 0;
+    mapRecvMsgsPerMsgCmd[NET_MESSAGE_COMMAND_OTHER] = 0;
+    mapProcessStatsPerMsgCmd[NET_MESSAGE_COMMAND_OTHER] = CMsgProcessStats();
 
     if (fLogIPs) {
         LogPrint("net", "Added connection to %s peer=%d\n", addrName, id);
@@ -2938,6 +3382,7 @@ void CConnman::PushMessage(CNode *pnode, CSerializedNetMsg &&msg) {
 
         // log total amount of bytes per command
         pnode->mapSendBytesPerMsgCmd[msg.command] += nTotalSize;
+        pnode->mapSendMsgsPerMsgCmd[msg.command]++;
         pnode->nSendSize += nTotalSize;
 
         if (pnode->nSendSize > nSendBufferMaxSize) {
@@ -28,6 +28,7 @@
 #include <cstdint>
 #include <deque>
 #include <memory>
+#include <set>
 #include <thread>
 
 #ifndef WIN32
@@ -81,6 +82,13 @@ static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 static const size_t SETASKFOR_MAX_SZ = 2 * MAX_INV_SZ;
 /** The maximum number of peer connections to maintain. */
 static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 125;
+/**
+ * Default for -msghandlerthreads, the number of threads processing peer
+ * messages. Each peer is handled by one of them.
+ */
+static const int DEFAULT_MESSAGE_HANDLER_THREADS = 1;
+/** Maximum number of message handler threads */
+static const int MAX_MESSAGE_HANDLER_THREADS = 16;
 /** The default for -maxuploadtarget. 0 = Unlimited */
 static const uint64_t DEFAULT_MAX_UPLOAD_TARGET = 0;
 /** The default timeframe for -maxuploadtarget. 1 day. */
@@ -126,6 +134,47 @@ struct CSerializedNetMsg {
     std::string command;
 };
 
+// Command, total bytes
+typedef std::map<std::string, uint64_t> mapMsgCmdSize;
+
+/**
+ * Time spent processing messages: how many were processed, the microseconds
+ * spent on them and waiting for cs_main meanwhile, and a histogram of how
+ * long each one took. For SendMessages, which does not wait for cs_main,
+ * nSkipped counts the calls that gave up because cs_main was busy instead;
+ * they are left out of the other fields.
+ */
+struct CMsgProcessStats {
+    static const int HISTOGRAM_BUCKETS = 7;
+    //! Upper bounds in microseconds of the buckets, but the last unbounded one
+    static const int64_t HISTOGRAM_BOUNDS[HISTOGRAM_BUCKETS - 1];
+
+    uint64_t nCount;
+    int64_t nMicros;
+    int64_t nLockWaitMicros;
+    uint64_t nSkipped;
+    uint64_t histogram[HISTOGRAM_BUCKETS];
+
+    CMsgProcessStats();
+    void Add(int64_t nMicrosIn, int64_t nLockWaitMicrosIn);
+    CMsgProcessStats &operator+=(const CMsgProcessStats &other);
+};
+
+// Command, processing statistics
+typedef std::map<std::string, CMsgProcessStats> mapMsgCmdProcessStats;
+
+/** Message accounting added up over peers, see getnetstats. */
+struct CNetMsgStats {
+    mapMsgCmdSize mapSendBytesPerMsgCmd;
+    mapMsgCmdSize mapSendMsgsPerMsgCmd;
+    mapMsgCmdSize mapRecvBytesPerMsgCmd;
+    mapMsgCmdSize mapRecvMsgsPerMsgCmd;
+    mapMsgCmdProcessStats mapProcessStatsPerMsgCmd;
+    CMsgProcessStats sendMessagesStats;
+
+    void Add(const CNodeStats &stats);
+};
+
 class CConnman {
 public:
     enum NumConnections {
@@ -148,6 +197,7 @@ public:
         unsigned int nReceiveFloodSize = 0;
         uint64_t nMaxOutboundTimeframe = 0;
         uint64_t nMaxOutboundLimit = 0;
+        int nMessageHandlerThreads = DEFAULT_MESSAGE_HANDLER_THREADS;
     };
     CConnman(const Config &configIn, uint64_t seed0, uint64_t seed1);
     ~CConnman();
@@ -243,6 +293,8 @@ public:
 
     size_t GetNodeCount(NumConnections num);
     void GetNodeStats(std::vector<CNodeStats> &vstats);
+    /** Message accounting of the peers which have been disconnected. */
+    CNetMsgStats GetDisconnectedMsgStats();
     bool DisconnectNode(const std::string &node);
     bool DisconnectNode(NodeId id);
 
@@ -285,7 +337,17 @@ public:
 
     unsigned int GetReceiveFloodSize() const;
 
+    /** Wake up all message handler threads. */
     void WakeMessageHandler();
+    /** Wake up the message handler thread which processes pnode. */
+    void WakeMessageHandler(const CNode *pnode);
+    /**
+     * Interrupt the socket handler's wait. Only epoll supports this; select()
+     * is woken up by its timeout.
+     */
+    void WakeSocketHandler();
+    /** Have the socket handler receive from pnode again after a pause. */
+    void ResumeReceive(CNode *pnode);
 
 private:
     struct ListenSocket {
@@ -299,8 +361,40 @@ private:
     void ThreadOpenAddedConnections();
     void ProcessOneShot();
     void ThreadOpenConnections();
-    void ThreadMessageHandler();
+    void ThreadMessageHandler(int nThread);
+    int GetMessageHandler(const CNode *pnode) const;
     void AcceptConnection(const ListenSocket &hListenSocket);
+    //! A node whose socket is ready, and what for.
+    struct NodeEvents {
+        CNode *pnode;
+        bool fRecv;
+        bool fSend;
+        bool fError;
+
+        explicit NodeEvents(CNode *pnodeIn)
+            : pnode(pnodeIn), fRecv(false), fSend(false), fError(false) {}
+    };
+
+#ifdef USE_EPOLL
+    /**
+     * Register the events the socket handler waits for on the socket of
+     * pnode, after what it has to send or whether receiving is paused
+     * changed. Requires pnode->cs_vSend.
+     */
+    void UpdateSocketEvents(CNode *pnode) const;
+#else
+    bool GenerateSelectSet(std::set<SOCKET> &recv_set,
+                           std::set<SOCKET> &send_set,
+                           std::set<SOCKET> &error_set);
+#endif
+    /**
+     * Wait for sockets to be ready. The listening sockets with a connection
+     * to accept go to listen_set, the nodes with a ready socket to vReady,
+     * each with a reference taken.
+     */
+    void SocketEvents(std::set<SOCKET> &listen_set,
+                      std::vector<NodeEvents> &vReady);
+    void InactivityCheck(CNode *pnode);
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
 
@@ -361,6 +455,8 @@ private:
     unsigned int nReceiveFloodSize;
 
     std::vector<ListenSocket> vhListenSocket;
+    CNetMsgStats disconnectedMsgStats;
+    CCriticalSection cs_disconnectedMsgStats;
     std::atomic<bool> fNetworkActive;
     banmap_t setBanned;
     CCriticalSection cs_setBanned;
@@ -394,20 +490,34 @@ private:
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor. */
-    bool fMsgProcWake;
+    /** flags for waking each message processor, guarded by mutexMsgProc. */
+    std::vector<bool> vMsgProcWake;
+    /**
+     * Condition variable each message processor waits on, so that waking one
+     * of them does not wake the others.
+     */
+    std::vector<std::condition_variable> vMsgProcCond;
+    int nMessageHandlerThreads;
 
-    std::condition_variable condMsgProc;
     std::mutex mutexMsgProc;
     std::atomic<bool> flagInterruptMsgProc;
 
     CThreadInterrupt interruptNet;
 
+#ifdef USE_EPOLL
+    /**
+     * epoll instance the sockets are registered with, and the eventfd used to
+     * wake it up.
+     */
+    int epollFd;
+    int wakeFd;
+#endif
+
     std::thread threadDNSAddressSeed;
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
+    std::vector<std::thread> threadMessageHandlers;
 };
 extern std::unique_ptr<CConnman> g_connman;
 void Discover(boost::thread_group &threadGroup);
@@ -492,9 +602,6 @@ struct LocalServiceInfo {
 extern CCriticalSection cs_mapLocalHost;
 extern std::map<CNetAddr, LocalServiceInfo> mapLocalHost;
 
-// Command, total bytes
-typedef std::map<std::string, uint64_t> mapMsgCmdSize;
-
 class CNodeStats {
 public:
     NodeId nodeid;
@@ -514,6 +621,14 @@ public:
     mapMsgCmdSize mapSendBytesPerMsgCmd;
     uint64_t nRecvBytes;
     mapMsgCmdSize mapRecvBytesPerMsgCmd;
+    mapMsgCmdSize mapSendMsgsPerMsgCmd;
+    mapMsgCmdSize mapRecvMsgsPerMsgCmd;
+    mapMsgCmdProcessStats mapProcessStatsPerMsgCmd;
+    CMsgProcessStats sendMessagesStats;
+    size_t nProcessQueueMsgs;
+    size_t nProcessQueueSize;
+    size_t nSendQueueMsgs;
+    size_t nSendQueueSize;
     bool fWhitelisted;
     double dPingTime;
     double dPingWait;
@@ -572,6 +687,15 @@ public:
 
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
+
+    /**
+     * Make room in vRecv for the next bytes of the message data, and return
+     * where they go so that they can be received in place. nBytes is set to
+     * how many of them fit there.
+     */
+    char *GetDataBuffer(unsigned int &nBytes);
+    /** Take in nBytes of message data received at GetDataBuffer(). */
+    void ReceivedData(unsigned int nBytes);
 };
 
 /** Information about a peer */
@@ -584,6 +708,10 @@ public:
     // Services expected from a peer, otherwise it will be disconnected
     ServiceFlags nServicesExpected;
     SOCKET hSocket;
+#ifdef USE_EPOLL
+    // Events hSocket is registered for with epoll, 0 if it is not registered.
+    uint32_t nEpollEvents;
+#endif
     // Total size of all vSendMsg entries.
     size_t nSendSize;
     // Offset inside the first vSendMsg already sent.
@@ -649,15 +777,26 @@ public:
 
 protected:
     mapMsgCmdSize mapSendBytesPerMsgCmd;
+    mapMsgCmdSize mapSendMsgsPerMsgCmd;
     mapMsgCmdSize mapRecvBytesPerMsgCmd;
+    mapMsgCmdSize mapRecvMsgsPerMsgCmd;
+    // Time spent processing each message type and in SendMessages, guarded
+    // by cs_vProcessMsg.
+    mapMsgCmdProcessStats mapProcessStatsPerMsgCmd;
+    CMsgProcessStats sendMessagesStats;
+
+    void RecordRecvMsg(CNetMessage &msg, int64_t nTimeMicros);
 
 public:
     uint256 hashContinue;
     std::atomic<int> nStartingHeight;
 
     // flood relay
+    // vAddrToSend and addrKnown are guarded by cs_addrKnown, as addresses are
+    // relayed to this node from the threads processing the other peers.
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
+    CCriticalSection cs_addrKnown;
     bool fGetAddr;
     std::set<uint256> setKnown;
     int64_t nNextAddrSend;
@@ -743,6 +882,25 @@ public:
     }
 
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool &complete);
+    /**
+     * Where the data of the message being received can be received directly,
+     * and how many bytes fit there. Returns nullptr when the next bytes do not
+     * belong to the data of a message, but to a header.
+     */
+    char *GetRecvBuffer(unsigned int &nBytes);
+    /** As ReceiveMsgBytes, for nBytes received at GetRecvBuffer(). */
+    bool ReceivedMsgBytesInPlace(unsigned int nBytes, bool &complete);
+    /**
+     * Account nMicros of processing time to a received message type, of which
+     * nLockWaitMicros were spent waiting for cs_main.
+     */
+    void RecordProcessTime(const std::string &strCommand, int64_t nMicros,
+                           int64_t nLockWaitMicros);
+    /**
+     * As RecordProcessTime, for a call to SendMessages, or only count it as
+     * skipped if it gave up because cs_main was busy.
+     */
+    void RecordSendMessagesTime(int64_t nMicros, bool fSkipped);
 
     void SetRecvVersion(int nVersionIn) { nRecvVersion = nVersionIn; }
     int GetRecvVersion() { return nRecvVersion; }
@@ -761,10 +919,12 @@ public:
     void Release() { nRefCount--; }
 
     void AddAddressKnown(const CAddress &_addr) {
+        LOCK(cs_addrKnown);
         addrKnown.insert(_addr.GetKey());
     }
 
     void PushAddress(const CAddress &_addr, FastRandomContext &insecure_rand) {
+        LOCK(cs_addrKnown);
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
@@ -544,6 +544,19 @@ bool PeerHasHeader(CNodeState *state, const CBlockIndex *pindex) {
     return false;
 }
 
+/**
+ * Append the header of pindex to vHeaders, failing if its solution cannot be
+ * found. A header without its solution must never be sent.
+ */
+bool AddBlockHeader(const CBlockIndex *pindex, std::vector<CBlock> &vHeaders) {
+    CBlockHeader header;
+    if (!pindex->GetBlockHeader(header)) {
+        return false;
+    }
+    vHeaders.push_back(header);
+    return true;
+}
+
 /**
  * Find the last common ancestor two blocks have.
  * Both pa and pb must be non null.
@@ -635,7 +648,8 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count,
         // the ones that are not yet downloaded and not in flight to vBlocks. In
         // the mean time, update pindexLastCommonBlock as long as all ancestors
         // are already downloaded, or if it's already part of our chain (and
-        // therefore don't need it even if pruned).
+        // therefore don't need it even if pruned, or loaded from a UTXO
+        // snapshot).
         for (const CBlockIndex *pindex : vToFetch) {
             if (!pindex->IsValid(BLOCK_VALID_TREE)) {
                 // We consider the chain that this peer is on invalid.
@@ -643,7 +657,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count,
             }
             if (pindex->nStatus & BLOCK_HAVE_DATA ||
                 chainActive.Contains(pindex)) {
-                if (pindex->nChainTx) {
+                if (pindex->nChainTx || chainActive.Contains(pindex)) {
                     state->pindexLastCommonBlock = pindex;
                 }
             } else if (mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
@@ -1140,7 +1154,7 @@ static void ProcessGetData(const Config &config, CNode *pfrom,
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
     std::vector<CInv> vNotFound;
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
-    LOCK(cs_main);
+    LOCK_TIMED(cs_main);
 
     while (it != pfrom->vRecvGetData.end()) {
         // Don't bother if send buffer is too full to respond anyway.
@@ -1229,13 +1243,26 @@ static void ProcessGetData(const Config &config, CNode *pfrom,
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
                     // Send block from disk
+                    int legacyFlag = (pfrom->IsLegacyBlockHeader(pfrom->GetSendVersion()) ? SERIALIZE_BLOCK_LEGACY : 0);
+                    // Blocks are stored in the format peers expect unless
+                    // they need the legacy one, so forward the bytes as they
+                    // are without deserializing the block.
+                    const bool fRaw = inv.type == MSG_BLOCK && !legacyFlag;
                     CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, config)) {
+                    if (!fRaw &&
+                        !ReadBlockFromDisk(block, (*mi).second, config)) {
                         assert(!"cannot load block from disk");
                     }
-                    int legacyFlag = (pfrom->IsLegacyBlockHeader(pfrom->GetSendVersion()) ? SERIALIZE_BLOCK_LEGACY : 0);
 
-                    if (inv.type == MSG_BLOCK) {
+                    if (fRaw) {
+                        CRawBlock rawBlock;
+                        if (!ReadRawBlockFromDisk(rawBlock, (*mi).second,
+                                                  config)) {
+                            assert(!"cannot load block from disk");
+                        }
+                        connman.PushMessage(
+                            pfrom, msgMaker.Make(NetMsgType::BLOCK, rawBlock));
+                    } else if (inv.type == MSG_BLOCK) {
                         connman.PushMessage(
                             pfrom, msgMaker.Make(legacyFlag,NetMsgType::BLOCK, block));
                     } else if (inv.type == MSG_FILTERED_BLOCK) {
@@ -1279,9 +1306,10 @@ static void ProcessGetData(const Config &config, CNode *pfrom,
                         // guaranteed they won't have a useful mempool to match
                         // against a compact block, and we don't feel like
                         // constructing the object for them, so instead we
-                        // respond with the full, non-compact block.
+                        // respond with the full, non-compact block. The same
+                        // goes for peers that use the legacy block header.
                         int nSendFlags = 0|legacyFlag;
-                        if (CanDirectFetch(consensusParams) &&
+                        if (!legacyFlag && CanDirectFetch(consensusParams) &&
                             mi->second->nHeight >=
                                 chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
                             CBlockHeaderAndShortTxIDs cmpctblock(block);
@@ -1376,7 +1404,7 @@ inline static void SendBlockTransactions(const CBlock &block,
     BlockTransactions resp(req);
     for (size_t i = 0; i < req.indexes.size(); i++) {
         if (req.indexes[i] >= block.vtx.size()) {
-            LOCK(cs_main);
+            LOCK_TIMED(cs_main);
             Misbehaving(pfrom, 100, "out-of-bound-tx-index");
             LogPrintf(
                 "Peer %d sent us a getblocktxn with out-of-bounds tx indices",
@@ -1385,7 +1413,7 @@ inline static void SendBlockTransactions(const CBlock &block,
         }
         resp.txn[i] = block.vtx[req.indexes[i]];
     }
-    LOCK(cs_main);
+    LOCK_TIMED(cs_main);
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
     int nSendFlags = 0;
     connman.PushMessage(pfrom,
@@ -1409,7 +1437,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         (strCommand == NetMsgType::FILTERLOAD ||
          strCommand == NetMsgType::FILTERADD)) {
         if (pfrom->nVersion >= NO_BLOOM_VERSION) {
-            LOCK(cs_main);
+            LOCK_TIMED(cs_main);
             Misbehaving(pfrom, 100, "no-bloom-version");
             return false;
         } else {
@@ -1453,7 +1481,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
                 CNetMsgMaker(INIT_PROTO_VERSION)
                     .Make(NetMsgType::REJECT, strCommand, REJECT_DUPLICATE,
                           std::string("Duplicate version message")));
-            LOCK(cs_main);
+            LOCK_TIMED(cs_main);
             Misbehaving(pfrom, 1, "multiple-version");
             return false;
         }
@@ -1559,7 +1587,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
 
         // Potentially mark this peer as a preferred download peer.
         {
-            LOCK(cs_main);
+            LOCK_TIMED(cs_main);
             UpdatePreferredDownload(pfrom, State(pfrom->GetId()));
         }
 
@@ -1633,7 +1661,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
 
     else if (pfrom->nVersion == 0) {
         // Must have a version message before anything else
-        LOCK(cs_main);
+        LOCK_TIMED(cs_main);
         Misbehaving(pfrom, 1, "missing-version");
         return false;
     }
@@ -1648,7 +1676,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         if (!pfrom->fInbound) {
             // Mark this node as currently connected, so we update its timestamp
             // later.
-            LOCK(cs_main);
+            LOCK_TIMED(cs_main);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
 
@@ -1659,7 +1687,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             // nodes)
             connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDHEADERS));
         }
-        if (pfrom->nVersion >= SHORT_IDS_BLOCKS_VERSION  && !DISABLE_CMPCTBLOCK) {
+        if (pfrom->nVersion >= CMPCTBLOCK_VERSION) {
             // Tell our peer we are willing to provide version 1 or 2
             // cmpctblocks. However, we do not request new block announcements
             // using cmpctblock messages. We send this to non-NODE NETWORK peers
@@ -1675,7 +1703,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
 
     else if (!pfrom->fSuccessfullyConnected) {
         // Must have a verack message before anything else
-        LOCK(cs_main);
+        LOCK_TIMED(cs_main);
         Misbehaving(pfrom, 1, "missing-verack");
         return false;
     }
@@ -1690,7 +1718,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             return true;
         }
         if (vAddr.size() > 1000) {
-            LOCK(cs_main);
+            LOCK_TIMED(cs_main);
             Misbehaving(pfrom, 20, "oversized-addr");
             return error("message addr size() = %u", vAddr.size());
         }
@@ -1733,42 +1761,43 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
     }
 
     else if (strCommand == NetMsgType::SENDHEADERS) {
-        LOCK(cs_main);
+        LOCK_TIMED(cs_main);
         State(pfrom->GetId())->fPreferHeaders = true;
     }
 
     else if (strCommand == NetMsgType::SENDCMPCT) {
-
-        if (DISABLE_CMPCTBLOCK) {
-            LogPrint("net", "Ignoring command \"%s\" from peer=%d because SENDCMPCT is temporarily disabled\n",
-                     SanitizeString(strCommand), pfrom->GetId());
+        if (pfrom->nVersion < CMPCTBLOCK_VERSION) {
+            // The peer would read our compact blocks with the legacy header.
+            LogPrint("net", "Ignoring sendcmpct from peer=%d, which uses the "
+                            "legacy block header format\n",
+                     pfrom->id);
+            return true;
         }
-        else {
-            bool fAnnounceUsingCMPCTBLOCK = false;
-            uint64_t nCMPCTBLOCKVersion = 0;
-            vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
-            if (nCMPCTBLOCKVersion == 1) {
-                LOCK(cs_main);
-                // fProvidesHeaderAndIDs is used to "lock in" version of compact
-                // blocks we send.
-                if (!State(pfrom->GetId())->fProvidesHeaderAndIDs) {
-                    State(pfrom->GetId())->fProvidesHeaderAndIDs = true;
-                }
 
-                State(pfrom->GetId())->fPreferHeaderAndIDs =
-                    fAnnounceUsingCMPCTBLOCK;
-                if (!State(pfrom->GetId())->fSupportsDesiredCmpctVersion) {
-                    State(pfrom->GetId())->fSupportsDesiredCmpctVersion = true;
-                }
-             }
-         }
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        if (nCMPCTBLOCKVersion == 1) {
+            LOCK_TIMED(cs_main);
+            // fProvidesHeaderAndIDs is used to "lock in" version of compact
+            // blocks we send.
+            if (!State(pfrom->GetId())->fProvidesHeaderAndIDs) {
+                State(pfrom->GetId())->fProvidesHeaderAndIDs = true;
+            }
+
+            State(pfrom->GetId())->fPreferHeaderAndIDs =
+                fAnnounceUsingCMPCTBLOCK;
+            if (!State(pfrom->GetId())->fSupportsDesiredCmpctVersion) {
+                State(pfrom->GetId())->fSupportsDesiredCmpctVersion = true;
+            }
+        }
     }
 
     else if (strCommand == NetMsgType::INV) {
         std::vector<CInv> vInv;
         vRecv >> vInv;
         if (vInv.size() > MAX_INV_SZ) {
-            LOCK(cs_main);
+            LOCK_TIMED(cs_main);
             Misbehaving(pfrom, 20, "oversized-inv");
             return error("message inv size() = %u", vInv.size());
         }
@@ -1782,7 +1811,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             fBlocksOnly = false;
         }
 
-        LOCK(cs_main);
+        LOCK_TIMED(cs_main);
 
         uint32_t nFetchFlags =
             GetFetchFlags(pfrom, chainActive.Tip(), chainparams.GetConsensus());
@@ -1850,7 +1879,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         std::vector<CInv> vInv;
         vRecv >> vInv;
         if (vInv.size() > MAX_INV_SZ) {
-            LOCK(cs_main);
+            LOCK_TIMED(cs_main);
             Misbehaving(pfrom, 20, "too-many-inv");
             return error("message getdata size() = %u", vInv.size());
         }
@@ -1893,7 +1922,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             ActivateBestChain(config, dummy, a_recent_block);
         }
 
-        LOCK(cs_main);
+        LOCK_TIMED(cs_main);
 
         // Find the last block the caller has in the main chain
         const CBlockIndex *pindex = FindForkInGlobalIndex(chainActive, locator);
@@ -1958,7 +1987,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             return true;
         }
 
-        LOCK(cs_main);
+        LOCK_TIMED(cs_main);
 
         BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
         if (it == mapBlockIndex.end() ||
@@ -2000,57 +2029,77 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         uint256 hashStop;
         vRecv >> locator >> hashStop;
 
-        LOCK(cs_main);
-        if (IsInitialBlockDownload() && !pfrom->fWhitelisted) {
-            LogPrint("net", "Ignoring getheaders from peer=%d because node is "
-                            "in initial block download\n",
-                     pfrom->id);
-            return true;
-        }
-
-        CNodeState *nodestate = State(pfrom->GetId());
-        const CBlockIndex *pindex = nullptr;
-        if (locator.IsNull()) {
-            // If locator is null, return the hashStop block
-            BlockMap::iterator mi = mapBlockIndex.find(hashStop);
-            if (mi == mapBlockIndex.end()) {
+        std::vector<const CBlockIndex *> vIndex;
+        const CBlockIndex *pindexBestHeaderSent = nullptr;
+        {
+            LOCK_TIMED(cs_main);
+            if (IsInitialBlockDownload() && !pfrom->fWhitelisted) {
+                LogPrint("net", "Ignoring getheaders from peer=%d because "
+                                "node is in initial block download\n",
+                         pfrom->id);
                 return true;
             }
-            pindex = (*mi).second;
-        } else {
-            // Find the last block the caller has in the main chain
-            pindex = FindForkInGlobalIndex(chainActive, locator);
-            if (pindex) {
-                pindex = chainActive.Next(pindex);
+
+            const CBlockIndex *pindex = nullptr;
+            if (locator.IsNull()) {
+                // If locator is null, return the hashStop block
+                BlockMap::iterator mi = mapBlockIndex.find(hashStop);
+                if (mi == mapBlockIndex.end()) {
+                    return true;
+                }
+                pindex = (*mi).second;
+            } else {
+                // Find the last block the caller has in the main chain
+                pindex = FindForkInGlobalIndex(chainActive, locator);
+                if (pindex) {
+                    pindex = chainActive.Next(pindex);
+                }
             }
+
+            int nLimit = MAX_HEADERS_RESULTS;
+            LogPrint("net", "getheaders %d to %s from peer=%d\n",
+                     (pindex ? pindex->nHeight : -1),
+                     hashStop.IsNull() ? "end" : hashStop.ToString(),
+                     pfrom->id);
+            for (; pindex; pindex = chainActive.Next(pindex)) {
+                vIndex.push_back(pindex);
+                if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop) {
+                    break;
+                }
+            }
+            // pindex can be nullptr either if we sent chainActive.Tip() OR
+            // if our peer has chainActive.Tip() (and thus we are sending an
+            // empty headers message). In both cases it's safe to update
+            // pindexBestHeaderSent to be our tip.
+            pindexBestHeaderSent = pindex ? pindex : chainActive.Tip();
         }
 
+        // Most of the solutions are read from the block tree database, so do
+        // that after releasing cs_main. A header is never sent without its
+        // solution.
+        std::vector<CBlockHeader> vSolvedHeaders;
+        if (!GetBlockHeaders(vIndex, vSolvedHeaders)) {
+            return error("getheaders from peer=%d: cannot read the headers",
+                         pfrom->id);
+        }
+        {
+            // Only record the headers as sent once they can be, so that
+            // SendMessages still announces the blocks otherwise.
+            //
+            // It is important that we simply reset the BestHeaderSent value
+            // here, and not max(BestHeaderSent, newHeaderSent). We might have
+            // announced the currently-being-connected tip using a compact
+            // block, which resulted in the peer sending a headers request,
+            // which we respond to without the new block. By resetting the
+            // BestHeaderSent, we ensure we will re-announce the new block via
+            // headers (or compact blocks again) in the SendMessages logic.
+            LOCK_TIMED(cs_main);
+            State(pfrom->GetId())->pindexBestHeaderSent = pindexBestHeaderSent;
+        }
         // we must use CBlocks, as CBlockHeaders won't include the 0x00 nTx
         // count at the end
-        std::vector<CBlock> vHeaders;
-        int nLimit = MAX_HEADERS_RESULTS;
-        LogPrint("net", "getheaders %d to %s from peer=%d\n",
-                 (pindex ? pindex->nHeight : -1),
-                 hashStop.IsNull() ? "end" : hashStop.ToString(), pfrom->id);
-        for (; pindex; pindex = chainActive.Next(pindex)) {
-            vHeaders.push_back(pindex->GetBlockHeader());
-            if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop) {
-                break;
-            }
-        }
-        // pindex can be nullptr either if we sent chainActive.Tip() OR
-        // if our peer has chainActive.Tip() (and thus we are sending an empty
-        // headers message). In both cases it's safe to update
-        // pindexBestHeaderSent to be our tip.
-        //
-        // It is important that we simply reset the BestHeaderSent value here,
-        // and not max(BestHeaderSent, newHeaderSent). We might have announced
-        // the currently-being-connected tip using a compact block, which
-        // resulted in the peer sending a headers request, which we respond to
-        // without the new block. By resetting the BestHeaderSent, we ensure we
-        // will re-announce the new block via headers (or compact blocks again)
-        // in the SendMessages logic.
-        nodestate->pindexBestHeaderSent = pindex ? pindex : chainActive.Tip();
+        std::vector<CBlock> vHeaders(vSolvedHeaders.begin(),
+                                     vSolvedHeaders.end());
         int legacyFlag = pfrom->IsLegacyBlockHeader(pfrom->GetSendVersion()) ? SERIALIZE_BLOCK_LEGACY : 0;
 
         connman.PushMessage(pfrom,
@@ -2079,7 +2128,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         CInv inv(MSG_TX, tx.GetId());
         pfrom->AddInventoryKnown(inv);
 
-        LOCK(cs_main);
+        LOCK_TIMED(cs_main);
 
         bool fMissingInputs = false;
         CValidationState state;
@@ -2276,11 +2325,19 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
 
     // Ignore blocks received while importing
     else if (strCommand == NetMsgType::CMPCTBLOCK && !fImporting && !fReindex) {
+        if (pfrom->nVersion < CMPCTBLOCK_VERSION) {
+            // We never asked for it, and its header cannot be read.
+            LogPrint("net", "Ignoring cmpctblock from peer=%d, which uses the "
+                            "legacy block header format\n",
+                     pfrom->id);
+            return true;
+        }
+
         CBlockHeaderAndShortTxIDs cmpctblock;
         vRecv >> cmpctblock;
 
         {
-            LOCK(cs_main);
+            LOCK_TIMED(cs_main);
 
             if (mapBlockIndex.find(cmpctblock.header.hashPrevBlock) ==
                 mapBlockIndex.end()) {
@@ -2304,7 +2361,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             int nDoS;
             if (state.IsInvalid(nDoS)) {
                 if (nDoS > 0) {
-                    LOCK(cs_main);
+                    LOCK_TIMED(cs_main);
                     Misbehaving(pfrom, nDoS, state.GetRejectReason());
                 }
                 LogPrintf("Peer %d sent us invalid header via cmpctblock\n",
@@ -2332,7 +2389,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         bool fBlockReconstructed = false;
 
         {
-            LOCK(cs_main);
+            LOCK_TIMED(cs_main);
             // If AcceptBlockHeader returned true, it set pindex
             assert(pindex);
             UpdateBlockAvailability(pfrom->GetId(), pindex->GetBlockHash());
@@ -2506,7 +2563,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             // If we got here, we were able to optimistically reconstruct a
             // block that is in flight from some other peer.
             {
-                LOCK(cs_main);
+                LOCK_TIMED(cs_main);
                 mapBlockSource.emplace(pblock->GetHash(),
                                        std::make_pair(pfrom->GetId(), false));
             }
@@ -2517,7 +2574,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             }
 
             // hold cs_main for CBlockIndex::IsValid()
-            LOCK(cs_main);
+            LOCK_TIMED(cs_main);
             if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS)) {
                 // Clear download state for this block, which is in process from
                 // some other peer. We do this after calling. ProcessNewBlock so
@@ -2538,7 +2595,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
         bool fBlockRead = false;
         {
-            LOCK(cs_main);
+            LOCK_TIMED(cs_main);
 
             std::map<uint256,
                      std::pair<NodeId,
@@ -2630,7 +2687,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         // deserializing 2000 full blocks.
         unsigned int nCount = ReadCompactSize(vRecv);
         if (nCount > MAX_HEADERS_RESULTS) {
-            LOCK(cs_main);
+            LOCK_TIMED(cs_main);
             Misbehaving(pfrom, 20, "too-many-headers");
             return error("headers message size = %u", nCount);
         }
@@ -2649,7 +2706,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
 
         const CBlockIndex *pindexLast = nullptr;
         {
-            LOCK(cs_main);
+            LOCK_TIMED(cs_main);
             CNodeState *nodestate = State(pfrom->GetId());
 
             // If this looks like it could be a block announcement (nCount <
@@ -2709,7 +2766,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             int nDoS;
             if (state.IsInvalid(nDoS)) {
                 if (nDoS > 0) {
-                    LOCK(cs_main);
+                    LOCK_TIMED(cs_main);
                     Misbehaving(pfrom, nDoS, state.GetRejectReason());
                 }
                 return error("invalid header received");
@@ -2717,7 +2774,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         }
 
         {
-            LOCK(cs_main);
+            LOCK_TIMED(cs_main);
             CNodeState *nodestate = State(pfrom->GetId());
             if (nodestate->nUnconnectingHeaders > 0) {
                 LogPrint("net",
@@ -2839,7 +2896,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload();
         const uint256 hash(pblock->GetHash());
         {
-            LOCK(cs_main);
+            LOCK_TIMED(cs_main);
             // Also always process if we requested the block explicitly, as we
             // may need it even though it is not a candidate for a new best tip.
             forceProcessing |= MarkBlockAsReceived(hash);
@@ -2878,7 +2935,10 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_addrKnown);
+            pfrom->vAddrToSend.clear();
+        }
         std::vector<CAddress> vAddr = connman.GetAddresses();
         FastRandomContext insecure_rand;
         for (const CAddress &addr : vAddr) {
@@ -2992,7 +3052,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
 
         if (!filter.IsWithinSizeConstraints()) {
             // There is no excuse for sending a too-large filter
-            LOCK(cs_main);
+            LOCK_TIMED(cs_main);
             Misbehaving(pfrom, 100, "oversized-bloom-filter");
         } else {
             LOCK(pfrom->cs_filter);
@@ -3022,7 +3082,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             }
         }
         if (bad) {
-            LOCK(cs_main);
+            LOCK_TIMED(cs_main);
             // The structure of this code doesn't really allow for a good error
             // code. We'll go generic.
             Misbehaving(pfrom, 100, "invalid-filteradd");
@@ -3133,6 +3193,7 @@ bool ProcessMessages(const Config &config, CNode *pfrom, CConnman &connman,
     }
 
     std::list<CNetMessage> msgs;
+    bool fResumeRecv = false;
     {
         LOCK(pfrom->cs_vProcessMsg);
         if (pfrom->vProcessMsg.empty()) {
@@ -3143,10 +3204,15 @@ bool ProcessMessages(const Config &config, CNode *pfrom, CConnman &connman,
                     pfrom->vProcessMsg.begin());
         pfrom->nProcessQueueSize -=
             msgs.front().vRecv.size() + CMessageHeader::HEADER_SIZE;
-        pfrom->fPauseRecv =
+        bool fPauseRecv =
             pfrom->nProcessQueueSize > connman.GetReceiveFloodSize();
+        fResumeRecv = pfrom->fPauseRecv && !fPauseRecv;
+        pfrom->fPauseRecv = fPauseRecv;
         fMoreWork = !pfrom->vProcessMsg.empty();
     }
+    if (fResumeRecv) {
+        connman.ResumeReceive(pfrom);
+    }
     CNetMessage &msg(msgs.front());
 
     msg.SetVersion(pfrom->GetRecvVersion());
@@ -3189,6 +3255,8 @@ bool ProcessMessages(const Config &config, CNode *pfrom, CConnman &connman,
 
     // Process message
     bool fRet = false;
+    int64_t nTimeStart = GetTimeMicros();
+    CLockWaitTimer lockWaitTimer(&cs_main);
     try {
         fRet = ProcessMessage(config, pfrom, strCommand, vRecv, msg.nTime,
                               chainparams, connman, interruptMsgProc);
@@ -3226,12 +3294,15 @@ bool ProcessMessages(const Config &config, CNode *pfrom, CConnman &connman,
         PrintExceptionContinue(nullptr, "ProcessMessages()");
     }
 
+    pfrom->RecordProcessTime(strCommand, GetTimeMicros() - nTimeStart,
+                             lockWaitTimer.GetWaitMicros());
+
     if (!fRet) {
         LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__,
                   SanitizeString(strCommand), nMessageSize, pfrom->id);
     }
 
-    LOCK(cs_main);
+    LOCK_TIMED(cs_main);
     SendRejectsAndCheckIfBanned(pfrom, connman);
 
     return fMoreWork;
@@ -3251,6 +3322,26 @@ public:
     }
 };
 
+/**
+ * Account the time spent in SendMessages, and whether it was skipped for want
+ * of cs_main, to the peer on every return path.
+ */
+class CSendMessagesTimer {
+private:
+    CNode *pnode;
+    int64_t nTimeStart;
+    bool fSkipped;
+
+public:
+    explicit CSendMessagesTimer(CNode *pnodeIn)
+        : pnode(pnodeIn), nTimeStart(GetTimeMicros()), fSkipped(false) {}
+    ~CSendMessagesTimer() {
+        pnode->RecordSendMessagesTime(GetTimeMicros() - nTimeStart, fSkipped);
+    }
+
+    void SetSkipped() { fSkipped = true; }
+};
+
 bool SendMessages(const Config &config, CNode *pto, CConnman &connman,
                   const std::atomic<bool> &interruptMsgProc) {
     const Consensus::Params &consensusParams = Params().GetConsensus();
@@ -3260,6 +3351,8 @@ bool SendMessages(const Config &config, CNode *pto, CConnman &connman,
         return true;
     }
 
+    CSendMessagesTimer sendMessagesTimer(pto);
+
     // If we get here, the outgoing message serialization version is set and
     // can't change.
     const CNetMsgMaker msgMaker(pto->GetSendVersion());
@@ -3298,6 +3391,7 @@ bool SendMessages(const Config &config, CNode *pto, CConnman &connman,
     // Acquire cs_main for IsInitialBlockDownload() and CNodeState()
     TRY_LOCK(cs_main, lockMain);
     if (!lockMain) {
+        sendMessagesTimer.SetSkipped();
         return true;
     }
 
@@ -3321,27 +3415,29 @@ bool SendMessages(const Config &config, CNode *pto, CConnman &connman,
         pto->nNextAddrSend =
             PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
         std::vector<CAddress> vAddr;
-        vAddr.reserve(pto->vAddrToSend.size());
-        for (const CAddress &addr : pto->vAddrToSend) {
-            if (!pto->addrKnown.contains(addr.GetKey())) {
-                pto->addrKnown.insert(addr.GetKey());
-                vAddr.push_back(addr);
-                // receiver rejects addr messages larger than 1000
-                if (vAddr.size() >= 1000) {
-                    connman.PushMessage(pto,
-                                        msgMaker.Make(NetMsgType::ADDR, vAddr));
-                    vAddr.clear();
+        {
+            LOCK(pto->cs_addrKnown);
+            vAddr.reserve(pto->vAddrToSend.size());
+            for (const CAddress &addr : pto->vAddrToSend) {
+                if (!pto->addrKnown.contains(addr.GetKey())) {
+                    pto->addrKnown.insert(addr.GetKey());
+                    vAddr.push_back(addr);
                 }
             }
-        }
-        pto->vAddrToSend.clear();
-        if (!vAddr.empty()) {
-            connman.PushMessage(pto, msgMaker.Make(NetMsgType::ADDR, vAddr));
-        }
+            pto->vAddrToSend.clear();
 
-        // we only send the big addr message once
-        if (pto->vAddrToSend.capacity() > 40) {
-            pto->vAddrToSend.shrink_to_fit();
+            // we only send the big addr message once
+            if (pto->vAddrToSend.capacity() > 40) {
+                pto->vAddrToSend.shrink_to_fit();
+            }
+        }
+        // receiver rejects addr messages larger than 1000
+        for (size_t i = 0; i < vAddr.size(); i += 1000) {
+            std::vector<CAddress> vAddrBatch(
+                vAddr.begin() + i,
+                vAddr.begin() + std::min(vAddr.size(), i + 1000));
+            connman.PushMessage(pto,
+                                msgMaker.Make(NetMsgType::ADDR, vAddrBatch));
         }
     }
 
@@ -3444,7 +3540,10 @@ bool SendMessages(const Config &config, CNode *pto, CConnman &connman,
                 pBestIndex = pindex;
                 if (fFoundStartingHeader) {
                     // add this to the headers message
-                    vHeaders.push_back(pindex->GetBlockHeader());
+                    if (!AddBlockHeader(pindex, vHeaders)) {
+                        fRevertToInv = true;
+                        break;
+                    }
                 } else if (PeerHasHeader(&state, pindex)) {
                     // Keep looking for the first new block.
                     continue;
@@ -3454,7 +3553,10 @@ bool SendMessages(const Config &config, CNode *pto, CConnman &connman,
                     // one.
                     // Start sending headers.
                     fFoundStartingHeader = true;
-                    vHeaders.push_back(pindex->GetBlockHeader());
+                    if (!AddBlockHeader(pindex, vHeaders)) {
+                        fRevertToInv = true;
+                        break;
+                    }
                 } else {
                     // Peer doesn't have this header or the prior one --
                     // nothing will connect, so bail out.
@@ -21,6 +21,9 @@
 #ifndef WIN32
 #include <fcntl.h>
 #endif
+#ifdef USE_EPOLL
+#include <poll.h>
+#endif
 
 #include <boost/algorithm/string/case_conv.hpp> // for to_lower()
 #include <boost/algorithm/string/predicate.hpp> // for startswith() and endswith()
@@ -197,6 +200,29 @@ struct timeval MillisToTimeval(int64_t nTimeout) {
     return timeout;
 }
 
+/**
+ * Wait for a single socket to become readable, or writable if fWrite is set.
+ * Returns as select() does: positive when ready, 0 on timeout and
+ * SOCKET_ERROR on failure. poll() is used where select() is not, as the
+ * socket numbers may then exceed FD_SETSIZE.
+ */
+static int WaitForSocket(SOCKET hSocket, bool fWrite, int64_t nTimeout) {
+#ifdef USE_EPOLL
+    struct pollfd pfd;
+    pfd.fd = hSocket;
+    pfd.events = fWrite ? POLLOUT : POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, nTimeout);
+#else
+    struct timeval timeout = MillisToTimeval(nTimeout);
+    fd_set fdset;
+    FD_ZERO(&fdset);
+    FD_SET(hSocket, &fdset);
+    return select(hSocket + 1, fWrite ? nullptr : &fdset,
+                  fWrite ? &fdset : nullptr, nullptr, &timeout);
+#endif
+}
+
 /**
  * Read bytes from socket. This will either read the full number of bytes
  * requested or return False on error or timeout.
@@ -232,12 +258,8 @@ static bool InterruptibleRecv(char *data, size_t len, int timeout,
                 if (!IsSelectableSocket(hSocket)) {
                     return false;
                 }
-                struct timeval tval =
-                    MillisToTimeval(std::min(endTime - curTime, maxWait));
-                fd_set fdset;
-                FD_ZERO(&fdset);
-                FD_SET(hSocket, &fdset);
-                int nRet = select(hSocket + 1, &fdset, nullptr, nullptr, &tval);
+                int nRet = WaitForSocket(hSocket, false,
+                                         std::min(endTime - curTime, maxWait));
                 if (nRet == SOCKET_ERROR) {
                     return false;
                 }
@@ -471,11 +493,7 @@ static bool ConnectSocketDirectly(const CService &addrConnect,
         // WSAEINVAL is here because some legacy version of winsock uses it
         if (nErr == WSAEINPROGRESS || nErr == WSAEWOULDBLOCK ||
             nErr == WSAEINVAL) {
-            struct timeval timeout = MillisToTimeval(nTimeout);
-            fd_set fdset;
-            FD_ZERO(&fdset);
-            FD_SET(hSocket, &fdset);
-            int nRet = select(hSocket + 1, nullptr, &fdset, nullptr, &timeout);
+            int nRet = WaitForSocket(hSocket, true, nTimeout);
             if (nRet == 0) {
                 LogPrint("net", "connection to %s timeout\n",
                          addrConnect.ToString());
@@ -0,0 +1,405 @@
+// Copyright (c) 2017 The Bitcoin Cash Plus developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_OPENHASHMAP_H
+#define BITCOIN_OPENHASHMAP_H
+
+#include "crypto/common.h"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Hash map with open addressing, meant as a drop-in replacement for the
+ * subset of std::unordered_map used by the coins cache.
+ *
+ * Storage layout:
+ * - A flat table of 8-byte slots, probed linearly. Each slot holds the low 32
+ *   bits of the hash of its key and the index of its entry, so that probing
+ *   rarely touches an entry that does not match and growing the table does
+ *   not need to hash the keys again.
+ * - The entries themselves, allocated NODES_PER_CHUNK at a time from a pool.
+ *   Freed entries are reused, a chunk is released once all of its entries are
+ *   erased, and entries never move: as with std::unordered_map, references to
+ *   them stay valid until they are erased.
+ *
+ * Erasing an entry leaves a marker in its slot, so erasing does not move other
+ * slots and iterators to other entries stay valid. Inserting may grow the
+ * table, which invalidates iterators but not references.
+ */
+template <typename K, typename T, typename Hash,
+          typename Pred = std::equal_to<K>>
+class openhashmap {
+public:
+    typedef K key_type;
+    typedef T mapped_type;
+    typedef std::pair<const K, T> value_type;
+    typedef size_t size_type;
+
+    //! Number of entries allocated at once, one per bit of a chunk's mask.
+    static const size_t NODES_PER_CHUNK = 64;
+
+private:
+    //! Storage for an entry.
+    struct Node {
+        typename std::aligned_storage<sizeof(value_type),
+                                      alignof(value_type)>::type value;
+    };
+
+    struct Slot {
+        uint32_t hash;
+        uint32_t node;
+    };
+
+    //! Slot node values that do not refer to an entry.
+    static const uint32_t EMPTY = 0xffffffff;
+    static const uint32_t DELETED = 0xfffffffe;
+
+    std::vector<Slot> slots;
+    //! The chunks, null once released. Node n is in chunk n / NODES_PER_CHUNK.
+    std::vector<std::unique_ptr<Node[]>> chunks;
+    //! For each chunk, a bit per node that holds an entry.
+    std::vector<uint64_t> chunkUsed;
+    //! Chunks with a node to spare, allocated or not.
+    std::vector<uint32_t> freeChunks;
+    //! The last chunk released, kept for reuse so that erasing and inserting
+    //! in turn does not allocate and free a chunk every time.
+    std::unique_ptr<Node[]> spareChunk;
+    //! Number of chunks allocated, including the spare one.
+    size_t nChunks;
+    size_t nSize;
+    size_t nDeleted;
+    Hash hasher;
+    Pred pred;
+
+    value_type &Value(uint32_t node) const {
+        return *reinterpret_cast<value_type *>(&GetNode(node).value);
+    }
+
+    Node &GetNode(uint32_t node) const {
+        return chunks[node / NODES_PER_CHUNK][node % NODES_PER_CHUNK];
+    }
+
+    uint32_t AllocateNode() {
+        if (freeChunks.empty()) {
+            assert(chunks.size() < DELETED / NODES_PER_CHUNK);
+            freeChunks.push_back(chunks.size());
+            chunks.emplace_back();
+            chunkUsed.push_back(0);
+        }
+        const uint32_t chunk = freeChunks.back();
+        if (!chunks[chunk]) {
+            if (spareChunk) {
+                chunks[chunk] = std::move(spareChunk);
+            } else {
+                chunks[chunk].reset(new Node[NODES_PER_CHUNK]);
+                nChunks++;
+            }
+        }
+        // Take the lowest free node.
+        const uint64_t free = ~chunkUsed[chunk];
+        const uint64_t bit = free & (~free + 1);
+        chunkUsed[chunk] |= bit;
+        if (chunkUsed[chunk] == ~uint64_t(0)) {
+            freeChunks.pop_back();
+        }
+        return chunk * NODES_PER_CHUNK + (CountBits(bit) - 1);
+    }
+
+    void FreeNode(uint32_t node) {
+        const uint32_t chunk = node / NODES_PER_CHUNK;
+        if (chunkUsed[chunk] == ~uint64_t(0)) {
+            freeChunks.push_back(chunk);
+        }
+        chunkUsed[chunk] &= ~(uint64_t(1) << (node % NODES_PER_CHUNK));
+        if (chunkUsed[chunk] == 0) {
+            if (spareChunk) {
+                nChunks--;
+            }
+            spareChunk = std::move(chunks[chunk]);
+        }
+    }
+
+    static uint32_t HashBits(size_t hash) { return uint32_t(hash); }
+
+    //! Position of the slot holding key, or slots.size() if there is none.
+    size_t FindSlot(const K &key, uint32_t hash) const {
+        if (nSize == 0) {
+            return slots.size();
+        }
+        const size_t mask = slots.size() - 1;
+        for (size_t pos = hash & mask;; pos = (pos + 1) & mask) {
+            const Slot &slot = slots[pos];
+            if (slot.node == EMPTY) {
+                return slots.size();
+            }
+            if (slot.hash == hash && slot.node != DELETED &&
+                pred(Value(slot.node).first, key)) {
+                return pos;
+            }
+        }
+    }
+
+    //! Store node in the first free slot for hash, which must have room.
+    size_t InsertSlot(uint32_t hash, uint32_t node) {
+        const size_t mask = slots.size() - 1;
+        for (size_t pos = hash & mask;; pos = (pos + 1) & mask) {
+            Slot &slot = slots[pos];
+            if (slot.node == EMPTY || slot.node == DELETED) {
+                if (slot.node == DELETED) {
+                    nDeleted--;
+                }
+                slot.hash = hash;
+                slot.node = node;
+                return pos;
+            }
+        }
+    }
+
+    /**
+     * Make room for one more entry. The table is rebuilt, dropping the erased
+     * markers, once live and erased slots make up three quarters of it, and
+     * is then at most half full.
+     */
+    void Reserve() {
+        if ((nSize + nDeleted + 1) * 4 <= slots.size() * 3) {
+            return;
+        }
+        size_t capacity = slots.empty() ? 16 : slots.size();
+        while ((nSize + 1) * 2 > capacity) {
+            capacity *= 2;
+        }
+        std::vector<Slot> old(capacity, Slot{0, EMPTY});
+        old.swap(slots);
+        nDeleted = 0;
+        for (const Slot &slot : old) {
+            if (slot.node != EMPTY && slot.node != DELETED) {
+                InsertSlot(slot.hash, slot.node);
+            }
+        }
+    }
+
+    void DestroyAll() {
+        for (const Slot &slot : slots) {
+            if (slot.node != EMPTY && slot.node != DELETED) {
+                Value(slot.node).~value_type();
+            }
+        }
+    }
+
+public:
+    class const_iterator {
+    protected:
+        const openhashmap *map;
+        size_t pos;
+
+        void Skip() {
+            while (pos < map->slots.size() &&
+                   (map->slots[pos].node == EMPTY ||
+                    map->slots[pos].node == DELETED)) {
+                pos++;
+            }
+        }
+
+        friend class openhashmap;
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename openhashmap::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type *pointer;
+        typedef const value_type &reference;
+
+        const_iterator() : map(nullptr), pos(0) {}
+        const_iterator(const openhashmap *mapIn, size_t posIn)
+            : map(mapIn), pos(posIn) {
+            Skip();
+        }
+
+        const value_type &operator*() const {
+            return map->Value(map->slots[pos].node);
+        }
+        const value_type *operator->() const { return &**this; }
+        const_iterator &operator++() {
+            pos++;
+            Skip();
+            return *this;
+        }
+        const_iterator operator++(int) {
+            const_iterator copy(*this);
+            ++*this;
+            return copy;
+        }
+
+        friend bool operator==(const const_iterator &a,
+                               const const_iterator &b) {
+            return a.pos == b.pos;
+        }
+        friend bool operator!=(const const_iterator &a,
+                               const const_iterator &b) {
+            return a.pos != b.pos;
+        }
+    };
+
+    class iterator : public const_iterator {
+    public:
+        typedef value_type *pointer;
+        typedef value_type &reference;
+
+        iterator() {}
+        iterator(const openhashmap *mapIn, size_t posIn)
+            : const_iterator(mapIn, posIn) {}
+
+        value_type &operator*() const {
+            return this->map->Value(this->map->slots[this->pos].node);
+        }
+        value_type *operator->() const { return &**this; }
+        iterator &operator++() {
+            const_iterator::operator++();
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator copy(*this);
+            ++*this;
+            return copy;
+        }
+    };
+
+    openhashmap() : nChunks(0), nSize(0), nDeleted(0) {}
+
+    openhashmap(const openhashmap &) = delete;
+    openhashmap &operator=(const openhashmap &) = delete;
+
+    ~openhashmap() { DestroyAll(); }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, slots.size()); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, slots.size()); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    bool empty() const { return nSize == 0; }
+    size_type size() const { return nSize; }
+    size_type bucket_count() const { return slots.size(); }
+
+    /**
+     * Iterator to the first entry at or after slot position pos, to resume a
+     * walk over the table. A position only refers to the same part of the
+     * table while bucket_count() is unchanged.
+     */
+    iterator begin_at(size_type pos) {
+        return iterator(this, std::min(pos, slots.size()));
+    }
+    //! Slot position of it, for begin_at.
+    size_type position(const_iterator it) const { return it.pos; }
+
+    iterator find(const K &key) {
+        return iterator(this, FindSlot(key, HashBits(hasher(key))));
+    }
+    const_iterator find(const K &key) const {
+        return const_iterator(this, FindSlot(key, HashBits(hasher(key))));
+    }
+    size_type count(const K &key) const { return find(key) != end(); }
+
+    /**
+     * Insert an entry constructed from args unless its key is present. Only
+     * an insertion may grow the table and so invalidate iterators.
+     */
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args &&... args) {
+        uint32_t node = AllocateNode();
+        value_type *value;
+        try {
+            value = new (&Value(node)) value_type(std::forward<Args>(args)...);
+        } catch (...) {
+            FreeNode(node);
+            throw;
+        }
+        const uint32_t hash = HashBits(hasher(value->first));
+        size_t pos = FindSlot(value->first, hash);
+        if (pos != slots.size()) {
+            value->~value_type();
+            FreeNode(node);
+            return std::make_pair(iterator(this, pos), false);
+        }
+        try {
+            Reserve();
+        } catch (...) {
+            value->~value_type();
+            FreeNode(node);
+            throw;
+        }
+        pos = InsertSlot(hash, node);
+        nSize++;
+        return std::make_pair(iterator(this, pos), true);
+    }
+
+    T &operator[](const K &key) {
+        iterator it = find(key);
+        if (it != end()) {
+            return it->second;
+        }
+        return emplace(std::piecewise_construct, std::forward_as_tuple(key),
+                       std::tuple<>())
+            .first->second;
+    }
+
+    iterator erase(const_iterator it) {
+        Slot &slot = slots[it.pos];
+        Value(slot.node).~value_type();
+        FreeNode(slot.node);
+        slot.node = DELETED;
+        nSize--;
+        nDeleted++;
+        return iterator(this, it.pos + 1);
+    }
+
+    size_type erase(const K &key) {
+        iterator it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+
+    /**
+     * Remove all entries and release their memory. The slot table keeps its
+     * size, like the bucket array of std::unordered_map.
+     */
+    void clear() {
+        DestroyAll();
+        std::fill(slots.begin(), slots.end(), Slot{0, EMPTY});
+        chunks.clear();
+        spareChunk.reset();
+        chunkUsed.clear();
+        freeChunks.clear();
+        nChunks = 0;
+        nSize = 0;
+        nDeleted = 0;
+    }
+
+    //! Sizes of the heap allocations, for memusage.
+    size_t slots_memory() const { return slots.capacity() * sizeof(Slot); }
+    size_t chunks_memory() const {
+        return chunks.capacity() * sizeof(std::unique_ptr<Node[]>) +
+               chunkUsed.capacity() * sizeof(uint64_t) +
+               freeChunks.capacity() * sizeof(uint32_t);
+    }
+    size_t chunk_count() const { return nChunks; }
+    static size_t chunk_memory() { return NODES_PER_CHUNK * sizeof(Node); }
+};
+
+#endif // BITCOIN_OPENHASHMAP_H
@@ -296,26 +296,25 @@ uint32_t GetNextCashPlusWorkRequired(const CBlockIndex *pindexPrev,
 
 
 bool CheckEquihashSolution(const CBlockHeader *pblock, const Config &config)
+{
+    return CheckEquihashSolution(CBlockHeaderHashContext(*pblock), config);
+}
+
+bool CheckEquihashSolution(const CBlockHeaderHashContext &context,
+                           const Config &config)
 {
     unsigned int n = config.GetChainParams().EquihashN();
     unsigned int k = config.GetChainParams().EquihashK();
 
     // Hash state
-    crypto_generichash_blake2b_state state;
+    eh_HashState state;
     EhInitialiseState(n, k, state);
 
-    // I = the block header minus nonce and solution.
-    CEquihashInput I{*pblock};
-    // I||V
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss << I;
-    ss << pblock->nNonce;
-
     // H(I||V||...
-    crypto_generichash_blake2b_update(&state, (unsigned char*)&ss[0], ss.size());
+    state.Write(context.data(), context.size());
 
     bool isValid;
-    EhIsValidSolution(n, k, state, pblock->nSolution, isValid);
+    EhIsValidSolution(n, k, state, context.GetHeader().nSolution, isValid);
     if (!isValid)
         return error("CheckEquihashSolution(): invalid solution");
 
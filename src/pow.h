@@ -10,6 +10,7 @@
 #include "consensus/params.h"
 
 class CBlockHeader;
+class CBlockHeaderHashContext;
 class CBlockIndex;
 class Config;
 class uint256;
@@ -42,5 +43,7 @@ uint32_t GetNextCashPlusWorkRequired(const CBlockIndex *pindexPrev,
 
 /** Check whether the Equihash solution in a block header is valid */
 bool CheckEquihashSolution(const CBlockHeader *pblock, const Config &config);
+bool CheckEquihashSolution(const CBlockHeaderHashContext &context,
+                           const Config &config);
 
 #endif // BITCOIN_POW_H
@@ -14,15 +14,36 @@
 #include "crypto/common.h"
 
 
+bool CBlockHeaderHashCache::Get(bool fLegacy, uint256 &hash) const
+{
+    std::shared_ptr<const Entry> cached = std::atomic_load(&entry);
+    if (!cached || cached->fLegacy != fLegacy) {
+        return false;
+    }
+    hash = cached->hash;
+    return true;
+}
+
+void CBlockHeaderHashCache::Set(bool fLegacy, const uint256 &hash)
+{
+    std::shared_ptr<Entry> cached = std::make_shared<Entry>();
+    cached->hash = hash;
+    cached->fLegacy = fLegacy;
+    std::atomic_store(&entry, std::shared_ptr<const Entry>(std::move(cached)));
+}
+
 uint256 CBlockHeader::GetHash(const Consensus::Params& params) const
 {
-    int version;
-    if (nHeight >= (uint32_t)params.BCPHeight) {
-        version = PROTOCOL_VERSION;
-    } else {
-        version = PROTOCOL_VERSION | SERIALIZE_BLOCK_LEGACY;
+    const bool fLegacy = nHeight < (uint32_t)params.BCPHeight;
+    uint256 hash;
+    if (hashCache.Get(fLegacy, hash)) {
+        return hash;
+    }
+
+    if (!fLegacy) {
+        return CBlockHeaderHashContext(*this).GetHash();
     }
-    CHashWriter writer(SER_GETHASH, version);
+    CHashWriter writer(SER_GETHASH, PROTOCOL_VERSION | SERIALIZE_BLOCK_LEGACY);
     ::Serialize(writer, *this);
     return writer.GetHash();
 }
@@ -34,6 +55,39 @@ uint256 CBlockHeader::GetHash() const
 }
 
 
+CBlockHeaderHashContext::CBlockHeaderHashContext(const CBlockHeader &headerIn) :
+    header(headerIn)
+{
+    unsigned char *p = buf;
+    WriteLE32(p, header.nVersion);
+    p += 4;
+    memcpy(p, header.hashPrevBlock.begin(), 32);
+    p += 32;
+    memcpy(p, header.hashMerkleRoot.begin(), 32);
+    p += 32;
+    WriteLE32(p, header.nHeight);
+    p += 4;
+    for (size_t i = 0; i < (sizeof(header.nReserved) / sizeof(header.nReserved[0])); i++) {
+        WriteLE32(p, header.nReserved[i]);
+        p += 4;
+    }
+    WriteLE32(p, header.nTime);
+    p += 4;
+    WriteLE32(p, header.nBits);
+    p += 4;
+    memcpy(p, header.nNonce.begin(), 32);
+    p += 32;
+    assert(p == buf + SIZE);
+}
+
+uint256 CBlockHeaderHashContext::GetHash() const
+{
+    CHashWriter writer(SER_GETHASH, PROTOCOL_VERSION);
+    writer.write((const char*)buf, SIZE);
+    writer << header.nSolution;
+    return writer.GetHash();
+}
+
 std::string CBlock::ToString() const
 {
     std::stringstream s;
@@ -12,6 +12,8 @@
 #include "uint256.h"
 #include "version.h"
 
+#include <memory>
+
 namespace Consensus {
     struct Params;
 };
@@ -19,6 +21,40 @@ namespace Consensus {
 
 static const int SERIALIZE_BLOCK_LEGACY = 0x04000000;
 
+/**
+ * Hash of a header that has passed its proof of work check. Validation treats
+ * such a header as immutable from then on, as it does a CBlock once fChecked
+ * is set, so the hash is kept without a copy of the header to compare with.
+ * SetNull() and deserializing clear it, and so must any other code that
+ * changes the header fields, like the miner. The hash is shared by copies of the
+ * header and swapped atomically, as a shared const block can be checked from
+ * several threads at once.
+ */
+class CBlockHeaderHashCache
+{
+public:
+    CBlockHeaderHashCache() {}
+    CBlockHeaderHashCache(const CBlockHeaderHashCache &other) :
+        entry(std::atomic_load(&other.entry)) {}
+    CBlockHeaderHashCache &operator=(const CBlockHeaderHashCache &other)
+    {
+        std::atomic_store(&entry, std::atomic_load(&other.entry));
+        return *this;
+    }
+
+    //! Return true and set hash if a hash in the given format is cached.
+    bool Get(bool fLegacy, uint256 &hash) const;
+    void Set(bool fLegacy, const uint256 &hash);
+    void Clear() { std::atomic_store(&entry, std::shared_ptr<const Entry>()); }
+
+private:
+    struct Entry {
+        uint256 hash;
+        bool fLegacy;
+    };
+    std::shared_ptr<const Entry> entry;
+};
+
 /**
  * Nodes collect new transactions into a block, hash them into a hash tree, and
  * scan through nonce values to make the block's hash satisfy proof-of-work
@@ -41,6 +77,8 @@ public:
     uint256 nNonce;
     std::vector<unsigned char> nSolution;  // Equihash solution.
 
+    // memory only
+    mutable CBlockHeaderHashCache hashCache;
 
     CBlockHeader() { SetNull(); }
 
@@ -49,6 +87,9 @@ public:
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream &s, Operation ser_action) {
         bool new_format = !(s.GetVersion() & SERIALIZE_BLOCK_LEGACY);
+        if (ser_action.ForRead()) {
+            hashCache.Clear();
+        }
         READWRITE(this->nVersion);
         READWRITE(hashPrevBlock);
         READWRITE(hashMerkleRoot);
@@ -82,7 +123,7 @@ public:
         nBits = 0;
         nNonce.SetNull();
         nSolution.clear();
-
+        hashCache.Clear();
     }
 
     bool IsNull() const { return (nBits == 0); }
@@ -134,6 +175,7 @@ public:
         block.nBits = nBits;
         block.nNonce = nNonce;
         block.nSolution  = nSolution;
+        block.hashCache = hashCache;
         return block;
     }
 
@@ -168,6 +210,34 @@ public:
         READWRITE(nBits);
     }
 };
+
+/**
+ * Post-fork serialization of a block header up to and including the nonce,
+ * written once into a fixed buffer. These bytes are the Equihash input I||V,
+ * and followed by the solution they hash to the block hash, so checking the
+ * solution and the proof of work of a header can share one serialization.
+ */
+class CBlockHeaderHashContext
+{
+public:
+    //! Size of the serialized CEquihashInput, I.
+    static const size_t EQUIHASH_INPUT_SIZE = 4+32+32+4+7*4+4+4;
+    //! Size of I||V.
+    static const size_t SIZE = EQUIHASH_INPUT_SIZE+32;
+
+    explicit CBlockHeaderHashContext(const CBlockHeader &headerIn);
+
+    const CBlockHeader &GetHeader() const { return header; }
+    const unsigned char *data() const { return buf; }
+    size_t size() const { return SIZE; }
+
+    //! Hash of the header in the post-fork format.
+    uint256 GetHash() const;
+
+private:
+    const CBlockHeader &header;
+    unsigned char buf[SIZE];
+};
 /**
  * Describes a place in the block chain to another node such that if the other
  * node doesn't have the same branch, it can find a recent common trunk.  The
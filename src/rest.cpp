@@ -171,9 +171,15 @@ static bool rest_headers(Config &config, HTTPRequest *req,
         }
     }
 
+    // Read the solutions after releasing cs_main.
+    std::vector<CBlockHeader> vSolvedHeaders;
+    if (!GetBlockHeaders(headers, vSolvedHeaders)) {
+        return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR,
+                       "Block solution not found");
+    }
     CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
-    for (const CBlockIndex *pindex : headers) {
-        ssHeader << pindex->GetBlockHeader();
+    for (const CBlockHeader &header : vSolvedHeaders) {
+        ssHeader << header;
     }
 
     switch (rf) {
@@ -193,8 +199,9 @@ static bool rest_headers(Config &config, HTTPRequest *req,
         }
         case RF_JSON: {
             UniValue jsonHeaders(UniValue::VARR);
-            for (const CBlockIndex *pindex : headers) {
-                jsonHeaders.push_back(blockheaderToJSON(pindex));
+            for (size_t i = 0; i < headers.size(); i++) {
+                jsonHeaders.push_back(blockheaderToJSON(
+                    headers[i], vSolvedHeaders[i].nSolution));
             }
             std::string strJSON = jsonHeaders.write() + "\n";
             req->WriteHeader("Content-Type", "application/json");
@@ -227,6 +234,8 @@ static bool rest_block(const Config &config, HTTPRequest *req,
     }
 
     CBlock block;
+    // The binary and hex formats are the block as it is stored.
+    CRawBlock rawBlock;
     CBlockIndex *pblockindex = nullptr;
     {
         LOCK(cs_main);
@@ -241,25 +250,26 @@ static bool rest_block(const Config &config, HTTPRequest *req,
                            hashStr + " not available (pruned data)");
         }
 
-        if (!ReadBlockFromDisk(block, pblockindex, config)) {
+        if (rf == RF_BINARY || rf == RF_HEX) {
+            if (!ReadRawBlockFromDisk(rawBlock, pblockindex, config)) {
+                return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+            }
+        } else if (!ReadBlockFromDisk(block, pblockindex, config)) {
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
         }
     }
 
-    CDataStream ssBlock(SER_NETWORK,
-                        PROTOCOL_VERSION | RPCSerializationFlags());
-    ssBlock << block;
-
     switch (rf) {
         case RF_BINARY: {
-            std::string binaryBlock = ssBlock.str();
+            std::string binaryBlock(rawBlock.begin(), rawBlock.end());
             req->WriteHeader("Content-Type", "application/octet-stream");
             req->WriteReply(HTTP_OK, binaryBlock);
             return true;
         }
 
         case RF_HEX: {
-            std::string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+            std::string strHex =
+                HexStr(rawBlock.begin(), rawBlock.end()) + "\n";
             req->WriteHeader("Content-Type", "text/plain");
             req->WriteReply(HTTP_OK, strHex);
             return true;
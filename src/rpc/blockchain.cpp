@@ -19,12 +19,14 @@
 #include "rpc/tojson.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilstrencodings.h"
 #include "validation.h"
 #include "consensus/params.h"
 
+#include <boost/filesystem.hpp>
 #include <boost/thread/thread.hpp> // boost::thread::interrupt
 
 #include <condition_variable>
@@ -67,7 +69,8 @@ double GetDifficulty(const CBlockIndex *blockindex) {
     return GetDifficultyFromBits(blockindex->nBits);
 }
 
-UniValue blockheaderToJSON(const CBlockIndex *blockindex) {
+UniValue blockheaderToJSON(const CBlockIndex *blockindex,
+                           const std::vector<unsigned char> &solution) {
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
     int confirmations = -1;
@@ -85,7 +88,7 @@ UniValue blockheaderToJSON(const CBlockIndex *blockindex) {
     result.push_back(Pair("mediantime", int64_t(blockindex->GetMedianTimePast())));
     result.push_back(Pair("nonceUint32", (uint64_t)((uint32_t)blockindex->nNonce.GetUint64(0))));
     result.push_back(Pair("nonce", blockindex->nNonce.GetHex()));
-    result.push_back(Pair("solution", HexStr(blockindex->nSolution)));
+    result.push_back(Pair("solution", HexStr(solution)));
     result.push_back(Pair("bits", strprintf("%08x", blockindex->nBits)));
     result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
     result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
@@ -757,17 +760,21 @@ UniValue getblockheader(const Config &config, const JSONRPCRequest &request) {
     }
 
     CBlockIndex *pblockindex = mapBlockIndex[hash];
+    CBlockHeader header;
+    if (!pblockindex->GetBlockHeader(header)) {
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Block solution not found");
+    }
 
     if (!fVerbose) {
         int serFlags = legacy_format ? SERIALIZE_BLOCK_LEGACY : 0;
 
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION|serFlags);
-        ssBlock << pblockindex->GetBlockHeader();
+        ssBlock << header;
         std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
         return strHex;
     }
 
-    return blockheaderToJSON(pblockindex);
+    return blockheaderToJSON(pblockindex, header.nSolution);
 }
 
 UniValue getblock(const Config &config, const JSONRPCRequest &request) {
@@ -850,6 +857,15 @@ UniValue getblock(const Config &config, const JSONRPCRequest &request) {
         throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
     }
 
+    if (!fVerbose && !legacy_format) {
+        // The block as it is stored is the serialization asked for.
+        CRawBlock rawBlock;
+        if (!ReadRawBlockFromDisk(rawBlock, pblockindex, config)) {
+            throw JSONRPCError(RPC_MISC_ERROR, "Block not found on disk");
+        }
+        return HexStr(rawBlock.begin(), rawBlock.end());
+    }
+
     if (!ReadBlockFromDisk(block, pblockindex, config)) {
         // Block not found on disk. This could be because we have the block
         // header in our index but don't have the block (for example if a
@@ -908,14 +924,19 @@ static void ApplyStats(CCoinsStats &stats, CHashWriter &ss, const uint256 &hash,
 
 //! Calculate statistics about the unspent transaction output set
 static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats) {
-    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
-
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
+    std::unique_ptr<CCoinsViewCursor> pcursor;
     {
+        // The coins database does not hold a complete set while the coins
+        // cache is partially written out, so write it out and open the cursor
+        // without letting blocks be connected in between.
         LOCK(cs_main);
+        FlushStateToDisk();
+        pcursor.reset(view->Cursor());
+        stats.hashBlock = pcursor->GetBestBlock();
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
     }
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     ss << stats.hashBlock;
     uint256 prevkey;
     std::map<uint32_t, Coin> outputs;
@@ -943,6 +964,76 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats) {
     return true;
 }
 
+/**
+ * Add the coins under cursor to commitment, up to the first one whose txid
+ * starts with a byte of at least nEnd.
+ */
+static bool ScanUTXOShard(CCoinsViewCursor *pcursor, int nEnd,
+                          CCoinsCommitment &commitment) {
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        COutPoint key;
+        Coin coin;
+        if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
+            return error("%s: unable to read value", __func__);
+        }
+        if (*key.hash.begin() >= nEnd) {
+            break;
+        }
+        commitment.AddCoin(key, coin);
+        pcursor->Next();
+    }
+    return true;
+}
+
+/**
+ * Calculate the UTXO set commitment from a scan of the whole set. The coins
+ * database is ordered by txid, so the set is split by the first byte of the
+ * txid into one range per thread.
+ */
+static bool ScanUTXOCommitment(CCoinsView *view,
+                               CCoinsCommitment &commitment) {
+    const int nShards = std::max(1, std::min(GetNumCores(), 16));
+    std::vector<std::unique_ptr<CCoinsViewCursor>> cursors;
+    {
+        // All cursors must see the same state, see GetUTXOStats.
+        LOCK(cs_main);
+        FlushStateToDisk();
+        for (int i = 0; i < nShards; i++) {
+            uint256 txidStart;
+            *txidStart.begin() = 256 * i / nShards;
+            cursors.emplace_back(view->Cursor(txidStart));
+        }
+    }
+
+    std::vector<CCoinsCommitment> shards(nShards);
+    std::vector<char> fShardOk(nShards, false);
+    boost::thread_group threads;
+    for (int i = 0; i < nShards; i++) {
+        threads.create_thread([&, i] {
+            fShardOk[i] = ScanUTXOShard(cursors[i].get(),
+                                        256 * (i + 1) / nShards, shards[i]);
+        });
+    }
+    try {
+        threads.join_all();
+    } catch (const boost::thread_interrupted &) {
+        threads.interrupt_all();
+        threads.join_all();
+        throw;
+    }
+
+    commitment = CCoinsCommitment();
+    commitment.hashBlock = cursors[0]->GetBestBlock();
+    for (int i = 0; i < nShards; i++) {
+        if (!fShardOk[i]) {
+            return false;
+        }
+        commitment.Merge(shards[i]);
+    }
+    return true;
+}
+
 UniValue pruneblockchain(const Config &config, const JSONRPCRequest &request) {
     if (request.fHelp || request.params.size() != 1) {
         throw std::runtime_error(
@@ -1007,34 +1098,87 @@ UniValue pruneblockchain(const Config &config, const JSONRPCRequest &request) {
 }
 
 UniValue gettxoutsetinfo(const Config &config, const JSONRPCRequest &request) {
-    if (request.fHelp || request.params.size() != 0) {
+    if (request.fHelp || request.params.size() > 1) {
         throw std::runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time, unless hash_type is muhash.\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"  (string, optional, default=hash_serialized) "
+            "Which UTXO set hash to calculate. hash_serialized is a hash of "
+            "the serialized set, which requires a scan of the whole set. "
+            "muhash is kept up to date as blocks are connected, unless "
+            "-coinscommitment=0, and is only calculated from a scan, split "
+            "across threads, when it is not known yet.\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
+            "  \"transactions\": n,      (numeric) The number of transactions, "
+            "only for hash_serialized\n"
             "  \"txouts\": n,            (numeric) The number of output "
             "transactions\n"
             "  \"bogosize\": n,          (numeric) A database-independent "
             "metric for UTXO set size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"hash_serialized\": \"hash\",   (string) The serialized hash, "
+            "only for hash_serialized\n"
+            "  \"muhash\": \"hash\",      (string) The MuHash3072 hash of the "
+            "set, only for muhash\n"
             "  \"disk_size\": n,         (numeric) The estimated size of the "
             "chainstate on disk\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("gettxoutsetinfo", "") +
+            HelpExampleCli("gettxoutsetinfo", "\"muhash\"") +
             HelpExampleRpc("gettxoutsetinfo", ""));
     }
 
+    std::string hashType = "hash_serialized";
+    if (request.params.size() > 0) {
+        hashType = request.params[0].get_str();
+    }
+    if (hashType != "hash_serialized" && hashType != "muhash") {
+        throw JSONRPCError(RPC_INVALID_PARAMETER,
+                           "Unknown hash_type: " + hashType);
+    }
+
     UniValue ret(UniValue::VOBJ);
 
+    if (hashType == "muhash") {
+        CCoinsCommitment commitment;
+        bool fKnown;
+        {
+            LOCK(cs_main);
+            fKnown = GetCoinsCommitment(commitment);
+        }
+        if (!fKnown) {
+            if (!ScanUTXOCommitment(pcoinsTip, commitment)) {
+                throw JSONRPCError(RPC_INTERNAL_ERROR,
+                                   "Unable to read UTXO set");
+            }
+            LOCK(cs_main);
+            SetCoinsCommitment(commitment);
+        }
+        int nHeight;
+        {
+            LOCK(cs_main);
+            nHeight = mapBlockIndex.find(commitment.hashBlock)->second->nHeight;
+        }
+        ret.push_back(Pair("height", int64_t(nHeight)));
+        ret.push_back(Pair("bestblock", commitment.hashBlock.GetHex()));
+        ret.push_back(
+            Pair("txouts", int64_t(commitment.nTransactionOutputs)));
+        ret.push_back(Pair("bogosize", int64_t(commitment.nBogoSize)));
+        ret.push_back(Pair("muhash", commitment.GetHash().GetHex()));
+        ret.push_back(
+            Pair("disk_size", uint64_t(pcoinsTip->EstimateSize())));
+        ret.push_back(
+            Pair("total_amount", ValueFromAmount(commitment.nTotalAmount)));
+        return ret;
+    }
+
     CCoinsStats stats;
-    FlushStateToDisk();
     if (GetUTXOStats(pcoinsTip, stats)) {
         ret.push_back(Pair("height", int64_t(stats.nHeight)));
         ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
@@ -1051,6 +1195,236 @@ UniValue gettxoutsetinfo(const Config &config, const JSONRPCRequest &request) {
     return ret;
 }
 
+static boost::filesystem::path GetSnapshotPath(const std::string &strPath) {
+    boost::filesystem::path path(strPath);
+    if (!path.is_complete()) {
+        path = GetDataDir() / path;
+    }
+    return path;
+}
+
+static UniValue SnapshotHeaderToJSON(const CUTXOSnapshotHeader &header,
+                                     const boost::filesystem::path &path) {
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("path", path.string()));
+    ret.push_back(Pair("bestblock", header.hashBlock.GetHex()));
+    ret.push_back(Pair("txouts", int64_t(header.nCoins)));
+    ret.push_back(Pair("muhash", header.hashCoins.GetHex()));
+    return ret;
+}
+
+UniValue dumptxoutset(const Config &config, const JSONRPCRequest &request) {
+    if (request.fHelp || request.params.size() != 1) {
+        throw std::runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrites the unspent transaction output set at the current tip "
+            "to a snapshot file, which loadtxoutset can load into a new "
+            "node.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"         (string, required) The file to write, "
+            "relative to the data directory unless absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"path\": \"path\",     (string) The absolute path of the file\n"
+            "  \"bestblock\": \"hex\", (string) The block of the snapshot\n"
+            "  \"txouts\": n,          (numeric) The number of outputs\n"
+            "  \"muhash\": \"hash\",   (string) The MuHash3072 hash of the "
+            "set, as reported by gettxoutsetinfo\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("dumptxoutset", "\"utxo.dat\"") +
+            HelpExampleRpc("dumptxoutset", "\"utxo.dat\""));
+    }
+
+    const boost::filesystem::path path =
+        GetSnapshotPath(request.params[0].get_str());
+    if (boost::filesystem::exists(path)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER,
+                           path.string() + " already exists");
+    }
+
+    CValidationState state;
+    CUTXOSnapshotHeader header;
+    if (!DumpUTXOSnapshot(state, pcoinsTip, path, header)) {
+        throw JSONRPCError(RPC_MISC_ERROR, state.GetRejectReason());
+    }
+    return SnapshotHeaderToJSON(header, path);
+}
+
+UniValue loadtxoutset(const Config &config, const JSONRPCRequest &request) {
+    if (request.fHelp || request.params.size() < 1 ||
+        request.params.size() > 2) {
+        throw std::runtime_error(
+            "loadtxoutset \"path\" ( \"muhash\" )\n"
+            "\nLoads a snapshot written by dumptxoutset and makes its block "
+            "the tip, after which the node continues from there.\n"
+            "The chain state must be at the genesis block, and the headers up "
+            "to the snapshot block must have been received. The blocks up to "
+            "the snapshot block are not downloaded or validated, so the "
+            "snapshot must come from a trusted source, and the node will not "
+            "serve them to peers.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"         (string, required) The file to read, relative "
+            "to the data directory unless absolute\n"
+            "2. \"muhash\"       (string, optional) The hash the snapshot must "
+            "have, as reported by gettxoutsetinfo \"muhash\" on a trusted "
+            "node\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"path\": \"path\",     (string) The absolute path of the file\n"
+            "  \"bestblock\": \"hex\", (string) The block of the snapshot\n"
+            "  \"txouts\": n,          (numeric) The number of outputs\n"
+            "  \"muhash\": \"hash\",   (string) The MuHash3072 hash of the "
+            "set\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("loadtxoutset", "\"utxo.dat\"") +
+            HelpExampleRpc("loadtxoutset", "\"utxo.dat\""));
+    }
+
+    const boost::filesystem::path path =
+        GetSnapshotPath(request.params[0].get_str());
+    uint256 hashExpected;
+    if (request.params.size() > 1) {
+        hashExpected = ParseHashV(request.params[1], "muhash");
+    }
+
+    CValidationState state;
+    CUTXOSnapshotHeader header;
+    if (!LoadUTXOSnapshot(config, state, path, hashExpected, header)) {
+        throw JSONRPCError(RPC_MISC_ERROR, state.GetRejectReason());
+    }
+
+    // Connect the blocks after the snapshot that are available already.
+    ActivateBestChain(config, state);
+    if (!state.IsValid()) {
+        throw JSONRPCError(RPC_DATABASE_ERROR, state.GetRejectReason());
+    }
+    return SnapshotHeaderToJSON(header, path);
+}
+
+UniValue compactchainstate(const Config &config,
+                           const JSONRPCRequest &request) {
+    if (request.fHelp || request.params.size() != 0) {
+        throw std::runtime_error(
+            "compactchainstate\n"
+            "\nCompacts the chain state database, which drops deleted and "
+            "overwritten coins from disk and leaves the rest in fewer, "
+            "lower level files. Blocks keep being connected meanwhile.\n"
+            "Note this call may take some time. Use -compactchainstate to "
+            "compact periodically.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"seconds\": x.xxx,     (numeric) The time the compaction "
+            "took\n"
+            "  \"disk_size_before\": n, (numeric) The estimated size of the "
+            "chainstate on disk before\n"
+            "  \"disk_size_after\": n,  (numeric) The estimated size after\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("compactchainstate", "") +
+            HelpExampleRpc("compactchainstate", ""));
+    }
+
+    // pcoinsdbview only changes during init and shutdown, when RPC is not
+    // available, and LevelDB compactions may run alongside writes.
+    UniValue ret(UniValue::VOBJ);
+    size_t nSizeBefore = pcoinsdbview->EstimateSize();
+    int64_t nStart = GetTimeMicros();
+    pcoinsdbview->Compact();
+    ret.push_back(Pair("seconds", 0.000001 * (GetTimeMicros() - nStart)));
+    ret.push_back(Pair("disk_size_before", uint64_t(nSizeBefore)));
+    ret.push_back(
+        Pair("disk_size_after", uint64_t(pcoinsdbview->EstimateSize())));
+    return ret;
+}
+
+static UniValue DBStatsToJSON(const CDBStats &stats) {
+    UniValue levels(UniValue::VARR);
+    double dCompactionTime = 0;
+    for (const CDBStats::Level &level : stats.levels) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("level", level.nLevel));
+        obj.push_back(Pair("files", level.nFiles));
+        obj.push_back(Pair("size_mb", level.dSize));
+        obj.push_back(Pair("read_mb", level.dRead));
+        obj.push_back(Pair("written_mb", level.dWritten));
+        obj.push_back(Pair("compaction_seconds", level.dCompactionTime));
+        levels.push_back(obj);
+        dCompactionTime += level.dCompactionTime;
+    }
+
+    const uint64_t nLookups = stats.nCacheHits + stats.nCacheMisses;
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("levels", levels));
+    ret.push_back(Pair("compaction_seconds", dCompactionTime));
+    ret.push_back(Pair("cache_hits", stats.nCacheHits));
+    ret.push_back(Pair("cache_misses", stats.nCacheMisses));
+    ret.push_back(Pair("cache_hit_rate",
+                       nLookups ? double(stats.nCacheHits) / nLookups : 0.0));
+    ret.push_back(Pair("cache_usage", uint64_t(stats.nCacheUsage)));
+    ret.push_back(Pair("memory_usage", stats.nMemoryUsage));
+    return ret;
+}
+
+UniValue getdbstats(const Config &config, const JSONRPCRequest &request) {
+    if (request.fHelp || request.params.size() != 0) {
+        throw std::runtime_error(
+            "getdbstats\n"
+            "\nReturns LevelDB statistics of the chain state and block index "
+            "databases, see the -db* options.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": {          (json object) The chain state "
+            "database\n"
+            "    \"levels\": [            (array) The levels that hold "
+            "files or have been compacted into\n"
+            "      {\n"
+            "        \"level\": n,        (numeric) The level\n"
+            "        \"files\": n,        (numeric) The number of files\n"
+            "        \"size_mb\": n,      (numeric) The size of the files, "
+            "in whole MiB\n"
+            "        \"read_mb\": n,      (numeric) MiB read by compactions "
+            "into this level\n"
+            "        \"written_mb\": n,   (numeric) MiB written by "
+            "compactions into this level\n"
+            "        \"compaction_seconds\": n (numeric) Time spent in "
+            "these compactions\n"
+            "      }, ...\n"
+            "    ],\n"
+            "    \"compaction_seconds\": n, (numeric) Time spent in "
+            "compactions since the database was opened\n"
+            "    \"cache_hits\": n,       (numeric) Block cache lookups that "
+            "found their block\n"
+            "    \"cache_misses\": n,     (numeric) Block cache lookups that "
+            "read from disk\n"
+            "    \"cache_hit_rate\": x.xxx, (numeric) The share of lookups "
+            "that hit\n"
+            "    \"cache_usage\": n,      (numeric) Bytes held by the block "
+            "cache\n"
+            "    \"memory_usage\": n      (numeric) Approximate bytes used "
+            "by LevelDB in total\n"
+            "  },\n"
+            "  \"blockindex\": {...}      (json object) The block index "
+            "database, as above\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getdbstats", "") +
+            HelpExampleRpc("getdbstats", ""));
+    }
+
+    CDBStats chainstate, blockindex;
+    pcoinsdbview->GetDBStats(chainstate);
+    pblocktree->GetStats(blockindex);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("chainstate", DBStatsToJSON(chainstate)));
+    ret.push_back(Pair("blockindex", DBStatsToJSON(blockindex)));
+    return ret;
+}
+
 UniValue gettxout(const Config &config, const JSONRPCRequest &request) {
     if (request.fHelp || request.params.size() < 2 ||
         request.params.size() > 3) {
@@ -1660,7 +2034,11 @@ static const CRPCCommand commands[] = {
     { "blockchain",         "getmempoolinfo",         getmempoolinfo,         true,  {} },
     { "blockchain",         "getrawmempool",          getrawmempool,          true,  {"verbose"} },
     { "blockchain",         "gettxout",               gettxout,               true,  {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        gettxoutsetinfo,        true,  {} },
+    { "blockchain",         "gettxoutsetinfo",        gettxoutsetinfo,        true,  {"hash_type"} },
+    { "blockchain",         "dumptxoutset",           dumptxoutset,           true,  {"path"} },
+    { "blockchain",         "loadtxoutset",           loadtxoutset,           true,  {"path","muhash"} },
+    { "blockchain",         "compactchainstate",      compactchainstate,      true,  {} },
+    { "blockchain",         "getdbstats",             getdbstats,             true,  {} },
     { "blockchain",         "pruneblockchain",        pruneblockchain,        true,  {"height"} },
     { "blockchain",         "verifychain",            verifychain,            true,  {"checklevel","nblocks"} },
     { "blockchain",         "preciousblock",          preciousblock,          true,  {"blockhash"} },
@@ -130,8 +130,11 @@ static UniValue generateBlocks(const Config &config,
     }
 
     const CChainParams& params = Params();
-    unsigned int n = params.EquihashN();
-    unsigned int k = params.EquihashK();
+    int nThreads = GetArg("-genproclimit", DEFAULT_GENPROCLIMIT);
+    if (nThreads <= 0) {
+        nThreads = GetNumCores();
+    }
+    nThreads = std::min(nThreads, MAX_GENPROCLIMIT);
     unsigned int nExtraNonce = 0;
     UniValue blockHashes(UniValue::VARR);
 
@@ -156,45 +159,27 @@ static UniValue generateBlocks(const Config &config,
              while (nMaxTries > 0 && (int)pblock->nNonce.GetUint64(0) < nInnerLoopCount &&
                     !CheckProofOfWork(pblock->GetHash(), pblock->nBits, false,config)) {
                  pblock->nNonce = ArithToUint256(UintToArith256(pblock->nNonce) + 1);
+                 pblock->hashCache.Clear();
                  --nMaxTries;
              }
          } else {
-             // Solve Equihash.
-             crypto_generichash_blake2b_state eh_state;
-             EhInitialiseState(n, k, eh_state);
-
-             // I = the block header minus nonce and solution.
-             CEquihashInput I{*pblock};
-             CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-             ss << I;
-
-             // H(I||...
-             crypto_generichash_blake2b_update(&eh_state, (unsigned char*)&ss[0], ss.size());
-
-             while (nMaxTries > 0 &&
-                    ((int)pblock->nNonce.GetUint64(0) & nInnerLoopEquihashMask) < nInnerLoopEquihashCount) {
-                 // Yes, there is a chance every nonce could fail to satisfy the -regtest
-                 // target -- 1 in 2^(2^256). That ain't gonna happen
-                 pblock->nNonce = ArithToUint256(UintToArith256(pblock->nNonce) + 1);
-
-                 // H(I||V||...
-                 crypto_generichash_blake2b_state curr_state;
-                 curr_state = eh_state;
-                 crypto_generichash_blake2b_update(&curr_state,
-                                                   pblock->nNonce.begin(),
-                                                   pblock->nNonce.size());
-
-                 // (x_1, x_2, ...) = A(I, V, n, k)
-                 std::function<bool(std::vector<unsigned char>)> validBlock =
-                         [&pblock](std::vector<unsigned char> soln) {
-                     pblock->nSolution = soln;
-                     return CheckProofOfWork(pblock->GetHash(), pblock->nBits,true, Params().GetConsensus());
-                 };
-                 bool found = EhBasicSolveUncancellable(n, k, curr_state, validBlock);
-                 --nMaxTries;
-                 if (found) {
+             // Solve Equihash, spreading the nonces over the solver threads.
+             uint64_t nTries = std::min<uint64_t>(
+                 nMaxTries,
+                 nInnerLoopEquihashCount -
+                     ((int)pblock->nNonce.GetUint64(0) & nInnerLoopEquihashMask));
+             uint64_t nTried = 0;
+             bool found = SolveEquihash(config, pblock, nTries, nThreads,
+                                        ShutdownRequested, nTried);
+             nMaxTries -= nTried;
+             if (ShutdownRequested()) {
+                 throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down");
+             }
+             if (!found) {
+                 if (nMaxTries == 0) {
                      break;
                  }
+                 continue;
              }
          }
 
@@ -742,6 +727,7 @@ static UniValue getblocktemplate(const Config &config,
     UpdateTime(pblock, config, pindexPrev);
     pblock->nNonce = uint256();
     pblock->nSolution.clear();
+    pblock->hashCache.Clear();
 
     UniValue aCaps(UniValue::VARR);
     aCaps.push_back("proposal");
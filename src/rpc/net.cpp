@@ -131,6 +131,12 @@ static UniValue getpeerinfo(const Config &config,
             "       \"addr\": n,              (numeric) The total bytes "
             "received aggregated by message type\n"
             "       ...\n"
+            "    },\n"
+            "    \"timeprocessed_per_msg\": {\n"
+            "       \"addr\": n,              (numeric) The total time in "
+            "microseconds spent processing received messages, aggregated "
+            "by message type\n"
+            "       ...\n"
             "    }\n"
             "  }\n"
             "  ,...\n"
@@ -213,6 +219,15 @@ static UniValue getpeerinfo(const Config &config,
         }
         obj.push_back(Pair("bytesrecv_per_msg", recvPerMsgCmd));
 
+        UniValue processPerMsgCmd(UniValue::VOBJ);
+        for (const mapMsgCmdProcessStats::value_type &i :
+             stats.mapProcessStatsPerMsgCmd) {
+            if (i.second.nCount > 0) {
+                processPerMsgCmd.push_back(Pair(i.first, i.second.nMicros));
+            }
+        }
+        obj.push_back(Pair("timeprocessed_per_msg", processPerMsgCmd));
+
         ret.push_back(obj);
     }
 
@@ -458,6 +473,188 @@ static UniValue getnettotals(const Config &config,
     return obj;
 }
 
+static UniValue ProcessStatsToJSON(const CMsgProcessStats &stats,
+                                   bool fSendMessages = false) {
+    static const char *const bucketNames[CMsgProcessStats::HISTOGRAM_BUCKETS] =
+        {"10us", "100us", "1ms", "10ms", "100ms", "1s", "more"};
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("count", stats.nCount));
+    obj.push_back(Pair("time", stats.nMicros));
+    if (fSendMessages) {
+        obj.push_back(Pair("skipped", stats.nSkipped));
+    } else {
+        obj.push_back(Pair("cs_main_wait", stats.nLockWaitMicros));
+    }
+    UniValue histogram(UniValue::VOBJ);
+    for (int i = 0; i < CMsgProcessStats::HISTOGRAM_BUCKETS; i++) {
+        histogram.push_back(Pair(bucketNames[i], stats.histogram[i]));
+    }
+    obj.push_back(Pair("histogram", histogram));
+    return obj;
+}
+
+static UniValue MsgStatsToJSON(const CNetMsgStats &stats) {
+    // Only the message types which have been seen at all.
+    std::set<std::string> setCommands;
+    for (const mapMsgCmdSize::value_type &i : stats.mapSendMsgsPerMsgCmd) {
+        if (i.second > 0) setCommands.insert(i.first);
+    }
+    for (const mapMsgCmdSize::value_type &i : stats.mapRecvMsgsPerMsgCmd) {
+        if (i.second > 0) setCommands.insert(i.first);
+    }
+
+    UniValue obj(UniValue::VOBJ);
+    for (const std::string &strCommand : setCommands) {
+        auto count = [&strCommand](const mapMsgCmdSize &map) -> uint64_t {
+            mapMsgCmdSize::const_iterator it = map.find(strCommand);
+            return it == map.end() ? 0 : it->second;
+        };
+        UniValue cmd(UniValue::VOBJ);
+        cmd.push_back(Pair("recvmsgs", count(stats.mapRecvMsgsPerMsgCmd)));
+        cmd.push_back(Pair("recvbytes", count(stats.mapRecvBytesPerMsgCmd)));
+        cmd.push_back(Pair("sentmsgs", count(stats.mapSendMsgsPerMsgCmd)));
+        cmd.push_back(Pair("sentbytes", count(stats.mapSendBytesPerMsgCmd)));
+        mapMsgCmdProcessStats::const_iterator it =
+            stats.mapProcessStatsPerMsgCmd.find(strCommand);
+        if (it != stats.mapProcessStatsPerMsgCmd.end() &&
+            it->second.nCount > 0) {
+            cmd.push_back(Pair("processed", ProcessStatsToJSON(it->second)));
+        }
+        obj.push_back(Pair(strCommand, cmd));
+    }
+    return obj;
+}
+
+static UniValue QueuesToJSON(size_t nProcessQueueMsgs,
+                             size_t nProcessQueueSize, size_t nSendQueueMsgs,
+                             size_t nSendQueueSize) {
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("processmsgs", uint64_t(nProcessQueueMsgs)));
+    obj.push_back(Pair("processbytes", uint64_t(nProcessQueueSize)));
+    obj.push_back(Pair("sendmsgs", uint64_t(nSendQueueMsgs)));
+    obj.push_back(Pair("sendbytes", uint64_t(nSendQueueSize)));
+    return obj;
+}
+
+static UniValue getnetstats(const Config &config,
+                            const JSONRPCRequest &request) {
+    if (request.fHelp || request.params.size() > 0) {
+        throw std::runtime_error(
+            "getnetstats\n"
+            "\nReturns message counts, bytes and processing times per "
+            "message type, for each connected peer and added up over all "
+            "peers since startup.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"peers\": [\n"
+            "    {\n"
+            "      \"id\": n,                  (numeric) Peer index\n"
+            "      \"addr\": \"host:port\",      (string) The ip address and "
+            "port of the peer\n"
+            "      \"queues\": {\n"
+            "        \"processmsgs\": n,       (numeric) Received messages "
+            "waiting to be processed\n"
+            "        \"processbytes\": n,      (numeric) Their size in bytes\n"
+            "        \"sendmsgs\": n,          (numeric) Message buffers "
+            "waiting to be sent\n"
+            "        \"sendbytes\": n          (numeric) Their size in bytes\n"
+            "      },\n"
+            "      \"sendmessages\": {...},    (json object) Processing "
+            "statistics of the periodic message sending to the peer, as "
+            "\"processed\" below but with \"skipped\", the number of times "
+            "it was put off because cs_main was busy and not counted "
+            "otherwise, instead of \"cs_main_wait\"\n"
+            "      \"msgs\": {\n"
+            "        \"addr\": {               (json object) Per message "
+            "type\n"
+            "          \"recvmsgs\": n,        (numeric) Messages received\n"
+            "          \"recvbytes\": n,       (numeric) Bytes received\n"
+            "          \"sentmsgs\": n,        (numeric) Messages sent\n"
+            "          \"sentbytes\": n,       (numeric) Bytes sent\n"
+            "          \"processed\": {        (json object) Only for "
+            "processed messages\n"
+            "            \"count\": n,         (numeric) Messages processed\n"
+            "            \"time\": n,          (numeric) Microseconds spent "
+            "processing them\n"
+            "            \"cs_main_wait\": n,  (numeric) Microseconds of that "
+            "spent waiting for cs_main in the message handler itself and, "
+            "for headers and blocks, in accepting and connecting them\n"
+            "            \"histogram\": {      (json object) Messages by "
+            "processing time, up to 10us, 100us, 1ms, 10ms, 100ms, 1s, "
+            "and more\n"
+            "              \"10us\": n,\n"
+            "              ...\n"
+            "            }\n"
+            "          }\n"
+            "        },\n"
+            "        ...\n"
+            "      }\n"
+            "    },\n"
+            "    ...\n"
+            "  ],\n"
+            "  \"totals\": {              (json object) As for a peer, over "
+            "the connected and disconnected peers; queues are only of the "
+            "connected peers\n"
+            "    \"queues\": {...},\n"
+            "    \"sendmessages\": {...},\n"
+            "    \"msgs\": {...}\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getnetstats", "") +
+            HelpExampleRpc("getnetstats", ""));
+    }
+
+    if (!g_connman) {
+        throw JSONRPCError(
+            RPC_CLIENT_P2P_DISABLED,
+            "Error: Peer-to-peer functionality missing or disabled");
+    }
+
+    std::vector<CNodeStats> vstats;
+    g_connman->GetNodeStats(vstats);
+    CNetMsgStats totals = g_connman->GetDisconnectedMsgStats();
+    size_t nProcessQueueMsgs = 0, nProcessQueueSize = 0;
+    size_t nSendQueueMsgs = 0, nSendQueueSize = 0;
+
+    UniValue peers(UniValue::VARR);
+    for (const CNodeStats &stats : vstats) {
+        CNetMsgStats msgStats;
+        msgStats.Add(stats);
+        totals.Add(stats);
+        nProcessQueueMsgs += stats.nProcessQueueMsgs;
+        nProcessQueueSize += stats.nProcessQueueSize;
+        nSendQueueMsgs += stats.nSendQueueMsgs;
+        nSendQueueSize += stats.nSendQueueSize;
+
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("id", stats.nodeid));
+        obj.push_back(Pair("addr", stats.addrName));
+        obj.push_back(Pair("queues", QueuesToJSON(stats.nProcessQueueMsgs,
+                                                  stats.nProcessQueueSize,
+                                                  stats.nSendQueueMsgs,
+                                                  stats.nSendQueueSize)));
+        obj.push_back(Pair("sendmessages",
+                           ProcessStatsToJSON(stats.sendMessagesStats, true)));
+        obj.push_back(Pair("msgs", MsgStatsToJSON(msgStats)));
+        peers.push_back(obj);
+    }
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("queues",
+                       QueuesToJSON(nProcessQueueMsgs, nProcessQueueSize,
+                                    nSendQueueMsgs, nSendQueueSize)));
+    obj.push_back(Pair("sendmessages",
+                       ProcessStatsToJSON(totals.sendMessagesStats, true)));
+    obj.push_back(Pair("msgs", MsgStatsToJSON(totals)));
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("peers", peers));
+    ret.push_back(Pair("totals", obj));
+    return ret;
+}
+
 static UniValue GetNetworksInfo() {
     UniValue networks(UniValue::VARR);
     for (int n = 0; n < NET_MAX; ++n) {
@@ -755,6 +952,7 @@ static const CRPCCommand commands[] = {
     { "network",            "getaddednodeinfo",       getaddednodeinfo,       true,  {"node"} },
     { "network",            "getnettotals",           getnettotals,           true,  {} },
     { "network",            "getnetworkinfo",         getnetworkinfo,         true,  {} },
+    { "network",            "getnetstats",            getnetstats,            true,  {} },
     { "network",            "setban",                 setban,                 true,  {"subnet", "command", "bantime", "absolute"} },
     { "network",            "listbanned",             listbanned,             true,  {} },
     { "network",            "clearbanned",            clearbanned,            true,  {} },
@@ -120,6 +120,42 @@ private:
     size_t nPos;
 };
 
+/**
+ * Minimal stream for reading from a byte range without copying it. The range
+ * must outlive the reader.
+ */
+class CSpanReader {
+public:
+    CSpanReader(int nTypeIn, int nVersionIn, const uint8_t *pbeginIn,
+                const uint8_t *pendIn)
+        : nType(nTypeIn), nVersion(nVersionIn), pcur(pbeginIn),
+          pend(pendIn) {}
+
+    void read(char *pch, size_t nSize) {
+        if (nSize > size()) {
+            throw std::ios_base::failure(
+                "CSpanReader::read(): end of data");
+        }
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+    }
+    template <typename T> CSpanReader &operator>>(T &obj) {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+    int GetVersion() const { return nVersion; }
+    int GetType() const { return nType; }
+    size_t size() const { return pend - pcur; }
+    bool empty() const { return pcur == pend; }
+
+private:
+    const int nType;
+    const int nVersion;
+    const uint8_t *pcur;
+    const uint8_t *pend;
+};
+
 /**
  * Double ended buffer combining vector and stream-like interfaces.
  *
@@ -18,6 +18,29 @@ void PrintLockContention(const char *pszName, const char *pszFile, int nLine) {
 }
 #endif /* DEBUG_LOCKCONTENTION */
 
+// The timers are owned by their scopes, so there is nothing to clean up when
+// a thread exits.
+static boost::thread_specific_ptr<CLockWaitTimer>
+    lockwaittimer([](CLockWaitTimer *) {});
+
+CLockWaitTimer::CLockWaitTimer(const void *csIn)
+    : cs(csIn), nWaitMicros(0), pprev(lockwaittimer.get()) {
+    lockwaittimer.reset(this);
+}
+
+CLockWaitTimer::~CLockWaitTimer() {
+    lockwaittimer.reset(pprev);
+}
+
+CLockWaitTimer *CLockWaitTimer::Find(const void *cs) {
+    CLockWaitTimer *timer = lockwaittimer.get();
+    return timer != nullptr && timer->cs == cs ? timer : nullptr;
+}
+
+int64_t CLockWaitTimer::GetTimeMicros() {
+    return ::GetTimeMicros();
+}
+
 #ifdef DEBUG_LOCKORDER
 //
 // Early deadlock detection.
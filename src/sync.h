@@ -8,6 +8,8 @@
 
 #include "threadsafety.h"
 
+#include <cstdint>
+
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
@@ -102,11 +104,35 @@ typedef boost::condition_variable CConditionVariable;
 void PrintLockContention(const char *pszName, const char *pszFile, int nLine);
 #endif
 
+/**
+ * While in scope, adds up the time the current thread spends waiting to lock
+ * one mutex, such as cs_main, with LOCK_TIMED. Timers may be nested, the
+ * innermost one is the one in effect.
+ */
+class CLockWaitTimer {
+private:
+    const void *cs;
+    int64_t nWaitMicros;
+    CLockWaitTimer *pprev;
+
+public:
+    explicit CLockWaitTimer(const void *csIn);
+    ~CLockWaitTimer();
+
+    int64_t GetWaitMicros() const { return nWaitMicros; }
+    void AddWait(int64_t nMicros) { nWaitMicros += nMicros; }
+
+    /** The current thread's timer for cs, if there is one. */
+    static CLockWaitTimer *Find(const void *cs);
+    static int64_t GetTimeMicros();
+};
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template <typename Mutex> class SCOPED_LOCKABLE CMutexLock {
 private:
     boost::unique_lock<Mutex> lock;
 
+protected:
     void Enter(const char *pszName, const char *pszFile, int nLine) {
         EnterCritical(pszName, pszFile, nLine, (void *)(lock.mutex()));
 #ifdef DEBUG_LOCKCONTENTION
@@ -156,6 +182,32 @@ public:
 
 typedef CMutexLock<CCriticalSection> CCriticalBlock;
 
+/**
+ * CMutexLock that adds the time spent waiting for a contended lock to the
+ * current thread's CLockWaitTimer for the mutex, if there is one.
+ */
+template <typename Mutex>
+class SCOPED_LOCKABLE CWaitTimedMutexLock : public CMutexLock<Mutex> {
+public:
+    CWaitTimedMutexLock(Mutex &mutexIn, const char *pszName,
+                        const char *pszFile, int nLine)
+        EXCLUSIVE_LOCK_FUNCTION(mutexIn)
+        : CMutexLock<Mutex>(mutexIn, pszName, pszFile, nLine, true) {
+        if (*this) {
+            return;
+        }
+        // Only a contended lock is looked up in the wait timers.
+        CLockWaitTimer *timer = CLockWaitTimer::Find(&mutexIn);
+        int64_t nStart = timer ? CLockWaitTimer::GetTimeMicros() : 0;
+        this->Enter(pszName, pszFile, nLine);
+        if (timer) {
+            timer->AddWait(CLockWaitTimer::GetTimeMicros() - nStart);
+        }
+    }
+};
+
+typedef CWaitTimedMutexLock<CCriticalSection> CWaitTimedCriticalBlock;
+
 #define PASTE(x, y) x##y
 #define PASTE2(x, y) PASTE(x, y)
 
@@ -165,6 +217,9 @@ typedef CMutexLock<CCriticalSection> CCriticalBlock;
 #define LOCK2(cs1, cs2)                                                        \
     CCriticalBlock criticalblock1(cs1, #cs1, __FILE__, __LINE__),              \
         criticalblock2(cs2, #cs2, __FILE__, __LINE__)
+#define LOCK_TIMED(cs)                                                         \
+    CWaitTimedCriticalBlock PASTE2(criticalblock, __COUNTER__)(                \
+        cs, #cs, __FILE__, __LINE__)
 #define TRY_LOCK(cs, name)                                                     \
     CCriticalBlock name(cs, #cs, __FILE__, __LINE__, true)
 
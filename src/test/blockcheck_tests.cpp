@@ -96,4 +96,46 @@ BOOST_AUTO_TEST_CASE(blockfail) {
     RunCheckOnBlock(config, block, "bad-blk-length");
 }
 
+BOOST_AUTO_TEST_CASE(blockfail_parallel) {
+    SelectParams(CBaseChainParams::MAIN);
+
+    GlobalConfig config;
+    config.SetMaxBlockSize(DEFAULT_MAX_BLOCK_SIZE);
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig.resize(10);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = Amount(42);
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(tx));
+    tx.vin[0].prevout.n = 0;
+    for (size_t i = 1; i < 1000; i++) {
+        tx.vin[0].prevout.hash = GetRandHash();
+        block.vtx.push_back(MakeTransactionRef(tx));
+    }
+
+    // Two bad transactions, the first one in block order must be reported
+    // whether or not the checks run on the transaction check queue.
+    CMutableTransaction badTx(tx);
+    badTx.vout[0].nValue = Amount(-1);
+    block.vtx[700] = MakeTransactionRef(badTx);
+    badTx = tx;
+    badTx.vout.clear();
+    block.vtx[300] = MakeTransactionRef(badTx);
+
+    const int nOldScriptCheckThreads = nScriptCheckThreads;
+    for (int nThreads : {0, 2}) {
+        nScriptCheckThreads = nThreads;
+        CValidationState state;
+        RunCheckOnBlockImpl(config, block, state, false);
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txns-vout-empty");
+        BOOST_CHECK_EQUAL(state.GetDebugMessage(),
+                          strprintf("Transaction check failed (txid %s) ",
+                                    block.vtx[300]->GetId().ToString()));
+    }
+    nScriptCheckThreads = nOldScriptCheckThreads;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -364,6 +364,48 @@ BOOST_AUTO_TEST_CASE(EmptyBlockRoundTripTest) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(EquihashHeaderRoundTripTest) {
+    CTxMemPool pool(CFeeRate(Amount(0)));
+    TestMemPoolEntryHelper entry;
+    CBlock block(BuildBlockTestCase());
+    block.nHeight = Params().GetConsensus().BCPHeight + 1;
+    block.nReserved[3] = 7;
+    block.nNonce = GetRandHash();
+    block.nSolution.resize(1344);
+    GetRandBytes(block.nSolution.data(), block.nSolution.size());
+
+    pool.addUnchecked(block.vtx[2]->GetId(), entry.FromTx(*block.vtx[2]));
+
+    CBlockHeaderAndShortTxIDs shortIDs(block);
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << shortIDs;
+
+    CBlockHeaderAndShortTxIDs shortIDs2;
+    stream >> shortIDs2;
+
+    // The whole header is kept, so both sides derive the same short IDs.
+    BOOST_CHECK_EQUAL(shortIDs2.header.GetHash().ToString(),
+                      block.GetHash().ToString());
+    BOOST_CHECK_EQUAL(shortIDs2.header.nHeight, block.nHeight);
+    BOOST_CHECK(shortIDs2.header.nNonce == block.nNonce);
+    BOOST_CHECK(shortIDs2.header.nSolution == block.nSolution);
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        BOOST_CHECK_EQUAL(shortIDs2.GetShortID(block.vtx[i]->GetHash()),
+                          shortIDs.GetShortID(block.vtx[i]->GetHash()));
+    }
+
+    PartiallyDownloadedBlock partialBlock(GetConfig(), &pool);
+    BOOST_CHECK(partialBlock.InitData(shortIDs2, extra_txn) == READ_STATUS_OK);
+    BOOST_CHECK(partialBlock.IsTxAvailable(0));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(1));
+    BOOST_CHECK(partialBlock.IsTxAvailable(2));
+
+    // The legacy header format cannot carry a compact block.
+    CDataStream legacyStream(SER_NETWORK,
+                             PROTOCOL_VERSION | SERIALIZE_BLOCK_LEGACY);
+    BOOST_CHECK_THROW(legacyStream << shortIDs, std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest) {
     BlockTransactionsRequest req1;
     req1.blockhash = GetRandHash();
@@ -0,0 +1,80 @@
+// Copyright (c) 2017 The Bitcoin Cash Plus developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blocksolutioncache.h"
+#include "chain.h"
+
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blocksolutioncache_tests, BasicTestingSetup)
+
+static std::vector<unsigned char> Solution(unsigned char n) {
+    return std::vector<unsigned char>(4, n);
+}
+
+BOOST_AUTO_TEST_CASE(blocksolutioncache_unwritten) {
+    CBlockSolutionCache cache(2);
+    CBlockIndex index[4];
+    std::vector<unsigned char> solution;
+
+    // Solutions not written yet are all kept, whatever the size of the cache.
+    for (int i = 0; i < 4; i++) {
+        cache.AddUnwritten(&index[i], Solution(i));
+    }
+    BOOST_CHECK_EQUAL(cache.UnwrittenCount(), 4U);
+    for (int i = 0; i < 4; i++) {
+        BOOST_CHECK(cache.Get(&index[i], solution));
+        BOOST_CHECK(solution == Solution(i));
+    }
+
+    // Once written, only the most recently used ones are.
+    cache.MarkWritten({&index[0], &index[1], &index[2]});
+    BOOST_CHECK_EQUAL(cache.UnwrittenCount(), 1U);
+    BOOST_CHECK(!cache.Get(&index[0], solution));
+    BOOST_CHECK(cache.Get(&index[1], solution));
+    BOOST_CHECK(solution == Solution(1));
+    BOOST_CHECK(cache.Get(&index[2], solution));
+    BOOST_CHECK(cache.Get(&index[3], solution));
+
+    // A solution added again while unwritten replaces the held one.
+    cache.AddUnwritten(&index[3], Solution(7));
+    BOOST_CHECK(cache.Get(&index[3], solution));
+    BOOST_CHECK(solution == Solution(7));
+
+    cache.Clear();
+    BOOST_CHECK_EQUAL(cache.UnwrittenCount(), 0U);
+    BOOST_CHECK(!cache.Get(&index[1], solution));
+    BOOST_CHECK(!cache.Get(&index[3], solution));
+}
+
+BOOST_AUTO_TEST_CASE(blocksolutioncache_recent) {
+    CBlockSolutionCache cache(2);
+    CBlockIndex index[3];
+    std::vector<unsigned char> solution;
+
+    cache.AddRecent(&index[0], Solution(0));
+    cache.AddRecent(&index[1], Solution(1));
+    // Using the first makes the second the least recently used ...
+    BOOST_CHECK(cache.Get(&index[0], solution));
+    BOOST_CHECK(solution == Solution(0));
+    // ... so it goes when a third is added.
+    cache.AddRecent(&index[2], Solution(2));
+    BOOST_CHECK(cache.Get(&index[0], solution));
+    BOOST_CHECK(!cache.Get(&index[1], solution));
+    BOOST_CHECK(cache.Get(&index[2], solution));
+    BOOST_CHECK(solution == Solution(2));
+
+    // Adding one that is present only updates it.
+    cache.AddRecent(&index[0], Solution(5));
+    BOOST_CHECK(cache.Get(&index[0], solution));
+    BOOST_CHECK(solution == Solution(5));
+    BOOST_CHECK(cache.Get(&index[2], solution));
+    BOOST_CHECK_EQUAL(cache.UnwrittenCount(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -73,6 +73,11 @@ public:
         }
         return true;
     }
+
+    bool BatchWritePartial(CCoinsMap &mapCoins,
+                           const uint256 &hashBlock) override {
+        return BatchWrite(mapCoins, uint256());
+    }
 };
 
 class CCoinsViewCacheTest : public CCoinsViewCache {
@@ -122,6 +127,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test) {
     bool found_an_entry = false;
     bool missed_an_entry = false;
     bool uncached_an_entry = false;
+    bool synced_a_cache = false;
 
     // A simple map to track what we expect the cache stack to represent.
     std::map<COutPoint, Coin> result;
@@ -206,11 +212,18 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test) {
             }
         }
 
-        // Every 100 iterations, flush an intermediate cache
+        // Every 100 iterations, flush or partially sync an intermediate cache
         if (insecure_rand() % 100 == 0) {
             if (stack.size() > 1 && insecure_rand() % 2 == 0) {
                 unsigned int flushIndex = insecure_rand() % (stack.size() - 1);
-                stack[flushIndex]->Flush();
+                if (insecure_rand() % 2 == 0) {
+                    stack[flushIndex]->Flush();
+                } else {
+                    bool fComplete = false;
+                    BOOST_CHECK(stack[flushIndex]->Sync(
+                        1 + insecure_rand() % 64, fComplete));
+                    synced_a_cache = true;
+                }
             }
         }
         if (insecure_rand() % 100 == 0) {
@@ -254,6 +267,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test) {
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
     BOOST_CHECK(uncached_an_entry);
+    BOOST_CHECK(synced_a_cache);
 }
 
 // Store of all necessary tx and undo data for next test
@@ -680,6 +694,109 @@ BOOST_AUTO_TEST_CASE(coin_access) {
     CheckAccessCoin(VALUE1, VALUE2, VALUE2, DIRTY | FRESH, DIRTY | FRESH);
 }
 
+void CheckCacheBaseCoin(const Amount base_value, const Amount cache_value,
+                        const Amount expected_value, char cache_flags,
+                        char expected_flags) {
+    SingleEntryCacheTest test(base_value, cache_value, cache_flags);
+    Coin coin;
+    if (test.base.GetCoin(OUTPOINT, coin)) {
+        test.cache.CacheBaseCoin(OUTPOINT, std::move(coin));
+    }
+    test.cache.SelfTest();
+
+    Amount result_value;
+    char result_flags;
+    GetCoinMapEntry(test.cache.map(), result_value, result_flags);
+    BOOST_CHECK_EQUAL(result_value, expected_value);
+    BOOST_CHECK_EQUAL(result_flags, expected_flags);
+}
+
+BOOST_AUTO_TEST_CASE(coin_cache_base) {
+    /* Check CacheBaseCoin behavior, caching the coin read from the base view
+     * the way the block input prefetch does. The resulting entry must be the
+     * same as after AccessCoin.
+     *
+     *                  Base    Cache   Result  Cache        Result
+     *                  Value   Value   Value   Flags        Flags
+     */
+    CheckCacheBaseCoin(ABSENT, ABSENT, ABSENT, NO_ENTRY, NO_ENTRY);
+    CheckCacheBaseCoin(ABSENT, PRUNED, PRUNED, 0, 0);
+    CheckCacheBaseCoin(ABSENT, PRUNED, PRUNED, FRESH, FRESH);
+    CheckCacheBaseCoin(ABSENT, PRUNED, PRUNED, DIRTY, DIRTY);
+    CheckCacheBaseCoin(ABSENT, PRUNED, PRUNED, DIRTY | FRESH, DIRTY | FRESH);
+    CheckCacheBaseCoin(ABSENT, VALUE2, VALUE2, 0, 0);
+    CheckCacheBaseCoin(ABSENT, VALUE2, VALUE2, FRESH, FRESH);
+    CheckCacheBaseCoin(ABSENT, VALUE2, VALUE2, DIRTY, DIRTY);
+    CheckCacheBaseCoin(ABSENT, VALUE2, VALUE2, DIRTY | FRESH, DIRTY | FRESH);
+    CheckCacheBaseCoin(PRUNED, ABSENT, PRUNED, NO_ENTRY, FRESH);
+    CheckCacheBaseCoin(PRUNED, PRUNED, PRUNED, 0, 0);
+    CheckCacheBaseCoin(PRUNED, PRUNED, PRUNED, FRESH, FRESH);
+    CheckCacheBaseCoin(PRUNED, PRUNED, PRUNED, DIRTY, DIRTY);
+    CheckCacheBaseCoin(PRUNED, PRUNED, PRUNED, DIRTY | FRESH, DIRTY | FRESH);
+    CheckCacheBaseCoin(PRUNED, VALUE2, VALUE2, 0, 0);
+    CheckCacheBaseCoin(PRUNED, VALUE2, VALUE2, FRESH, FRESH);
+    CheckCacheBaseCoin(PRUNED, VALUE2, VALUE2, DIRTY, DIRTY);
+    CheckCacheBaseCoin(PRUNED, VALUE2, VALUE2, DIRTY | FRESH, DIRTY | FRESH);
+    CheckCacheBaseCoin(VALUE1, ABSENT, VALUE1, NO_ENTRY, 0);
+    CheckCacheBaseCoin(VALUE1, PRUNED, PRUNED, 0, 0);
+    CheckCacheBaseCoin(VALUE1, PRUNED, PRUNED, FRESH, FRESH);
+    CheckCacheBaseCoin(VALUE1, PRUNED, PRUNED, DIRTY, DIRTY);
+    CheckCacheBaseCoin(VALUE1, PRUNED, PRUNED, DIRTY | FRESH, DIRTY | FRESH);
+    CheckCacheBaseCoin(VALUE1, VALUE2, VALUE2, 0, 0);
+    CheckCacheBaseCoin(VALUE1, VALUE2, VALUE2, FRESH, FRESH);
+    CheckCacheBaseCoin(VALUE1, VALUE2, VALUE2, DIRTY, DIRTY);
+    CheckCacheBaseCoin(VALUE1, VALUE2, VALUE2, DIRTY | FRESH, DIRTY | FRESH);
+}
+
+void CheckSyncCoin(Amount base_value, Amount cache_value,
+                   Amount expected_base_value, Amount expected_value,
+                   char cache_flags, char expected_flags) {
+    SingleEntryCacheTest test(base_value, cache_value, cache_flags);
+    bool fComplete = false;
+    BOOST_CHECK(test.cache.Sync(1, fComplete));
+    BOOST_CHECK(fComplete);
+    test.cache.SelfTest();
+    test.base.SelfTest();
+
+    Amount result_value;
+    char result_flags;
+    GetCoinMapEntry(test.cache.map(), result_value, result_flags);
+    BOOST_CHECK_EQUAL(result_value, expected_value);
+    BOOST_CHECK_EQUAL(result_flags, expected_flags);
+    GetCoinMapEntry(test.base.map(), result_value, result_flags);
+    BOOST_CHECK_EQUAL(result_value, expected_base_value);
+}
+
+BOOST_AUTO_TEST_CASE(coin_sync) {
+    /* Check Sync behavior, writing the modified entry of a cache to its base
+     * while keeping it cached. Written coins stay as unmodified entries, and
+     * written spent coins are dropped.
+     *
+     *             Base    Cache   Result  Result  Cache        Result
+     *             Value   Value   Base    Value   Flags        Flags
+     */
+    CheckSyncCoin(ABSENT, ABSENT, ABSENT, ABSENT, NO_ENTRY, NO_ENTRY);
+    CheckSyncCoin(ABSENT, PRUNED, PRUNED, ABSENT, DIRTY, NO_ENTRY);
+    CheckSyncCoin(ABSENT, PRUNED, PRUNED, ABSENT, DIRTY | FRESH, NO_ENTRY);
+    CheckSyncCoin(ABSENT, VALUE2, VALUE2, VALUE2, DIRTY, 0);
+    CheckSyncCoin(ABSENT, VALUE2, VALUE2, VALUE2, DIRTY | FRESH, 0);
+    CheckSyncCoin(PRUNED, PRUNED, PRUNED, ABSENT, DIRTY, NO_ENTRY);
+    CheckSyncCoin(PRUNED, VALUE2, VALUE2, VALUE2, DIRTY, 0);
+    CheckSyncCoin(PRUNED, VALUE2, VALUE2, VALUE2, DIRTY | FRESH, 0);
+    CheckSyncCoin(VALUE1, PRUNED, PRUNED, ABSENT, DIRTY, NO_ENTRY);
+    CheckSyncCoin(VALUE1, VALUE2, VALUE2, VALUE2, DIRTY, 0);
+
+    // Unmodified entries are left alone, and the base is not written.
+    for (Amount base_value : {ABSENT, PRUNED, VALUE1}) {
+        for (Amount cache_value : {PRUNED, VALUE2}) {
+            for (char cache_flags : CLEAN_FLAGS) {
+                CheckSyncCoin(base_value, cache_value, base_value, cache_value,
+                              cache_flags, cache_flags);
+            }
+        }
+    }
+}
+
 void CheckSpendCoin(Amount base_value, Amount cache_value,
                     Amount expected_value, char cache_flags,
                     char expected_flags) {
@@ -3,9 +3,11 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "crypto/aes.h"
+#include "crypto/blake2b.h"
 #include "crypto/chacha20.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "crypto/muhash.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
@@ -607,6 +609,172 @@ BOOST_AUTO_TEST_CASE(chacha20_testvector) {
         "38407a6deb3ab78fab78c9");
 }
 
+static std::vector<uint8_t> InsecureRandBytes(size_t len) {
+    std::vector<uint8_t> ret(len);
+    for (uint8_t &b : ret) {
+        b = insecure_rand();
+    }
+    return ret;
+}
+
+BOOST_AUTO_TEST_CASE(blake2b_testvectors) {
+    // Test vector from RFC 7693, Appendix A.
+    std::vector<uint8_t> hash(CBLAKE2b::MAX_OUTPUT_SIZE);
+    CBLAKE2b().Write((const uint8_t *)"abc", 3).Finalize(&hash[0]);
+    BOOST_CHECK_EQUAL(HexStr(hash),
+                      "ba80a53f981c4d0d6a2797b69f12f6e94c212f14685ac4b74b12bb6f"
+                      "dbffa2d17d87c5392aab792dc252d5de4533cc9518d38aa8dbf1925a"
+                      "b92386edd4009923");
+
+    // Compare against libsodium, which Equihash used to rely on, with a
+    // personalization string and the output lengths of each parameter set.
+    const size_t outlens[] = {1, 32, 50, 54, 60, 64};
+    for (size_t outlen : outlens) {
+        for (size_t len = 0; len <= 3 * CBLAKE2b::BLOCK_SIZE; len += 29) {
+            std::vector<uint8_t> personal = InsecureRandBytes(16);
+            std::vector<uint8_t> in = InsecureRandBytes(len);
+
+            crypto_generichash_blake2b_state state;
+            crypto_generichash_blake2b_init_salt_personal(
+                &state, nullptr, 0, outlen, nullptr, &personal[0]);
+            crypto_generichash_blake2b_update(&state, in.data(), in.size());
+            std::vector<uint8_t> expected(outlen);
+            crypto_generichash_blake2b_final(&state, &expected[0], outlen);
+
+            std::vector<uint8_t> actual(outlen);
+            CBLAKE2b(outlen, &personal[0])
+                .Write(in.data(), in.size())
+                .Finalize(&actual[0]);
+            BOOST_CHECK(actual == expected);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(blake2b_finalize_indices) {
+    BOOST_TEST_MESSAGE(
+        strprintf("Using BLAKE2b implementation: %s", BLAKE2bImplementation()));
+
+    // FinalizeIndices must match hashing each index separately, whether or
+    // not the index fits in the buffered block and whatever the count.
+    const size_t outlen = 50;
+    std::vector<uint8_t> personal = InsecureRandBytes(16);
+    for (size_t len = 0; len <= 2 * CBLAKE2b::BLOCK_SIZE + 8; len += 3) {
+        std::vector<uint8_t> in = InsecureRandBytes(len);
+        CBLAKE2b base(outlen, &personal[0]);
+        base.Write(in.data(), in.size());
+
+        const size_t count = 1 + len % 11;
+        std::vector<uint32_t> indices(count);
+        for (uint32_t &i : indices) {
+            i = insecure_rand();
+        }
+        std::vector<uint8_t> hashes(count * outlen);
+        base.FinalizeIndices(indices.data(), count, &hashes[0]);
+
+        for (size_t j = 0; j < count; j++) {
+            uint8_t le[4];
+            WriteLE32(le, indices[j]);
+            std::vector<uint8_t> expected(outlen);
+            CBLAKE2b(base).Write(le, sizeof(le)).Finalize(&expected[0]);
+            BOOST_CHECK(std::equal(expected.begin(), expected.end(),
+                                   hashes.begin() + j * outlen));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sha256d64) {
+    BOOST_TEST_MESSAGE(
+        strprintf("Using SHA-256 implementation: %s", SHA256Implementation()));
+
+    // Cover every batch size the multi-lane kernels leave a remainder for,
+    // both into a separate buffer and in place.
+    for (size_t blocks = 0; blocks <= 32; blocks++) {
+        std::vector<uint8_t> in = InsecureRandBytes(64 * blocks);
+        std::vector<uint8_t> expected(32 * blocks);
+        for (size_t i = 0; i < blocks; i++) {
+            CHash256().Write(&in[64 * i], 64).Finalize(&expected[32 * i]);
+        }
+
+        std::vector<uint8_t> out(32 * blocks);
+        SHA256D64(out.data(), in.data(), blocks);
+        BOOST_CHECK(out == expected);
+
+        SHA256D64(in.data(), in.data(), blocks);
+        in.resize(32 * blocks);
+        BOOST_CHECK(in == expected);
+    }
+}
+
+static MuHash3072 MuHashFromInt(uint8_t i) {
+    uint8_t tmp[32] = {i, 0};
+    return MuHash3072(tmp, sizeof(tmp));
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests) {
+    uint256 out, out2;
+
+    MuHash3072 acc = MuHashFromInt(0);
+    acc *= MuHashFromInt(1);
+    acc /= MuHashFromInt(2);
+    acc.Finalize(out.begin());
+    BOOST_CHECK_EQUAL(
+        out.GetHex(),
+        "10d312b100cbd32ada024a6646e40d3482fcff103668d2625f10002a607d5863");
+
+    // The hash of a set does not depend on the order in which elements were
+    // inserted and removed.
+    for (int iter = 0; iter < 10; iter++) {
+        std::vector<uint8_t> elems[4];
+        for (int i = 0; i < 4; i++) {
+            elems[i] = InsecureRandBytes(1 + insecure_rand() % 64);
+        }
+        MuHash3072 a, b;
+        for (int i = 0; i < 4; i++) {
+            a.Insert(elems[i].data(), elems[i].size());
+        }
+        a.Remove(elems[1].data(), elems[1].size());
+        b.Insert(elems[3].data(), elems[3].size());
+        b.Insert(elems[0].data(), elems[0].size());
+        b.Insert(elems[2].data(), elems[2].size());
+        a.Finalize(out.begin());
+        b.Finalize(out2.begin());
+        BOOST_CHECK(out == out2);
+        // Finalizing does not change the set.
+        a.Finalize(out2.begin());
+        BOOST_CHECK(out == out2);
+
+        MuHash3072 empty;
+        b /= a;
+        empty.Finalize(out.begin());
+        b.Finalize(out2.begin());
+        BOOST_CHECK(out == out2);
+    }
+
+    // Numbers at or above the prime are reduced.
+    uint8_t bytes[Num3072::BYTE_SIZE];
+    memset(bytes, 0xff, sizeof(bytes));
+    const uint32_t diff = 1103717 - 5;
+    bytes[0] = uint8_t(0 - diff);
+    bytes[1] = uint8_t((0 - diff) >> 8);
+    bytes[2] = uint8_t((0 - diff) >> 16);
+    Num3072 num(bytes);
+    num.ToBytes(bytes);
+    BOOST_CHECK_EQUAL(bytes[0], 5);
+    for (size_t i = 1; i < sizeof(bytes); i++) {
+        BOOST_CHECK_EQUAL(bytes[i], 0);
+    }
+
+    // A number times its inverse is one.
+    memcpy(bytes, InsecureRandBytes(sizeof(bytes)).data(), sizeof(bytes));
+    num = Num3072(bytes);
+    num.Multiply(num.GetInverse());
+    num.ToBytes(bytes);
+    BOOST_CHECK_EQUAL(bytes[0], 1);
+    for (size_t i = 1; i < sizeof(bytes); i++) {
+        BOOST_CHECK_EQUAL(bytes[i], 0);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(countbits_tests) {
     FastRandomContext ctx;
     for (int i = 0; i <= 64; ++i) {
@@ -328,4 +328,46 @@ BOOST_AUTO_TEST_CASE(iterator_string_ordering) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(dbwrapper_options_stats) {
+    boost::filesystem::path ph = boost::filesystem::temp_directory_path() /
+                                 boost::filesystem::unique_path();
+    // A small write buffer and blocks, so that the data spans many tables.
+    CDBOptions options;
+    options.nWriteBufferSize = 64 << 10;
+    options.nBlockSize = 1 << 10;
+    options.nBloomBits = 0;
+    CDBWrapper dbw(ph, (1 << 20), true, false, false, options);
+
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint32_t i = 0; i < 10000; i++) {
+            BOOST_CHECK(dbw.Write(i, GetRandHash()));
+        }
+    }
+    dbw.Compact();
+
+    CDBStats stats;
+    dbw.GetStats(stats);
+    BOOST_CHECK(!stats.levels.empty());
+    int nFiles = 0;
+    for (const CDBStats::Level &level : stats.levels) {
+        // Compaction moved everything out of level 0.
+        BOOST_CHECK(level.nLevel > 0 || level.nFiles == 0);
+        nFiles += level.nFiles;
+    }
+    BOOST_CHECK(nFiles > 0);
+    BOOST_CHECK(stats.nMemoryUsage > 0);
+
+    // Reading each key twice misses and then hits the block cache.
+    uint256 res;
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint32_t i = 0; i < 100; i++) {
+            BOOST_CHECK(dbw.Read(i, res));
+        }
+    }
+    dbw.GetStats(stats);
+    BOOST_CHECK(stats.nCacheMisses > 0);
+    BOOST_CHECK(stats.nCacheHits > 0);
+    BOOST_CHECK(stats.nCacheUsage > 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
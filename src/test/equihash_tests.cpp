@@ -0,0 +1,123 @@
+// Copyright (c) 2017 The Bitcoin Cash Plus developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/equihash.h"
+
+#include "test/test_bitcoin.h"
+#include "test/test_random.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+const size_t INDEX_BYTES = sizeof(eh_index);
+
+// The rows of the Equihash<48,5> solver, wide enough for every key tested.
+typedef FullStepRow<Equihash<48, 5>::FullWidth> TestRow;
+
+// Rows with len random key bytes, of which the first fixed are zero, and the
+// row number as index so that every row stays distinguishable.
+std::vector<TestRow> MakeRows(size_t count, size_t len, size_t fixed,
+                              unsigned int range) {
+    std::vector<TestRow> rows;
+    rows.reserve(count);
+    std::vector<unsigned char> key(len);
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = 0; j < len; j++) {
+            key[j] = j < fixed ? 0 : insecure_rand() % range;
+        }
+        rows.emplace_back(key.data(), len, len, 8, i);
+    }
+    return rows;
+}
+
+void CheckSortRows(std::vector<TestRow> rows, size_t len) {
+    std::vector<TestRow> expected = rows;
+    std::sort(expected.begin(), expected.end(), CompareSR(len));
+    SortRows(rows, len);
+
+    BOOST_REQUIRE_EQUAL(rows.size(), expected.size());
+    std::multiset<std::string> sorted, sortedExpected;
+    for (size_t i = 0; i < rows.size(); i++) {
+        // Rows equal on the key may come out in either order ...
+        BOOST_CHECK_EQUAL(rows[i].GetHex(len), expected[i].GetHex(len));
+        sorted.insert(rows[i].GetHex(len + INDEX_BYTES));
+        sortedExpected.insert(expected[i].GetHex(len + INDEX_BYTES));
+    }
+    // ... but no row may be lost or duplicated.
+    BOOST_CHECK(sorted == sortedExpected);
+}
+
+std::set<std::vector<unsigned char>> Solve(unsigned int n, unsigned int k,
+                                           const eh_HashState &state,
+                                           bool optimised) {
+    std::set<std::vector<unsigned char>> solutions;
+    std::function<bool(std::vector<unsigned char>)> validBlock =
+        [&solutions](std::vector<unsigned char> soln) {
+            solutions.insert(soln);
+            return false;
+        };
+    if (optimised) {
+        EhOptimisedSolveUncancellable(n, k, state, validBlock);
+    } else {
+        EhBasicSolveUncancellable(n, k, state, validBlock);
+    }
+    return solutions;
+}
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(equihash_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(equihash_sort_rows) {
+    seed_insecure_rand();
+    for (size_t len : {1, 2, 3, 6, 12}) {
+        for (size_t count : {0, 1, 2, 63, 64, 65, 1000, 5000}) {
+            CheckSortRows(MakeRows(count, len, 0, 256), len);
+            // Few distinct byte values, so that most keys collide.
+            CheckSortRows(MakeRows(count, len, 0, 3), len);
+            // Every row in one bucket for all but the last key byte.
+            CheckSortRows(MakeRows(count, len, len - 1, 256), len);
+            // Every row in one bucket on every key byte.
+            CheckSortRows(MakeRows(count, len, len, 256), len);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(equihash_solvers) {
+    const unsigned int n = 48, k = 5;
+    size_t total = 0;
+    for (uint32_t nonce = 0; nonce < 8; nonce++) {
+        eh_HashState state;
+        EhInitialiseState(n, k, state);
+        const std::string input = "Equihash solver test";
+        state.Write((const unsigned char *)input.data(), input.size());
+        state.Write((const unsigned char *)&nonce, sizeof(nonce));
+
+        std::set<std::vector<unsigned char>> basic =
+            Solve(n, k, state, false);
+        std::set<std::vector<unsigned char>> optimised =
+            Solve(n, k, state, true);
+        BOOST_CHECK(basic == optimised);
+        for (const std::vector<unsigned char> &soln : basic) {
+            bool valid = false;
+            EhIsValidSolution(n, k, state, soln, valid);
+            BOOST_CHECK(valid);
+
+            std::vector<unsigned char> bad = soln;
+            bad[bad.size() / 2] ^= 0x01;
+            EhIsValidSolution(n, k, state, bad, valid);
+            BOOST_CHECK(!valid);
+        }
+        total += basic.size();
+    }
+    // Instances have about two solutions on average.
+    BOOST_CHECK(total > 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -168,6 +168,58 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test) {
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+BOOST_AUTO_TEST_CASE(cnetmessage_receive_in_place) {
+    // A message larger than the initial receive buffer.
+    std::vector<uint8_t> payload(1000000);
+    for (size_t i = 0; i < payload.size(); i++) {
+        payload[i] = uint8_t(i * 7);
+    }
+    uint256 hash = Hash(payload.begin(), payload.end());
+    CMessageHeader hdr(Params().NetMagic(), NetMsgType::BLOCK, payload.size());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CDataStream ssHeader(SER_NETWORK, INIT_PROTO_VERSION);
+    ssHeader << hdr;
+
+    // Copied in, in small pieces.
+    CNetMessage msgCopied(Params().NetMagic(), SER_NETWORK, INIT_PROTO_VERSION);
+    BOOST_CHECK_EQUAL(msgCopied.readHeader(&ssHeader[0], ssHeader.size()),
+                      CMessageHeader::HEADER_SIZE);
+    size_t nPos = 0;
+    while (nPos < payload.size()) {
+        int handled =
+            msgCopied.readData((const char *)&payload[nPos],
+                               std::min<size_t>(1000, payload.size() - nPos));
+        BOOST_REQUIRE(handled > 0);
+        nPos += handled;
+    }
+
+    // Received in place, in pieces as large as the buffer takes.
+    CNetMessage msgInPlace(Params().NetMagic(), SER_NETWORK,
+                           INIT_PROTO_VERSION);
+    BOOST_CHECK_EQUAL(msgInPlace.readHeader(&ssHeader[0], ssHeader.size()),
+                      CMessageHeader::HEADER_SIZE);
+    nPos = 0;
+    while (!msgInPlace.complete()) {
+        unsigned int nBytes = 0;
+        char *pch = msgInPlace.GetDataBuffer(nBytes);
+        BOOST_REQUIRE(nBytes > 0 && nBytes <= payload.size() - nPos);
+        // The buffer stays within twice the data received.
+        BOOST_CHECK(msgInPlace.vRecv.size() <=
+                    std::max<size_t>(2 * nPos, 256 * 1024));
+        memcpy(pch, &payload[nPos], nBytes);
+        msgInPlace.ReceivedData(nBytes);
+        nPos += nBytes;
+    }
+
+    for (const CNetMessage *msg : {&msgCopied, &msgInPlace}) {
+        BOOST_CHECK(msg->complete());
+        BOOST_CHECK_EQUAL(msg->vRecv.size(), payload.size());
+        BOOST_CHECK(memcmp(payload.data(), &msg->vRecv[0], payload.size()) ==
+                    0);
+        BOOST_CHECK(msg->GetMessageHash() == hash);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(test_getSubVersionEB) {
     BOOST_CHECK_EQUAL(getSubVersionEB(13800000000), "13800.0");
     BOOST_CHECK_EQUAL(getSubVersionEB(3800000000), "3800.0");
@@ -202,4 +254,49 @@ BOOST_AUTO_TEST_CASE(test_userAgentLength) {
                       "very very very very very very v)/");
 }
 
+BOOST_AUTO_TEST_CASE(msg_process_stats) {
+    CMsgProcessStats stats;
+    stats.Add(0, 0);
+    stats.Add(10, 0);
+    stats.Add(999, 500);
+    stats.Add(5000000, 4000000);
+    BOOST_CHECK_EQUAL(stats.nCount, 4U);
+    BOOST_CHECK_EQUAL(stats.nMicros, 5001009);
+    BOOST_CHECK_EQUAL(stats.nLockWaitMicros, 4000500);
+    const uint64_t histogram[CMsgProcessStats::HISTOGRAM_BUCKETS] = {
+        1, 1, 1, 0, 0, 0, 1};
+    BOOST_CHECK(std::equal(std::begin(histogram), std::end(histogram),
+                           std::begin(stats.histogram)));
+
+    stats.nSkipped++;
+
+    CMsgProcessStats total;
+    total += stats;
+    total += stats;
+    BOOST_CHECK_EQUAL(total.nCount, 8U);
+    BOOST_CHECK_EQUAL(total.nSkipped, 2U);
+    BOOST_CHECK_EQUAL(total.histogram[CMsgProcessStats::HISTOGRAM_BUCKETS - 1],
+                      2U);
+}
+
+BOOST_AUTO_TEST_CASE(send_messages_stats) {
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CAddress addr = CAddress(CService(ipv4Addr, 7777), NODE_NETWORK);
+    CNode node(0, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, "", false);
+
+    // Skipped calls are only counted as such.
+    node.RecordSendMessagesTime(50, false);
+    node.RecordSendMessagesTime(2000000, true);
+    CNodeStats stats;
+    node.copyStats(stats);
+    BOOST_CHECK_EQUAL(stats.sendMessagesStats.nCount, 1U);
+    BOOST_CHECK_EQUAL(stats.sendMessagesStats.nMicros, 50);
+    BOOST_CHECK_EQUAL(stats.sendMessagesStats.nSkipped, 1U);
+    BOOST_CHECK_EQUAL(
+        stats.sendMessagesStats.histogram[CMsgProcessStats::HISTOGRAM_BUCKETS -
+                                          1],
+        0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
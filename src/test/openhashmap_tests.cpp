@@ -0,0 +1,181 @@
+// Copyright (c) 2017 The Bitcoin Cash Plus developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "openhashmap.h"
+
+#include "test/test_bitcoin.h"
+
+#include <cstdint>
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+// Keys land in the slot of their own value, so collisions can be arranged.
+struct IdentityHash {
+    size_t operator()(uint32_t key) const { return key; }
+};
+
+typedef openhashmap<uint32_t, std::string, IdentityHash> TestMap;
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(openhashmap_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(openhashmap_insert_erase) {
+    TestMap map;
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.find(1) == map.end());
+
+    for (uint32_t i = 0; i < 1000; i++) {
+        auto ret = map.emplace(i, std::to_string(i));
+        BOOST_CHECK(ret.second);
+        BOOST_CHECK_EQUAL(ret.first->first, i);
+    }
+    BOOST_CHECK_EQUAL(map.size(), 1000U);
+
+    // An existing key keeps its value.
+    auto ret = map.emplace(7, "other");
+    BOOST_CHECK(!ret.second);
+    BOOST_CHECK_EQUAL(ret.first->second, "7");
+    BOOST_CHECK_EQUAL(map[7], "7");
+    map[1000] = "1000";
+    BOOST_CHECK_EQUAL(map.size(), 1001U);
+
+    for (uint32_t i = 0; i <= 1000; i += 2) {
+        BOOST_CHECK_EQUAL(map.erase(i), 1U);
+    }
+    BOOST_CHECK_EQUAL(map.erase(0), 0U);
+    BOOST_CHECK_EQUAL(map.size(), 500U);
+    for (uint32_t i = 0; i <= 1000; i++) {
+        BOOST_CHECK_EQUAL(map.count(i), i % 2);
+    }
+
+    size_t n = 0;
+    for (const auto &entry : map) {
+        BOOST_CHECK_EQUAL(entry.second, std::to_string(entry.first));
+        n++;
+    }
+    BOOST_CHECK_EQUAL(n, 500U);
+
+    map.clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.begin() == map.end());
+    BOOST_CHECK_EQUAL(map.chunk_count(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(openhashmap_rehash) {
+    TestMap map;
+    std::string &first = map[0];
+    first = "0";
+    const size_t nBuckets = map.bucket_count();
+
+    // Growing the table keeps the entries and the references to them.
+    for (uint32_t i = 1; i < 100; i++) {
+        map.emplace(i, std::to_string(i));
+    }
+    BOOST_CHECK(map.bucket_count() > nBuckets);
+    BOOST_CHECK(map.size() * 2 <= map.bucket_count());
+    BOOST_CHECK_EQUAL(&map.find(0)->second, &first);
+    for (uint32_t i = 0; i < 100; i++) {
+        BOOST_CHECK_EQUAL(map.find(i)->second, std::to_string(i));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(openhashmap_iterator_stability) {
+    // Find how many entries fit before the table grows.
+    TestMap full;
+    uint32_t nFit = 0;
+    full.emplace(nFit++, "");
+    const size_t nBuckets = full.bucket_count();
+    while (true) {
+        full.emplace(nFit, "");
+        if (full.bucket_count() != nBuckets) {
+            break;
+        }
+        nFit++;
+    }
+
+    TestMap map;
+    for (uint32_t i = 0; i < nFit; i++) {
+        map.emplace(i, std::to_string(i));
+    }
+    BOOST_CHECK_EQUAL(map.bucket_count(), nBuckets);
+
+    // Emplacing a key that is present does not grow the table, so iterators
+    // stay valid.
+    TestMap::iterator it = map.find(3);
+    auto ret = map.emplace(3, "other");
+    BOOST_CHECK(!ret.second);
+    BOOST_CHECK(ret.first == it);
+    BOOST_CHECK_EQUAL(map.bucket_count(), nBuckets);
+    BOOST_CHECK_EQUAL(it->second, "3");
+
+    // Erasing does not move the other entries.
+    for (it = map.begin(); it != map.end();) {
+        if (it->first % 2) {
+            it = map.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    BOOST_CHECK_EQUAL(map.size(), (nFit + 1) / 2);
+    for (uint32_t i = 0; i < nFit; i++) {
+        BOOST_CHECK_EQUAL(map.count(i), i % 2 == 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(openhashmap_tombstone_reuse) {
+    TestMap map;
+    map.emplace(1, "1");
+    const uint32_t nBuckets = map.bucket_count();
+    // Both collide with key 1, and probe past it.
+    const uint32_t key2 = 1 + nBuckets;
+    const uint32_t key3 = 1 + 2 * nBuckets;
+    map.emplace(key2, "2");
+    const size_t pos1 = map.position(map.find(1));
+    const size_t pos2 = map.position(map.find(key2));
+    BOOST_CHECK_EQUAL(pos2, pos1 + 1);
+
+    // The erased slot still lets lookups probe past it ...
+    map.erase(1);
+    BOOST_CHECK(map.find(1) == map.end());
+    BOOST_CHECK_EQUAL(map.find(key2)->second, "2");
+
+    // ... and is taken by the next insertion that probes it.
+    map.emplace(key3, "3");
+    BOOST_CHECK_EQUAL(map.position(map.find(key3)), pos1);
+    BOOST_CHECK_EQUAL(map.find(key2)->second, "2");
+    BOOST_CHECK_EQUAL(map.bucket_count(), nBuckets);
+    BOOST_CHECK_EQUAL(map.size(), 2U);
+}
+
+BOOST_AUTO_TEST_CASE(openhashmap_chunk_release) {
+    TestMap map;
+    const uint32_t nEntries = 10 * TestMap::NODES_PER_CHUNK;
+    for (uint32_t i = 0; i < nEntries; i++) {
+        map.emplace(i, std::to_string(i));
+    }
+    BOOST_CHECK_EQUAL(map.chunk_count(), 10U);
+
+    // Chunks are released as they empty, all but one kept for reuse.
+    for (uint32_t i = 0; i < nEntries / 2; i++) {
+        map.erase(i);
+    }
+    BOOST_CHECK_EQUAL(map.chunk_count(), 6U);
+    for (uint32_t i = nEntries / 2; i < nEntries; i++) {
+        map.erase(i);
+    }
+    BOOST_CHECK_EQUAL(map.chunk_count(), 1U);
+
+    // Inserting again reuses the freed nodes.
+    for (uint32_t i = 0; i < nEntries; i++) {
+        map.emplace(i, std::to_string(i));
+    }
+    BOOST_CHECK_EQUAL(map.chunk_count(), 10U);
+    for (uint32_t i = 0; i < nEntries; i++) {
+        BOOST_CHECK_EQUAL(map.find(i)->second, std::to_string(i));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
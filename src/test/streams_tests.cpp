@@ -73,6 +73,34 @@ BOOST_AUTO_TEST_CASE(streams_vector_writer) {
     vch.clear();
 }
 
+BOOST_AUTO_TEST_CASE(streams_span_reader) {
+    std::vector<uint8_t> vch = {1, 255, 3, 4, 5, 6};
+
+    CSpanReader reader(SER_NETWORK, INIT_PROTO_VERSION, vch.data(),
+                       vch.data() + vch.size());
+    BOOST_CHECK_EQUAL(reader.size(), 6);
+    BOOST_CHECK(!reader.empty());
+
+    uint8_t a;
+    reader >> a;
+    BOOST_CHECK_EQUAL(a, 1);
+    BOOST_CHECK_EQUAL(reader.size(), 5);
+
+    uint8_t b;
+    reader >> b;
+    BOOST_CHECK_EQUAL(b, 255);
+
+    uint32_t c;
+    reader >> c;
+    BOOST_CHECK_EQUAL(c, 0x06050403);
+    BOOST_CHECK(reader.empty());
+
+    // Reading past the end throws and leaves the range alone.
+    uint8_t d;
+    BOOST_CHECK_THROW(reader >> d, std::ios_base::failure);
+    BOOST_CHECK_EQUAL(vch.size(), 6);
+}
+
 BOOST_AUTO_TEST_CASE(streams_serializedata_xor) {
     std::vector<char> in;
     std::vector<char> expected_xor;
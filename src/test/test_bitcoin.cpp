@@ -94,6 +94,8 @@ TestingSetup::TestingSetup(const std::string &chainName)
     nScriptCheckThreads = 3;
     for (int i = 0; i < nScriptCheckThreads - 1; i++) {
         threadGroup.create_thread(&ThreadScriptCheck);
+        threadGroup.create_thread(&ThreadEquihashCheck);
+        threadGroup.create_thread(&ThreadCoinsPrefetch);
     }
 
     // Deterministic randomness for tests.
@@ -4,15 +4,26 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "validation.h"
+#include "chain.h"
 #include "chainparams.h"
 #include "config.h"
 #include "consensus/consensus.h"
+#include "consensus/validation.h"
+#include "crypto/equihash.h"
+#include "hash.h"
+#include "miner.h"
+#include "pow.h"
 #include "primitives/transaction.h"
+#include "random.h"
+#include "script/interpreter.h"
+#include "streams.h"
 #include "test/test_bitcoin.h"
+#include "txdb.h"
 #include "util.h"
 
 #include <cstdint>
 #include <cstdio>
+#include <string>
 #include <vector>
 
 #include <boost/test/unit_test.hpp>
@@ -28,8 +39,164 @@ static CBlock makeLargeDummyBlock(const size_t num_tx) {
     return block;
 }
 
+static CBlockHeader makeSolvedHeader(const Config &config,
+                                     CBlockHeader header) {
+    unsigned int n = config.GetChainParams().EquihashN();
+    unsigned int k = config.GetChainParams().EquihashK();
+
+    while (true) {
+        header.nNonce = ArithToUint256(UintToArith256(header.nNonce) + 1);
+
+        eh_HashState state;
+        EhInitialiseState(n, k, state);
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << CEquihashInput{header} << header.nNonce;
+        state.Write((unsigned char *)&ss[0], ss.size());
+
+        std::function<bool(std::vector<unsigned char>)> validBlock =
+            [&header](std::vector<unsigned char> soln) {
+                header.nSolution = soln;
+                return true;
+            };
+        if (EhBasicSolveUncancellable(n, k, state, validBlock)) {
+            return header;
+        }
+    }
+}
+
+static CBlockHeader makeSolvedHeader(const Config &config, uint32_t nHeight) {
+    CBlockHeader header;
+    header.nHeight = nHeight;
+    header.nBits = 0x207fffff;
+    return makeSolvedHeader(config, header);
+}
+
 BOOST_FIXTURE_TEST_SUITE(validation_tests, TestingSetup)
 
+BOOST_AUTO_TEST_CASE(equihash_batch_check) {
+    DummyConfig config;
+
+    std::vector<CBlockHeader> headers;
+    for (uint32_t i = 0; i < 20; i++) {
+        headers.push_back(makeSolvedHeader(config, i));
+    }
+    std::vector<const CBlockHeader *> vpheaders;
+    for (const CBlockHeader &header : headers) {
+        BOOST_CHECK(CheckEquihashSolution(&header, config));
+        vpheaders.push_back(&header);
+    }
+
+    BOOST_CHECK(CheckEquihashSolutions(config, {}));
+    BOOST_CHECK(CheckEquihashSolutions(config, vpheaders));
+
+    // A single bad solution anywhere in the batch fails the whole batch.
+    headers[13].nSolution[0] ^= 0x01;
+    BOOST_CHECK(!CheckEquihashSolutions(config, vpheaders));
+    headers[13].nSolution[0] ^= 0x01;
+    BOOST_CHECK(CheckEquihashSolutions(config, vpheaders));
+
+    CBlockHeader &last = headers.back();
+    last.nNonce = ArithToUint256(UintToArith256(last.nNonce) + 1);
+    BOOST_CHECK(!CheckEquihashSolutions(config, vpheaders));
+}
+
+BOOST_AUTO_TEST_CASE(header_hash_context) {
+    DummyConfig config;
+    CBlockHeader unsolved;
+    unsolved.nVersion = -2;
+    unsolved.nHeight = 7;
+    unsolved.nReserved[3] = 0x01020304;
+    unsolved.nBits = 0x207fffff;
+    CBlockHeader header = makeSolvedHeader(config, unsolved);
+
+    // The context holds the Equihash input I||V ...
+    CBlockHeaderHashContext context(header);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << CEquihashInput{header} << header.nNonce;
+    BOOST_CHECK_EQUAL(ss.size(), context.size());
+    BOOST_CHECK(memcmp(&ss[0], context.data(), ss.size()) == 0);
+
+    // ... and hashes to the post-fork block hash.
+    CHashWriter writer(SER_GETHASH, PROTOCOL_VERSION);
+    writer << header;
+    BOOST_CHECK(context.GetHash() == writer.GetHash());
+    BOOST_CHECK(CheckEquihashSolution(context, config));
+}
+
+BOOST_AUTO_TEST_CASE(header_hash_cache) {
+    DummyConfig config;
+    const Consensus::Params &params = config.GetChainParams().GetConsensus();
+    // A header whose hash meets its target, not only with a valid solution.
+    CBlockHeader unsolved;
+    unsolved.nHeight = params.BCPHeight;
+    unsolved.nBits = 0x207fffff;
+    CBlockHeader header;
+    do {
+        unsolved.nTime++;
+        header = makeSolvedHeader(config, unsolved);
+    } while (!CheckProofOfWork(header.GetHash(params), header.nBits, true,
+                               config));
+
+    auto uncachedHash = [](const CBlockHeader &h) {
+        CHashWriter writer(SER_GETHASH, PROTOCOL_VERSION);
+        writer << h;
+        return writer.GetHash();
+    };
+
+    // Only a header that passed its proof of work check caches its hash,
+    // until it is cleared or deserialized again.
+    const uint256 hash = header.GetHash(params);
+    BOOST_CHECK(hash == uncachedHash(header));
+    uint256 cached;
+    BOOST_CHECK(!header.hashCache.Get(false, cached));
+
+    CBlock block(header);
+    // The empty block fails a later check, but its header passed.
+    CValidationState state;
+    BOOST_CHECK(!CheckBlock(config, block, state, true, false));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-cb-missing");
+    BOOST_CHECK(block.hashCache.Get(false, cached));
+    BOOST_CHECK(cached == hash);
+    BOOST_CHECK(!block.hashCache.Get(true, cached));
+
+    // Copies keep it, deserializing drops it.
+    CBlock copy(block);
+    BOOST_CHECK(copy.GetHash(params) == hash);
+    BOOST_CHECK(block.GetBlockHeader().GetHash(params) == hash);
+
+    CBlockHeader reread = block.GetBlockHeader();
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << header;
+    ss >> reread;
+    BOOST_CHECK(!reread.hashCache.Get(false, cached));
+    BOOST_CHECK(reread.GetHash(params) == hash);
+
+    // So do the miner's writers of the header fields.
+    CBlockIndex indexPrev;
+    indexPrev.nHeight = header.nHeight - 1;
+    CBlockHeader updated = block.GetBlockHeader();
+    BOOST_CHECK(updated.hashCache.Get(false, cached));
+    UpdateTime(&updated, config, &indexPrev);
+    BOOST_CHECK(!updated.hashCache.Get(false, cached));
+    BOOST_CHECK(updated.GetHash(params) == uncachedHash(updated));
+    BOOST_CHECK(updated.GetHash(params) != hash);
+
+    CBlock extended(block);
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.resize(1);
+    extended.vtx.push_back(MakeTransactionRef(coinbase));
+    BOOST_CHECK(extended.hashCache.Get(false, cached));
+    unsigned int nExtraNonce = 0;
+    IncrementExtraNonce(config, &extended, &indexPrev, nExtraNonce);
+    BOOST_CHECK(!extended.hashCache.Get(false, cached));
+    BOOST_CHECK(extended.GetHash(params) == uncachedHash(extended));
+    BOOST_CHECK(extended.GetHash(params) != hash);
+
+    block.SetNull();
+    BOOST_CHECK(!block.hashCache.Get(false, cached));
+}
+
 /** Test that LoadExternalBlockFile works with the buffer size set
 below the size of a large block. Currently, LoadExternalBlockFile has the
 buffer size for CBufferedFile set to 2 * MAX_TX_SIZE. Test with a value
@@ -76,4 +243,162 @@ BOOST_AUTO_TEST_CASE(validation_load_external_block_file) {
     BOOST_CHECK_NO_THROW({ LoadExternalBlockFile(config, fp, 0); });
 }
 
+BOOST_AUTO_TEST_CASE(block_index_write_missing_solution) {
+    // An entry whose solution is neither in memory nor in the database is not
+    // written, rather than written without its solution.
+    const uint256 hash = GetRandHash();
+    CBlockIndex index;
+    index.phashBlock = &hash;
+    BOOST_CHECK(!pblocktree->WriteBatchSync({}, 0, {&index}));
+    std::vector<unsigned char> solution;
+    BOOST_CHECK(!pblocktree->ReadBlockSolution(hash, solution));
+
+    // Nor is its header served without the solution.
+    CBlockHeader header;
+    BOOST_CHECK(!index.GetBlockHeader(header));
+    std::vector<CBlockHeader> headers;
+    BOOST_CHECK(!GetBlockHeaders({&index}, headers));
+}
+
+BOOST_FIXTURE_TEST_CASE(block_solution_lazy_load, TestChain100Setup) {
+    const Config &config = GetConfig();
+    const CChainParams &chainparams = config.GetChainParams();
+
+    // Once written out and loaded again, the block index entries leave their
+    // solutions in the block tree database until they are needed.
+    FlushStateToDisk();
+    UnloadBlockIndex();
+    BOOST_CHECK(LoadBlockIndex(chainparams));
+    BOOST_CHECK(LoadChainTip(chainparams));
+
+    LOCK(cs_main);
+    for (const CBlockIndex *pindex = chainActive.Tip(); pindex;
+         pindex = pindex->pprev) {
+        CBlock block;
+        BOOST_CHECK(ReadBlockFromDisk(block, pindex, config));
+        std::vector<unsigned char> solution;
+        BOOST_CHECK(GetBlockSolution(pindex, solution));
+        BOOST_CHECK(solution == block.nSolution);
+        CBlockHeader header;
+        BOOST_CHECK(pindex->GetBlockHeader(header));
+        BOOST_CHECK(header.GetHash() == pindex->GetBlockHash());
+    }
+
+    // Reading them in one batch, from the database again, returns the same
+    // headers in the order asked for.
+    UnloadBlockIndex();
+    BOOST_CHECK(LoadBlockIndex(chainparams));
+    BOOST_CHECK(LoadChainTip(chainparams));
+    std::vector<const CBlockIndex *> vIndex;
+    for (const CBlockIndex *pindex = chainActive.Tip(); pindex;
+         pindex = pindex->pprev) {
+        vIndex.push_back(pindex);
+    }
+    std::vector<CBlockHeader> headers;
+    BOOST_CHECK(GetBlockHeaders(vIndex, headers));
+    BOOST_REQUIRE_EQUAL(headers.size(), vIndex.size());
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        BOOST_CHECK(headers[i].GetHash() == vIndex[i]->GetBlockHash());
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(replay_interrupted_sync, TestChain100Setup) {
+    const Config &config = GetConfig();
+    const CChainParams &chainparams = config.GetChainParams();
+
+    // Make the coins database consistent with the tip.
+    FlushStateToDisk();
+    const uint256 hashOld = chainActive.Tip()->GetBlockHash();
+    BOOST_CHECK(pcoinsdbview->GetBestBlock() == hashOld);
+
+    // A transaction spending a coin from before, with enough outputs that
+    // the cache cannot be written out a coin per call by the end.
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey())
+                                     << OP_CHECKSIG;
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetId(), 0);
+    spend.vout.resize(20);
+    for (CTxOut &txout : spend.vout) {
+        txout.nValue = 11 * CENT;
+        txout.scriptPubKey = scriptPubKey;
+    }
+    std::vector<uint8_t> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0,
+                                 SIGHASH_ALL | SIGHASH_FORKID,
+                                 coinbaseTxns[0].vout[0].nValue);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back(uint8_t(SIGHASH_ALL | SIGHASH_FORKID));
+    spend.vin[0].scriptSig << vchSig;
+
+    // Write the cache out a coin at a time, as FlushStateToDisk does over
+    // several calls once the cache is large, while connecting a few blocks,
+    // the first of which includes the transaction.
+    ForceSetArg("-coinssyncentries", "1");
+    {
+        LOCK(cs_main);
+        fCoinsSyncPending = true;
+    }
+    std::vector<CBlock> blocks;
+    blocks.push_back(CreateAndProcessBlock({spend}, scriptPubKey));
+    for (int i = 0; i < 2; i++) {
+        blocks.push_back(CreateAndProcessBlock({}, scriptPubKey));
+    }
+    ForceSetArg("-coinssyncentries", std::to_string(MAX_COINS_SYNC_ENTRIES));
+    const uint256 hashNew = chainActive.Tip()->GetBlockHash();
+    BOOST_CHECK(hashNew == blocks.back().GetHash());
+
+    // The database is in the middle of the transition to the tip.
+    BOOST_CHECK(fCoinsSyncPending);
+    BOOST_CHECK(pcoinsdbview->GetBestBlock().IsNull());
+    std::vector<uint256> hashHeads = pcoinsdbview->GetHeadBlocks();
+    BOOST_CHECK_EQUAL(hashHeads.size(), 2UL);
+    BOOST_CHECK(hashHeads[0] == hashNew);
+    BOOST_CHECK(hashHeads[1] == hashOld);
+
+    // Crash: whatever was only in memory is lost, and the block index and
+    // chainstate are loaded from the databases as at startup.
+    {
+        LOCK(cs_main);
+        fCoinsSyncPending = false;
+        delete pcoinsTip;
+        pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+    }
+    UnloadBlockIndex();
+    BOOST_CHECK(LoadBlockIndex(chainparams));
+
+    // The blocks the coins database refers to were written before it was.
+    {
+        LOCK(cs_main);
+        for (const CBlock &block : blocks) {
+            BlockMap::iterator it = mapBlockIndex.find(block.GetHash());
+            BOOST_CHECK(it != mapBlockIndex.end() &&
+                        (it->second->nStatus & BLOCK_HAVE_DATA));
+        }
+    }
+
+    // Replaying them completes the transition.
+    BOOST_CHECK(ReplayBlocks(config, pcoinsdbview));
+    BOOST_CHECK(pcoinsdbview->GetHeadBlocks().empty());
+    BOOST_CHECK(pcoinsdbview->GetBestBlock() == hashNew);
+    BOOST_CHECK(LoadChainTip(chainparams));
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == hashNew);
+    BOOST_CHECK(!pcoinsdbview->HaveCoin(spend.vin[0].prevout));
+    for (const CBlock &block : blocks) {
+        for (const CTransactionRef &tx : block.vtx) {
+            for (size_t i = 0; i < tx->vout.size(); i++) {
+                Coin coin;
+                BOOST_CHECK(
+                    pcoinsdbview->GetCoin(COutPoint(tx->GetId(), i), coin));
+                BOOST_CHECK(coin.GetTxOut() == tx->vout[i]);
+            }
+        }
+    }
+
+    // Once consistent, there is nothing left to replay.
+    BOOST_CHECK(ReplayBlocks(config, pcoinsdbview));
+    BOOST_CHECK(pcoinsdbview->GetBestBlock() == hashNew);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
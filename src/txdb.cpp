@@ -13,6 +13,7 @@
 
 #include <boost/thread.hpp>
 
+#include <algorithm>
 #include <cstdint>
 
 static const char DB_COIN = 'C';
@@ -22,8 +23,12 @@ static const char DB_TXINDEX = 't';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
+static const char DB_HEAD_BLOCKS = 'H';
+static const char DB_COINS_COMMITMENT = 'M';
+static const char DB_SNAPSHOT_LOAD = 'L';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
+static const char DB_SNAPSHOT_BASE = 'S';
 static const char DB_LAST_BLOCK = 'l';
 
 namespace {
@@ -48,8 +53,33 @@ struct CoinEntry {
 };
 }
 
+/**
+ * Read the LevelDB settings of a database from -<name><setting>, falling back
+ * to -db<setting>, which applies to all databases.
+ */
+static CDBOptions GetDBOptions(const std::string &name) {
+    auto getArg = [&name](const std::string &setting, int64_t nDefault) {
+        return std::max<int64_t>(
+            0, GetArg("-" + name + setting, GetArg("-db" + setting, nDefault)));
+    };
+
+    CDBOptions options;
+    options.nWriteBufferSize = getArg("writebuffer", 0) << 20;
+    options.nBlockSize =
+        getArg("blocksize", DBWRAPPER_BLOCK_SIZE >> 10) << 10;
+    options.nMaxOpenFiles = getArg("maxopenfiles", DBWRAPPER_MAX_OPEN_FILES);
+    options.nBloomBits = getArg("bloombits", DBWRAPPER_BLOOM_BITS);
+    return options;
+}
+
+int GetDBMaxOpenFiles() {
+    return GetDBOptions("chainstate").nMaxOpenFiles +
+           GetDBOptions("blockindex").nMaxOpenFiles;
+}
+
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe)
-    : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) {}
+    : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true,
+         GetDBOptions("chainstate")) {}
 
 bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     return db.Read(CoinEntry(&outpoint), coin);
@@ -65,25 +95,92 @@ uint256 CCoinsViewDB::GetBestBlock() const {
     return hashBestChain;
 }
 
+std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
+    std::vector<uint256> vhashHeadBlocks;
+    if (!db.Read(DB_HEAD_BLOCKS, vhashHeadBlocks)) {
+        return std::vector<uint256>();
+    }
+    return vhashHeadBlocks;
+}
+
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    return WriteCoins(mapCoins, hashBlock, true);
+}
+
+bool CCoinsViewDB::BatchWritePartial(CCoinsMap &mapCoins,
+                                     const uint256 &hashBlock) {
+    return WriteCoins(mapCoins, hashBlock, false);
+}
+
+/**
+ * Write the coins in bounded batches, in the order of their keys in the
+ * database. While that happens the database records the transition it is in
+ * as head blocks instead of a best block, so that an interrupted write can be
+ * completed by replaying the blocks in between.
+ */
+bool CCoinsViewDB::WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock,
+                              bool fFinal) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
+    size_t batch_size = (size_t)GetArg("-dbbatchsize", nDefaultDbBatchSize);
+
+    if (!hashBlock.IsNull()) {
+        uint256 old_tip = GetBestBlock();
+        if (old_tip.IsNull()) {
+            // We may be in the middle of an earlier transition, in which case
+            // it started from its old head.
+            std::vector<uint256> old_heads = GetHeadBlocks();
+            if (old_heads.size() == 2) {
+                old_tip = old_heads[1];
+            }
+        }
+
+        // In the first batch, mark the database as being in the middle of a
+        // transition from old_tip to hashBlock.
+        batch.Erase(DB_BEST_BLOCK);
+        batch.Write(DB_HEAD_BLOCKS, std::vector<uint256>{hashBlock, old_tip});
+    }
+
+    // Sort the changed coins, whose keys order like their outpoints. Erasing
+    // entries does not invalidate iterators to the others.
+    std::vector<CCoinsMap::iterator> vChanged;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+        count++;
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            CoinEntry entry(&it->first);
-            if (it->second.coin.IsSpent()) {
-                batch.Erase(entry);
-            } else {
-                batch.Write(entry, it->second.coin);
+            vChanged.push_back(it++);
+        } else {
+            it = mapCoins.erase(it);
+        }
+    }
+    std::sort(vChanged.begin(), vChanged.end(),
+              [](const CCoinsMap::iterator &a, const CCoinsMap::iterator &b) {
+                  return a->first < b->first;
+              });
+
+    for (const CCoinsMap::iterator &it : vChanged) {
+        CoinEntry entry(&it->first);
+        if (it->second.coin.IsSpent()) {
+            batch.Erase(entry);
+        } else {
+            batch.Write(entry, it->second.coin);
+        }
+        changed++;
+        mapCoins.erase(it);
+        if (batch.SizeEstimate() > batch_size) {
+            LogPrint("coindb", "Writing partial batch of %.2f MiB\n",
+                     batch.SizeEstimate() * (1.0 / 1048576.0));
+            if (!db.WriteBatch(batch)) {
+                return false;
             }
-            changed++;
+            batch.Clear();
         }
-        count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
-    if (!hashBlock.IsNull()) {
+
+    if (fFinal && !hashBlock.IsNull()) {
+        // In the last batch, mark the database as consistent with hashBlock
+        // again.
+        batch.Erase(DB_HEAD_BLOCKS);
         batch.Write(DB_BEST_BLOCK, hashBlock);
     }
 
@@ -100,7 +197,7 @@ size_t CCoinsViewDB::EstimateSize() const {
 
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe)
     : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory,
-                 fWipe) {}
+                 fWipe, false, GetDBOptions("blockindex")) {}
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
     return Read(std::make_pair(DB_BLOCK_FILES, nFile), info);
@@ -118,11 +215,53 @@ bool CBlockTreeDB::ReadReindexing(bool &fReindexing) {
     return true;
 }
 
+bool CBlockTreeDB::WriteSnapshotBase(const uint256 &hash,
+                                     unsigned int nChainTx) {
+    return Write(DB_SNAPSHOT_BASE, std::make_pair(hash, nChainTx), true);
+}
+
+bool CBlockTreeDB::ReadSnapshotBase(uint256 &hash, unsigned int &nChainTx) {
+    std::pair<uint256, unsigned int> base;
+    if (!Read(DB_SNAPSHOT_BASE, base)) {
+        return false;
+    }
+    hash = base.first;
+    nChainTx = base.second;
+    return true;
+}
+
 bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read(DB_LAST_BLOCK, nFile);
 }
 
+bool CCoinsViewDB::GetCommitment(CCoinsCommitment &commitment) const {
+    return db.Read(DB_COINS_COMMITMENT, commitment);
+}
+
+bool CCoinsViewDB::WriteCommitment(const CCoinsCommitment &commitment) {
+    return db.Write(DB_COINS_COMMITMENT, commitment);
+}
+
+uint256 CCoinsViewDB::GetSnapshotLoad() const {
+    uint256 hashBlock;
+    if (!db.Read(DB_SNAPSHOT_LOAD, hashBlock)) {
+        return uint256();
+    }
+    return hashBlock;
+}
+
+bool CCoinsViewDB::WriteSnapshotLoad(const uint256 &hashBlock) {
+    if (hashBlock.IsNull()) {
+        return db.Erase(DB_SNAPSHOT_LOAD, true);
+    }
+    return db.Write(DB_SNAPSHOT_LOAD, hashBlock, true);
+}
+
 CCoinsViewCursor *CCoinsViewDB::Cursor() const {
+    return Cursor(uint256());
+}
+
+CCoinsViewCursor *CCoinsViewDB::Cursor(const uint256 &txidStart) const {
     CCoinsViewDBCursor *i = new CCoinsViewDBCursor(
         const_cast<CDBWrapper *>(&db)->NewIterator(), GetBestBlock());
     /**
@@ -130,7 +269,8 @@ CCoinsViewCursor *CCoinsViewDB::Cursor() const {
      * need read operations on it, use a const-cast to get around that
      * restriction.
      */
-    i->pcursor->Seek(DB_COIN);
+    COutPoint start(txidStart, 0);
+    i->pcursor->Seek(CoinEntry(&start));
     // Cache key of first record
     if (i->pcursor->Valid()) {
         CoinEntry entry(&i->keyTmp.second);
@@ -186,15 +326,30 @@ bool CBlockTreeDB::WriteBatchSync(
         batch.Write(std::make_pair(DB_BLOCK_FILES, it->first), *it->second);
     }
     batch.Write(DB_LAST_BLOCK, nLastFile);
+    std::vector<unsigned char> solution;
     for (std::vector<const CBlockIndex *>::const_iterator it =
              blockinfo.begin();
          it != blockinfo.end(); it++) {
+        // Writing the entry without its solution would lose it for good.
+        if (!GetBlockSolution(*it, solution)) {
+            return false;
+        }
         batch.Write(std::make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()),
-                    CDiskBlockIndex(*it));
+                    CDiskBlockIndex(*it, solution));
     }
     return WriteBatch(batch, true);
 }
 
+bool CBlockTreeDB::ReadBlockSolution(const uint256 &hash,
+                                     std::vector<unsigned char> &solution) {
+    CDiskBlockIndex diskindex;
+    if (!Read(std::make_pair(DB_BLOCK_INDEX, hash), diskindex)) {
+        return false;
+    }
+    solution.swap(diskindex.nSolution);
+    return true;
+}
+
 bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
     return Read(std::make_pair(DB_TXINDEX, txid), pos);
 }
@@ -220,9 +375,17 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+/**
+ * Entries are keyed by their block hash and LevelDB checksums every block it
+ * reads, so the key is trusted as the hash of the entry. Recomputing it means
+ * hashing the full header including the Equihash solution, which is only done
+ * for one in every nHashCheckInterval entries (never if 0).
+ */
 bool CBlockTreeDB::LoadBlockIndexGuts(
-    std::function<CBlockIndex *(const uint256 &)> insertBlockIndex) {
+    std::function<CBlockIndex *(const uint256 &)> insertBlockIndex,
+    unsigned int nHashCheckInterval) {
     const Config &config = GetConfig();
+    uint64_t nLoaded = 0;
 
     std::unique_ptr<CDBIterator> pcursor(NewIterator());
 
@@ -241,8 +404,14 @@ bool CBlockTreeDB::LoadBlockIndexGuts(
             return error("LoadBlockIndex() : failed to read value");
         }
 
+        if (nHashCheckInterval && nLoaded++ % nHashCheckInterval == 0 &&
+            diskindex.GetBlockHash() != key.second) {
+            return error("LoadBlockIndex(): block hash mismatch: %s",
+                         key.second.ToString());
+        }
+
         // Construct block index object
-        CBlockIndex *pindexNew = insertBlockIndex(diskindex.GetBlockHash());
+        CBlockIndex *pindexNew = insertBlockIndex(key.second);
         pindexNew->pprev = insertBlockIndex(diskindex.hashPrev);
         pindexNew->nHeight = diskindex.nHeight;
         pindexNew->nFile = diskindex.nFile;
@@ -254,7 +423,6 @@ bool CBlockTreeDB::LoadBlockIndexGuts(
         pindexNew->nTime = diskindex.nTime;
         pindexNew->nBits = diskindex.nBits;
         pindexNew->nNonce = diskindex.nNonce;
-        pindexNew->nSolution  = diskindex.nSolution;
         pindexNew->nStatus = diskindex.nStatus;
         pindexNew->nTx = diskindex.nTx;
 
@@ -27,6 +27,10 @@ static constexpr int MAX_BLOCK_COINSDB_USAGE = 200 * DB_PEAK_USAGE_FACTOR;
 static constexpr int MIN_BLOCK_COINSDB_USAGE = 50 * DB_PEAK_USAGE_FACTOR;
 //! -dbcache default (MiB)
 static const int64_t nDefaultDbCache = 450;
+//! -dbbatchsize default (bytes)
+static const int64_t nDefaultDbBatchSize = 16 << 20;
+//! -compactchainstate default (hours, 0 to disable)
+static const int64_t nDefaultDbCompactInterval = 0;
 //! max. -dbcache (MiB)
 static const int64_t nMaxDbCache = sizeof(void *) > 4 ? 16384 : 1024;
 //! min. -dbcache (MiB)
@@ -74,13 +78,29 @@ public:
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
+    std::vector<uint256> GetHeadBlocks() const override;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWritePartial(CCoinsMap &mapCoins,
+                           const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
+    CCoinsViewCursor *Cursor(const uint256 &txidStart) const override;
+    bool GetCommitment(CCoinsCommitment &commitment) const override;
+    bool WriteCommitment(const CCoinsCommitment &commitment) override;
+    uint256 GetSnapshotLoad() const override;
+    bool WriteSnapshotLoad(const uint256 &hashBlock) override;
 
     //! Attempt to update from an older database format.
     //! Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
+
+    //! Compact the database, see CDBWrapper::Compact.
+    void Compact() { db.Compact(); }
+    void GetDBStats(CDBStats &stats) const { db.GetStats(stats); }
+
+private:
+    bool WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock,
+                    bool fFinal);
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -104,6 +124,12 @@ private:
     friend class CCoinsViewDB;
 };
 
+/**
+ * Number of table files the chain state and block index databases keep open
+ * at most, as set with -dbmaxopenfiles and the like.
+ */
+int GetDBMaxOpenFiles();
+
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CDBWrapper {
 public:
@@ -119,14 +145,20 @@ public:
         int nLastFile, const std::vector<const CBlockIndex *> &blockinfo);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
     bool ReadLastBlockFile(int &nFile);
+    bool ReadBlockSolution(const uint256 &hash,
+                           std::vector<unsigned char> &solution);
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
+    //! The block and chain transaction count of a loaded UTXO snapshot.
+    bool WriteSnapshotBase(const uint256 &hash, unsigned int nChainTx);
+    bool ReadSnapshotBase(uint256 &hash, unsigned int &nChainTx);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>> &list);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts(
-        std::function<CBlockIndex *(const uint256 &)> insertBlockIndex);
+        std::function<CBlockIndex *(const uint256 &)> insertBlockIndex,
+        unsigned int nHashCheckInterval);
 };
 
 #endif // BITCOIN_TXDB_H
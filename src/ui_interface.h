@@ -115,6 +115,13 @@ public:
     boost::signals2::signal<void(const std::string &title, int nProgress)>
         ShowProgress;
 
+    /**
+     * Progress of the block verification at startup, with the estimated
+     * number of seconds left, or -1 if there is no estimate yet.
+     */
+    boost::signals2::signal<void(int nProgress, int64_t nSecondsLeft)>
+        NotifyVerifyProgress;
+
     /** New block has been accepted */
     boost::signals2::signal<void(bool, const CBlockIndex *)> NotifyBlockTip;
 
@@ -135,11 +135,13 @@ DisconnectResult UndoCoinSpend(const Coin &undo, CCoinsViewCache &view,
                                const COutPoint &out);
 
 /**
- * Undo a block from the block and the undoblock data.
- * See DisconnectBlock for more details.
+ * Undo a block from the block and the undoblock data, and apply the changes to
+ * commitment if given. The commitment is only accurate if DISCONNECT_OK is
+ * returned. See DisconnectBlock for more details.
  */
 DisconnectResult ApplyBlockUndo(const CBlockUndo &blockUndo,
                                 const CBlock &block, const CBlockIndex *pindex,
-                                CCoinsViewCache &coins);
+                                CCoinsViewCache &coins,
+                                CCoinsCommitment *commitment = nullptr);
 
 #endif // BITCOIN_UNDO_H
@@ -7,6 +7,7 @@
 #include "validation.h"
 
 #include "arith_uint256.h"
+#include "blocksolutioncache.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -39,8 +40,16 @@
 #include "versionbits.h"
 #include "warnings.h"
 
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
 #include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/replace.hpp>
@@ -50,6 +59,11 @@
 #include <boost/range/adaptor/reversed.hpp>
 #include <boost/thread.hpp>
 
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #if defined(NDEBUG)
 #error "Bitcoin cannot be compiled without assertions."
 #endif
@@ -63,6 +77,7 @@ CCriticalSection cs_main;
 BlockMap mapBlockIndex;
 CChain chainActive;
 CBlockIndex *pindexBestHeader = nullptr;
+CBlockIndex *pindexSnapshotBase = nullptr;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
@@ -75,7 +90,9 @@ bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+bool fCoinsCommitment = DEFAULT_COINS_COMMITMENT;
 size_t nCoinCacheUsage = 5000 * 300;
+unsigned int nReorgCacheBlocks = DEFAULT_REORG_CACHE_BLOCKS;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 
@@ -140,6 +157,22 @@ int nLastBlockFile = 0;
  */
 bool fCheckForPruning = false;
 
+/**
+ * Disk space to reserve per coin written to the coins database. Typical Coin
+ * structures on disk are around 48 bytes in size. Pushing a new one to the
+ * database can cause it to be written twice (once in the log, and once in the
+ * tables). This is already an overestimation, as most will delete an existing
+ * entry or overwrite one. Still, use a conservative safety factor of 2.
+ */
+static const uint64_t COINS_DB_SPACE_PER_ENTRY = 48 * 2 * 2;
+
+/**
+ * Commitment to the UTXO set, carried along by ConnectTip and DisconnectTip.
+ * It is only valid while its block is the best block of pcoinsTip; once it
+ * falls behind it stays stale until it is set again from a full scan.
+ */
+CCoinsCommitment coinsCommitment;
+
 /**
  * Every received block is assigned a unique and increasing identifier, so we
  * know which one to give priority in case of a fork.
@@ -157,8 +190,57 @@ std::set<CBlockIndex *> setDirtyBlockIndex;
 
 /** Dirty block file entries. */
 std::set<int> setDirtyFileInfo;
+
+CBlockSolutionCache blockSolutionCache(BLOCK_SOLUTION_CACHE_SIZE);
 } // namespace
 
+/**
+ * Whether the coins cache is being written out over several calls to
+ * FlushStateToDisk. Until that completes, the coins database records the
+ * transition to the tip it is in, which only replaying blocks along the active
+ * chain can complete, so the tip must not be disconnected before a full flush.
+ */
+bool fCoinsSyncPending = false;
+
+bool GetBlockSolution(const CBlockIndex *pindex,
+                      std::vector<unsigned char> &solution) {
+    if (blockSolutionCache.Get(pindex, solution)) {
+        return true;
+    }
+    if (!pblocktree ||
+        !pblocktree->ReadBlockSolution(pindex->GetBlockHash(), solution)) {
+        return error("%s: no solution found for block %s", __func__,
+                     pindex->GetBlockHash().ToString());
+    }
+    blockSolutionCache.AddRecent(pindex, solution);
+    return true;
+}
+
+bool GetBlockHeaders(const std::vector<const CBlockIndex *> &vIndex,
+                     std::vector<CBlockHeader> &vHeaders) {
+    vHeaders.resize(vIndex.size());
+    std::vector<size_t> vMissing;
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        vIndex[i]->GetUnsolvedBlockHeader(vHeaders[i]);
+        if (!blockSolutionCache.Get(vIndex[i], vHeaders[i].nSolution)) {
+            vMissing.push_back(i);
+        }
+    }
+    // Read in key order, so that neighbouring reads share database blocks.
+    std::sort(vMissing.begin(), vMissing.end(), [&vIndex](size_t a, size_t b) {
+        return vIndex[a]->GetBlockHash() < vIndex[b]->GetBlockHash();
+    });
+    for (size_t i : vMissing) {
+        if (!pblocktree ||
+            !pblocktree->ReadBlockSolution(vIndex[i]->GetBlockHash(),
+                                           vHeaders[i].nSolution)) {
+            return error("%s: no solution found for block %s", __func__,
+                         vIndex[i]->GetBlockHash().ToString());
+        }
+    }
+    return true;
+}
+
 /**
  * Use this class to start tracking transactions that are removed from the
  * mempool and pass all those transactions through SyncTransaction when the
@@ -212,6 +294,7 @@ CBlockIndex *FindForkInGlobalIndex(const CChain &chain,
     return chain.Genesis();
 }
 
+CCoinsViewDB *pcoinsdbview = nullptr;
 CCoinsViewCache *pcoinsTip = nullptr;
 CBlockTreeDB *pblocktree = nullptr;
 
@@ -1093,27 +1176,283 @@ bool GetTransaction(const Config &config, const uint256 &txid,
 // CBlock and CBlockIndex
 //
 
+namespace {
+
+/**
+ * Writes block and undo files on a dedicated thread, so that validation can
+ * continue as soon as the data is serialized. Writes, preallocations and
+ * commits are carried out in the order they were queued, and reading a file
+ * through OpenBlockFile or OpenUndoFile first waits for the writes queued to
+ * it.
+ *
+ * Files are only committed to disk when a block file is left, and when Sync
+ * is called by FlushStateToDisk before writing the block index that refers to
+ * them, so that a single fdatasync per file covers all blocks since the
+ * previous flush.
+ *
+ * Before the thread is started and after it is interrupted, the callers carry
+ * out the work themselves.
+ */
+class CBlockFileWriter {
+private:
+    struct Item {
+        enum Type { WRITE, ALLOCATE, FINALIZE, SYNC };
+
+        Type type;
+        bool fUndo;
+        CDiskBlockPos pos;
+        //! The data to write
+        std::vector<uint8_t> data;
+        //! The length to allocate, or the size to truncate to if fTruncate
+        unsigned int nLength;
+        bool fTruncate;
+
+        Item(Type typeIn, bool fUndoIn, const CDiskBlockPos &posIn)
+            : type(typeIn), fUndo(fUndoIn), pos(posIn), nLength(0),
+              fTruncate(false) {}
+    };
+
+    std::mutex cs;
+    //! Signalled when items are queued or the thread is interrupted
+    std::condition_variable condWork;
+    //! Signalled when items are done
+    std::condition_variable condDone;
+    std::deque<Item> queue;
+    size_t nQueuedBytes;
+    //! Sequence numbers of the last queued and the last done item
+    uint64_t nQueued;
+    uint64_t nDone;
+    //! Sequence number of the last item queued for each undo flag and file
+    std::map<std::pair<bool, int>, uint64_t> mapLastQueued;
+    bool fRunning;
+    bool fInterrupted;
+    std::atomic<bool> fFailed;
+
+    //! Only used by whoever processes the items, the thread if fRunning.
+    //! The open block and undo file, and the files written since their last
+    //! commit.
+    FILE *files[2];
+    int nOpenFile[2];
+    std::set<std::pair<bool, int>> setDirty;
+
+    FILE *GetFile(bool fUndo, int nFile) {
+        if (files[fUndo] && nOpenFile[fUndo] == nFile) {
+            return files[fUndo];
+        }
+        CloseFile(fUndo);
+        CDiskBlockPos pos(nFile, 0);
+        files[fUndo] = fUndo ? OpenUndoFile(pos) : OpenBlockFile(pos);
+        nOpenFile[fUndo] = nFile;
+        return files[fUndo];
+    }
+
+    void CloseFile(bool fUndo) {
+        if (files[fUndo]) {
+            fclose(files[fUndo]);
+            files[fUndo] = nullptr;
+        }
+    }
+
+    void Process(const Item &item) {
+        if (item.type == Item::SYNC) {
+            for (const std::pair<bool, int> &file : setDirty) {
+                FILE *pfile = GetFile(file.first, file.second);
+                if (pfile) {
+                    FileCommit(pfile);
+                }
+            }
+            setDirty.clear();
+            CloseFile(false);
+            CloseFile(true);
+            return;
+        }
+
+        FILE *file = GetFile(item.fUndo, item.pos.nFile);
+        if (!file) {
+            fFailed = true;
+            return;
+        }
+        switch (item.type) {
+            case Item::WRITE:
+                // Flush right away, so that readers opening the file find
+                // the data.
+                if (fseek(file, item.pos.nPos, SEEK_SET) ||
+                    fwrite(item.data.data(), 1, item.data.size(), file) !=
+                        item.data.size() ||
+                    fflush(file)) {
+                    LogPrintf("Unable to write %u bytes at position %u of "
+                              "%s%05u.dat\n",
+                              item.data.size(), item.pos.nPos,
+                              item.fUndo ? "rev" : "blk", item.pos.nFile);
+                    fFailed = true;
+                }
+                setDirty.emplace(item.fUndo, item.pos.nFile);
+                break;
+            case Item::ALLOCATE:
+                AllocateFileRange(file, item.pos.nPos, item.nLength);
+                fflush(file);
+                setDirty.emplace(item.fUndo, item.pos.nFile);
+                break;
+            case Item::FINALIZE:
+                if (item.fTruncate) {
+                    TruncateFile(file, item.nLength);
+                }
+                FileCommit(file);
+                setDirty.erase(std::make_pair(item.fUndo, item.pos.nFile));
+                break;
+            case Item::SYNC:
+                break;
+        }
+    }
+
+    //! Queue an item, or process it if the thread is not running. Returns its
+    //! sequence number.
+    uint64_t Add(Item &&item) {
+        std::unique_lock<std::mutex> lock(cs);
+        // Bound the memory held by the queue, but always accept one item.
+        condDone.wait(lock, [this, &item] {
+            return !fRunning || queue.empty() ||
+                   nQueuedBytes + item.data.size() <=
+                       MAX_BLOCKFILE_WRITE_QUEUE;
+        });
+        const uint64_t nSeq = ++nQueued;
+        if (item.type != Item::SYNC) {
+            mapLastQueued[std::make_pair(item.fUndo, item.pos.nFile)] = nSeq;
+        }
+        if (!fRunning) {
+            // The thread drains the queue before it stops.
+            assert(queue.empty());
+            Process(item);
+            nDone = nSeq;
+            return nSeq;
+        }
+        nQueuedBytes += item.data.size();
+        queue.push_back(std::move(item));
+        condWork.notify_one();
+        return nSeq;
+    }
+
+    void WaitFor(std::unique_lock<std::mutex> &lock, uint64_t nSeq) {
+        condDone.wait(lock, [this, nSeq] { return nDone >= nSeq; });
+    }
+
+public:
+    CBlockFileWriter()
+        : nQueuedBytes(0), nQueued(0), nDone(0), fRunning(false),
+          fInterrupted(false), fFailed(false), files{nullptr, nullptr},
+          nOpenFile{0, 0} {}
+
+    ~CBlockFileWriter() {
+        CloseFile(false);
+        CloseFile(true);
+    }
+
+    //! Queue writing data at pos. Returns false if an earlier write failed.
+    bool Write(bool fUndo, const CDiskBlockPos &pos,
+               std::vector<uint8_t> &&data) {
+        Item item(Item::WRITE, fUndo, pos);
+        item.data = std::move(data);
+        Add(std::move(item));
+        return !fFailed;
+    }
+
+    //! Queue preallocating nLength bytes from pos.
+    void Allocate(bool fUndo, const CDiskBlockPos &pos, unsigned int nLength) {
+        Item item(Item::ALLOCATE, fUndo, pos);
+        item.nLength = nLength;
+        Add(std::move(item));
+    }
+
+    //! Queue committing a file, after optionally truncating it to nSize.
+    void Finalize(bool fUndo, int nFile, bool fTruncate, unsigned int nSize) {
+        Item item(Item::FINALIZE, fUndo, CDiskBlockPos(nFile, 0));
+        item.fTruncate = fTruncate;
+        item.nLength = nSize;
+        Add(std::move(item));
+    }
+
+    /**
+     * Wait until everything queued has been written and committed to disk.
+     * Returns false if any write failed.
+     */
+    bool Sync() {
+        const uint64_t nSeq =
+            Add(Item(Item::SYNC, false, CDiskBlockPos(0, 0)));
+        std::unique_lock<std::mutex> lock(cs);
+        WaitFor(lock, nSeq);
+        return !fFailed;
+    }
+
+    //! Wait until the writes queued to a file are done.
+    void WaitForFile(bool fUndo, int nFile) {
+        std::unique_lock<std::mutex> lock(cs);
+        auto it = mapLastQueued.find(std::make_pair(fUndo, nFile));
+        if (it != mapLastQueued.end()) {
+            WaitFor(lock, it->second);
+        }
+    }
+
+    void Run() {
+        std::unique_lock<std::mutex> lock(cs);
+        fRunning = true;
+        while (true) {
+            condWork.wait(lock,
+                          [this] { return fInterrupted || !queue.empty(); });
+            if (queue.empty()) {
+                break;
+            }
+            Item item = std::move(queue.front());
+            queue.pop_front();
+            lock.unlock();
+            Process(item);
+            lock.lock();
+            nQueuedBytes -= item.data.size();
+            nDone++;
+            condDone.notify_all();
+        }
+        fRunning = false;
+        condDone.notify_all();
+    }
+
+    void Interrupt() {
+        std::unique_lock<std::mutex> lock(cs);
+        fInterrupted = true;
+        condWork.notify_all();
+    }
+};
+
+CBlockFileWriter blockFileWriter;
+
+} // namespace
+
+void ThreadBlockFileWriter() {
+    RenameThread("bitcoin-blkwrite");
+    blockFileWriter.Run();
+}
+
+void InterruptBlockFileWriter() {
+    blockFileWriter.Interrupt();
+}
+
 bool WriteBlockToDisk(const CBlock &block, CDiskBlockPos &pos,
                       const CMessageHeader::MessageMagic &messageStart) {
-    // Open history file to append
-    CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull()) {
-        return error("WriteBlockToDisk: OpenBlockFile failed");
-    }
+    unsigned int nSize =
+        ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+    std::vector<uint8_t> data;
+    data.reserve(sizeof(messageStart) + sizeof(nSize) + nSize);
+    CVectorWriter writer(SER_DISK, CLIENT_VERSION, data, 0);
 
     // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, block);
-    fileout << FLATDATA(messageStart) << nSize;
+    writer << FLATDATA(messageStart) << nSize;
+    CDiskBlockPos posHeader = pos;
+    pos.nPos += data.size();
 
     // Write block
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0) {
-        return error("WriteBlockToDisk: ftell failed");
+    writer << block;
+    if (!blockFileWriter.Write(false, posHeader, std::move(data))) {
+        return error("WriteBlockToDisk: writing block files failed");
     }
 
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
-
     return true;
 }
 
@@ -1137,16 +1476,24 @@ bool ReadBlockFromDisk(CBlock &block, const CDiskBlockPos &pos,
     }
   // Check Equihash solution
     bool postfork = IsBCPEnabled(config,block.nHeight);
-    if (postfork && !CheckEquihashSolution(&block, config)) {
-        return error("ReadBlockFromDisk: Errors in block header at %s (bad Equihash solution)", pos.ToString());
+    uint256 hash;
+    if (postfork) {
+        CBlockHeaderHashContext context(block);
+        if (!CheckEquihashSolution(context, config)) {
+            return error("ReadBlockFromDisk: Errors in block header at %s (bad Equihash solution)", pos.ToString());
+        }
+        hash = context.GetHash();
+    } else {
+        hash = block.GetHash();
     }
 
 
     // Check the header
-    if (!CheckProofOfWork(block.GetHash(), block.nBits, postfork,config)) {
+    if (!CheckProofOfWork(hash, block.nBits, postfork,config)) {
         return error("ReadBlockFromDisk: Errors in block header at %s",
                      pos.ToString());
     }
+    block.hashCache.Set(!postfork, hash);
 
     return true;
 }
@@ -1166,6 +1513,177 @@ bool ReadBlockFromDisk(CBlock &block, const CBlockIndex *pindex,
     return true;
 }
 
+/** A block file mapped into memory for reading. */
+class CMappedBlockFile {
+public:
+    const uint8_t *data;
+    size_t size;
+
+    CMappedBlockFile(const uint8_t *dataIn, size_t sizeIn)
+        : data(dataIn), size(sizeIn) {}
+    ~CMappedBlockFile() {
+#ifndef WIN32
+        munmap(const_cast<uint8_t *>(data), size);
+#endif
+    }
+};
+
+namespace {
+
+/**
+ * The number of block files kept mapped for ReadRawBlockFromDisk. Blocks that
+ * peers request tend to be close together, so a few files go a long way.
+ */
+const size_t MAX_MAPPED_BLOCK_FILES = 8;
+
+typedef std::map<int, std::pair<std::shared_ptr<const CMappedBlockFile>,
+                                uint64_t>>
+    MappedBlockFileMap;
+
+CCriticalSection cs_mappedBlockFiles;
+//! The mapped block files, with the last time they were used.
+MappedBlockFileMap mapMappedBlockFiles;
+uint64_t nMappedBlockFileUses = 0;
+
+/**
+ * Map a block file at least nMinSize bytes long, or return nullptr if it
+ * cannot be mapped or is too short. Files are mapped anew once they have
+ * grown beyond their mapping.
+ */
+std::shared_ptr<const CMappedBlockFile> GetMappedBlockFile(int nFile,
+                                                           size_t nMinSize) {
+#ifdef WIN32
+    return nullptr;
+#else
+    // Leave the address space of 32-bit systems alone.
+    if (sizeof(void *) < 8) {
+        return nullptr;
+    }
+
+    LOCK(cs_mappedBlockFiles);
+    auto it = mapMappedBlockFiles.find(nFile);
+    if (it != mapMappedBlockFiles.end() &&
+        it->second.first->size >= nMinSize) {
+        it->second.second = ++nMappedBlockFileUses;
+        return it->second.first;
+    }
+
+    FILE *file = OpenBlockFile(CDiskBlockPos(nFile, 0), true);
+    if (!file) {
+        return nullptr;
+    }
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fileno(file), &st) == 0 && size_t(st.st_size) >= nMinSize &&
+        st.st_size > 0) {
+        data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fileno(file),
+                    0);
+    }
+    fclose(file);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+
+    auto mapping = std::make_shared<const CMappedBlockFile>(
+        static_cast<const uint8_t *>(data), st.st_size);
+    if (it == mapMappedBlockFiles.end() &&
+        mapMappedBlockFiles.size() >= MAX_MAPPED_BLOCK_FILES) {
+        auto itOldest = std::min_element(
+            mapMappedBlockFiles.begin(), mapMappedBlockFiles.end(),
+            [](const MappedBlockFileMap::value_type &a,
+               const MappedBlockFileMap::value_type &b) {
+                return a.second.second < b.second.second;
+            });
+        mapMappedBlockFiles.erase(itOldest);
+    }
+    // Readers still holding the old mapping keep it alive.
+    mapMappedBlockFiles[nFile] =
+        std::make_pair(mapping, ++nMappedBlockFileUses);
+    return mapping;
+#endif
+}
+
+void ForgetMappedBlockFile(int nFile) {
+    LOCK(cs_mappedBlockFiles);
+    mapMappedBlockFiles.erase(nFile);
+}
+
+} // namespace
+
+bool ReadRawBlockFromDisk(CRawBlock &block, const CBlockIndex *pindex,
+                          const Config &config) {
+    const CDiskBlockPos pos = pindex->GetBlockPos();
+    const CMessageHeader::MessageMagic &messageStart =
+        config.GetChainParams().DiskMagic();
+    // The block is preceded by the magic and its size.
+    CMessageHeader::MessageMagic magic;
+    unsigned int nSize;
+    const unsigned int nHeaderSize = sizeof(magic) + sizeof(nSize);
+    if (pos.IsNull() || pos.nPos < nHeaderSize) {
+        return error("%s: invalid position %s", __func__, pos.ToString());
+    }
+    const CDiskBlockPos posHeader(pos.nFile, pos.nPos - nHeaderSize);
+
+    block.mapping.reset();
+    block.buffer.clear();
+    blockFileWriter.WaitForFile(false, pos.nFile);
+    block.mapping = GetMappedBlockFile(pos.nFile, pos.nPos);
+    try {
+        if (block.mapping) {
+            CSpanReader(SER_DISK, CLIENT_VERSION,
+                        block.mapping->data + posHeader.nPos,
+                        block.mapping->data + pos.nPos) >>
+                FLATDATA(magic) >> nSize;
+            if (magic == messageStart &&
+                block.mapping->size < size_t(pos.nPos) + nSize) {
+                block.mapping =
+                    GetMappedBlockFile(pos.nFile, size_t(pos.nPos) + nSize);
+                if (!block.mapping) {
+                    return error("%s: block at %s extends beyond its file",
+                                 __func__, pos.ToString());
+                }
+            }
+            block.pbegin = block.mapping->data + pos.nPos;
+        } else {
+            CAutoFile filein(OpenBlockFile(posHeader, true), SER_DISK,
+                             CLIENT_VERSION);
+            if (filein.IsNull()) {
+                return error("%s: OpenBlockFile failed for %s", __func__,
+                             pos.ToString());
+            }
+            filein >> FLATDATA(magic) >> nSize;
+            if (magic == messageStart && nSize <= MAX_BLOCKFILE_SIZE) {
+                block.buffer.resize(nSize);
+                filein.read((char *)block.buffer.data(), nSize);
+            }
+            block.pbegin = block.buffer.data();
+        }
+    } catch (const std::exception &e) {
+        return error("%s: I/O error - %s at %s", __func__, e.what(),
+                     pos.ToString());
+    }
+    if (magic != messageStart || nSize > MAX_BLOCKFILE_SIZE) {
+        return error("%s: invalid block header at %s", __func__,
+                     pos.ToString());
+    }
+    block.nSize = nSize;
+
+    CBlockHeader header;
+    try {
+        CSpanReader(SER_DISK, CLIENT_VERSION, block.begin(), block.end()) >>
+            header;
+    } catch (const std::exception &e) {
+        return error("%s: Deserialize error - %s at %s", __func__, e.what(),
+                     pos.ToString());
+    }
+    if (header.GetHash() != pindex->GetBlockHash()) {
+        return error("%s: GetHash() doesn't match index for %s at %s",
+                     __func__, pindex->ToString(), pos.ToString());
+    }
+
+    return true;
+}
+
 Amount GetBlockSubsidy(int nHeight, const Consensus::Params &consensusParams) {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
     // Force block reward to zero when right shift is undefined.
@@ -1326,7 +1844,9 @@ static void InvalidBlockFound(CBlockIndex *pindex,
 }
 
 void UpdateCoins(const CTransaction &tx, CCoinsViewCache &inputs,
-                 CTxUndo &txundo, int nHeight) {
+                 CTxUndo &txundo, int nHeight, CCoinsCommitment *commitment) {
+    const uint256 &txid = tx.GetId();
+
     // Mark inputs spent.
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
@@ -1335,11 +1855,25 @@ void UpdateCoins(const CTransaction &tx, CCoinsViewCache &inputs,
             bool is_spent =
                 inputs.SpendCoin(txin.prevout, &txundo.vprevout.back());
             assert(is_spent);
+            if (commitment) {
+                commitment->RemoveCoin(txin.prevout, txundo.vprevout.back());
+            }
         }
     }
 
     // Add outputs.
     AddCoins(inputs, tx, nHeight);
+    if (commitment) {
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            // Unspendable outputs are not added, and looking them up in the
+            // cache would miss down to the database.
+            if (tx.vout[o].scriptPubKey.IsUnspendable()) {
+                continue;
+            }
+            commitment->AddCoin(COutPoint(txid, o),
+                                Coin(tx.vout[o], nHeight, tx.IsCoinBase()));
+        }
+    }
 }
 
 void UpdateCoins(const CTransaction &tx, CCoinsViewCache &inputs, int nHeight) {
@@ -1358,6 +1892,26 @@ bool CScriptCheck::operator()() {
     return true;
 }
 
+bool CEquihashCheck::operator()() {
+    return CheckEquihashSolution(pheader, *config);
+}
+
+bool CTxCheck::operator()() {
+    *pnSigOps = GetSigOpCountWithoutP2SH(*ptx);
+    if (fCheckTx) {
+        CValidationState state;
+        *pfValid = CheckRegularTransaction(*ptx, state, false);
+    }
+    return true;
+}
+
+bool CCoinsPrefetch::operator()() {
+    // pcoinsTip's backing view aborts the node on read errors, so there is
+    // nothing to catch here.
+    *pfFound = pview->GetCoin(*poutpoint, *pcoin);
+    return true;
+}
+
 int GetSpendHeight(const CCoinsViewCache &inputs) {
     LOCK(cs_main);
     CBlockIndex *pindexPrev = mapBlockIndex.find(inputs.GetBestBlock())->second;
@@ -1521,26 +2075,30 @@ namespace {
 bool UndoWriteToDisk(const CBlockUndo &blockundo, CDiskBlockPos &pos,
                      const uint256 &hashBlock,
                      const CMessageHeader::MessageMagic &messageStart) {
-    // Open history file to append
-    CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull()) return error("%s: OpenUndoFile failed", __func__);
+    unsigned int nSize =
+        ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION);
+    std::vector<uint8_t> data;
+    data.reserve(sizeof(messageStart) + sizeof(nSize) + nSize +
+                 sizeof(uint256));
+    CVectorWriter writer(SER_DISK, CLIENT_VERSION, data, 0);
 
     // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, blockundo);
-    fileout << FLATDATA(messageStart) << nSize;
+    writer << FLATDATA(messageStart) << nSize;
+    CDiskBlockPos posHeader = pos;
+    pos.nPos += data.size();
 
     // Write undo data
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0) return error("%s: ftell failed", __func__);
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
+    writer << blockundo;
 
     // calculate & write checksum
     CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
     hasher << hashBlock;
     hasher << blockundo;
-    fileout << hasher.GetHash();
+    writer << hasher.GetHash();
 
+    if (!blockFileWriter.Write(true, posHeader, std::move(data))) {
+        return error("%s: writing undo files failed", __func__);
+    }
     return true;
 }
 
@@ -1622,7 +2180,9 @@ DisconnectResult UndoCoinSpend(const Coin &undo, CCoinsViewCache &view,
                                         alternate.IsCoinBase());
     }
 
-    view.AddCoin(out, undo, undo.IsCoinBase());
+    // The coin may already exist when replaying blocks after an interrupted
+    // write of the coins database.
+    view.AddCoin(out, undo, undo.IsCoinBase() || !fClean);
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
@@ -1631,9 +2191,9 @@ DisconnectResult UndoCoinSpend(const Coin &undo, CCoinsViewCache &view,
  * by coins. When UNCLEAN or FAILED is returned, view is left in an
  * indeterminate state.
  */
-static DisconnectResult DisconnectBlock(const CBlock &block,
-                                        const CBlockIndex *pindex,
-                                        CCoinsViewCache &view) {
+static DisconnectResult
+DisconnectBlock(const CBlock &block, const CBlockIndex *pindex,
+                CCoinsViewCache &view, CCoinsCommitment *commitment = nullptr) {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
     CBlockUndo blockUndo;
@@ -1648,12 +2208,13 @@ static DisconnectResult DisconnectBlock(const CBlock &block,
         return DISCONNECT_FAILED;
     }
 
-    return ApplyBlockUndo(blockUndo, block, pindex, view);
+    return ApplyBlockUndo(blockUndo, block, pindex, view, commitment);
 }
 
 DisconnectResult ApplyBlockUndo(const CBlockUndo &blockUndo,
                                 const CBlock &block, const CBlockIndex *pindex,
-                                CCoinsViewCache &view) {
+                                CCoinsViewCache &view,
+                                CCoinsCommitment *commitment) {
     bool fClean = true;
 
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size()) {
@@ -1681,6 +2242,9 @@ DisconnectResult ApplyBlockUndo(const CBlockUndo &blockUndo,
                 // transaction output mismatch
                 fClean = false;
             }
+            if (is_spent && commitment) {
+                commitment->RemoveCoin(out, coin);
+            }
         }
 
         // Restore inputs.
@@ -1702,6 +2266,9 @@ DisconnectResult ApplyBlockUndo(const CBlockUndo &blockUndo,
             if (res == DISCONNECT_FAILED) {
                 return DISCONNECT_FAILED;
             }
+            if (commitment) {
+                commitment->AddCoin(out, undo);
+            }
             fClean = fClean && res != DISCONNECT_UNCLEAN;
         }
     }
@@ -1712,38 +2279,135 @@ DisconnectResult ApplyBlockUndo(const CBlockUndo &blockUndo,
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
-static void FlushBlockFile(bool fFinalize = false) {
+/**
+ * Commit the current block and undo file when leaving them, after truncating
+ * them to their size if fFinalize, without waiting for that to be done.
+ */
+static void FlushBlockFile(bool fFinalize) {
     LOCK(cs_LastBlockFile);
 
-    CDiskBlockPos posOld(nLastBlockFile, 0);
-
-    FILE *fileOld = OpenBlockFile(posOld);
-    if (fileOld) {
-        if (fFinalize)
-            TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
-        FileCommit(fileOld);
-        fclose(fileOld);
-    }
+    blockFileWriter.Finalize(false, nLastBlockFile, fFinalize,
+                             vinfoBlockFile[nLastBlockFile].nSize);
+    blockFileWriter.Finalize(true, nLastBlockFile, fFinalize,
+                             vinfoBlockFile[nLastBlockFile].nUndoSize);
+}
 
-    fileOld = OpenUndoFile(posOld);
-    if (fileOld) {
-        if (fFinalize)
-            TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nUndoSize);
-        FileCommit(fileOld);
-        fclose(fileOld);
-    }
+/**
+ * Write out and commit all queued block and undo data. Returns false if any
+ * of it could not be written.
+ */
+static bool SyncBlockFiles() {
+    return blockFileWriter.Sync();
 }
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos,
                  unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+static CCheckQueue<CBlockCheck> scriptcheckqueue(128);
+// CCheckQueueControl expects an idle queue, so each of the check queues comes
+// with a lock that serializes its users.
+static CCriticalSection cs_scriptcheckqueue;
+// Blocks with fewer transactions are checked on the calling thread.
+static const size_t MIN_PARALLEL_TX_CHECKS = 256;
 
 void ThreadScriptCheck() {
     RenameThread("bitcoin-scriptch");
     scriptcheckqueue.Thread();
 }
 
+static CCheckQueue<CEquihashCheck> equihashcheckqueue(16);
+static CCriticalSection cs_equihashcheckqueue;
+
+void ThreadEquihashCheck() {
+    RenameThread("bitcoin-eqcheck");
+    equihashcheckqueue.Thread();
+}
+
+bool CheckEquihashSolutions(const Config &config,
+                            const std::vector<const CBlockHeader *> &headers) {
+    if (nScriptCheckThreads == 0 || headers.size() < 2) {
+        for (const CBlockHeader *pheader : headers) {
+            if (!CheckEquihashSolution(pheader, config)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::vector<CEquihashCheck> vChecks;
+    vChecks.reserve(headers.size());
+    for (const CBlockHeader *pheader : headers) {
+        vChecks.emplace_back(config, *pheader);
+    }
+
+    LOCK(cs_equihashcheckqueue);
+    CCheckQueueControl<CEquihashCheck> control(&equihashcheckqueue);
+    control.Add(vChecks);
+    return control.Wait();
+}
+
+static CCheckQueue<CCoinsPrefetch> coinsprefetchqueue(16);
+static CCriticalSection cs_coinsprefetchqueue;
+
+void ThreadCoinsPrefetch() {
+    RenameThread("bitcoin-prefetch");
+    coinsprefetchqueue.Thread();
+}
+
+/**
+ * Load the coins spent by a block that are not in pcoinsTip yet with parallel
+ * reads from the UTXO database, so that ConnectBlock finds them in the cache
+ * instead of doing one synchronous read per input.
+ */
+static void PrefetchBlockInputs(const CBlock &block) {
+    AssertLockHeld(cs_main);
+    if (nScriptCheckThreads == 0) {
+        return;
+    }
+
+    // Outputs created by the block itself are not in the database yet.
+    std::unordered_set<uint256, SaltedTxidHasher> setBlockTxids;
+    for (const auto &tx : block.vtx) {
+        setBlockTxids.insert(tx->GetId());
+    }
+    std::vector<COutPoint> vOutpoints;
+    for (const auto &tx : block.vtx) {
+        if (tx->IsCoinBase()) {
+            continue;
+        }
+        for (const CTxIn &txin : tx->vin) {
+            if (!setBlockTxids.count(txin.prevout.hash) &&
+                !pcoinsTip->HaveCoinInCache(txin.prevout)) {
+                vOutpoints.push_back(txin.prevout);
+            }
+        }
+    }
+    if (vOutpoints.empty()) {
+        return;
+    }
+
+    std::vector<Coin> vCoins(vOutpoints.size());
+    std::vector<char> vFound(vOutpoints.size(), 0);
+    std::vector<CCoinsPrefetch> vChecks;
+    vChecks.reserve(vOutpoints.size());
+    const CCoinsView &base = *pcoinsTip->GetBackend();
+    for (size_t i = 0; i < vOutpoints.size(); i++) {
+        vChecks.emplace_back(base, vOutpoints[i], vCoins[i], vFound[i]);
+    }
+    {
+        LOCK(cs_coinsprefetchqueue);
+        CCheckQueueControl<CCoinsPrefetch> control(&coinsprefetchqueue);
+        control.Add(vChecks);
+        control.Wait();
+    }
+
+    for (size_t i = 0; i < vOutpoints.size(); i++) {
+        if (vFound[i]) {
+            pcoinsTip->CacheBaseCoin(vOutpoints[i], std::move(vCoins[i]));
+        }
+    }
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -1861,14 +2525,17 @@ static int64_t nTimeTotal = 0;
 
 /**
  * Apply the effects of this block (with given index) on the UTXO set
- * represented by coins. Validity checks that depend on the UTXO set are also
- * done; ConnectBlock() can fail if those validity checks fail (among other
- * reasons).
+ * represented by coins, and on commitment if given. Validity checks that depend
+ * on the UTXO set are also done; ConnectBlock() can fail if those validity
+ * checks fail (among other reasons). If pblockundo is given, it receives the
+ * undo data of the block.
  */
 static bool ConnectBlock(const Config &config, const CBlock &block,
                          CValidationState &state, CBlockIndex *pindex,
                          CCoinsViewCache &view, const CChainParams &chainparams,
-                         bool fJustCheck = false) {
+                         bool fJustCheck = false,
+                         CCoinsCommitment *commitment = nullptr,
+                         CBlockUndo *pblockundo = nullptr) {
     AssertLockHeld(cs_main);
 
     int64_t nTimeStart = GetTimeMicros();
@@ -1949,17 +2616,18 @@ static bool ConnectBlock(const Config &config, const CBlock &block,
     // applied to all blocks except the two in the chain that violate it. This
     // prevents exploiting the issue against nodes during their initial block
     // download.
-    bool fEnforceBIP30 = (!pindex->phashBlock) || // Enforce on CreateNewBlock
-                                                  // invocations which don't
-                                                  // have a hash.
-                         !((pindex->nHeight == 91842 &&
-                            pindex->GetBlockHash() ==
-                                uint256S("0x00000000000a4d0a398161ffc163c503763"
-                                         "b1f4360639393e0e4c8e300e0caec")) ||
-                           (pindex->nHeight == 91880 &&
-                            pindex->GetBlockHash() ==
-                                uint256S("0x00000000000743f190a18c5577a3c2d2a1f"
-                                         "610ae9601ac046a38084ccb7cd721")));
+    const bool fBIP30Exception =
+        pindex->phashBlock && // Enforce on CreateNewBlock invocations which
+                              // don't have a hash.
+        ((pindex->nHeight == 91842 &&
+          pindex->GetBlockHash() ==
+              uint256S("0x00000000000a4d0a398161ffc163c503763"
+                       "b1f4360639393e0e4c8e300e0caec")) ||
+         (pindex->nHeight == 91880 &&
+          pindex->GetBlockHash() ==
+              uint256S("0x00000000000743f190a18c5577a3c2d2a1f"
+                       "610ae9601ac046a38084ccb7cd721")));
+    bool fEnforceBIP30 = !fBIP30Exception;
 
     // Once BIP34 activated it was not possible to create new duplicate
     // coinbases and thus other than starting with the 2 existing duplicate
@@ -2008,8 +2676,9 @@ static bool ConnectBlock(const Config &config, const CBlock &block,
 
     CBlockUndo blockundo;
 
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks ? &scriptcheckqueue
-                                                           : nullptr);
+    LOCK(cs_scriptcheckqueue);
+    CCheckQueueControl<CBlockCheck> control(fScriptChecks ? &scriptcheckqueue
+                                                          : nullptr);
 
     std::vector<int> prevheights;
     Amount nFees(0);
@@ -2092,8 +2761,20 @@ static bool ConnectBlock(const Config &config, const CBlock &block,
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
         }
+        if (commitment && fBIP30Exception) {
+            // The duplicate coinbases of these blocks replace the outputs of
+            // the earlier ones that are still unspent, which leave the set
+            // without being spent. No other block can overwrite a coin.
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                const COutPoint out(tx.GetId(), o);
+                const Coin &coin = view.AccessCoin(out);
+                if (!coin.IsSpent()) {
+                    commitment->RemoveCoin(out, coin);
+                }
+            }
+        }
         UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(),
-                    pindex->nHeight);
+                    pindex->nHeight, commitment);
 
         vPos.push_back(std::make_pair(tx.GetId(), pos));
         pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
@@ -2169,6 +2850,10 @@ static bool ConnectBlock(const Config &config, const CBlock &block,
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
+    if (pblockundo) {
+        *pblockundo = std::move(blockundo);
+    }
+
     int64_t nTime5 = GetTimeMicros();
     nTimeIndex += nTime5 - nTime4;
     LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n",
@@ -2187,6 +2872,54 @@ static bool ConnectBlock(const Config &config, const CBlock &block,
     return true;
 }
 
+/**
+ * Store the UTXO set commitment alongside the coins database, if it is valid
+ * at the best block the database was just written at.
+ */
+static bool WriteCoinsCommitment() {
+    if (coinsCommitment.hashBlock.IsNull() ||
+        coinsCommitment.hashBlock != pcoinsTip->GetBestBlock()) {
+        return true;
+    }
+    return pcoinsTip->WriteCommitment(coinsCommitment);
+}
+
+/**
+ * Commit the block and undo files to disk, then write the block file
+ * information and block index entries that changed since the last call.
+ */
+static bool WriteBlockIndex(CValidationState &state) {
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_LastBlockFile);
+    // Depend on nMinDiskSpace to ensure we can write block index
+    if (!CheckDiskSpace(0)) return state.Error("out of disk space");
+    // First make sure all block and undo data is flushed to disk.
+    if (!SyncBlockFiles()) {
+        return AbortNode(state, "Failed to write block files");
+    }
+    // Then update all block file information (which may refer to block and
+    // undo files).
+    std::vector<std::pair<int, const CBlockFileInfo *>> vFiles;
+    vFiles.reserve(setDirtyFileInfo.size());
+    for (std::set<int>::iterator it = setDirtyFileInfo.begin();
+         it != setDirtyFileInfo.end();) {
+        vFiles.push_back(std::make_pair(*it, &vinfoBlockFile[*it]));
+        setDirtyFileInfo.erase(it++);
+    }
+    std::vector<const CBlockIndex *> vBlocks;
+    vBlocks.reserve(setDirtyBlockIndex.size());
+    for (std::set<CBlockIndex *>::iterator it = setDirtyBlockIndex.begin();
+         it != setDirtyBlockIndex.end();) {
+        vBlocks.push_back(*it);
+        setDirtyBlockIndex.erase(it++);
+    }
+    if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
+        return AbortNode(state, "Failed to write to block index database");
+    }
+    blockSolutionCache.MarkWritten(vBlocks);
+    return true;
+}
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed depending on the mode we're called with if
@@ -2200,6 +2933,7 @@ static bool FlushStateToDisk(CValidationState &state, FlushStateMode mode,
     LOCK2(cs_main, cs_LastBlockFile);
     static int64_t nLastWrite = 0;
     static int64_t nLastFlush = 0;
+    static int64_t nLastSync = 0;
     static int64_t nLastSetChain = 0;
     std::set<int> setFilesToPrune;
     bool fFlushForPrune = false;
@@ -2259,43 +2993,36 @@ static bool FlushStateToDisk(CValidationState &state, FlushStateMode mode,
         bool fPeriodicWrite =
             mode == FLUSH_STATE_PERIODIC &&
             nNow > nLastWrite + (int64_t)DATABASE_WRITE_INTERVAL * 1000000;
+        // The solutions of the entries not written yet take too much memory,
+        // which happens during header sync.
+        bool fSolutionsLarge =
+            mode != FLUSH_STATE_NONE &&
+            blockSolutionCache.UnwrittenCount() > MAX_UNWRITTEN_BLOCK_SOLUTIONS;
         // It's been very long since we flushed the cache. Do this infrequently,
         // to optimize cache usage.
         bool fPeriodicFlush =
             mode == FLUSH_STATE_PERIODIC &&
             nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
         // Combine all conditions that result in a full cache flush.
-        bool fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge ||
-                            fCacheCritical || fPeriodicFlush || fFlushForPrune;
-        // Write blocks and block index to disk.
-        if (fDoFullFlush || fPeriodicWrite) {
-            // Depend on nMinDiskSpace to ensure we can write block index
-            if (!CheckDiskSpace(0)) return state.Error("out of disk space");
-            // First make sure all block and undo data is flushed to disk.
-            FlushBlockFile();
-            // Then update all block file information (which may refer to block
-            // and undo files).
-            {
-                std::vector<std::pair<int, const CBlockFileInfo *>> vFiles;
-                vFiles.reserve(setDirtyFileInfo.size());
-                for (std::set<int>::iterator it = setDirtyFileInfo.begin();
-                     it != setDirtyFileInfo.end();) {
-                    vFiles.push_back(std::make_pair(*it, &vinfoBlockFile[*it]));
-                    setDirtyFileInfo.erase(it++);
-                }
-                std::vector<const CBlockIndex *> vBlocks;
-                vBlocks.reserve(setDirtyBlockIndex.size());
-                for (std::set<CBlockIndex *>::iterator it =
-                         setDirtyBlockIndex.begin();
-                     it != setDirtyBlockIndex.end();) {
-                    vBlocks.push_back(*it);
-                    setDirtyBlockIndex.erase(it++);
-                }
-                if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile,
-                                                vBlocks)) {
-                    return AbortNode(state,
-                                     "Failed to write to block index database");
-                }
+        bool fDoFullFlush =
+            (mode == FLUSH_STATE_ALWAYS) || fCacheCritical || fFlushForPrune;
+        // The cache is large, or it's been very long since it was written. Do
+        // not empty it, but write its modifications out a chunk at a time,
+        // continuing on the following calls so blocks keep being connected in
+        // between. After that the cache is not written again for being large
+        // for a while: memory is only released by a full flush, which then
+        // has little left to write.
+        bool fDoSync =
+            !fDoFullFlush &&
+            (fCoinsSyncPending || fPeriodicFlush ||
+             (fCacheLarge &&
+              nNow > nLastSync + (int64_t)DATABASE_WRITE_INTERVAL * 1000000));
+        // Write blocks and block index to disk. While the cache is written out
+        // over several calls, each of them records the tip as the block to
+        // replay to, so the blocks up to it must be on disk every time.
+        if (fDoFullFlush || fDoSync || fPeriodicWrite || fSolutionsLarge) {
+            if (!WriteBlockIndex(state)) {
+                return false;
             }
             // Finally remove any pruned files
             if (fFlushForPrune) UnlinkPrunedFiles(setFilesToPrune);
@@ -2304,19 +3031,39 @@ static bool FlushStateToDisk(CValidationState &state, FlushStateMode mode,
         // Flush best chain related state. This can only be done if the blocks /
         // block index write was also done.
         if (fDoFullFlush) {
-            // Typical Coin structures on disk are around 48 bytes in size.
-            // Pushing a new one to the database can cause it to be written
-            // twice (once in the log, and once in the tables). This is already
-            // an overestimation, as most will delete an existing entry or
-            // overwrite one. Still, use a conservative safety factor of 2.
-            if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize())) {
+            if (!CheckDiskSpace(COINS_DB_SPACE_PER_ENTRY *
+                                pcoinsTip->GetCacheSize())) {
                 return state.Error("out of disk space");
             }
             // Flush the chainstate (which may refer to block index entries).
             if (!pcoinsTip->Flush()) {
                 return AbortNode(state, "Failed to write to coin database");
             }
+            fCoinsSyncPending = false;
             nLastFlush = nNow;
+            nLastSync = nNow;
+            if (!WriteCoinsCommitment()) {
+                return AbortNode(state, "Failed to write to coin database");
+            }
+        }
+        if (fDoSync) {
+            const size_t nSyncEntries = std::max<int64_t>(
+                1, GetArg("-coinssyncentries", MAX_COINS_SYNC_ENTRIES));
+            if (!CheckDiskSpace(COINS_DB_SPACE_PER_ENTRY * nSyncEntries)) {
+                return state.Error("out of disk space");
+            }
+            bool fComplete = false;
+            if (!pcoinsTip->Sync(nSyncEntries, fComplete)) {
+                return AbortNode(state, "Failed to write to coin database");
+            }
+            fCoinsSyncPending = !fComplete;
+            if (fComplete) {
+                nLastFlush = nNow;
+                nLastSync = nNow;
+                if (!WriteCoinsCommitment()) {
+                    return AbortNode(state, "Failed to write to coin database");
+                }
+            }
         }
         if (fDoFullFlush ||
             ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) &&
@@ -2427,33 +3174,120 @@ static void UpdateTip(const Config &config, CBlockIndex *pindexNew) {
     LogPrintf("\n");
 }
 
+namespace {
 /**
- * Disconnect chainActive's tip. You probably want to call
- * mempool.removeForReorg and manually re-limit mempool size after this, with
- * cs_main held.
+ * The most recently connected blocks of the active chain with their undo data,
+ * so that a reorg can disconnect them, and connect them again if it fails,
+ * without reading either from disk. Protected by cs_main.
  */
-static bool DisconnectTip(const Config &config, CValidationState &state,
-                          bool fBare = false) {
-    CBlockIndex *pindexDelete = chainActive.Tip();
-    assert(pindexDelete);
+class CReorgCache {
+private:
+    struct Entry {
+        uint256 hash;
+        std::shared_ptr<const CBlock> pblock;
+        std::shared_ptr<const CBlockUndo> pblockundo;
+    };
 
-    // Read block from disk.
-    CBlock block;
-    if (!ReadBlockFromDisk(block, pindexDelete, config)) {
-        return AbortNode(state, "Failed to read block");
-    }
+    //! Oldest first, at most nReorgCacheBlocks long.
+    std::deque<Entry> entries;
 
-    // Apply the block atomically to the chain state.
-    int64_t nStart = GetTimeMicros();
+public:
+    void Add(const uint256 &hash, const std::shared_ptr<const CBlock> &pblock,
+             const std::shared_ptr<const CBlockUndo> &pblockundo) {
+        AssertLockHeld(cs_main);
+        for (auto it = entries.begin(); it != entries.end(); it++) {
+            if (it->hash == hash) {
+                entries.erase(it);
+                break;
+            }
+        }
+        while (!entries.empty() && entries.size() >= nReorgCacheBlocks) {
+            entries.pop_front();
+        }
+        if (nReorgCacheBlocks > 0) {
+            entries.push_back(Entry{hash, pblock, pblockundo});
+        }
+    }
+
+    bool Get(const uint256 &hash, std::shared_ptr<const CBlock> &pblock,
+             std::shared_ptr<const CBlockUndo> &pblockundo) const {
+        AssertLockHeld(cs_main);
+        for (auto it = entries.rbegin(); it != entries.rend(); it++) {
+            if (it->hash == hash) {
+                pblock = it->pblock;
+                pblockundo = it->pblockundo;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Clear() { entries.clear(); }
+};
+
+CReorgCache reorgCache;
+} // namespace
+
+/**
+ * Disconnect chainActive's tip. You probably want to call
+ * mempool.removeForReorg and manually re-limit mempool size after this, with
+ * cs_main held.
+ */
+static bool DisconnectTip(const Config &config, CValidationState &state,
+                          bool fBare = false) {
+    CBlockIndex *pindexDelete = chainActive.Tip();
+    assert(pindexDelete);
+
+    // Complete a partial write of the coins cache at the current tip first.
+    if (fCoinsSyncPending && !FlushStateToDisk(state, FLUSH_STATE_ALWAYS)) {
+        return false;
+    }
+
+    // Read block from disk, unless it was connected recently.
+    int64_t nStart = GetTimeMicros();
+    std::shared_ptr<const CBlock> pblock;
+    std::shared_ptr<const CBlockUndo> pblockundo;
+    if (!reorgCache.Get(pindexDelete->GetBlockHash(), pblock, pblockundo)) {
+        std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
+        if (!ReadBlockFromDisk(*pblockNew, pindexDelete, config)) {
+            return AbortNode(state, "Failed to read block");
+        }
+        pblock = pblockNew;
+    }
+    const CBlock &block = *pblock;
+    LogPrint("bench", "- Load block%s: %.2fms\n",
+             pblockundo ? " from reorg cache" : " from disk",
+             (GetTimeMicros() - nStart) * 0.001);
+
+    // Apply the block atomically to the chain state.
+    nStart = GetTimeMicros();
     {
         CCoinsViewCache view(pcoinsTip);
-        if (DisconnectBlock(block, pindexDelete, view) != DISCONNECT_OK) {
+        CCoinsCommitment commitment = coinsCommitment;
+        CCoinsCommitment *pcommitment =
+            fCoinsCommitment &&
+                    commitment.hashBlock == pindexDelete->GetBlockHash()
+                ? &commitment
+                : nullptr;
+        DisconnectResult res;
+        if (pblockundo) {
+            assert(pindexDelete->GetBlockHash() == view.GetBestBlock());
+            res = ApplyBlockUndo(*pblockundo, block, pindexDelete, view,
+                                 pcommitment);
+        } else {
+            res = DisconnectBlock(block, pindexDelete, view, pcommitment);
+        }
+        if (res != DISCONNECT_OK) {
             return error("DisconnectTip(): DisconnectBlock %s failed",
                          pindexDelete->GetBlockHash().ToString());
         }
 
         bool flushed = view.Flush();
         assert(flushed);
+        if (pcommitment) {
+            commitment.hashBlock = pindexDelete->pprev->GetBlockHash();
+            coinsCommitment = commitment;
+        }
     }
 
     LogPrint("bench", "- Disconnect block: %.2fms\n",
@@ -2500,6 +3334,7 @@ static bool DisconnectTip(const Config &config, CValidationState &state,
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
@@ -2530,7 +3365,12 @@ static bool ConnectTip(const Config &config, CValidationState &state,
     assert(pindexNew->pprev == chainActive.Tip());
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
-    if (!pblock) {
+    std::shared_ptr<const CBlock> pblockCached;
+    std::shared_ptr<const CBlockUndo> pblockundoCached;
+    if (!pblock && reorgCache.Get(pindexNew->GetBlockHash(), pblockCached,
+                                  pblockundoCached)) {
+        connectTrace.blocksConnected.emplace_back(pindexNew, pblockCached);
+    } else if (!pblock) {
         std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
         connectTrace.blocksConnected.emplace_back(pindexNew, pblockNew);
         if (!ReadBlockFromDisk(*pblockNew, pindexNew, config)) {
@@ -2547,10 +3387,22 @@ static bool ConnectTip(const Config &config, CValidationState &state,
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n",
              (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    PrefetchBlockInputs(blockConnecting);
+    int64_t nTimePrefetched = GetTimeMicros();
+    nTimePrefetch += nTimePrefetched - nTime2;
+    LogPrint("bench", "  - Prefetch inputs: %.2fms [%.2fs]\n",
+             (nTimePrefetched - nTime2) * 0.001, nTimePrefetch * 0.000001);
     {
         CCoinsViewCache view(pcoinsTip);
-        bool rv = ConnectBlock(config, blockConnecting, state, pindexNew, view,
-                               chainparams);
+        CCoinsCommitment commitment = coinsCommitment;
+        CCoinsCommitment *pcommitment =
+            fCoinsCommitment && commitment.hashBlock == view.GetBestBlock()
+                ? &commitment
+                : nullptr;
+        std::shared_ptr<CBlockUndo> pblockundo = std::make_shared<CBlockUndo>();
+        bool rv =
+            ConnectBlock(config, blockConnecting, state, pindexNew, view,
+                         chainparams, false, pcommitment, pblockundo.get());
         GetMainSignals().BlockChecked(blockConnecting, state);
         if (!rv) {
             if (state.IsInvalid()) {
@@ -2560,11 +3412,18 @@ static bool ConnectTip(const Config &config, CValidationState &state,
                          pindexNew->GetBlockHash().ToString());
         }
         nTime3 = GetTimeMicros();
-        nTimeConnectTotal += nTime3 - nTime2;
+        nTimeConnectTotal += nTime3 - nTimePrefetched;
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n",
-                 (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
+                 (nTime3 - nTimePrefetched) * 0.001,
+                 nTimeConnectTotal * 0.000001);
         bool flushed = view.Flush();
         assert(flushed);
+        if (pcommitment) {
+            commitment.hashBlock = pindexNew->GetBlockHash();
+            coinsCommitment = commitment;
+        }
+        reorgCache.Add(pindexNew->GetBlockHash(),
+                       connectTrace.blocksConnected.back().second, pblockundo);
     }
     int64_t nTime4 = GetTimeMicros();
     nTimeFlush += nTime4 - nTime3;
@@ -2807,7 +3666,7 @@ bool ActivateBestChain(const Config &config, CValidationState &state,
         ConnectTrace connectTrace;
         bool fInitialDownload;
         {
-            LOCK(cs_main);
+            LOCK_TIMED(cs_main);
             {
                 // TODO: Tempoarily ensure that mempool removals are notified
                 // before connected transactions. This shouldn't matter, but the
@@ -3011,6 +3870,7 @@ CBlockIndex *AddToBlockIndex(const CBlockHeader &block) {
     // Construct new block index object
     CBlockIndex *pindexNew = new CBlockIndex(block);
     assert(pindexNew);
+    blockSolutionCache.AddUnwritten(pindexNew, block.nSolution);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -3042,6 +3902,37 @@ CBlockIndex *AddToBlockIndex(const CBlockHeader &block) {
     return pindexNew;
 }
 
+/**
+ * Set nChainTx of the blocks in queue, whose parents have it set, and of their
+ * descendants that were waiting for them, and make them candidates for the tip.
+ */
+static void LinkBlocks(std::deque<CBlockIndex *> &queue) {
+    while (!queue.empty()) {
+        CBlockIndex *pindex = queue.front();
+        queue.pop_front();
+        pindex->nChainTx =
+            (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
+        {
+            LOCK(cs_nBlockSequenceId);
+            pindex->nSequenceId = nBlockSequenceId++;
+        }
+        if (chainActive.Tip() == nullptr ||
+            !setBlockIndexCandidates.value_comp()(pindex, chainActive.Tip())) {
+            setBlockIndexCandidates.insert(pindex);
+        }
+        std::pair<std::multimap<CBlockIndex *, CBlockIndex *>::iterator,
+                  std::multimap<CBlockIndex *, CBlockIndex *>::iterator>
+            range = mapBlocksUnlinked.equal_range(pindex);
+        while (range.first != range.second) {
+            std::multimap<CBlockIndex *, CBlockIndex *>::iterator it =
+                range.first;
+            queue.push_back(it->second);
+            range.first++;
+            mapBlocksUnlinked.erase(it);
+        }
+    }
+}
+
 /**
  * Mark a block as having its data received and checked (up to
  * BLOCK_VALID_TRANSACTIONS).
@@ -3057,40 +3948,17 @@ bool ReceivedBlockTransactions(const CBlock &block, CValidationState &state,
     pindexNew->nStatus |= BLOCK_HAVE_DATA;
     pindexNew->RaiseValidity(BLOCK_VALID_TRANSACTIONS);
     setDirtyBlockIndex.insert(pindexNew);
+    // The header may have been written long ago. Hold the solution until the
+    // entry is written again, as connecting the block dirties it once more.
+    blockSolutionCache.AddUnwritten(pindexNew, block.nSolution);
 
     if (pindexNew->pprev == nullptr || pindexNew->pprev->nChainTx) {
         // If pindexNew is the genesis block or all parents are
-        // BLOCK_VALID_TRANSACTIONS.
+        // BLOCK_VALID_TRANSACTIONS, recursively process any descendant blocks
+        // that now may be eligible to be connected.
         std::deque<CBlockIndex *> queue;
         queue.push_back(pindexNew);
-
-        // Recursively process any descendant blocks that now may be eligible to
-        // be connected.
-        while (!queue.empty()) {
-            CBlockIndex *pindex = queue.front();
-            queue.pop_front();
-            pindex->nChainTx =
-                (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
-            {
-                LOCK(cs_nBlockSequenceId);
-                pindex->nSequenceId = nBlockSequenceId++;
-            }
-            if (chainActive.Tip() == nullptr ||
-                !setBlockIndexCandidates.value_comp()(pindex,
-                                                      chainActive.Tip())) {
-                setBlockIndexCandidates.insert(pindex);
-            }
-            std::pair<std::multimap<CBlockIndex *, CBlockIndex *>::iterator,
-                      std::multimap<CBlockIndex *, CBlockIndex *>::iterator>
-                range = mapBlocksUnlinked.equal_range(pindex);
-            while (range.first != range.second) {
-                std::multimap<CBlockIndex *, CBlockIndex *>::iterator it =
-                    range.first;
-                queue.push_back(it->second);
-                range.first++;
-                mapBlocksUnlinked.erase(it);
-            }
-        }
+        LinkBlocks(queue);
     } else {
         if (pindexNew->pprev && pindexNew->pprev->IsValid(BLOCK_VALID_TREE)) {
             mapBlocksUnlinked.insert(
@@ -3147,16 +4015,11 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos,
         if (nNewChunks > nOldChunks) {
             if (fPruneMode) fCheckForPruning = true;
             if (CheckDiskSpace(nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos)) {
-                FILE *file = OpenBlockFile(pos);
-                if (file) {
-                    LogPrintf(
-                        "Pre-allocating up to position 0x%x in blk%05u.dat\n",
-                        nNewChunks * BLOCKFILE_CHUNK_SIZE, pos.nFile);
-                    AllocateFileRange(file, pos.nPos,
-                                      nNewChunks * BLOCKFILE_CHUNK_SIZE -
-                                          pos.nPos);
-                    fclose(file);
-                }
+                LogPrintf("Pre-allocating up to position 0x%x in blk%05u.dat\n",
+                          nNewChunks * BLOCKFILE_CHUNK_SIZE, pos.nFile);
+                blockFileWriter.Allocate(false, pos,
+                                         nNewChunks * BLOCKFILE_CHUNK_SIZE -
+                                             pos.nPos);
             } else
                 return state.Error("out of disk space");
         }
@@ -3184,14 +4047,11 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos,
     if (nNewChunks > nOldChunks) {
         if (fPruneMode) fCheckForPruning = true;
         if (CheckDiskSpace(nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos)) {
-            FILE *file = OpenUndoFile(pos);
-            if (file) {
-                LogPrintf("Pre-allocating up to position 0x%x in rev%05u.dat\n",
-                          nNewChunks * UNDOFILE_CHUNK_SIZE, pos.nFile);
-                AllocateFileRange(file, pos.nPos,
-                                  nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos);
-                fclose(file);
-            }
+            LogPrintf("Pre-allocating up to position 0x%x in rev%05u.dat\n",
+                      nNewChunks * UNDOFILE_CHUNK_SIZE, pos.nFile);
+            blockFileWriter.Allocate(true, pos,
+                                     nNewChunks * UNDOFILE_CHUNK_SIZE -
+                                         pos.nPos);
         } else
             return state.Error("out of disk space");
     }
@@ -3200,21 +4060,35 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos,
 }
 
 static bool CheckBlockHeader(const Config &config, const CBlockHeader &block,
-                             CValidationState &state, bool fCheckPOW = true) {
+                             CValidationState &state, bool fCheckPOW = true,
+                             bool fCheckSolution = true) {
+
+    if (!fCheckPOW) {
+        return true;
+    }
 
   // Check Equihash solution is valid
     bool postfork = IsBCPEnabled(config,block.nHeight);
-    if (fCheckPOW && postfork && !CheckEquihashSolution(&block, config)) {
-        LogPrintf("CheckBlockHeader(): Equihash solution invalid at height %d\n", block.nHeight);
-        return state.DoS(100, error("CheckBlockHeader(): Equihash solution invalid"),
-                         REJECT_INVALID, "invalid-solution");
+    uint256 hash;
+    if (postfork) {
+        // Serialize the header once for both the solution and the hash.
+        CBlockHeaderHashContext context(block);
+        if (fCheckSolution && !CheckEquihashSolution(context, config)) {
+            LogPrintf("CheckBlockHeader(): Equihash solution invalid at height %d\n", block.nHeight);
+            return state.DoS(100, error("CheckBlockHeader(): Equihash solution invalid"),
+                             REJECT_INVALID, "invalid-solution");
+        }
+        hash = context.GetHash();
+    } else {
+        hash = block.GetHash();
     }
 
     // Check proof of work matches claimed amount
-    if (fCheckPOW && !CheckProofOfWork(block.GetHash(), block.nBits,postfork, config)) {
+    if (!CheckProofOfWork(hash, block.nBits,postfork, config)) {
         return state.DoS(50, false, REJECT_INVALID, "high-hash", false,
                          "proof of work failed");
     }
+    block.hashCache.Set(!postfork, hash);
 
     return true;
 }
@@ -3299,11 +4173,35 @@ bool CheckBlock(const Config &config, const CBlock &block,
     auto txCount = block.vtx.size();
     auto *tx = block.vtx[0].get();
 
+    // On large blocks, count the sigops and check the transactions on the
+    // script check threads first, unless they are busy connecting a block.
+    // The loop below then goes through the results in block order, so the
+    // reported error is the same as when checking serially.
+    std::vector<uint64_t> vSigOps;
+    std::vector<char> vValid;
+    if (nScriptCheckThreads && txCount >= MIN_PARALLEL_TX_CHECKS) {
+        TRY_LOCK(cs_scriptcheckqueue, lockQueue);
+        if (lockQueue) {
+            vSigOps.resize(txCount);
+            vValid.resize(txCount, true);
+            std::vector<CTxCheck> vChecks;
+            vChecks.reserve(txCount);
+            for (size_t j = 0; j < txCount; j++) {
+                vChecks.emplace_back(*block.vtx[j], j > 0, vSigOps[j],
+                                     vValid[j]);
+            }
+
+            CCheckQueueControl<CBlockCheck> control(&scriptcheckqueue);
+            control.Add(vChecks);
+            control.Wait();
+        }
+    }
+
     size_t i = 0;
     while (true) {
         // Count the sigops for the current transaction. If the total sigops
         // count is too high, the the block is invalid.
-        nSigOps += GetSigOpCountWithoutP2SH(*tx);
+        nSigOps += vSigOps.empty() ? GetSigOpCountWithoutP2SH(*tx) : vSigOps[i];
         if (nSigOps > nMaxSigOpsCount) {
             return state.DoS(100, false, REJECT_INVALID, "bad-blk-sigops",
                              false, "out-of-bounds SigOpCount");
@@ -3321,7 +4219,9 @@ bool CheckBlock(const Config &config, const CBlock &block,
         // the coinbase, the loos is arranged such as this only runs after at
         // least one increment.
         tx = block.vtx[i].get();
-        if (!CheckRegularTransaction(*tx, state, false)) {
+        // Rerun a failed check serially to fill in the validation state.
+        if ((vValid.empty() || !vValid[i]) &&
+            !CheckRegularTransaction(*tx, state, false)) {
             return state.Invalid(
                 false, state.GetRejectCode(), state.GetRejectReason(),
                 strprintf("Transaction check failed (txid %s) %s",
@@ -3517,7 +4417,8 @@ bool ContextualCheckBlock(const Config &config, const CBlock &block,
 }
 
 static bool AcceptBlockHeader(const Config &config, const CBlockHeader &block,
-                              CValidationState &state, CBlockIndex **ppindex) {
+                              CValidationState &state, CBlockIndex **ppindex,
+                              bool fCheckSolution = true) {
     AssertLockHeld(cs_main);
     const CChainParams &chainparams = config.GetChainParams();
 
@@ -3540,7 +4441,7 @@ static bool AcceptBlockHeader(const Config &config, const CBlockHeader &block,
             return true;
         }
 
-        if (!CheckBlockHeader(config, block, state)) {
+        if (!CheckBlockHeader(config, block, state, true, fCheckSolution)) {
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__,
                          hash.ToString(), FormatStateMessage(state));
         }
@@ -3591,12 +4492,31 @@ bool ProcessNewBlockHeaders(const Config &config,
                             const std::vector<CBlockHeader> &headers,
                             CValidationState &state,
                             const CBlockIndex **ppindex) {
+    // Equihash solutions are by far the most expensive part of header
+    // validation. Check the ones we don't know about yet in parallel before
+    // taking cs_main for the serial part.
+    std::vector<const CBlockHeader *> vToCheck;
     {
-        LOCK(cs_main);
+        LOCK_TIMED(cs_main);
+        for (const CBlockHeader &header : headers) {
+            if (IsBCPEnabled(config, header.nHeight) &&
+                mapBlockIndex.count(header.GetHash()) == 0) {
+                vToCheck.push_back(&header);
+            }
+        }
+    }
+
+    // If any solution is invalid, check them again one by one so that the
+    // offending header is reported exactly as before.
+    const bool fSolutionsValid = CheckEquihashSolutions(config, vToCheck);
+
+    {
+        LOCK_TIMED(cs_main);
         for (const CBlockHeader &header : headers) {
             // Use a temp pindex instead of ppindex to avoid a const_cast
             CBlockIndex *pindex = nullptr;
-            if (!AcceptBlockHeader(config, header, state, &pindex)) {
+            if (!AcceptBlockHeader(config, header, state, &pindex,
+                                   !fSolutionsValid)) {
                 return false;
             }
             if (ppindex) {
@@ -3604,6 +4524,10 @@ bool ProcessNewBlockHeaders(const Config &config,
             }
         }
     }
+    // Write the new entries out if their solutions take too much memory.
+    if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED)) {
+        return false;
+    }
     NotifyHeaderTip();
     return true;
 }
@@ -3747,7 +4671,7 @@ bool ProcessNewBlock(const Config &config,
         // belt-and-suspenders.
         bool ret = CheckBlock(config, *pblock, state);
 
-        LOCK(cs_main);
+        LOCK_TIMED(cs_main);
 
         if (ret) {
             // Store to disk
@@ -3866,6 +4790,7 @@ void UnlinkPrunedFiles(const std::set<int> &setFilesToPrune) {
     for (std::set<int>::iterator it = setFilesToPrune.begin();
          it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        ForgetMappedBlockFile(*it);
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -3980,6 +4905,10 @@ bool CheckDiskSpace(uint64_t nAdditionalBytes) {
 FILE *OpenDiskFile(const CDiskBlockPos &pos, const char *prefix,
                    bool fReadOnly) {
     if (pos.IsNull()) return nullptr;
+    if (fReadOnly) {
+        // Only the block file writer opens files for writing.
+        blockFileWriter.WaitForFile(strcmp(prefix, "rev") == 0, pos.nFile);
+    }
     boost::filesystem::path path = GetBlockPosFilename(pos, prefix);
     boost::filesystem::create_directories(path.parent_path());
     FILE *file = fopen(path.string().c_str(), "rb+");
@@ -4031,10 +4960,36 @@ CBlockIndex *InsertBlockIndex(uint256 hash) {
 }
 
 static bool LoadBlockIndexDB(const CChainParams &chainparams) {
-    if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex)) return false;
+    int64_t nTimeStart = GetTimeMicros();
+    // A negative interval would wrap around to a huge one, treat it as none.
+    const unsigned int nCheckHashInterval = std::max<int64_t>(
+        0, std::min<int64_t>(std::numeric_limits<unsigned int>::max(),
+                             GetArg("-checkblockindexhashes",
+                                    DEFAULT_CHECKBLOCKINDEXHASHES)));
+    if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex, nCheckHashInterval)) {
+        return false;
+    }
+    int64_t nTimeLoaded = GetTimeMicros();
+    LogPrintf("%s: loaded %u block index entries in %.2fms\n", __func__,
+              mapBlockIndex.size(), (nTimeLoaded - nTimeStart) * 0.001);
 
     boost::this_thread::interruption_point();
 
+    // The chain state may have been loaded from a UTXO snapshot, in which case
+    // the blocks after it are linked through its base.
+    uint256 hashSnapshotBase;
+    unsigned int nSnapshotChainTx = 0;
+    if (pblocktree->ReadSnapshotBase(hashSnapshotBase, nSnapshotChainTx)) {
+        BlockMap::iterator it = mapBlockIndex.find(hashSnapshotBase);
+        if (it == mapBlockIndex.end()) {
+            return error("%s: UTXO snapshot block %s not found", __func__,
+                         hashSnapshotBase.ToString());
+        }
+        pindexSnapshotBase = it->second;
+        LogPrintf("%s: chain state was loaded from a UTXO snapshot at %s\n",
+                  __func__, hashSnapshotBase.ToString());
+    }
+
     // Calculate nChainWork
     std::vector<std::pair<int, CBlockIndex *>> vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
@@ -4065,6 +5020,14 @@ static bool LoadBlockIndexDB(const CChainParams &chainparams) {
                 pindex->nChainTx = pindex->nTx;
             }
         }
+        if (pindex == pindexSnapshotBase) {
+            // The load may have been interrupted before its block index entry
+            // was written.
+            pindex->nChainTx = nSnapshotChainTx;
+            if (pindex->RaiseValidity(BLOCK_VALID_SCRIPTS)) {
+                setDirtyBlockIndex.insert(pindex);
+            }
+        }
         if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS) &&
             (pindex->nChainTx || pindex->pprev == nullptr)) {
             setBlockIndexCandidates.insert(pindex);
@@ -4083,6 +5046,8 @@ static bool LoadBlockIndexDB(const CChainParams &chainparams) {
             pindexBestHeader = pindex;
         }
     }
+    LogPrint("bench", "    - Calculate chain work: %.2fms\n",
+             (GetTimeMicros() - nTimeLoaded) * 0.001);
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
@@ -4137,6 +5102,25 @@ static bool LoadBlockIndexDB(const CChainParams &chainparams) {
     LogPrintf("%s: transaction index %s\n", __func__,
               fTxIndex ? "enabled" : "disabled");
 
+    return true;
+}
+
+bool LoadChainTip(const CChainParams &chainparams) {
+    // The stored commitment is only of use if it was written at the best
+    // block. An empty database is committed to by the empty set.
+    coinsCommitment = CCoinsCommitment();
+    const uint256 hashBest = pcoinsTip->GetBestBlock();
+    if (!hashBest.IsNull()) {
+        CCoinsCommitment commitment;
+        if (pcoinsTip->GetCommitment(commitment) &&
+            commitment.hashBlock == hashBest) {
+            coinsCommitment = commitment;
+        } else {
+            LogPrintf("%s: no UTXO set commitment at the best block\n",
+                      __func__);
+        }
+    }
+
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end()) {
@@ -4156,6 +5140,513 @@ static bool LoadBlockIndexDB(const CChainParams &chainparams) {
     return true;
 }
 
+bool GetCoinsCommitment(CCoinsCommitment &commitment) {
+    AssertLockHeld(cs_main);
+    if (coinsCommitment.hashBlock.IsNull() ||
+        coinsCommitment.hashBlock != pcoinsTip->GetBestBlock()) {
+        return false;
+    }
+    commitment = coinsCommitment;
+    return true;
+}
+
+void SetCoinsCommitment(const CCoinsCommitment &commitment) {
+    AssertLockHeld(cs_main);
+    if (!commitment.hashBlock.IsNull() &&
+        commitment.hashBlock == pcoinsTip->GetBestBlock()) {
+        coinsCommitment = commitment;
+    }
+}
+
+namespace {
+
+/** Coins of a UTXO snapshot, ordered by txid and output index. */
+typedef std::vector<std::pair<COutPoint, Coin>> SnapshotCoins;
+
+//! Number of coins read or written at once.
+const size_t SNAPSHOT_CHUNK_COINS = 1 << 16;
+
+/** Add coins to a commitment, split across threads. */
+void AddSnapshotCoins(const SnapshotCoins &coins,
+                      CCoinsCommitment &commitment) {
+    const int nParts = std::max(1, std::min(GetNumCores(), 16));
+    std::vector<CCoinsCommitment> parts(nParts);
+    boost::thread_group threads;
+    for (int i = 0; i < nParts; i++) {
+        threads.create_thread([&, i] {
+            const size_t nEnd = coins.size() * (i + 1) / nParts;
+            for (size_t j = coins.size() * i / nParts; j < nEnd; j++) {
+                parts[i].AddCoin(coins[j].first, coins[j].second);
+            }
+        });
+    }
+    threads.join_all();
+    for (const CCoinsCommitment &part : parts) {
+        commitment.Merge(part);
+    }
+}
+
+/**
+ * Read the coins of a snapshot, checking that they are in order and that there
+ * are as many as its header says.
+ */
+class CUTXOSnapshotReader {
+private:
+    CAutoFile &file;
+    const CUTXOSnapshotHeader &header;
+    const int nMaxHeight;
+    uint64_t nRead;
+    //! The transaction being read, how many of its coins are left and the
+    //! lowest output index the next one may have.
+    uint256 txid;
+    uint64_t nLeft;
+    uint64_t nNextIndex;
+
+public:
+    CUTXOSnapshotReader(CAutoFile &fileIn, const CUTXOSnapshotHeader &headerIn,
+                        int nMaxHeightIn)
+        : file(fileIn), header(headerIn), nMaxHeight(nMaxHeightIn), nRead(0),
+          nLeft(0), nNextIndex(0) {}
+
+    /**
+     * Read up to SNAPSHOT_CHUNK_COINS coins into coins. Returns false when
+     * the snapshot is malformed. Throws if the file ends early.
+     */
+    bool Read(SnapshotCoins &coins, std::string &strError) {
+        coins.clear();
+        while (nRead < header.nCoins && coins.size() < SNAPSHOT_CHUNK_COINS) {
+            if (nLeft == 0) {
+                uint256 txidNext;
+                file >> txidNext >> VARINT(nLeft);
+                if (nRead > 0 && !(txid < txidNext)) {
+                    strError = "Snapshot transactions are out of order";
+                    return false;
+                }
+                if (nLeft == 0 || nLeft > header.nCoins - nRead) {
+                    strError = "Snapshot has a bad number of coins";
+                    return false;
+                }
+                txid = txidNext;
+                nNextIndex = 0;
+            }
+            COutPoint outpoint(txid, 0);
+            Coin coin;
+            file >> VARINT(outpoint.n) >> coin;
+            if (outpoint.n < nNextIndex) {
+                strError = "Snapshot outputs are out of order";
+                return false;
+            }
+            if (int(coin.GetHeight()) > nMaxHeight) {
+                strError = "Snapshot coin is newer than its block";
+                return false;
+            }
+            nNextIndex = uint64_t(outpoint.n) + 1;
+            nLeft--;
+            coins.emplace_back(outpoint, std::move(coin));
+            nRead++;
+        }
+        return true;
+    }
+
+    bool IsComplete() const { return nRead == header.nCoins; }
+};
+
+} // namespace
+
+bool DumpUTXOSnapshot(CValidationState &state, CCoinsView *view,
+                      const boost::filesystem::path &path,
+                      CUTXOSnapshotHeader &header) {
+    const CChainParams &chainparams = Params();
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    CCoinsCommitment commitment;
+    bool fKnown;
+    {
+        // As in gettxoutsetinfo, the coins database only holds the whole set
+        // after the cache is written out.
+        LOCK(cs_main);
+        FlushStateToDisk();
+        pcursor.reset(view->Cursor());
+        fKnown = GetCoinsCommitment(commitment);
+        const CBlockIndex *pindex =
+            mapBlockIndex.find(pcursor->GetBestBlock())->second;
+        header = CUTXOSnapshotHeader();
+        header.diskMagic = chainparams.DiskMagic();
+        header.hashBlock = pindex->GetBlockHash();
+        header.nChainTx = pindex->nChainTx;
+    }
+    if (!fKnown) {
+        commitment = CCoinsCommitment();
+        commitment.hashBlock = header.hashBlock;
+    }
+
+    const boost::filesystem::path pathTmp = path.string() + ".incomplete";
+    CAutoFile file(fopen(pathTmp.string().c_str(), "wb"), SER_DISK,
+                   CLIENT_VERSION);
+    if (file.IsNull()) {
+        return state.Error("Unable to open " + pathTmp.string());
+    }
+
+    try {
+        // The count and hash are filled in once all coins are written.
+        file << header;
+        SnapshotCoins coins;
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            // Read whole transactions, so that each can be written with its
+            // number of coins.
+            coins.clear();
+            while (pcursor->Valid()) {
+                COutPoint key;
+                Coin coin;
+                if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
+                    return state.Error("Unable to read UTXO set");
+                }
+                if (coins.size() >= SNAPSHOT_CHUNK_COINS &&
+                    key.hash != coins.back().first.hash) {
+                    break;
+                }
+                coins.emplace_back(key, std::move(coin));
+                pcursor->Next();
+            }
+            if (!fKnown) {
+                AddSnapshotCoins(coins, commitment);
+            }
+
+            // The database orders outputs by their serialized index, which
+            // differs from their numeric order for large indexes.
+            for (SnapshotCoins::iterator it = coins.begin();
+                 it != coins.end();) {
+                SnapshotCoins::iterator itEnd = it;
+                while (itEnd != coins.end() &&
+                       itEnd->first.hash == it->first.hash) {
+                    itEnd++;
+                }
+                std::sort(it, itEnd,
+                          [](const std::pair<COutPoint, Coin> &a,
+                             const std::pair<COutPoint, Coin> &b) {
+                              return a.first.n < b.first.n;
+                          });
+                file << it->first.hash << VARINT(uint64_t(itEnd - it));
+                for (; it != itEnd; it++) {
+                    file << VARINT(it->first.n) << it->second;
+                }
+            }
+            header.nCoins += coins.size();
+        }
+
+        header.hashCoins = commitment.GetHash();
+        if (fseek(file.Get(), 0, SEEK_SET) != 0) {
+            return state.Error("Unable to write " + pathTmp.string());
+        }
+        file << header;
+    } catch (const std::ios_base::failure &) {
+        return state.Error("Unable to write " + pathTmp.string());
+    }
+    FileCommit(file.Get());
+    file.fclose();
+    if (!RenameOver(pathTmp, path)) {
+        return state.Error("Unable to rename " + pathTmp.string());
+    }
+
+    if (!fKnown) {
+        LOCK(cs_main);
+        SetCoinsCommitment(commitment);
+    }
+    LogPrintf("%s: wrote %u coins at %s to %s\n", __func__, header.nCoins,
+              header.hashBlock.ToString(), path.string());
+    return true;
+}
+
+bool LoadUTXOSnapshot(const Config &config, CValidationState &state,
+                      const boost::filesystem::path &path,
+                      const uint256 &hashExpected,
+                      CUTXOSnapshotHeader &header) {
+    const CChainParams &chainparams = config.GetChainParams();
+    {
+        LOCK(cs_main);
+        if (chainActive.Height() != 0) {
+            return state.Error("The chain state must be at the genesis block "
+                               "to load a UTXO snapshot");
+        }
+    }
+
+    // Check the whole snapshot before writing any of it. This is most of the
+    // work, and does not need cs_main.
+    CBlockIndex *pindexBase = nullptr;
+    CCoinsCommitment commitment;
+    std::string strError;
+    {
+        CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK,
+                       CLIENT_VERSION);
+        if (file.IsNull()) {
+            return state.Error("Unable to open " + path.string());
+        }
+        try {
+            file >> header;
+            if (header.diskMagic != chainparams.DiskMagic()) {
+                return state.Error("Snapshot is for a different network");
+            }
+            if (header.nVersion != CUTXOSnapshotHeader::CURRENT_VERSION) {
+                return state.Error("Unknown snapshot version");
+            }
+            {
+                LOCK(cs_main);
+                BlockMap::iterator it = mapBlockIndex.find(header.hashBlock);
+                if (it == mapBlockIndex.end() ||
+                    !it->second->IsValid(BLOCK_VALID_TREE)) {
+                    return state.Error("Snapshot block header " +
+                                       header.hashBlock.GetHex() +
+                                       " is not known yet");
+                }
+                pindexBase = it->second;
+            }
+            if (pindexBase->nHeight == 0 ||
+                header.nChainTx <= (unsigned int)pindexBase->nHeight) {
+                return state.Error("Snapshot has a bad transaction count");
+            }
+            if (!hashExpected.IsNull() && header.hashCoins != hashExpected) {
+                return state.Error("Snapshot hash " + header.hashCoins.GetHex() +
+                                   " does not match the expected hash");
+            }
+
+            CUTXOSnapshotReader reader(file, header, pindexBase->nHeight);
+            SnapshotCoins coins;
+            while (!reader.IsComplete()) {
+                boost::this_thread::interruption_point();
+                if (!reader.Read(coins, strError)) {
+                    return state.Error(strError);
+                }
+                AddSnapshotCoins(coins, commitment);
+            }
+        } catch (const std::ios_base::failure &) {
+            return state.Error("Snapshot file is truncated");
+        }
+        if (fgetc(file.Get()) != EOF) {
+            return state.Error("Snapshot has data after its coins");
+        }
+    }
+    commitment.hashBlock = header.hashBlock;
+    if (commitment.GetHash() != header.hashCoins) {
+        return state.Error("Snapshot coins do not match its hash");
+    }
+
+    // Blocks may have been connected meanwhile, so check the chain state
+    // again, and keep it from changing until the snapshot is its tip.
+    LOCK(cs_main);
+    if (chainActive.Height() != 0) {
+        return state.Error("The chain state must be at the genesis block to "
+                           "load a UTXO snapshot");
+    }
+
+    // Write out the cache, so that the snapshot goes into an empty coins
+    // database that is not in the middle of a write.
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS)) {
+        return false;
+    }
+    if (pcoinsTip->GetCacheSize() != 0) {
+        return state.Error("The coins cache is not empty");
+    }
+
+    // Write the coins in the order of the database, a cache worth at a time.
+    // Until the last write, the database records that it is in the middle of
+    // moving to the snapshot block, and that this is a snapshot load, so that
+    // ReplayBlocks discards the coins of an interrupted load.
+    {
+        CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK,
+                       CLIENT_VERSION);
+        if (file.IsNull()) {
+            return state.Error("Unable to open " + path.string());
+        }
+        CCoinsView *view = pcoinsTip->GetBackend();
+        if (!view->WriteSnapshotLoad(header.hashBlock)) {
+            return AbortNode(state, "Failed to write to coin database");
+        }
+        try {
+            file >> header;
+            CUTXOSnapshotReader reader(file, header, pindexBase->nHeight);
+            SnapshotCoins coins;
+            CCoinsMap mapCoins;
+            size_t nCoinsUsage = 0;
+            while (!reader.IsComplete()) {
+                if (!reader.Read(coins, strError)) {
+                    return state.Error(strError);
+                }
+                for (std::pair<COutPoint, Coin> &item : coins) {
+                    CCoinsCacheEntry &entry =
+                        mapCoins.emplace(std::piecewise_construct,
+                                         std::forward_as_tuple(item.first),
+                                         std::forward_as_tuple(
+                                             std::move(item.second)))
+                            .first->second;
+                    entry.flags =
+                        CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+                    nCoinsUsage += entry.coin.DynamicMemoryUsage();
+                }
+                if (nCoinsUsage + memusage::DynamicUsage(mapCoins) >
+                    nCoinCacheUsage) {
+                    LogPrint("coindb", "Writing %u snapshot coins\n",
+                             mapCoins.size());
+                    if (!view->BatchWritePartial(mapCoins, header.hashBlock)) {
+                        return AbortNode(state,
+                                         "Failed to write to coin database");
+                    }
+                    nCoinsUsage = 0;
+                }
+            }
+            LogPrint("coindb", "Writing %u snapshot coins\n", mapCoins.size());
+            if (!view->BatchWritePartial(mapCoins, header.hashBlock)) {
+                return AbortNode(state, "Failed to write to coin database");
+            }
+        } catch (const std::ios_base::failure &) {
+            return AbortNode(state, "Snapshot file changed while loading");
+        }
+    }
+
+    // Record the snapshot in the block index first, so that the blocks after
+    // it are linked once the coins database is at its block. From here on an
+    // interrupted load is completed rather than discarded.
+    pindexBase->nChainTx = header.nChainTx;
+    pindexBase->RaiseValidity(BLOCK_VALID_SCRIPTS);
+    setDirtyBlockIndex.insert(pindexBase);
+    pindexSnapshotBase = pindexBase;
+    if (!pblocktree->WriteSnapshotBase(header.hashBlock, header.nChainTx)) {
+        return AbortNode(state, "Failed to write to block index database");
+    }
+
+    pcoinsTip->SetBestBlock(header.hashBlock);
+    chainActive.SetTip(pindexBase);
+    setBlockIndexCandidates.insert(pindexBase);
+    PruneBlockIndexCandidates();
+    SetCoinsCommitment(commitment);
+
+    // Blocks after the snapshot may have been received already.
+    std::deque<CBlockIndex *> queue;
+    std::pair<std::multimap<CBlockIndex *, CBlockIndex *>::iterator,
+              std::multimap<CBlockIndex *, CBlockIndex *>::iterator>
+        range = mapBlocksUnlinked.equal_range(pindexBase);
+    for (std::multimap<CBlockIndex *, CBlockIndex *>::iterator it =
+             range.first;
+         it != range.second; it++) {
+        queue.push_back(it->second);
+    }
+    mapBlocksUnlinked.erase(range.first, range.second);
+    LinkBlocks(queue);
+
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS)) {
+        return false;
+    }
+    if (!pcoinsTip->WriteSnapshotLoad(uint256())) {
+        return AbortNode(state, "Failed to write to coin database");
+    }
+    LogPrintf("%s: loaded %u coins, new tip %s height=%d\n", __func__,
+              header.nCoins, header.hashBlock.ToString(), pindexBase->nHeight);
+    return true;
+}
+
+namespace {
+/**
+ * Reads the blocks VerifyDB checks, and optionally their undo data, on a
+ * separate thread ahead of the block being checked. The disk positions are
+ * taken when it is constructed, with cs_main held.
+ */
+class CVerifyReadAhead {
+public:
+    struct Item {
+        CBlockIndex *pindex;
+        CDiskBlockPos blockPos;
+        CDiskBlockPos undoPos;
+        CBlock block;
+        CBlockUndo undo;
+        bool fBlockRead;
+        bool fUndoRead;
+
+        Item() : pindex(nullptr), fBlockRead(false), fUndoRead(false) {}
+    };
+
+private:
+    const Config &config;
+    std::vector<Item> items;
+
+    std::mutex cs;
+    //! Signalled when an item was read
+    std::condition_variable condRead;
+    //! Signalled when an item was taken or the reader is stopped
+    std::condition_variable condTaken;
+    size_t nRead;
+    size_t nTaken;
+    bool fStop;
+    std::thread thread;
+
+    void Run() {
+        RenameThread("bitcoin-verifyrd");
+        for (size_t i = 0; i < items.size(); i++) {
+            {
+                std::unique_lock<std::mutex> lock(cs);
+                condTaken.wait(lock, [&] {
+                    return fStop || i - nTaken < VERIFYDB_READ_AHEAD_BLOCKS;
+                });
+                if (fStop) {
+                    return;
+                }
+            }
+
+            // Only this thread touches the item until nRead is past it.
+            Item &item = items[i];
+            item.fBlockRead =
+                ReadBlockFromDisk(item.block, item.blockPos, config) &&
+                item.block.GetHash() == item.pindex->GetBlockHash();
+            item.fUndoRead =
+                !item.undoPos.IsNull() &&
+                UndoReadFromDisk(item.undo, item.undoPos,
+                                 item.pindex->pprev->GetBlockHash());
+
+            std::lock_guard<std::mutex> lock(cs);
+            nRead = i + 1;
+            condRead.notify_one();
+        }
+    }
+
+public:
+    CVerifyReadAhead(const Config &configIn,
+                     const std::vector<CBlockIndex *> &vpindex,
+                     bool fReadUndo)
+        : config(configIn), items(vpindex.size()), nRead(0), nTaken(0),
+          fStop(false) {
+        AssertLockHeld(cs_main);
+        for (size_t i = 0; i < vpindex.size(); i++) {
+            items[i].pindex = vpindex[i];
+            items[i].blockPos = vpindex[i]->GetBlockPos();
+            if (fReadUndo) {
+                items[i].undoPos = vpindex[i]->GetUndoPos();
+            }
+        }
+        thread = std::thread(&CVerifyReadAhead::Run, this);
+    }
+
+    ~CVerifyReadAhead() {
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            fStop = true;
+            condTaken.notify_one();
+        }
+        thread.join();
+    }
+
+    size_t size() const { return items.size(); }
+
+    //! Wait for the next item, in the order they were given in.
+    void Next(Item &item) {
+        std::unique_lock<std::mutex> lock(cs);
+        assert(nTaken < items.size());
+        condRead.wait(lock, [&] { return nRead > nTaken; });
+        item = std::move(items[nTaken]);
+        items[nTaken] = Item();
+        nTaken++;
+        condTaken.notify_one();
+    }
+};
+} // namespace
+
 CVerifyDB::CVerifyDB() {
     uiInterface.ShowProgress(_("Verifying blocks..."), 0);
 }
@@ -4187,95 +5678,118 @@ bool CVerifyDB::VerifyDB(const Config &config, CCoinsView *coinsview,
 
     const CChainParams &chainparams = config.GetChainParams();
 
+    // Collect the blocks to check first, so that they can be read ahead.
+    std::vector<CBlockIndex *> vpindex;
+    for (CBlockIndex *pindex = chainActive.Tip(); pindex && pindex->pprev;
+         pindex = pindex->pprev) {
+        if (pindex->nHeight < chainActive.Height() - nCheckDepth) {
+            break;
+        }
+
+        if ((fPruneMode || pindexSnapshotBase) &&
+            !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            // If pruning or loaded from a UTXO snapshot, only go back as far
+            // as we have data.
+            LogPrintf("VerifyDB(): block verification stopping at height %d "
+                      "(no data)\n",
+                      pindex->nHeight);
+            break;
+        }
+        vpindex.push_back(pindex);
+    }
+
     CCoinsViewCache coins(coinsview);
     CBlockIndex *pindexState = chainActive.Tip();
     CBlockIndex *pindexFailure = nullptr;
     int nGoodTransactions = 0;
     CValidationState state;
     int reportDone = 0;
-    LogPrintf("[0%%]...");
-    for (CBlockIndex *pindex = chainActive.Tip(); pindex && pindex->pprev;
-         pindex = pindex->pprev) {
-        boost::this_thread::interruption_point();
-        int percentageDone = std::max(
-            1, std::min(
-                   99,
-                   (int)(((double)(chainActive.Height() - pindex->nHeight)) /
-                         (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100))));
-
+    int64_t nStart = GetTimeMillis();
+    // Report the fraction of all checks done, with an estimate of the time
+    // left once there is enough to go by.
+    auto reportProgress = [&](double dProgress) {
+        int percentageDone = std::max(1, std::min(99, int(dProgress * 100)));
         if (reportDone < percentageDone / 10) {
             // report every 10% step
             LogPrintf("[%d%%]...", percentageDone);
             reportDone = percentageDone / 10;
         }
 
-        uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone);
-        if (pindex->nHeight < chainActive.Height() - nCheckDepth) {
-            break;
+        int64_t nElapsed = GetTimeMillis() - nStart;
+        int64_t nSecondsLeft = -1;
+        if (dProgress >= 0.01 && nElapsed >= 1000) {
+            nSecondsLeft =
+                int64_t(nElapsed * (1 - dProgress) / dProgress / 1000);
         }
+        uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone);
+        uiInterface.NotifyVerifyProgress(percentageDone, nSecondsLeft);
+    };
+    // With level 4, disconnecting and reconnecting are each half of the work.
+    const double dDisconnectShare = nCheckLevel >= 4 ? 0.5 : 1;
 
-        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
-            // If pruning, only go back as far as we have data.
-            LogPrintf("VerifyDB(): block verification stopping at height %d "
-                      "(pruning, no data)\n",
-                      pindex->nHeight);
-            break;
-        }
+    LogPrintf("[0%%]...");
+    {
+        CVerifyReadAhead readAhead(config, vpindex, nCheckLevel >= 2);
+        for (size_t i = 0; i < readAhead.size(); i++) {
+            boost::this_thread::interruption_point();
+            reportProgress(dDisconnectShare * i / readAhead.size());
 
-        CBlock block;
+            CVerifyReadAhead::Item item;
+            readAhead.Next(item);
+            CBlockIndex *pindex = item.pindex;
+            const CBlock &block = item.block;
 
-        // check level 0: read from disk
-        if (!ReadBlockFromDisk(block, pindex, config)) {
-            return error(
-                "VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s",
-                pindex->nHeight, pindex->GetBlockHash().ToString());
-        }
-
-        // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(config, block, state)) {
-            return error("%s: *** found bad block at %d, hash=%s (%s)\n",
-                         __func__, pindex->nHeight,
-                         pindex->GetBlockHash().ToString(),
-                         FormatStateMessage(state));
-        }
-
-        // check level 2: verify undo validity
-        if (nCheckLevel >= 2 && pindex) {
-            CBlockUndo undo;
-            CDiskBlockPos pos = pindex->GetUndoPos();
-            if (!pos.IsNull()) {
-                if (!UndoReadFromDisk(undo, pos,
-                                      pindex->pprev->GetBlockHash())) {
-                    return error(
-                        "VerifyDB(): *** found bad undo data at %d, hash=%s\n",
-                        pindex->nHeight, pindex->GetBlockHash().ToString());
-                }
+            // check level 0: read from disk
+            if (!item.fBlockRead) {
+                return error(
+                    "VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s",
+                    pindex->nHeight, pindex->GetBlockHash().ToString());
             }
-        }
 
-        // check level 3: check for inconsistencies during memory-only
-        // disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState &&
-            (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <=
-                nCoinCacheUsage) {
-            DisconnectResult res = DisconnectBlock(block, pindex, coins);
-            if (res == DISCONNECT_FAILED) {
-                return error("VerifyDB(): *** irrecoverable inconsistency in "
-                             "block data at %d, hash=%s",
-                             pindex->nHeight,
-                             pindex->GetBlockHash().ToString());
+            // check level 1: verify block validity
+            if (nCheckLevel >= 1 && !CheckBlock(config, block, state)) {
+                return error("%s: *** found bad block at %d, hash=%s (%s)\n",
+                             __func__, pindex->nHeight,
+                             pindex->GetBlockHash().ToString(),
+                             FormatStateMessage(state));
             }
-            pindexState = pindex->pprev;
-            if (res == DISCONNECT_UNCLEAN) {
-                nGoodTransactions = 0;
-                pindexFailure = pindex;
-            } else {
-                nGoodTransactions += block.vtx.size();
+
+            // check level 2: verify undo validity
+            if (nCheckLevel >= 2 && !item.undoPos.IsNull() &&
+                !item.fUndoRead) {
+                return error(
+                    "VerifyDB(): *** found bad undo data at %d, hash=%s\n",
+                    pindex->nHeight, pindex->GetBlockHash().ToString());
             }
-        }
 
-        if (ShutdownRequested()) {
-            return true;
+            // check level 3: check for inconsistencies during memory-only
+            // disconnect of tip blocks
+            if (nCheckLevel >= 3 && pindex == pindexState &&
+                (coins.DynamicMemoryUsage() +
+                 pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
+                // The undo data was read above, unless there is none.
+                DisconnectResult res =
+                    item.fUndoRead
+                        ? ApplyBlockUndo(item.undo, block, pindex, coins)
+                        : DisconnectBlock(block, pindex, coins);
+                if (res == DISCONNECT_FAILED) {
+                    return error("VerifyDB(): *** irrecoverable inconsistency "
+                                 "in block data at %d, hash=%s",
+                                 pindex->nHeight,
+                                 pindex->GetBlockHash().ToString());
+                }
+                pindexState = pindex->pprev;
+                if (res == DISCONNECT_UNCLEAN) {
+                    nGoodTransactions = 0;
+                    pindexFailure = pindex;
+                } else {
+                    nGoodTransactions += block.vtx.size();
+                }
+            }
+
+            if (ShutdownRequested()) {
+                return true;
+            }
         }
     }
 
@@ -4286,25 +5800,29 @@ bool CVerifyDB::VerifyDB(const Config &config, CCoinsView *coinsview,
                      nGoodTransactions);
     }
 
-    // check level 4: try reconnecting blocks
+    // check level 4: try reconnecting blocks. Their scripts are checked by
+    // the script check threads, while the next blocks are read.
     if (nCheckLevel >= 4) {
-        CBlockIndex *pindex = pindexState;
-        while (pindex != chainActive.Tip()) {
+        std::vector<CBlockIndex *> vpindexConnect;
+        for (CBlockIndex *pindex = chainActive.Next(pindexState); pindex;
+             pindex = chainActive.Next(pindex)) {
+            vpindexConnect.push_back(pindex);
+        }
+
+        CVerifyReadAhead readAhead(config, vpindexConnect, false);
+        for (size_t i = 0; i < readAhead.size(); i++) {
             boost::this_thread::interruption_point();
-            uiInterface.ShowProgress(
-                _("Verifying blocks..."),
-                std::max(
-                    1, std::min(99, 100 - (int)(((double)(chainActive.Height() -
-                                                          pindex->nHeight)) /
-                                                (double)nCheckDepth * 50))));
-            pindex = chainActive.Next(pindex);
-            CBlock block;
-            if (!ReadBlockFromDisk(block, pindex, config)) {
+            reportProgress(0.5 + 0.5 * i / readAhead.size());
+
+            CVerifyReadAhead::Item item;
+            readAhead.Next(item);
+            CBlockIndex *pindex = item.pindex;
+            if (!item.fBlockRead) {
                 return error(
                     "VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s",
                     pindex->nHeight, pindex->GetBlockHash().ToString());
             }
-            if (!ConnectBlock(config, block, state, pindex, coins,
+            if (!ConnectBlock(config, item.block, state, pindex, coins,
                               chainparams)) {
                 return error(
                     "VerifyDB(): *** found unconnectable block at %d, hash=%s",
@@ -4321,6 +5839,203 @@ bool CVerifyDB::VerifyDB(const Config &config, CCoinsView *coinsview,
     return true;
 }
 
+/**
+ * Apply the effects of a block on the UTXO set, ignoring that they may already
+ * have been applied.
+ */
+static bool RollforwardBlock(const Config &config, const CBlockIndex *pindex,
+                             CCoinsViewCache &view) {
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex, config)) {
+        return error("RollforwardBlock(): ReadBlockFromDisk failed at %d, "
+                     "hash=%s",
+                     pindex->nHeight, pindex->GetBlockHash().ToString());
+    }
+
+    for (const CTransactionRef &tx : block.vtx) {
+        if (!tx->IsCoinBase()) {
+            for (const CTxIn &txin : tx->vin) {
+                view.SpendCoin(txin.prevout);
+            }
+        }
+        // Every addition may be an overwrite.
+        const uint256 &txid = tx->GetId();
+        for (size_t i = 0; i < tx->vout.size(); i++) {
+            view.AddCoin(COutPoint(txid, i),
+                         Coin(tx->vout[i], pindex->nHeight, tx->IsCoinBase()),
+                         true);
+        }
+    }
+    view.SetBestBlock(pindex->GetBlockHash());
+    return true;
+}
+
+/**
+ * Erase all the coins of view, which is in the middle of a transition to
+ * hashHead, and make it consistent with the empty UTXO set at hashBlock.
+ */
+static bool DiscardCoins(CCoinsView *view, const uint256 &hashHead,
+                         const uint256 &hashBlock) {
+    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+    CCoinsMap mapCoins;
+    for (; pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        COutPoint key;
+        if (!pcursor->GetKey(key)) {
+            continue;
+        }
+        // A spent coin erases the entry.
+        mapCoins[key].flags = CCoinsCacheEntry::DIRTY;
+        if (mapCoins.size() >= MAX_COINS_SYNC_ENTRIES) {
+            // Keep recording the transition to hashHead, so that an
+            // interruption leads here again.
+            if (!view->BatchWritePartial(mapCoins, hashHead)) {
+                return false;
+            }
+            mapCoins.clear();
+        }
+    }
+    return view->BatchWrite(mapCoins, hashBlock);
+}
+
+bool ReplayBlocks(const Config &config, CCoinsView *view) {
+    LOCK(cs_main);
+
+    CCoinsViewCache cache(view);
+
+    // Set while a UTXO snapshot is being loaded, see LoadUTXOSnapshot.
+    const uint256 hashSnapshotLoad = view->GetSnapshotLoad();
+
+    std::vector<uint256> hashHeads = view->GetHeadBlocks();
+    if (hashHeads.empty()) {
+        // We're already in a consistent state. A snapshot load interrupted
+        // before or after writing its coins has nothing left to do.
+        if (!hashSnapshotLoad.IsNull() &&
+            !view->WriteSnapshotLoad(uint256())) {
+            return error("ReplayBlocks(): failed to write to coin database");
+        }
+        return true;
+    }
+    if (hashHeads.size() != 2) {
+        return error("ReplayBlocks(): unknown inconsistent state");
+    }
+
+    uiInterface.ShowProgress(_("Replaying blocks..."), 0);
+    LogPrintf("Replaying blocks\n");
+
+    // Old tip during the interrupted write.
+    const CBlockIndex *pindexOld = nullptr;
+    // New tip during the interrupted write.
+    const CBlockIndex *pindexNew;
+    // Latest block common to both the old and the new tip.
+    const CBlockIndex *pindexFork = nullptr;
+
+    BlockMap::iterator it = mapBlockIndex.find(hashHeads[0]);
+    if (it == mapBlockIndex.end()) {
+        return error(
+            "ReplayBlocks(): reorganization to unknown block requested");
+    }
+    pindexNew = it->second;
+
+    // The old tip is null if the interrupted write was the first one.
+    if (!hashHeads[1].IsNull()) {
+        it = mapBlockIndex.find(hashHeads[1]);
+        if (it == mapBlockIndex.end()) {
+            return error(
+                "ReplayBlocks(): reorganization from unknown block requested");
+        }
+        pindexOld = it->second;
+        pindexFork = pindexOld->GetAncestor(
+            std::min(pindexOld->nHeight, pindexNew->nHeight));
+        const CBlockIndex *pindexWalk =
+            pindexNew->GetAncestor(pindexFork->nHeight);
+        while (pindexFork != pindexWalk) {
+            pindexFork = pindexFork->pprev;
+            pindexWalk = pindexWalk->pprev;
+        }
+        assert(pindexFork != nullptr);
+    }
+
+    // A UTXO snapshot is loaded as a transition from the genesis block to the
+    // snapshot block, with none of the blocks in between to replay.
+    if (pindexNew == pindexSnapshotBase) {
+        // The snapshot base is only recorded once all the coins are written.
+        LogPrintf("Completing the load of the UTXO snapshot at %s\n",
+                  pindexNew->GetBlockHash().ToString());
+        cache.SetBestBlock(pindexNew->GetBlockHash());
+        if (!cache.Flush() || !view->WriteSnapshotLoad(uint256())) {
+            return error("ReplayBlocks(): failed to write to coin database");
+        }
+        uiInterface.ShowProgress("", 100);
+        return true;
+    }
+    if (!hashSnapshotLoad.IsNull()) {
+        // The load was interrupted before its coins were all written. It
+        // started from the empty UTXO set at the genesis block.
+        if (hashSnapshotLoad != pindexNew->GetBlockHash()) {
+            return error("ReplayBlocks(): interrupted UTXO snapshot load does "
+                         "not match the transition");
+        }
+        LogPrintf("Discarding a partly loaded UTXO snapshot at %s\n",
+                  pindexNew->GetBlockHash().ToString());
+        if (!DiscardCoins(view, pindexNew->GetBlockHash(),
+                          config.GetChainParams()
+                              .GetConsensus()
+                              .hashGenesisBlock) ||
+            !view->WriteSnapshotLoad(uint256())) {
+            return error("ReplayBlocks(): failed to write to coin database");
+        }
+        uiInterface.ShowProgress("", 100);
+        return true;
+    }
+
+    // Roll back along the old branch.
+    while (pindexOld != pindexFork) {
+        // Never disconnect the genesis block.
+        if (pindexOld->nHeight > 0) {
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindexOld, config)) {
+                return error("ReplayBlocks(): ReadBlockFromDisk failed at %d, "
+                             "hash=%s",
+                             pindexOld->nHeight,
+                             pindexOld->GetBlockHash().ToString());
+            }
+            LogPrintf("Rolling back %s (%i)\n",
+                      pindexOld->GetBlockHash().ToString(), pindexOld->nHeight);
+            cache.SetBestBlock(pindexOld->GetBlockHash());
+            // An unclean result means the block never had all its changes
+            // written. Both writing and erasing a coin are idempotent, so the
+            // result is still the UTXO set with the block undone.
+            if (DisconnectBlock(block, pindexOld, cache) == DISCONNECT_FAILED) {
+                return error("ReplayBlocks(): DisconnectBlock failed at %d, "
+                             "hash=%s",
+                             pindexOld->nHeight,
+                             pindexOld->GetBlockHash().ToString());
+            }
+        }
+        pindexOld = pindexOld->pprev;
+    }
+
+    // Roll forward from the fork point to the new tip.
+    int nForkHeight = pindexFork ? pindexFork->nHeight : 0;
+    for (int nHeight = nForkHeight + 1; nHeight <= pindexNew->nHeight;
+         nHeight++) {
+        const CBlockIndex *pindex = pindexNew->GetAncestor(nHeight);
+        LogPrintf("Rolling forward %s (%i)\n",
+                  pindex->GetBlockHash().ToString(), nHeight);
+        if (!RollforwardBlock(config, pindex, cache)) {
+            return false;
+        }
+    }
+
+    cache.SetBestBlock(pindexNew->GetBlockHash());
+    if (!cache.Flush()) {
+        return error("ReplayBlocks(): failed to write to coin database");
+    }
+    uiInterface.ShowProgress("", 100);
+    return true;
+}
+
 bool RewindBlockIndex(const Config &config) {
     LOCK(cs_main);
 
@@ -4378,10 +6093,14 @@ bool RewindBlockIndex(const Config &config) {
 // logic assumes a consistent block index state
 void UnloadBlockIndex() {
     LOCK(cs_main);
+    // Finish the queued writes and close the files, which may be in another
+    // directory when the index is loaded again.
+    blockFileWriter.Sync();
     setBlockIndexCandidates.clear();
     chainActive.SetTip(nullptr);
     pindexBestInvalid = nullptr;
     pindexBestHeader = nullptr;
+    pindexSnapshotBase = nullptr;
     mempool.clear();
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
@@ -4389,6 +6108,9 @@ void UnloadBlockIndex() {
     nBlockSequenceId = 1;
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
+    coinsCommitment = CCoinsCommitment();
+    blockSolutionCache.Clear();
+    reorgCache.Clear();
     versionbitscache.Clear();
     for (int b = 0; b < VERSIONBITS_NUM_BITS; b++) {
         warningcache[b].clear();
@@ -4631,6 +6353,13 @@ static void CheckBlockIndex(const Consensus::Params &consensusParams) {
         return;
     }
 
+    // The checks below assume that every block in the active chain was
+    // received and connected, which is not so for the blocks up to a UTXO
+    // snapshot.
+    if (pindexSnapshotBase) {
+        return;
+    }
+
     // Build forward-pointing map of the entire block tree.
     std::multimap<CBlockIndex *, CBlockIndex *> forward;
     for (BlockMap::iterator it = mapBlockIndex.begin();
@@ -26,6 +26,7 @@
 #include <cstdint>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <utility>
@@ -34,6 +35,7 @@
 class CBlockIndex;
 class CBlockTreeDB;
 class CBloomFilter;
+class CCoinsViewDB;
 class CChainParams;
 class CConnman;
 class CInv;
@@ -83,6 +85,10 @@ static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
+/** The maximum size of block and undo data waiting to be written to disk */
+static const size_t MAX_BLOCKFILE_WRITE_QUEUE = 0x4000000; // 64 MiB
+/** The number of blocks verifychain reads ahead of the one being checked */
+static const size_t VERIFYDB_READ_AHEAD_BLOCKS = 16;
 
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
@@ -99,6 +105,14 @@ static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
  *  less than this number, we reached its tip. Changing this value is a protocol
  * upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 2000;
+/** Number of recently used Equihash solutions kept in memory, enough to serve
+ * two getheaders results without reading the block tree database. */
+static const unsigned int BLOCK_SOLUTION_CACHE_SIZE = 2 * MAX_HEADERS_RESULTS;
+/** Number of Equihash solutions of block index entries not written yet beyond
+ * which the block index is written without waiting for the periodic write,
+ * around 27 MB at the main chain parameters. */
+static const unsigned int MAX_UNWRITTEN_BLOCK_SOLUTIONS =
+    10 * MAX_HEADERS_RESULTS;
 /** Maximum depth of blocks we're willing to serve as compact blocks to peers
  *  when requested. For older blocks, a regular BLOCK response will be sent. */
 static const int MAX_CMPCTBLOCK_DEPTH = 5;
@@ -115,6 +129,11 @@ static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
 static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
+/**
+ * Maximum number of modified coins written per block while the coins cache is
+ * written out without being emptied, -coinssyncentries default.
+ */
+static const unsigned int MAX_COINS_SYNC_ENTRIES = 200000;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 /** Average delay between local address broadcasts in seconds. */
@@ -151,6 +170,12 @@ static const int64_t MAX_FEE_ESTIMATION_TIP_AGE = 3 * 60 * 60;
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = false;
+/** Default for -coinscommitment */
+static const bool DEFAULT_COINS_COMMITMENT = true;
+/** Default for -reorgcache, the number of recently connected blocks kept in
+ * memory with their undo data, so that disconnecting them reads nothing from
+ * disk. */
+static const unsigned int DEFAULT_REORG_CACHE_BLOCKS = 10;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 
 /** Default for using fee filter */
@@ -181,7 +206,9 @@ extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+extern bool fCoinsCommitment;
 extern size_t nCoinCacheUsage;
+extern unsigned int nReorgCacheBlocks;
 
 /** A fee rate smaller than this is considered zero fee (for relaying, mining
  * and transaction creation) */
@@ -201,6 +228,18 @@ extern uint256 hashAssumeValid;
  * points). */
 extern CBlockIndex *pindexBestHeader;
 
+/**
+ * The block of the UTXO snapshot the chainstate was loaded from, if any. This
+ * node did not process the blocks up to it and does not have their data.
+ */
+extern CBlockIndex *pindexSnapshotBase;
+
+/**
+ * Whether the coins cache is being written out over several calls to
+ * FlushStateToDisk, a chunk per connected block.
+ */
+extern bool fCoinsSyncPending;
+
 /** Minimum disk space required - used in CheckDiskSpace() */
 static const uint64_t nMinDiskSpace = 52428800;
 
@@ -217,6 +256,9 @@ static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
 
 static const signed int DEFAULT_CHECKBLOCKS = 6;
 static const unsigned int DEFAULT_CHECKLEVEL = 3;
+/** Default for -checkblockindexhashes, the interval at which block index
+ * entries loaded at startup get their header hash recomputed. */
+static const unsigned int DEFAULT_CHECKBLOCKINDEXHASHES = 1000;
 
 // Require that user allocate at least 550MB for block & undo files (blk???.dat
 // and rev???.dat)
@@ -288,10 +330,84 @@ bool LoadExternalBlockFile(const Config &config, FILE *fileIn,
 bool InitBlockIndex(const Config &config);
 /** Load the block tree and coins database from disk */
 bool LoadBlockIndex(const CChainParams &chainparams);
+/** Update the chain tip based on database information. */
+bool LoadChainTip(const CChainParams &chainparams);
+/**
+ * Retrieve the UTXO set commitment at the best block of pcoinsTip, if it is
+ * known. Requires cs_main.
+ */
+bool GetCoinsCommitment(CCoinsCommitment &commitment);
+/**
+ * Replace the UTXO set commitment, such as after a full scan, if it is at the
+ * best block of pcoinsTip. Requires cs_main.
+ */
+void SetCoinsCommitment(const CCoinsCommitment &commitment);
+
+/**
+ * Header of a UTXO snapshot file. The coins follow ordered by txid and output
+ * index, grouped by transaction: the txid, VARINT(number of coins), and for
+ * each coin VARINT(output index) followed by the Coin.
+ */
+class CUTXOSnapshotHeader {
+public:
+    static const uint32_t CURRENT_VERSION = 1;
+
+    CMessageHeader::MessageMagic diskMagic;
+    uint32_t nVersion;
+    //! The block whose UTXO set the snapshot holds.
+    uint256 hashBlock;
+    //! Number of transactions in the chain up to and including that block.
+    unsigned int nChainTx;
+    uint64_t nCoins;
+    //! The muhash of the set, as reported by gettxoutsetinfo.
+    uint256 hashCoins;
+
+    CUTXOSnapshotHeader() : nVersion(CURRENT_VERSION), nChainTx(0), nCoins(0) {
+        diskMagic.fill(0);
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action) {
+        READWRITE(FLATDATA(diskMagic));
+        READWRITE(nVersion);
+        READWRITE(hashBlock);
+        READWRITE(nChainTx);
+        READWRITE(nCoins);
+        READWRITE(hashCoins);
+    }
+};
+
+/**
+ * Write the UTXO set of view at its best block to a snapshot file at path. The
+ * set is read without holding cs_main.
+ */
+bool DumpUTXOSnapshot(CValidationState &state, CCoinsView *view,
+                      const boost::filesystem::path &path,
+                      CUTXOSnapshotHeader &header);
+/**
+ * Load the UTXO snapshot at path into the chainstate, which must be at the
+ * genesis block, and make the snapshot block the tip. Its header must be known
+ * already. The snapshot is checked against the hash in its header and, unless
+ * null, against hashExpected; the blocks up to it are not validated. cs_main
+ * is only held while the snapshot is written, not while it is checked.
+ */
+bool LoadUTXOSnapshot(const Config &config, CValidationState &state,
+                      const boost::filesystem::path &path,
+                      const uint256 &hashExpected, CUTXOSnapshotHeader &header);
 /** Unload database information */
 void UnloadBlockIndex();
-/** Run an instance of the script checking thread */
+/** Run an instance of the script and block transaction checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the Equihash solution checking thread */
+void ThreadEquihashCheck();
+/** Run an instance of the block input prefetching thread */
+void ThreadCoinsPrefetch();
+/** Run the thread that writes block and undo files */
+void ThreadBlockFileWriter();
+/** Make the block file writer thread finish the queued work and exit */
+void InterruptBlockFileWriter();
 /** Check whether we are doing an initial block download (synchronizing from
  * disk or network) */
 bool IsInitialBlockDownload();
@@ -437,10 +553,16 @@ bool CheckInputs(const CTransaction &tx, CValidationState &state,
                  const PrecomputedTransactionData &txdata,
                  std::vector<CScriptCheck> *pvChecks = nullptr);
 
-/** Apply the effects of this transaction on the UTXO set represented by view */
+/**
+ * Apply the effects of this transaction on the UTXO set represented by view,
+ * and on commitment if given. The commitment does not account for coins the
+ * outputs overwrite, which only the duplicate coinbases exempted from BIP30
+ * do; ConnectBlock takes care of those.
+ */
 void UpdateCoins(const CTransaction &tx, CCoinsViewCache &inputs, int nHeight);
 void UpdateCoins(const CTransaction &tx, CCoinsViewCache &inputs,
-                 CTxUndo &txundo, int nHeight);
+                 CTxUndo &txundo, int nHeight,
+                 CCoinsCommitment *commitment = nullptr);
 
 /** Transaction validation functions */
 
@@ -536,6 +658,138 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the verification of one header's Equihash solution.
+ * Used to check the solutions of a batch of headers in parallel on the
+ * Equihash check queue.
+ */
+class CEquihashCheck {
+private:
+    const Config *config;
+    const CBlockHeader *pheader;
+
+public:
+    CEquihashCheck() : config(nullptr), pheader(nullptr) {}
+
+    CEquihashCheck(const Config &configIn, const CBlockHeader &headerIn)
+        : config(&configIn), pheader(&headerIn) {}
+
+    bool operator()();
+
+    void swap(CEquihashCheck &check) {
+        std::swap(config, check.config);
+        std::swap(pheader, check.pheader);
+    }
+};
+
+/**
+ * Check the Equihash solutions of a batch of headers, spreading the work over
+ * the Equihash check threads when they are running. Returns true only if every
+ * solution is valid; it does not tell which header failed, callers are
+ * expected to fall back to the serial checks to get accurate error reporting.
+ *
+ * Call without cs_main held.
+ */
+bool CheckEquihashSolutions(const Config &config,
+                            const std::vector<const CBlockHeader *> &headers);
+
+/**
+ * Closure representing the context-free checks of one transaction of a block:
+ * its sigop count and, except for the coinbase, CheckRegularTransaction. The
+ * results are written to slots owned by the caller so that CheckBlock can go
+ * through them in block order, and it always returns true so that every
+ * transaction of the batch gets checked.
+ */
+class CTxCheck {
+private:
+    const CTransaction *ptx;
+    bool fCheckTx;
+    uint64_t *pnSigOps;
+    char *pfValid;
+
+public:
+    CTxCheck()
+        : ptx(nullptr), fCheckTx(false), pnSigOps(nullptr), pfValid(nullptr) {}
+
+    CTxCheck(const CTransaction &txIn, bool fCheckTxIn, uint64_t &nSigOpsOut,
+             char &fValidOut)
+        : ptx(&txIn), fCheckTx(fCheckTxIn), pnSigOps(&nSigOpsOut),
+          pfValid(&fValidOut) {}
+
+    bool operator()();
+
+    void swap(CTxCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(fCheckTx, check.fCheckTx);
+        std::swap(pnSigOps, check.pnSigOps);
+        std::swap(pfValid, check.pfValid);
+    }
+};
+
+/**
+ * Closure run on the script check queue: a CScriptCheck from ConnectBlock or a
+ * CTxCheck from CheckBlock. The two never share a batch, but they share the
+ * worker threads.
+ */
+class CBlockCheck {
+private:
+    bool fTxCheck;
+    CScriptCheck scriptCheck;
+    CTxCheck txCheck;
+
+public:
+    CBlockCheck() : fTxCheck(false) {}
+
+    explicit CBlockCheck(CScriptCheck &&check) : fTxCheck(false) {
+        scriptCheck.swap(check);
+    }
+
+    explicit CBlockCheck(CTxCheck &&check) : fTxCheck(true) {
+        txCheck.swap(check);
+    }
+
+    bool operator()() { return fTxCheck ? txCheck() : scriptCheck(); }
+
+    void swap(CBlockCheck &check) {
+        std::swap(fTxCheck, check.fTxCheck);
+        scriptCheck.swap(check.scriptCheck);
+        txCheck.swap(check.txCheck);
+    }
+};
+
+/**
+ * Closure reading the coin spent by one input of a block from the view backing
+ * pcoinsTip, ahead of ConnectBlock. The coin and whether it was found are
+ * written to slots owned by the caller, which adds them to the cache once all
+ * reads are done. It always returns true.
+ */
+class CCoinsPrefetch {
+private:
+    const CCoinsView *pview;
+    const COutPoint *poutpoint;
+    Coin *pcoin;
+    char *pfFound;
+
+public:
+    CCoinsPrefetch()
+        : pview(nullptr), poutpoint(nullptr), pcoin(nullptr),
+          pfFound(nullptr) {}
+
+    CCoinsPrefetch(const CCoinsView &viewIn, const COutPoint &outpointIn,
+                   Coin &coinOut, char &fFoundOut)
+        : pview(&viewIn), poutpoint(&outpointIn), pcoin(&coinOut),
+          pfFound(&fFoundOut) {}
+
+    bool operator()();
+
+    void swap(CCoinsPrefetch &check) {
+        std::swap(pview, check.pview);
+        std::swap(poutpoint, check.poutpoint);
+        std::swap(pcoin, check.pcoin);
+        std::swap(pfFound, check.pfFound);
+    }
+};
+
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock &block, CDiskBlockPos &pos,
                       const CMessageHeader::MessageMagic &messageStart);
@@ -544,6 +798,47 @@ bool ReadBlockFromDisk(CBlock &block, const CDiskBlockPos &pos,
 bool ReadBlockFromDisk(CBlock &block, const CBlockIndex *pindex,
                        const Config &config);
 
+class CMappedBlockFile;
+
+/**
+ * A block as serialized in its block file, for callers that only forward the
+ * bytes. It points into a memory mapping of the file where possible, which it
+ * keeps alive, and into a copy otherwise.
+ */
+class CRawBlock {
+private:
+    std::shared_ptr<const CMappedBlockFile> mapping;
+    std::vector<uint8_t> buffer;
+    const uint8_t *pbegin;
+    size_t nSize;
+
+    friend bool ReadRawBlockFromDisk(CRawBlock &block,
+                                     const CBlockIndex *pindex,
+                                     const Config &config);
+
+public:
+    CRawBlock() : pbegin(nullptr), nSize(0) {}
+    CRawBlock(const CRawBlock &) = delete;
+    CRawBlock &operator=(const CRawBlock &) = delete;
+
+    const uint8_t *begin() const { return pbegin; }
+    const uint8_t *end() const { return pbegin + nSize; }
+    size_t size() const { return nSize; }
+
+    template <typename Stream> void Serialize(Stream &s) const {
+        s.write((const char *)pbegin, nSize);
+    }
+};
+
+/**
+ * Read a block without deserializing it. The bytes are serialized without
+ * SERIALIZE_BLOCK_LEGACY, which is how peers and RPC clients get them unless
+ * they ask for the legacy format. Only the header is checked, against the
+ * hash of pindex.
+ */
+bool ReadRawBlockFromDisk(CRawBlock &block, const CBlockIndex *pindex,
+                          const Config &config);
+
 /** Functions for validating blocks and updating the block tree */
 
 /** Context-independent validity checks */
@@ -597,6 +892,12 @@ bool TestBlockValidity(const Config &config, CValidationState &state,
  */
 bool RewindBlockIndex(const Config &config);
 
+/**
+ * Complete a write of the coins database that was interrupted, by replaying
+ * the blocks between the old and the new tip it was written for.
+ */
+bool ReplayBlocks(const Config &config, CCoinsView *view);
+
 /**
  * RAII wrapper for VerifyDB: Verify consistency of the block and coin
  * databases.
@@ -627,6 +928,10 @@ bool ResetBlockFailureFlags(CBlockIndex *pindex);
 /** The currently-connected chain of blocks (protected by cs_main). */
 extern CChain chainActive;
 
+/** Global variable that points to the coin database, which backs pcoinsTip
+ * (protected by cs_main) */
+extern CCoinsViewDB *pcoinsdbview;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main)
  */
 extern CCoinsViewCache *pcoinsTip;
@@ -49,6 +49,8 @@ static const int INVALID_CB_NO_BAN_VERSION = 70015;
 
 static const int BCP_HARD_FORK_VERSION = 70016;
 
-static const bool DISABLE_CMPCTBLOCK = true;
+//! compact blocks carry the block header in the format of this version, so
+//! they are only exchanged with peers at or above it
+static const int CMPCTBLOCK_VERSION = BCP_HARD_FORK_VERSION;
 
 #endif // BITCOIN_VERSION_H
@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 The Bitcoin Cash Plus developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test compact block relay (BIP152) between two nodes, with the block header
+# of the hard fork.
+#
+# node0 mines past the fork height. node1 reconstructs the blocks node0 mines
+# from its mempool, asks for the transactions it does not have, and switches
+# node0 to announcing new blocks with compact blocks (high-bandwidth mode).
+#
+
+from test_framework.mininode import BCP_REGTEST_HARDFORK_HEIGHT, wait_until
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_greater_than,
+    connect_nodes,
+    disconnect_nodes,
+    start_nodes,
+    sync_blocks,
+    sync_mempools,
+)
+
+
+def msg_bytes(node, direction, command):
+    # Bytes of command messages sent or received by node, over all its peers.
+    return sum(peer[direction].get(command, 0) for peer in node.getpeerinfo())
+
+
+class CompactBlocksTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = False
+        self.num_nodes = 2
+
+    def setup_network(self):
+        # A single connection, so that the message counts are easy to follow.
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir)
+        self.connect()
+
+    def connect(self):
+        node0, node1 = self.nodes
+        connect_nodes(node1, 0)
+        assert(wait_until(
+            lambda: msg_bytes(node0, "bytesrecv_per_msg", "sendcmpct") > 0 and
+            msg_bytes(node1, "bytesrecv_per_msg", "sendcmpct") > 0,
+            timeout=30))
+        self.sendcmpct = msg_bytes(node1, "bytessent_per_msg", "sendcmpct")
+
+    def mine_block(self):
+        # Mine a block on node0, and return the bytes of block, cmpctblock
+        # and getdata messages node1 exchanged for it.
+        node0, node1 = self.nodes
+        commands = [("bytesrecv_per_msg", "block"),
+                    ("bytesrecv_per_msg", "cmpctblock"),
+                    ("bytessent_per_msg", "getdata")]
+        before = [msg_bytes(node1, d, c) for d, c in commands]
+        node0.generate(1)
+        sync_blocks(self.nodes)
+        after = [msg_bytes(node1, d, c) for d, c in commands]
+        return [a - b for a, b in zip(after, before)]
+
+    def run_test(self):
+        node0, node1 = self.nodes
+
+        self.log.info("Mining past the fork height")
+        node0.generate(BCP_REGTEST_HARDFORK_HEIGHT - node0.getblockcount() + 1)
+        sync_blocks(self.nodes)
+        tip = node1.getblock(node1.getbestblockhash())
+        assert_greater_than(tip["height"], BCP_REGTEST_HARDFORK_HEIGHT - 1)
+
+        self.log.info("Reconstructing a block from the mempool")
+        for _ in range(5):
+            node0.sendtoaddress(node1.getnewaddress(), 1)
+        sync_mempools(self.nodes)
+        getblocktxn = msg_bytes(node0, "bytesrecv_per_msg", "getblocktxn")
+        block, cmpctblock, _ = self.mine_block()
+        assert_equal(block, 0)
+        assert_greater_than(cmpctblock, 0)
+        assert_equal(msg_bytes(node0, "bytesrecv_per_msg", "getblocktxn"),
+                     getblocktxn)
+        assert_equal(node1.getmempoolinfo()["size"], 0)
+
+        self.log.info("Switching to high-bandwidth mode")
+        # Having provided a block, node0 is asked with a second sendcmpct to
+        # send compact blocks without announcing them first.
+        assert(wait_until(
+            lambda: msg_bytes(node1, "bytessent_per_msg", "sendcmpct") >
+            self.sendcmpct, timeout=30))
+        block, cmpctblock, getdata = self.mine_block()
+        assert_equal(block, 0)
+        assert_greater_than(cmpctblock, 0)
+        assert_equal(getdata, 0)
+
+        self.log.info("Requesting missing transactions")
+        disconnect_nodes(node1, 0)
+        txid = node0.sendtoaddress(node1.getnewaddress(), 1)
+        self.connect()
+        assert(txid not in node1.getrawmempool())
+        getblocktxn = msg_bytes(node0, "bytesrecv_per_msg", "getblocktxn")
+        blocktxn = msg_bytes(node1, "bytesrecv_per_msg", "blocktxn")
+        block, cmpctblock, _ = self.mine_block()
+        assert_equal(block, 0)
+        assert_greater_than(cmpctblock, 0)
+        assert_greater_than(
+            msg_bytes(node0, "bytesrecv_per_msg", "getblocktxn"), getblocktxn)
+        assert_greater_than(
+            msg_bytes(node1, "bytesrecv_per_msg", "blocktxn"), blocktxn)
+        assert_equal(node1.gettransaction(txid)["confirmations"], 1)
+
+
+if __name__ == '__main__':
+    CompactBlocksTest().main()
@@ -15,6 +15,7 @@ from test_framework.authproxy import JSONRPCException
 from test_framework.util import (
     assert_equal,
     assert_raises,
+    assert_raises_jsonrpc,
     assert_is_hex_string,
     assert_is_hash_string,
     start_nodes,
@@ -28,6 +29,8 @@ class BlockchainTest(BitcoinTestFramework):
     Test blockchain-related RPC calls:
 
         - gettxoutsetinfo
+        - compactchainstate
+        - getdbstats
         - verifychain
 
     """
@@ -40,6 +43,7 @@ class BlockchainTest(BitcoinTestFramework):
     def run_test(self):
         self._test_gettxoutsetinfo()
         self._test_getblockheader()
+        self._test_compactchainstate()
         self.nodes[0].verifychain(4, 0)
 
     def _test_gettxoutsetinfo(self):
@@ -58,11 +62,24 @@ class BlockchainTest(BitcoinTestFramework):
         assert_equal(len(res['bestblock']), 64)
         assert_equal(len(res['hash_serialized']), 64)
 
+        self.log.info("Test that gettxoutsetinfo() agrees with hash_type muhash")
+        mu = node.gettxoutsetinfo("muhash")
+        for key in ['total_amount', 'height', 'txouts', 'bogosize', 'bestblock']:
+            assert_equal(mu[key], res[key])
+        assert_equal(len(mu['muhash']), 64)
+        assert 'hash_serialized' not in mu
+        assert_raises_jsonrpc(-8, "Unknown hash_type",
+                              node.gettxoutsetinfo, "sha256")
+
         self.log.info(
             "Test that gettxoutsetinfo() works for blockchain with just the genesis block")
         b1hash = node.getblockhash(1)
         node.invalidateblock(b1hash)
 
+        mu2 = node.gettxoutsetinfo("muhash")
+        assert_equal(mu2['txouts'], 0)
+        assert_equal(mu2['bogosize'], 0)
+
         res2 = node.gettxoutsetinfo()
         assert_equal(res2['transactions'], 0)
         assert_equal(res2['total_amount'], Decimal('0'))
@@ -84,6 +101,9 @@ class BlockchainTest(BitcoinTestFramework):
         assert_equal(res['bogosize'], res3['bogosize'])
         assert_equal(res['bestblock'], res3['bestblock'])
         assert_equal(res['hash_serialized'], res3['hash_serialized'])
+        mu3 = node.gettxoutsetinfo("muhash")
+        for key in ['total_amount', 'height', 'txouts', 'bogosize', 'bestblock', 'muhash']:
+            assert_equal(mu[key], mu3[key])
 
     def _test_getblockheader(self):
         node = self.nodes[0]
@@ -112,6 +132,30 @@ class BlockchainTest(BitcoinTestFramework):
         assert isinstance(int(header['versionHex'], 16), int)
         assert isinstance(header['difficulty'], Decimal)
 
+    def _test_compactchainstate(self):
+        node = self.nodes[0]
+        info = node.gettxoutsetinfo("muhash")
+        del info['disk_size']
+
+        res = node.compactchainstate()
+        assert res['seconds'] >= 0
+        assert res['disk_size_before'] > 0
+        assert res['disk_size_after'] > 0
+        # Compaction leaves the set itself alone.
+        info_after = node.gettxoutsetinfo("muhash")
+        del info_after['disk_size']
+        assert_equal(info_after, info)
+
+        stats = node.getdbstats()
+        for db in ['chainstate', 'blockindex']:
+            assert stats[db]['memory_usage'] > 0
+            assert 0 <= stats[db]['cache_hit_rate'] <= 1
+        # The compaction left all the coins below level 0.
+        levels = stats['chainstate']['levels']
+        assert sum(level['files'] for level in levels) > 0
+        assert all(level['files'] == 0
+                   for level in levels if level['level'] == 0)
+
 
 if __name__ == '__main__':
     BlockchainTest().main()
@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 The Bitcoin Cash Plus developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test relaying blocks and transactions with several message handler threads.
+#
+# Each peer is handled by one of the -msghandlerthreads threads, chosen by its
+# node id. The nodes are connected in a ring so that every node has peers on
+# more than one of its threads, and one node runs with a single thread.
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    connect_nodes_bi,
+    start_nodes,
+)
+
+
+class MsgHandlerThreadsTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = False
+        self.num_nodes = 4
+        self.extra_args = [["-msghandlerthreads=4"],
+                           ["-msghandlerthreads=4"],
+                           ["-msghandlerthreads=3"],
+                           ["-msghandlerthreads=1"]]
+
+    def setup_network(self):
+        self.nodes = start_nodes(
+            self.num_nodes, self.options.tmpdir, self.extra_args)
+        for i in range(self.num_nodes):
+            connect_nodes_bi(self.nodes, i, (i + 1) % self.num_nodes)
+        self.sync_all()
+
+    def run_test(self):
+        for node in self.nodes:
+            assert_equal(len(node.getpeerinfo()), 4)
+
+        # Blocks mined on any node reach all the others.
+        for i, node in enumerate(self.nodes):
+            node.generate(2 + i)
+            self.sync_all()
+        height = self.nodes[0].getblockcount()
+        for node in self.nodes:
+            assert_equal(node.getblockcount(), height)
+
+        # Transactions are relayed through every node's handler threads.
+        txids = []
+        for i, node in enumerate(self.nodes):
+            address = self.nodes[(i + 2) % self.num_nodes].getnewaddress()
+            txids.append(node.sendtoaddress(address, 1))
+        self.sync_all()
+        for node in self.nodes:
+            assert_equal(sorted(node.getrawmempool()), sorted(txids))
+
+        # And get mined.
+        self.nodes[3].generate(1)
+        self.sync_all()
+        for node in self.nodes:
+            assert_equal(node.getrawmempool(), [])
+            assert_equal(node.getbestblockhash(),
+                         self.nodes[3].getbestblockhash())
+
+
+if __name__ == '__main__':
+    MsgHandlerThreadsTest().main()
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 The Bitcoin Cash Plus developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test getnetstats.
+#
+# The statistics of each peer are checked against getpeerinfo, and the totals
+# must keep the messages of peers that have disconnected.
+#
+
+from test_framework.mininode import wait_until
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_greater_than,
+    assert_greater_than_or_equal,
+    disconnect_nodes,
+)
+
+HISTOGRAM_BUCKETS = ["10us", "100us", "1ms", "10ms", "100ms", "1s", "more"]
+
+
+def check_process_stats(stats, send_messages):
+    assert_greater_than_or_equal(stats["time"], 0)
+    assert_equal(set(stats["histogram"].keys()), set(HISTOGRAM_BUCKETS))
+    assert_equal(sum(stats["histogram"].values()), stats["count"])
+    if send_messages:
+        # SendMessages does not wait for cs_main but skips when it is busy,
+        # and skipped calls are not counted as processed.
+        assert "cs_main_wait" not in stats
+        assert_greater_than_or_equal(stats["skipped"], 0)
+    else:
+        assert "skipped" not in stats
+        assert_greater_than_or_equal(stats["time"], stats["cs_main_wait"])
+
+
+def check_msgs(msgs):
+    for cmd, stats in msgs.items():
+        assert_greater_than(stats["recvmsgs"] + stats["sentmsgs"], 0)
+        assert_greater_than_or_equal(stats["recvbytes"], stats["recvmsgs"])
+        assert_greater_than_or_equal(stats["sentbytes"], stats["sentmsgs"])
+        if "processed" in stats:
+            check_process_stats(stats["processed"], False)
+            assert_greater_than_or_equal(
+                stats["recvmsgs"], stats["processed"]["count"])
+
+
+class NetStatsTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 3
+
+    def run_test(self):
+        node0, node1, node2 = self.nodes
+        node0.generate(10)
+        self.sync_all()
+
+        # node1 is connected to both others, twice each.
+        netstats = node1.getnetstats()
+        peerinfo = node1.getpeerinfo()
+        assert_equal(sorted(p["id"] for p in netstats["peers"]),
+                     sorted(p["id"] for p in peerinfo))
+        assert_equal(len(netstats["peers"]), 4)
+
+        for peer in netstats["peers"]:
+            info = [p for p in peerinfo if p["id"] == peer["id"]][0]
+            assert_equal(peer["addr"], info["addr"])
+            for key in ["processmsgs", "processbytes", "sendmsgs",
+                        "sendbytes"]:
+                assert_greater_than_or_equal(peer["queues"][key], 0)
+            check_process_stats(peer["sendmessages"], True)
+            assert_greater_than(peer["sendmessages"]["count"], 0)
+            msgs = peer["msgs"]
+            check_msgs(msgs)
+            # Every peer went through the handshake.
+            for cmd in ["version", "verack"]:
+                assert_equal(msgs[cmd]["recvmsgs"], 1)
+                assert_equal(msgs[cmd]["sentmsgs"], 1)
+                assert_equal(msgs[cmd]["processed"]["count"], 1)
+                # These are not sent again, so the byte counts must agree
+                # with getpeerinfo.
+                assert_equal(msgs[cmd]["recvbytes"],
+                             info["bytesrecv_per_msg"][cmd])
+                assert_equal(msgs[cmd]["sentbytes"],
+                             info["bytessent_per_msg"][cmd])
+
+        # The totals add up the peers.
+        totals = netstats["totals"]
+        check_process_stats(totals["sendmessages"], True)
+        check_msgs(totals["msgs"])
+        assert_equal(totals["msgs"]["version"]["recvmsgs"], 4)
+        assert_equal(totals["msgs"]["verack"]["processed"]["count"], 4)
+        for key in ["processmsgs", "processbytes", "sendmsgs", "sendbytes"]:
+            assert_equal(totals["queues"][key],
+                         sum(p["queues"][key] for p in netstats["peers"]))
+
+        # Peers which disconnect stay in the totals, but not in the queues.
+        disconnect_nodes(node1, 2)
+        disconnect_nodes(node2, 1)
+
+        def disconnected():
+            netstats = node1.getnetstats()
+            return (len(netstats["peers"]) == 2 and
+                    netstats["totals"]["msgs"]["version"]["recvmsgs"] == 4)
+        assert wait_until(disconnected, timeout=30)
+        netstats = node1.getnetstats()
+        totals = netstats["totals"]
+        assert_equal(totals["msgs"]["verack"]["processed"]["count"], 4)
+        assert_greater_than_or_equal(
+            totals["sendmessages"]["count"],
+            sum(p["sendmessages"]["count"] for p in netstats["peers"]))
+        for key in ["processmsgs", "processbytes", "sendmsgs", "sendbytes"]:
+            assert_equal(totals["queues"][key],
+                         sum(p["queues"][key] for p in netstats["peers"]))
+
+
+if __name__ == '__main__':
+    NetStatsTest().main()
@@ -74,6 +74,9 @@ BASE_SCRIPTS = [
     'disconnect_ban.py',
     'decodescript.py',
     'blockchain.py',
+    'utxosnapshot.py',
+    'msghandlerthreads.py',
+    'netstats.py',
     'disablewallet.py',
     'keypool.py',
     'p2p-mempool.py',
@@ -95,6 +98,7 @@ BASE_SCRIPTS = [
     'bcp-rpc.py',
     'mempool-accept-txn.py',
     'bcp_hardfork.py',
+    'bcp-compactblocks.py',
 
 ]
 
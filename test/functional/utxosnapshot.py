@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 The Bitcoin Cash Plus developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test dumptxoutset and loadtxoutset.
+#
+# node0 mines a chain and writes a UTXO snapshot. node1 only receives the
+# headers of that chain, loads the snapshot, and then syncs the blocks after it
+# from node0.
+#
+
+import os
+
+from test_framework.mininode import (
+    CBlockHeader,
+    FromHex,
+    NetworkThread,
+    NodeConn,
+    SingleNodeConnCB,
+    msg_headers,
+    wait_until,
+)
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_raises_jsonrpc,
+    connect_nodes_bi,
+    p2p_port,
+    start_node,
+    start_nodes,
+    stop_node,
+    sync_blocks,
+)
+
+
+def set_info(node, hash_type):
+    # Everything but the size on disk, which depends on how the set was written.
+    info = node.gettxoutsetinfo(hash_type)
+    del info["disk_size"]
+    return info
+
+
+class UTXOSnapshotTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def setup_network(self):
+        # The nodes are only connected once node1 has loaded the snapshot.
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir)
+
+    def run_test(self):
+        node0, node1 = self.nodes
+        node0.generate(110)
+        base_hash = node0.getbestblockhash()
+
+        dump = node0.dumptxoutset("utxo.dat")
+        stats = set_info(node0, "muhash")
+        assert_equal(dump["bestblock"], base_hash)
+        assert_equal(dump["txouts"], stats["txouts"])
+        assert_equal(dump["muhash"], stats["muhash"])
+        assert(os.path.isfile(dump["path"]))
+        assert_raises_jsonrpc(-8, "already exists", node0.dumptxoutset,
+                              "utxo.dat")
+        # A node with blocks cannot load a snapshot.
+        assert_raises_jsonrpc(-1, "genesis", node0.loadtxoutset, dump["path"])
+
+        # The snapshot block must be known, so send node1 the headers.
+        headers = msg_headers()
+        for height in range(1, 111):
+            header_hex = node0.getblockheader(node0.getblockhash(height),
+                                              False, True)
+            headers.headers.append(FromHex(CBlockHeader(), header_hex))
+        peer = SingleNodeConnCB()
+        conn = NodeConn('127.0.0.1', p2p_port(1), node1, peer)
+        peer.add_connection(conn)
+        NetworkThread().start()
+        peer.wait_for_verack()
+        peer.send_message(headers)
+        assert(wait_until(lambda: any(
+            tip["hash"] == base_hash for tip in node1.getchaintips()),
+            timeout=30))
+        conn.disconnect_node()
+        assert_equal(node1.getblockcount(), 0)
+
+        assert_raises_jsonrpc(-1, "does not match the expected hash",
+                              node1.loadtxoutset, dump["path"], "00" * 32)
+        load = node1.loadtxoutset(dump["path"], dump["muhash"])
+        assert_equal(load, dump)
+        assert_equal(node1.getblockcount(), 110)
+        assert_equal(node1.getbestblockhash(), base_hash)
+        assert_equal(set_info(node1, "muhash"), stats)
+        assert_equal(set_info(node1, "hash_serialized"),
+                     set_info(node0, "hash_serialized"))
+
+        # The snapshot is kept across a restart.
+        stop_node(node1, 1)
+        node1 = self.nodes[1] = start_node(1, self.options.tmpdir)
+        assert_equal(node1.getbestblockhash(), base_hash)
+        assert_equal(set_info(node1, "muhash"), stats)
+
+        # node1 continues from the snapshot block.
+        node0.generate(5)
+        connect_nodes_bi(self.nodes, 0, 1)
+        sync_blocks(self.nodes)
+        assert_equal(node1.getblockcount(), 115)
+        assert_equal(set_info(node1, "muhash"), set_info(node0, "muhash"))
+
+
+if __name__ == '__main__':
+    UTXOSnapshotTest().main()